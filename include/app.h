@@ -1,6 +1,35 @@
 #ifndef APP_H
 #define APP_H
 
-int run_app(void);
+#include <stdio.h>
+#include "bvh.h"
+#include "scene.h"
+#include "software_rt.h"
+
+typedef struct {
+    /* Scene file, or an OBJ/glTF file to import; NULL builds the demo scene. */
+    const char *path;
+    mesh_layout layout;
+    /* Above 0, draws the scene as a grid of this many instances. */
+    uint32_t instances;
+    /* Optional BVH cache directory, see bvh_cache.h. */
+    const char *bvh_cache_dir;
+    /* Optional; importing and the BVH build run on it. */
+    thread_pool *pool;
+    /* Optional progress report; errors always go to stderr. */
+    FILE *log;
+    /* Runs scene_file_validate on a scene file and on a cached BVH before trusting them, at a cost
+     * that grows with the scene; needed for files that may be corrupt or hostile. */
+    int validate;
+} app_scene_options;
+
+/* Loads, imports or builds the scene, converts its meshes to layout, moves it into its arena and
+ * takes the scene file's BVH or builds (or maps a cached) one for it. Nothing is left to destroy on failure. */
+int app_load_scene(const app_scene_options *opts, scene *out_scene, bvh *out_tree);
+
+/* vk_hybrid_raytracer [--scene file] [--output image] [--frames n ...] [--server ...]: renders a scene file, an
+ * imported model or the demo scene once or as an animated sequence (see render_sequence.h), or serves
+ * render requests (see render_server.h). */
+int run_app(int argc, char **argv);
 
 #endif
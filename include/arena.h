@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_DEFAULT_ALIGN 16
+#define ARENA_DEFAULT_BLOCK_BYTES ((size_t)1 << 20)
+
+typedef struct arena_block arena_block;
+
+/* Bump allocator: allocations are never freed one by one, only all together by arena_reset or
+ * arena_destroy. Not thread-safe; give each thread its own arena. */
+typedef struct {
+    /* Region allocations currently bump through. */
+    uint8_t *base;
+    size_t capacity;
+    size_t offset;
+    /* Heap blocks owned by the arena, newest first; always NULL for fixed arenas. */
+    arena_block *blocks;
+    size_t block_count;
+    /* Minimum size of a new heap block; 0 marks a fixed arena that never grows. */
+    size_t block_bytes;
+    /* Bytes handed out since the last reset, alignment padding included. */
+    size_t used_bytes;
+    size_t reserved_bytes;
+    size_t peak_bytes;
+} arena;
+
+/* Growable arena; block_bytes 0 selects ARENA_DEFAULT_BLOCK_BYTES. Nothing is allocated until the first use. */
+void arena_init(arena *a, size_t block_bytes);
+/* Arena over caller-owned memory; allocations fail once it is full instead of growing. */
+void arena_init_fixed(arena *a, void *memory, size_t bytes);
+/* align must be a power of two (0 selects ARENA_DEFAULT_ALIGN). Returns NULL when out of memory. */
+void *arena_alloc(arena *a, size_t bytes, size_t align);
+/* Zeroed array of count elements; overflow-checked. */
+void *arena_calloc(arena *a, size_t count, size_t size, size_t align);
+/* Invalidates every allocation. A growable arena that spilled into several blocks swaps them for one
+ * block of the combined size, so repeating the same allocations afterwards never touches the heap. */
+void arena_reset(arena *a);
+/* Frees the arena's blocks in O(blocks); fixed arenas just forget their memory. */
+void arena_destroy(arena *a);
+
+#endif
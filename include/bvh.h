@@ -2,7 +2,13 @@
 #define BVH_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "scene.h"
+#include "thread_pool.h"
+
+#define BVH_MAX_DEPTH 64
+#define BVH_MAX_BINS 64
+#define BVH_PACKET_MAX 16
 
 typedef struct {
     aabb box;
@@ -12,16 +18,170 @@ typedef struct {
     size_t count;
 } bvh_node;
 
+/* Collapsed wide nodes with SoA child bounds. A child is a leaf when count > 0 (child is then
+ * the first triangle slot), an inner node when count == 0 and child >= 0, and empty when child < 0. */
+typedef struct {
+    float min_x[4], min_y[4], min_z[4];
+    float max_x[4], max_y[4], max_z[4];
+    int32_t child[4];
+    uint32_t count[4];
+} bvh4_node;
+
+typedef struct {
+    float min_x[8], min_y[8], min_z[8];
+    float max_x[8], max_y[8], max_z[8];
+    int32_t child[8];
+    uint32_t count[8];
+} bvh8_node;
+
+/* Precomputed Moller-Trumbore inputs for consecutive leaf triangle slots, SoA by component:
+ * slot i lives in block i / W, lane i % W. */
+typedef struct {
+    float v0_x[4], v0_y[4], v0_z[4];
+    float e1_x[4], e1_y[4], e1_z[4];
+    float e2_x[4], e2_y[4], e2_z[4];
+} bvh_tri4;
+
+typedef struct {
+    float v0_x[8], v0_y[8], v0_z[8];
+    float e1_x[8], e1_y[8], e1_z[8];
+    float e2_x[8], e2_y[8], e2_z[8];
+} bvh_tri8;
+
+typedef enum {
+    BVH_BUILDER_SAH = 0,
+    BVH_BUILDER_LBVH = 1
+} bvh_builder;
+
+typedef struct {
+    bvh_builder builder;
+    size_t max_leaf_size;
+    /* SAH only. */
+    uint32_t bin_count;
+    /* LBVH only: 30 or 63 bit Morton keys. */
+    uint32_t morton_bits;
+    /* Leaves per treelet for the optional reoptimization pass (3..7); 0 disables it. */
+    uint32_t treelet_size;
+    /* Traversal node width: 2 (binary), 4 or 8 (collapsed, SIMD box tests). */
+    uint32_t width;
+    /* Leaf triangle block width for the SIMD intersector: 4 or 8; 0 keeps the scalar path. */
+    uint32_t triangle_block_width;
+    /* Optional; subtrees and top-level binning run on it when set. */
+    thread_pool *pool;
+} bvh_build_options;
+
 typedef struct {
+    size_t node_count;
+    size_t leaf_count;
+    int max_depth;
+    float sah_cost;
+    double build_ms;
+    uint32_t thread_count;
+} bvh_build_stats;
+
+/* Top-level record of a scene instance. Both directions are kept so rays enter object space and
+ * normals leave it without an inversion per hit. */
+typedef struct {
+    transform3x4 object_to_world;
+    transform3x4 world_to_object;
+    uint32_t mesh_index;
+    uint32_t mask;
+} bvh_instance;
+
+typedef struct bvh {
     bvh_node *nodes;
     size_t node_count;
     size_t *triangle_indices;
     size_t triangle_count;
+    uint32_t *triangle_mesh;
+    size_t *mesh_first_triangle;
+    bvh4_node *nodes4;
+    bvh8_node *nodes8;
+    size_t wide_node_count;
+    uint32_t width;
+    bvh_tri4 *tris4;
+    bvh_tri8 *tris8;
+    uint32_t triangle_block_width;
     const scene *scene_ref;
+    bvh_build_stats stats;
+    /* SAH cost right after the last full build; refits are measured against it. */
+    float build_sah_cost;
+    /* The arrays point into memory owned elsewhere (a mapped scene file or an arena); bvh_destroy leaves them alone. */
+    int borrowed_storage;
+    /* Set when the arrays were mapped from a BVH cache file (scene_file_load_bvh); bvh_destroy unmaps it. */
+    scene_file *file;
+    /* Two-level trees, built for scenes with instances, mirror a TLAS over BLASes: the binary nodes
+     * span instance bounds, triangle_indices and triangle_count list the visible instances, and
+     * blas[m] is the owned tree of mesh m alone, built against the one-mesh view blas_scenes[m]. */
+    struct bvh *blas;
+    scene *blas_scenes;
+    size_t blas_count;
+    bvh_instance *instances;
+    size_t instance_count;
 } bvh;
 
+/* SoA bundle of up to BVH_PACKET_MAX rays traced together (typically 4, 8 or 16 coherent
+ * camera rays); lanes at or above size, or outside active_mask, are ignored. */
+typedef struct {
+    float org_x[BVH_PACKET_MAX], org_y[BVH_PACKET_MAX], org_z[BVH_PACKET_MAX];
+    float dir_x[BVH_PACKET_MAX], dir_y[BVH_PACKET_MAX], dir_z[BVH_PACKET_MAX];
+    float tmin[BVH_PACKET_MAX], tmax[BVH_PACKET_MAX];
+    uint32_t size;
+    uint32_t active_mask;
+} bvh_ray_packet;
+
+typedef struct {
+    float t[BVH_PACKET_MAX], u[BVH_PACKET_MAX], v[BVH_PACKET_MAX];
+    size_t mesh[BVH_PACKET_MAX], tri[BVH_PACKET_MAX], instance[BVH_PACKET_MAX];
+    uint32_t hit_mask;
+} bvh_packet_hit;
+
+typedef struct {
+    float t, u, v;
+    size_t mesh, tri;
+    int hit;
+    /* Scene instance that was hit; 0 for single-level trees. */
+    size_t instance;
+} bvh_ray_hit;
+
+typedef enum {
+    BVH_UPDATE_FAILED = 0,
+    BVH_UPDATE_REFIT = 1,
+    BVH_UPDATE_REBUILT = 2
+} bvh_update_result;
+
+void bvh_build_options_default(bvh_build_options *opts);
 int bvh_build(bvh *tree, const scene *s);
+int bvh_build_with_options(bvh *tree, const scene *s, const bvh_build_options *opts);
 void bvh_destroy(bvh *tree);
+/* Copies the tree's arrays into a (usually the scene's) arena and frees the heap copies; the tree
+ * then borrows its storage, so bvh_destroy is O(1) and refits take private copies first. */
+int bvh_move_to_arena(bvh *tree, const scene *s, arena *a);
+/* Recomputes node bounds from the scene's current vertex positions; topology must match the build. */
+int bvh_refit(bvh *tree, const scene *s);
+int bvh_refit_with_pool(bvh *tree, const scene *s, thread_pool *pool);
+/* Refits, then rebuilds with opts once the SAH cost exceeds max_sah_growth times the built cost.
+ * Two-level trees apply this per mesh and then rebuild their top level. */
+bvh_update_result bvh_update(bvh *tree, const scene *s, const bvh_build_options *opts, float max_sah_growth);
+/* Rebuilds only the top level of a two-level tree after instances moved, were hidden, added or
+ * removed; the per-mesh trees are kept, so the cost scales with the instance count alone. */
+int bvh_update_instances(bvh *tree, const scene *s, thread_pool *pool);
+void bvh_compute_stats(const bvh *tree, bvh_build_stats *out_stats);
+/* Bytes held by the tree's arrays, per-mesh trees of two-level builds included; owned or borrowed alike. */
+size_t bvh_memory_bytes(const bvh *tree);
 int bvh_trace_first_hit(const bvh *tree, ray r, float tmin, float tmax, size_t *out_mesh, size_t *out_tri, float *out_t, vec3 *out_normal, float *out_u, float *out_v);
+/* Closest hit with everything shading needs, the instance included; returns out->hit. */
+int bvh_trace_closest_hit(const bvh *tree, ray r, float tmin, float tmax, bvh_ray_hit *out);
+/* Closest hits for the packet's active lanes; returns the mask of lanes that hit. */
+uint32_t bvh_trace_packet(const bvh *tree, const bvh_ray_packet *packet, bvh_packet_hit *out);
+/* Traces rays in consecutive packets of BVH_PACKET_MAX, so neighbouring rays should be coherent
+ * (e.g. pixel blocks); returns the number of hits. */
+size_t bvh_trace_stream(const bvh *tree, const ray *rays, size_t count, float tmin, float tmax, bvh_ray_hit *hits);
+/* Interpolated world-space shading normal at the hit's barycentrics. */
+vec3 bvh_hit_normal(const bvh *tree, const bvh_ray_hit *hit);
+/* Maps an object-space direction of the hit mesh (e.g. a triangle edge) to world space. */
+vec3 bvh_hit_to_world(const bvh *tree, const bvh_ray_hit *hit, vec3 v);
+/* Returns 1 if any triangle is hit in (tmin, tmax); stops at the first hit and reports no attributes. */
+int bvh_trace_occluded(const bvh *tree, ray r, float tmin, float tmax);
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <stdint.h>
+#include "bvh.h"
+#include "scene.h"
+
+typedef struct {
+    uint64_t key;
+    int hit;
+    /* Misses only: the fresh tree was written to the cache. */
+    int stored;
+    double hash_ms;
+    /* Mapping the cached tree on a hit, building it on a miss. */
+    double load_ms;
+} bvh_cache_info;
+
+/* 64-bit hash of everything a build depends on: per-mesh vertex positions and triangle indices, in
+ * whatever layout, and the build options (the pool excepted). Any change to either picks a new key. */
+uint64_t bvh_cache_key(const scene *s, const bvh_build_options *opts);
+/* Maps the tree cached under dir for s and opts, or builds it and stores it there (dir is created if
+ * missing). The cached tree borrows the mapping, so it costs neither a build nor a copy. Scenes with
+ * instances, or a NULL dir, build as usual. info is optional. Entries are never evicted. */
+int bvh_cache_build(const char *dir, bvh *tree, const scene *s, const bvh_build_options *opts, bvh_cache_info *info);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef IMAGE_WRITE_H
+#define IMAGE_WRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "software_rt.h"
+
+typedef enum {
+    /* Binary 8-bit RGB, clamped as in fb->rgba8. */
+    IMAGE_FORMAT_PPM = 0,
+    /* 32-bit float RGB in host byte order, bottom row first. */
+    IMAGE_FORMAT_PFM = 1,
+    /* OpenEXR scanline image, half-float B, G, R channels; whole images are RLE compressed line by
+     * line (lines that do not shrink are stored raw), streams are uncompressed. */
+    IMAGE_FORMAT_EXR = 2
+} image_format;
+
+/* By extension: .pfm and .exr, anything else is PPM. */
+image_format image_format_from_path(const char *path);
+/* Float formats read fb->rgb32 when set and rgba8 / 255 otherwise. Rows are encoded into one
+ * buffer each and written through a large stdio buffer. */
+int image_write(const char *path, const framebuffer *fb, image_format format);
+
+/* Called on the writer thread once a queued write finished; ms covers encoding and I/O (summed over
+ * a stream's rows). */
+typedef void (*image_write_done_fn)(void *user, const char *path, int ok, double ms);
+
+typedef struct image_writer image_writer;
+typedef struct image_stream image_stream;
+
+/* Background thread that encodes and writes queued images in submission order, so rendering the
+ * next frame overlaps the last one's output. Submitting waits while more than max_queued_bytes of
+ * copies are queued (one image is always accepted). */
+image_writer *image_writer_create(size_t max_queued_bytes);
+/* Waits for queued writes, then stops the thread. */
+void image_writer_destroy(image_writer *writer);
+/* Queues a copy of fb, so the caller may reuse it at once. done is optional. */
+int image_writer_submit(image_writer *writer, const char *path, const framebuffer *fb, image_format format,
+                        image_write_done_fn done, void *user);
+/* Waits until the queue is empty; returns 0 if any write since the last flush failed. */
+int image_writer_flush(image_writer *writer);
+
+/* Writes a width x height image as its tiles finish: image_stream_tile copies a rectangle of fb
+ * and, for every row it completes, queues that row's encoding at its final file offset, so output
+ * overlaps the rest of the render. Safe to call from many threads for disjoint rectangles (e.g.
+ * from render_settings.tile_done). The file is created by the writer thread. */
+image_stream *image_writer_open_stream(image_writer *writer, const char *path, uint32_t width, uint32_t height,
+                                       image_format format);
+void image_stream_tile(image_stream *stream, const framebuffer *fb, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+/* Queues closing the file once the queued rows are written and frees the stream then; done
+ * reports failure if any row never arrived. */
+int image_stream_close(image_stream *stream, image_write_done_fn done, void *user);
+
+#endif
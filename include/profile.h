@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Threads that get their own counters and event buffer; later threads share the last slot's
+ * counters and record no events. */
+#define PROFILE_MAX_THREADS 64
+#define PROFILE_MAX_EVENTS_PER_THREAD 65536
+
+typedef enum {
+    PROFILE_RAYS = 0,
+    /* Binary or wide nodes popped; packets count a node once for all their lanes. */
+    PROFILE_NODE_VISITS = 1,
+    PROFILE_TRIANGLE_TESTS = 2,
+    PROFILE_HITS = 3,
+    PROFILE_COUNTER_COUNT
+} profile_counter;
+
+typedef struct {
+    uint64_t values[PROFILE_COUNTER_COUNT];
+} profile_counters;
+
+/* Open scoped timer; name must outlive the profile (string literals). */
+typedef struct {
+    const char *name;
+    double start_ms;
+} profile_zone;
+
+/* Profiling is compiled in with RT_PROFILE (CMake option ENABLE_PROFILING) and then starts switched
+ * off: until profile_set_enabled(1) every counter and zone costs one predictable branch. Without
+ * RT_PROFILE the macros vanish and the functions below are inert stubs. */
+extern int profile_active;
+
+void profile_set_enabled(int enabled);
+/* Zeroes counters and drops events; call while no other thread is counting. */
+void profile_reset(void);
+/* Frees the per-thread event buffers. */
+void profile_shutdown(void);
+/* The calling thread's counters, registering the thread on first use. */
+profile_counters *profile_thread_counters(void);
+/* Node visits plus triangle tests so far on the calling thread; 0 while disabled. */
+uint64_t profile_thread_cost(void);
+profile_zone profile_begin(const char *name);
+void profile_end(const profile_zone *zone);
+void profile_get_totals(profile_counters *out);
+/* Chrome/Perfetto trace event JSON: one complete event per zone, one track per thread, the counter
+ * totals under otherData. Returns 0 on I/O failure or when profiling is compiled out. */
+int profile_write_trace(const char *path);
+/* Per-zone count, total, mean and max, then per-thread and total counters. */
+void profile_print_summary(FILE *f);
+
+#ifdef RT_PROFILE
+#define PROFILE_COUNT(counter, n) \
+    do { \
+        if (profile_active) profile_thread_counters()->values[counter] += (uint64_t)(n); \
+    } while (0)
+#define PROFILE_BEGIN(var, name) profile_zone var = profile_begin(name)
+#define PROFILE_END(var) profile_end(&(var))
+#else
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_BEGIN(var, name) ((void)0)
+#define PROFILE_END(var) ((void)0)
+#endif
+
+#endif
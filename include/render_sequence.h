@@ -0,0 +1,83 @@
+#ifndef RENDER_SEQUENCE_H
+#define RENDER_SEQUENCE_H
+
+#include <stdio.h>
+#include "bvh.h"
+#include "scene.h"
+#include "software_rt.h"
+
+/* Keys are interpolated linearly between the two around a frame's time and held before the first
+ * and after the last; each list must be sorted by time. */
+typedef struct {
+    float time;
+    render_camera camera;
+} render_camera_key;
+
+/* Rigid motion of one mesh in its own space, before its instances (if any) place it: scale, then
+ * X, Y and Z rotations in radians, all about the center of the mesh's bounds, then translation.
+ * Angles interpolate as numbers, so keys can spin a mesh by more than a turn. */
+typedef struct {
+    float time;
+    uint32_t mesh_index;
+    vec3 translation;
+    vec3 rotation;
+    float scale;
+} render_mesh_key;
+
+/* Bits returned by render_sequence_options.update. */
+#define RENDER_SEQUENCE_GEOMETRY 1u
+#define RENDER_SEQUENCE_INSTANCES 2u
+
+typedef struct {
+    uint32_t frame_count;
+    uint32_t width;
+    uint32_t height;
+    /* Frame i shows time i / fps. */
+    float fps;
+    /* No camera keys keep render_settings.camera. */
+    const render_camera_key *camera_keys;
+    size_t camera_key_count;
+    const render_mesh_key *mesh_keys;
+    size_t mesh_key_count;
+    /* Optional hook run before each frame's BVH update, e.g. to deform vertices in place (topology
+     * must stay) or edit the scene's instances; returns which of RENDER_SEQUENCE_* it changed. */
+    uint32_t (*update)(void *user, scene *s, uint32_t frame, float time);
+    void *update_user;
+    /* Deformed geometry is refit until its SAH cost grows past this factor of the built cost, then
+     * rebuilt (see bvh_update). */
+    float max_sah_growth;
+    /* Output path with exactly one frame number conversion, %u or %d with an optional zero flag and
+     * a width up to 20, e.g. "frame_%04u.exr"; %% writes a percent sign and nothing else may follow
+     * a %. The extension picks the format (see image_write.h). */
+    const char *output_pattern;
+    /* Optional per-frame report. */
+    FILE *log;
+} render_sequence_options;
+
+typedef struct {
+    uint32_t frames;
+    double total_ms;
+    /* Keys, the update hook and BVH maintenance. */
+    double update_ms;
+    double render_ms;
+    /* Time the render loop spent waiting for the writer, including the final flush. */
+    double write_wait_ms;
+    size_t top_level_updates;
+    size_t refits;
+    size_t rebuilds;
+    double frames_per_hour;
+} render_sequence_stats;
+
+void render_sequence_options_default(render_sequence_options *opts);
+/* Whether pattern is a valid render_sequence_options.output_pattern. */
+int render_sequence_pattern_valid(const char *pattern);
+/* Renders opts->frame_count frames of s with settings. The pool, frame arena and framebuffer are
+ * made once and reused, the tree only changes where the frame did: nothing for camera-only
+ * motion, a top-level rebuild over per-mesh trees when meshes move (a flat tree is replaced by a
+ * two-level one for the sequence), a refit (or rebuild) after the update hook deforms geometry.
+ * Frame n is written on a background thread while frame n + 1 renders. tree is the scene's BVH
+ * (its scene_ref must be s); it is left matching s, which keeps the update hook's changes. */
+int render_sequence_run(scene *s, bvh *tree, const render_settings *settings, const render_sequence_options *opts,
+                        render_sequence_stats *stats);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scene.h"
+
+/* Long-running renderer: scenes and their BVHs stay resident between jobs. A dispatcher thread
+ * loads scenes and renders jobs one at a time in request order, each spread over the whole thread
+ * pool, while the reading thread takes further requests and a writer thread writes finished
+ * frames. Requests are lines of key=value words (no spaces in
+ * values); replies are single lines, tagged with the request's id, in completion order:
+ *
+ *   render id=f0 scene=model.glb out=f0.ppm width=640 height=360 spp=16 error=0
+ *          camera=0,0,-3 target=0,0,0 up=0,1,0 focal=1.5 instances=0
+ *     -> ok id=f0 out=f0.ppm scene=resident|loaded load_ms=... render_ms=... write_ms=...
+ *     -> error id=f0 <message>
+ *   stats -> stats scenes=... resident_mb=... hits=... misses=... evictions=... jobs=... failed=...
+ *   quit  -> stops reading once queued jobs are done
+ *
+ * Only out is required; its extension picks PPM, PFM or EXR (see image_write.h), and the reply
+ * comes once the writer thread has written the frame, while the next job renders. scene defaults to
+ * the demo scene; spp above 1 renders progressively, sampling to spp unless error sets a target (see
+ * render_progressive_options). stats is answered once the jobs queued before it have rendered.
+ * Scene files and cached BVHs are always validated (see scene_file_validate); a file that fails
+ * gets an error reply and is not kept. */
+typedef struct {
+    /* Unix domain socket to listen on, serving one client at a time; NULL reads requests from stdin
+     * and replies on stdout. */
+    const char *socket_path;
+    /* Pool workers each render and scene load is spread over; 0 selects the hardware concurrency. */
+    uint32_t worker_count;
+    /* Idle scenes are evicted, least recently used first, while the resident scenes and BVHs
+     * take more than this. */
+    size_t cache_bytes;
+    mesh_layout layout;
+    /* Optional BVH cache directory, so scenes reloaded after eviction or a restart skip their build. */
+    const char *bvh_cache_dir;
+} render_server_options;
+
+void render_server_options_default(render_server_options *opts);
+/* Serves until end of input or a quit request; returns 0 if the server could not start. */
+int render_server_run(const render_server_options *opts);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "arena.h"
 #include "math3d.h"
 
 typedef struct {
@@ -13,11 +14,66 @@ typedef struct {
     int normal_texture;
 } material;
 
+/* Edge of the square texel tiles used by the tiled layout and the tile cache. */
+#define TEXTURE_TILE_SIZE 8
+
+typedef enum {
+    TEXTURE_LAYOUT_LINEAR = 0,
+    /* TEXTURE_TILE_SIZE^2 texel tiles, row-major inside and between tiles, edges padded to whole tiles. */
+    TEXTURE_LAYOUT_TILED = 1
+} texture_layout;
+
+typedef enum {
+    TEXTURE_FORMAT_RGBA8 = 0,
+    /* 4x4 blocks of 8 bytes: two RGB565 endpoints and 2-bit indices. For albedo. */
+    TEXTURE_FORMAT_BC1 = 1,
+    /* 4x4 blocks of 16 bytes: two BC4 channels holding normal X and Y; Z is rebuilt on decode. */
+    TEXTURE_FORMAT_BC5 = 2,
+    /* 4x4 blocks of 16 bytes, all eight modes. Decode only. */
+    TEXTURE_FORMAT_BC7 = 3
+} texture_format;
+
+typedef struct texture_cache texture_cache;
+typedef struct scene_file scene_file;
+typedef struct texture texture;
+
+/* Fills one tile (TEXTURE_TILE_SIZE^2 RGBA8 texels, row-major) of a streamed texture's mip level. */
+typedef int (*texture_tile_loader)(void *user, const texture *tx, uint32_t level, uint32_t tile_x, uint32_t tile_y, uint8_t *out_rgba8);
+
 typedef struct {
     uint32_t width;
     uint32_t height;
     uint8_t *rgba8;
-} texture;
+    /* Row-major 4x4 blocks of a compressed texture's level; NULL for RGBA8. */
+    uint8_t *blocks;
+} texture_mip;
+
+struct texture {
+    uint32_t width;
+    uint32_t height;
+    uint8_t *rgba8;
+    /* Box-filtered mip chain down to 1x1 from texture_build_mips; level 0 aliases rgba8. */
+    texture_mip *mips;
+    uint32_t mip_count;
+    texture_layout layout;
+    /* Streamed textures keep no texels resident: rgba8 is NULL and tiles come from loader via cache. */
+    texture_cache *cache;
+    texture_tile_loader loader;
+    void *loader_user;
+    /* Compressed textures keep their blocks in mips[].blocks and decode on fetch; rgba8 is NULL. */
+    texture_format format;
+    /* Names the blocks in the per-thread decoded-block caches. */
+    size_t block_id;
+};
+
+typedef enum {
+    /* Nearest texel of the full-resolution image. */
+    TEXTURE_FILTER_NEAREST = 0,
+    /* Bilinear on the mip level closest to the footprint. */
+    TEXTURE_FILTER_BILINEAR = 1,
+    /* Bilinear on the two bracketing levels, blended by the fractional LOD. */
+    TEXTURE_FILTER_TRILINEAR = 2
+} texture_filter;
 
 typedef struct {
     vec3 position;
@@ -33,13 +89,58 @@ typedef struct {
     int material_index;
 } triangle;
 
+/* Triangle of a quantized mesh with at most 65536 vertices and materials. */
 typedef struct {
+    uint16_t i0;
+    uint16_t i1;
+    uint16_t i2;
+    uint16_t material_index;
+} triangle16;
+
+typedef enum {
+    /* Interleaved vertex records; what scenes are built, imported and stored in. */
+    MESH_LAYOUT_AOS = 0,
+    /* Positions in their own array, away from the shading attributes, so intersection streams 12 bytes per vertex. */
+    MESH_LAYOUT_SOA = 1,
+    /* SoA with octahedral 2x16-bit normals, 2x16-bit UVs over the mesh's UV bounds and, for meshes of at most
+     * 65536 vertices, 16-bit triangles; positions stay full precision so hits do not move. */
+    MESH_LAYOUT_SOA_QUANTIZED = 2
+} mesh_layout;
+
+typedef struct {
+    /* AoS layout only. */
     vertex *vertices;
     size_t vertex_count;
+    /* Every layout except quantized meshes that fit 16-bit triangles. */
     triangle *triangles;
     size_t triangle_count;
+    mesh_layout layout;
+    /* SoA layouts: positions always; float normals and UVs (u, v pairs) or their packed forms. */
+    vec3 *positions;
+    vec3 *normals;
+    float *uvs;
+    uint32_t *packed_normals;
+    uint32_t *packed_uvs;
+    /* Packed UV = uv_offset + q * uv_scale per component. */
+    float uv_offset[2];
+    float uv_scale[2];
+    triangle16 *triangles16;
 } mesh;
 
+/* Row-major 3x4 object-to-world matrix, laid out like VkTransformMatrixKHR. */
+typedef struct {
+    float m[3][4];
+} transform3x4;
+
+/* One placement of a mesh, after VkAccelerationStructureInstanceKHR. Any number of instances may
+ * share a mesh, whose geometry is stored and built into a BVH only once. */
+typedef struct {
+    transform3x4 transform;
+    uint32_t mesh_index;
+    /* 0 hides the instance; rays use a full mask, so any other value is visible to all of them. */
+    uint32_t mask;
+} mesh_instance;
+
 typedef struct {
     mesh *meshes;
     size_t mesh_count;
@@ -47,10 +148,125 @@ typedef struct {
     size_t texture_count;
     material *materials;
     size_t material_count;
+    /* Optional. When present, meshes are drawn only through their instances and the BVH is built in two
+     * levels; without instances every mesh is drawn once, as stored. */
+    mesh_instance *instances;
+    size_t instance_count;
+    /* Optional, owned; shared by the streamed textures. */
+    texture_cache *texture_cache;
+    /* Set when the arrays point into a mapped scene file; destroy_scene unmaps it instead of freeing them. */
+    scene_file *file;
+    /* Set by scene_move_to_arena: every array lives in this owned arena and destroy_scene frees it whole. */
+    arena *arena;
 } scene;
 
+/* Octahedral normal encoding: x and y as signed 16-bit values in the low and high halves. */
+static inline uint32_t mesh_pack_normal(vec3 n) {
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = l1 > 0.0f ? n.x / l1 : 0.0f, y = l1 > 0.0f ? n.y / l1 : 0.0f;
+    if (n.z < 0.0f) {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    int16_t qx = (int16_t)lrintf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f);
+    int16_t qy = (int16_t)lrintf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f);
+    return (uint32_t)(uint16_t)qx | (uint32_t)(uint16_t)qy << 16;
+}
+
+static inline vec3 mesh_unpack_normal(uint32_t packed) {
+    float x = (float)(int16_t)(packed & 0xffffu) * (1.0f / 32767.0f);
+    float y = (float)(int16_t)(packed >> 16) * (1.0f / 32767.0f);
+    vec3 n = {x, y, 1.0f - fabsf(x) - fabsf(y)};
+    float t = fmaxf(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return vec3_norm(n);
+}
+
+/* Layout-independent vertex and triangle access; intersection and shading go through these. */
+static inline vec3 mesh_position(const mesh *m, uint32_t i) {
+    return m->positions ? m->positions[i] : m->vertices[i].position;
+}
+
+static inline vec3 mesh_normal(const mesh *m, uint32_t i) {
+    if (m->packed_normals) return mesh_unpack_normal(m->packed_normals[i]);
+    return m->normals ? m->normals[i] : m->vertices[i].normal;
+}
+
+static inline void mesh_uv(const mesh *m, uint32_t i, float *u, float *v) {
+    if (m->packed_uvs) {
+        *u = m->uv_offset[0] + (float)(m->packed_uvs[i] & 0xffffu) * m->uv_scale[0];
+        *v = m->uv_offset[1] + (float)(m->packed_uvs[i] >> 16) * m->uv_scale[1];
+    } else if (m->uvs) {
+        *u = m->uvs[2 * (size_t)i];
+        *v = m->uvs[2 * (size_t)i + 1];
+    } else {
+        *u = m->vertices[i].u;
+        *v = m->vertices[i].v;
+    }
+}
+
+static inline triangle mesh_triangle(const mesh *m, size_t t) {
+    if (m->triangles) return m->triangles[t];
+    const triangle16 *q = &m->triangles16[t];
+    return (triangle){q->i0, q->i1, q->i2, q->material_index};
+}
+
+static inline transform3x4 transform3x4_identity(void) {
+    return (transform3x4){{{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}}};
+}
+
+static inline vec3 transform3x4_point(const transform3x4 *t, vec3 p) {
+    return (vec3){t->m[0][0] * p.x + t->m[0][1] * p.y + t->m[0][2] * p.z + t->m[0][3],
+                  t->m[1][0] * p.x + t->m[1][1] * p.y + t->m[1][2] * p.z + t->m[1][3],
+                  t->m[2][0] * p.x + t->m[2][1] * p.y + t->m[2][2] * p.z + t->m[2][3]};
+}
+
+static inline vec3 transform3x4_vector(const transform3x4 *t, vec3 v) {
+    return (vec3){t->m[0][0] * v.x + t->m[0][1] * v.y + t->m[0][2] * v.z,
+                  t->m[1][0] * v.x + t->m[1][1] * v.y + t->m[1][2] * v.z,
+                  t->m[2][0] * v.x + t->m[2][1] * v.y + t->m[2][2] * v.z};
+}
+
+/* Multiplies by the transposed linear part: with the inverse transform this maps normals. */
+static inline vec3 transform3x4_normal(const transform3x4 *inverse, vec3 n) {
+    return (vec3){inverse->m[0][0] * n.x + inverse->m[1][0] * n.y + inverse->m[2][0] * n.z,
+                  inverse->m[0][1] * n.x + inverse->m[1][1] * n.y + inverse->m[2][1] * n.z,
+                  inverse->m[0][2] * n.x + inverse->m[1][2] * n.y + inverse->m[2][2] * n.z};
+}
+
+/* Returns 0 for singular (e.g. zero-scale) transforms. */
+int transform3x4_invert(const transform3x4 *t, transform3x4 *out);
+
 int build_demo_scene(scene *out_scene);
 void destroy_scene(scene *s);
+/* Copies a finished scene's meshes, materials, instances, textures and texel data into one owned arena sized to
+ * fit, releasing the individual heap arrays. Texture layout, mip and compression changes must not run
+ * on the scene afterwards; a mapped scene is left as it is. */
+int scene_move_to_arena(scene *s);
+/* Replaces a heap-owned scene's instances with count copies of all its meshes on a square grid over
+ * the scene's XY extent, each scaled to its cell. Geometry is shared, not duplicated. */
+int scene_instance_grid(scene *s, uint32_t count);
+/* Converts a mesh between layouts; leaving the quantized layout keeps the quantized values. */
+int mesh_set_layout(mesh *m, mesh_layout layout);
+/* Every mesh of a heap-owned scene; mapped and arena scenes are left alone and return 0. */
+int scene_set_mesh_layout(scene *s, mesh_layout layout);
+/* Bytes of vertex and triangle data in the mesh's current layout. */
+size_t mesh_geometry_bytes(const mesh *m);
 vec3 sample_texture(const texture *tx, float u, float v);
+int texture_build_mips(texture *tx);
+int scene_build_texture_mips(scene *s);
+/* Reorders the resident texels of every level; sampling results do not change. */
+int texture_set_layout(texture *tx, texture_layout layout);
+/* Bytes of one resident level as stored: padded tiles, linear rows or compressed blocks. */
+size_t texture_level_bytes(const texture *tx, uint32_t level);
+/* mip_count 0 selects the full chain down to 1x1. */
+int texture_init_streamed(texture *tx, uint32_t width, uint32_t height, uint32_t mip_count,
+                          texture_cache *cache, texture_tile_loader loader, void *user);
+/* footprint is the pixel's extent in UV units and selects the mip level; textures without mips
+ * fall back to nearest sampling. */
+vec3 sample_texture_filtered(const texture *tx, float u, float v, float footprint, texture_filter filter);
 
 #endif
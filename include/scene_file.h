@@ -0,0 +1,42 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "scene.h"
+
+/* Binary scene container: a header, a section table and 64-byte aligned sections holding the
+ * scene's arrays in their in-memory layout (little-endian, 64-bit size_t). Loading maps the file
+ * and points the scene and optional BVH straight into it: no parsing, no copies, and pages
+ * fault in on first touch. Files written on a different ABI are rejected, not converted. */
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_ALIGN 64
+
+typedef struct {
+    size_t file_bytes;
+    size_t section_count;
+    int has_bvh;
+    double map_ms;
+} scene_file_info;
+
+/* tree is optional; it must have been built for s and be single-level. Streamed textures and SoA
+ * meshes are not supported. */
+int scene_file_write(const char *path, const scene *s, const bvh *tree);
+/* Maps path copy-on-write: in-place edits (e.g. refits) never reach the file. Only the header and
+ * section table are checked, so the cost does not grow with the scene; run scene_file_validate
+ * on untrusted files. When the file holds a BVH and out_tree is set, out_tree borrows it and
+ * references out_scene, which must then stay where it is. info is optional. */
+int scene_file_load(const char *path, scene *out_scene, bvh *out_tree, scene_file_info *info);
+/* Full pass over indices and references; writes a message to error (if set) on failure. */
+int scene_file_validate(const scene *s, const bvh *tree, char *error, size_t error_size);
+/* BVH-only files, the entries of the BVH cache: the same container with the BVH sections and a
+ * key instead of the scene's arrays. Two-level trees are not stored. Loading maps the file and
+ * checks the key and s's mesh, vertex and triangle counts; out_tree then borrows the mapping,
+ * references s and unmaps the file in bvh_destroy. */
+int scene_file_write_bvh(const char *path, const scene *s, const bvh *tree, uint64_t key);
+int scene_file_load_bvh(const char *path, const scene *s, uint64_t key, bvh *out_tree);
+/* Unmaps a file opened by scene_file_load or scene_file_load_bvh; destroy_scene and bvh_destroy call it. */
+void scene_file_close(scene_file *file);
+
+#endif
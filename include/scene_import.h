@@ -0,0 +1,45 @@
+#ifndef SCENE_IMPORT_H
+#define SCENE_IMPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scene.h"
+#include "thread_pool.h"
+
+typedef struct {
+    /* OBJ text is read and parsed this many bytes at a time, so memory does not grow with the file. */
+    size_t chunk_bytes;
+    /* Parses chunk slices (OBJ) or primitives (glb) in parallel; NULL runs on the calling thread. */
+    thread_pool *pool;
+    /* glb: store each primitive once and place it with scene instances, instead of baking one
+     * transformed copy per node. */
+    int instance_meshes;
+} scene_import_options;
+
+typedef struct {
+    size_t bytes;
+    size_t mesh_count;
+    size_t vertex_count;
+    size_t triangle_count;
+    size_t chunk_count;
+    /* Face corners that reused an existing vertex through the dedup table. */
+    size_t deduplicated_corners;
+    double ms;
+    double mb_per_s;
+} scene_import_stats;
+
+void scene_import_options_default(scene_import_options *opts);
+/* Whether scene_import recognizes the path's extension. */
+int scene_import_supported(const char *path);
+/* Picks the importer from the extension (.obj or .glb). Textures are not imported; materials keep
+ * their base colour, roughness and metallic factors. opts and stats are optional. */
+int scene_import(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats);
+/* Wavefront OBJ plus its mtllib materials, as one mesh with per-triangle materials; polygons are
+ * fanned, (v, vt, vn) corners are deduplicated and missing normals are smoothed from the faces. */
+int scene_import_obj(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats);
+/* Binary glTF 2.0: one mesh per triangle primitive instance, node transforms applied (or one mesh per
+ * primitive plus an instance per placement with instance_meshes). Accessors are
+ * read from the BIN chunk one at a time; the file is never held in memory whole. */
+int scene_import_glb(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats);
+
+#endif
@@ -2,14 +2,171 @@
 #define SOFTWARE_RT_H
 
 #include <stdint.h>
+#include "bvh.h"
 #include "scene.h"
+#include "texture_cache.h"
 
 typedef struct {
     uint32_t width;
     uint32_t height;
     uint8_t *rgba8;
+    /* Optional width x height x 3 linear radiance, stored alongside rgba8 without clamping, for
+     * float image output. */
+    float *rgb32;
 } framebuffer;
 
+#define RENDER_STATS_MAX_THREADS 256
+
+typedef enum {
+    /* Tiles of primary rays with direct lighting, shaded pixel by pixel. */
+    RENDER_MODE_TILED = 0,
+    /* Path tracing in frame-wide stages over ray queues. */
+    RENDER_MODE_WAVEFRONT = 1
+} render_mode;
+
+/* Queue order between wavefront stages. */
+typedef enum {
+    RENDER_SORT_NONE = 0,
+    /* Before each extend: direction octant, then Morton order of the origin. */
+    RENDER_SORT_RAY = 1,
+    /* Before each shade: material of the hit, misses first. */
+    RENDER_SORT_MATERIAL = 2
+} render_ray_sort;
+
+typedef enum {
+    RENDER_STAGE_GENERATE = 0,
+    RENDER_STAGE_SORT,
+    RENDER_STAGE_EXTEND,
+    RENDER_STAGE_SHADE,
+    RENDER_STAGE_CONNECT,
+    RENDER_STAGE_COUNT
+} render_stage;
+
+typedef struct {
+    /* Rays (or paths, for generate, sort and shade) processed by the stage over the frame. */
+    size_t rays;
+    double ms;
+} render_stage_stats;
+
+/* Convergence state of a progressive render, reported after every pass and in render_stats. */
+typedef struct {
+    uint32_t pass;
+    /* Samples over the frame, and the most any pixel received. */
+    size_t samples;
+    uint32_t max_pixel_samples;
+    size_t tile_count;
+    /* Tiles that stopped sampling, either below target_error or at max_samples. */
+    size_t converged_tiles;
+    /* Largest error estimate over the tiles that are still sampling (0 once all converged). */
+    float max_error;
+    double elapsed_ms;
+    /* Set on the final report; budget_exhausted tells a time-budget stop from convergence. */
+    int done;
+    int budget_exhausted;
+} render_progress;
+
+/* Runs on the rendering thread between passes; fb holds the current estimate of every pixel. */
+typedef void (*render_progress_fn)(void *user, const framebuffer *fb, const render_progress *progress);
+
+/* Runs on the thread that finished the tile, once its final pixels are in fb; tiles of one frame
+ * arrive in any order and may overlap in time. */
+typedef void (*render_tile_fn)(void *user, const framebuffer *fb, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+typedef struct {
+    /* Samples per pixel at most; 0 disables progressive rendering (one centered sample per pixel). */
+    uint32_t max_samples;
+    /* Samples before a tile's error estimate is trusted. */
+    uint32_t min_samples;
+    /* Samples each unconverged pixel gets per pass. */
+    uint32_t samples_per_pass;
+    /* A tile stops once the RMS over its pixels of the luminance standard error, relative to the
+     * pixel's mean luminance plus RENDER_ERROR_LUMINANCE_BIAS, drops below this; 0 samples to max_samples. */
+    float target_error;
+    /* No new pass starts once the last one would overrun this; 0 means no limit. */
+    double time_budget_ms;
+    /* Optional; called at most every progress_interval_ms and once when done. */
+    render_progress_fn progress;
+    void *progress_user;
+    double progress_interval_ms;
+} render_progressive_options;
+
+#define RENDER_ERROR_LUMINANCE_BIAS 0.1f
+
+/* Pinhole camera. The image plane spans [-1, 1] on both axes at focal_length along the view
+ * direction, whatever the aspect ratio; up only has to be off that direction. */
+typedef struct {
+    vec3 position;
+    vec3 target;
+    vec3 up;
+    float focal_length;
+} render_camera;
+
+typedef struct {
+    double render_ms;
+    size_t tile_count;
+    uint32_t thread_count;
+    /* One entry per render thread (pool workers, then the calling thread); capped at RENDER_STATS_MAX_THREADS. */
+    uint32_t thread_stats_count;
+    thread_pool_worker_stats threads[RENDER_STATS_MAX_THREADS];
+    /* Wavefront mode only. */
+    render_stage_stats stages[RENDER_STAGE_COUNT];
+    /* Lookups during this render when the scene has a texture cache. */
+    texture_cache_stats texture_cache;
+    /* Progressive renders only. */
+    render_progress progressive;
+} render_stats;
+
+typedef struct {
+    /* Acceleration structure build for this scene; a NULL pool builds on the render pool. */
+    bvh_build_options bvh;
+    /* Optional tree already built for the scene (e.g. loaded from a scene file); skips the build and bvh. */
+    const bvh *prebuilt_bvh;
+    /* Optional directory of BVHs keyed by geometry and build options (see bvh_cache.h): a cached tree
+     * is mapped instead of built, a fresh one is stored. NULL builds every time. */
+    const char *bvh_cache_dir;
+    /* Render threads including the caller; 0 selects the hardware concurrency. Ignored with pool. */
+    uint32_t worker_count;
+    /* Optional pool shared with other renders, which may run concurrently from its tasks; its
+     * statistics then cover all of them. NULL creates a pool for this render. */
+    thread_pool *pool;
+    render_camera camera;
+    /* Tile edge in pixels. */
+    uint32_t tile_size;
+    /* Shadow rays per shaded pixel: 0 disables shadows, 1 gives hard shadows. */
+    uint32_t shadow_samples;
+    /* Angular radius of the directional light in radians; above 0 with several samples gives soft shadows. */
+    float light_angle;
+    /* Primary rays traced together as 4 (2x2), 8 (4x2) or 16 (4x4) pixel packets; other values trace single rays. */
+    uint32_t packet_size;
+    render_mode mode;
+    /* Wavefront mode: diffuse bounces after the primary hit. */
+    uint32_t max_bounces;
+    render_ray_sort ray_sort;
+    /* Albedo and normal map filtering; LODs come from ray differentials (cones after a bounce). */
+    texture_filter texture_filter;
+    /* Tiled mode: jittered samples accumulate pass by pass, and tiles stop sampling once converged. */
+    render_progressive_options progressive;
+    /* Optional width x height heatmap, zeroed and then filled with each pixel's BVH node visits plus
+     * triangle tests (all its samples and shadow rays; packets split evenly over their pixels). Needs
+     * profiling compiled in and enabled, see profile.h. */
+    float *traversal_cost;
+    /* Optional; called once per tile when its pixels are final (progressive tiles when they converge,
+     * the rest when sampling stops; wavefront renders report the whole frame as one tile), e.g. to
+     * stream the image out while the render goes on. */
+    render_tile_fn tile_done;
+    void *tile_done_user;
+    /* Optional report of the last render. */
+    render_stats *stats;
+    /* Optional, caller-owned; reset at the start of each render and used for the tile list, the
+     * wavefront queues and the per-thread tile scratch. Reusing it across frames of the same size
+     * keeps rendering off the heap; NULL uses a temporary arena. */
+    arena *frame_arena;
+    /* Skips the BVH and render reports on stdout, e.g. when stdout carries a protocol. */
+    int quiet;
+} render_settings;
+
+void render_settings_default(render_settings *settings);
 int render_software(const scene *s, framebuffer *fb);
+int render_software_ex(const scene *s, framebuffer *fb, const render_settings *settings);
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scene.h"
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    /* Misses that replaced a resident tile. */
+    size_t evictions;
+    size_t load_failures;
+    size_t capacity_tiles;
+} texture_cache_stats;
+
+/* Set-associative cache of TEXTURE_TILE_SIZE^2 RGBA8 tiles with LRU replacement inside each set;
+ * the budget is rounded down to whole sets (at least one). Safe to fetch from many threads. */
+texture_cache *texture_cache_create(size_t budget_bytes);
+void texture_cache_destroy(texture_cache *cache);
+/* Copies texel (x, y) of a streamed texture's mip level, loading its tile on a miss. */
+int texture_cache_fetch(texture_cache *cache, const texture *tx, uint32_t level, uint32_t x, uint32_t y, uint8_t out_rgba8[4]);
+void texture_cache_get_stats(const texture_cache *cache, texture_cache_stats *out);
+void texture_cache_reset_stats(texture_cache *cache);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TEXTURE_COMPRESS_H
+#define TEXTURE_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scene.h"
+
+#define TEXTURE_BLOCK_SIZE 4
+
+/* Bytes per 4x4 block; 0 for TEXTURE_FORMAT_RGBA8. */
+size_t texture_format_block_bytes(texture_format format);
+/* Decodes one block into 16 RGBA8 texels, row-major. */
+int texture_decode_block(texture_format format, const uint8_t *block, uint8_t out_rgba8[64]);
+/* Bounding-box encoder for BC1 and BC5; BC7 has no encoder. */
+int texture_encode_block(texture_format format, const uint8_t in_rgba8[64], uint8_t *out_block);
+/* Replaces every resident RGBA8 level (tiled or linear) with blocks of format, BC1 or BC5. */
+int texture_compress(texture *tx, texture_format format);
+/* Allocates zeroed blocks for each level of a compressed texture; the caller fills mips[].blocks
+ * before the first sample. mip_count 0 selects the full chain down to 1x1. */
+int texture_init_compressed(texture *tx, uint32_t width, uint32_t height, uint32_t mip_count, texture_format format);
+/* Fresh id for a texture whose blocks were (re)placed, so no thread serves stale decoded blocks. */
+size_t texture_next_block_id(void);
+/* Texel (x, y) of a compressed level, decoded through the calling thread's small block cache. */
+void texture_fetch_compressed(const texture *tx, uint32_t level, uint32_t x, uint32_t y, uint8_t out_rgba8[4]);
+
+#endif
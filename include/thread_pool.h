@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct thread_pool thread_pool;
+
+typedef void (*thread_pool_task_fn)(void *arg);
+typedef void (*thread_pool_range_fn)(void *ctx, size_t chunk, size_t begin, size_t end);
+
+typedef struct {
+    volatile size_t pending;
+} thread_pool_group;
+
+typedef struct {
+    size_t tasks_run;
+    /* Tasks taken from another worker's deque. */
+    size_t tasks_stolen;
+    double busy_ms;
+} thread_pool_worker_stats;
+
+uint32_t thread_pool_hardware_concurrency(void);
+
+/* Each worker owns a deque and steals from the others when it runs dry.
+ * worker_count == 0 selects the hardware concurrency. */
+thread_pool *thread_pool_create(uint32_t worker_count);
+void thread_pool_destroy(thread_pool *pool);
+uint32_t thread_pool_worker_count(const thread_pool *pool);
+
+/* A NULL pool runs the task inline. Tasks may submit further tasks into the same group. */
+int thread_pool_submit(thread_pool *pool, thread_pool_group *group, thread_pool_task_fn fn, void *arg);
+/* Blocks until the group drains; the calling thread executes queued tasks while it waits. */
+void thread_pool_wait(thread_pool *pool, thread_pool_group *group);
+
+/* Slots 0..worker_count-1 are the workers; the last slot collects threads outside the pool
+ * that run tasks while waiting. Counters accumulate until thread_pool_reset_stats. */
+uint32_t thread_pool_stats_slot_count(const thread_pool *pool);
+/* Slot of the calling thread, for indexing per-thread state; 0 for a NULL pool. */
+uint32_t thread_pool_current_slot(const thread_pool *pool);
+int thread_pool_get_worker_stats(const thread_pool *pool, uint32_t slot, thread_pool_worker_stats *out);
+void thread_pool_reset_stats(thread_pool *pool);
+
+size_t thread_pool_chunk_count(const thread_pool *pool, size_t count, size_t grain);
+void thread_pool_parallel_for(thread_pool *pool, size_t count, size_t grain, thread_pool_range_fn fn, void *ctx);
+
+size_t thread_pool_atomic_add(volatile size_t *value, size_t delta);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Monotonic wall clock in milliseconds, for build/render reports. */
+double timer_now_ms(void);
+
+#endif
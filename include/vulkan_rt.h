@@ -19,6 +19,5 @@ typedef struct {
 } vulkan_rt_report;
 
 int render_hardware_vulkan(const scene *s, vulkan_rt_report *out_report);
-int render_hardware_vulkan(const scene *s);
 
 #endif
@@ -2,63 +2,409 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "bvh_cache.h"
+#include "image_write.h"
+#include "profile.h"
+#include "render_sequence.h"
+#include "render_server.h"
 #include "scene.h"
+#include "scene_file.h"
+#include "scene_import.h"
 #include "software_rt.h"
 #include "vulkan_rt.h"
 
-static int write_ppm(const char *path, const framebuffer *fb) {
-    FILE *f = fopen(path, "wb");
-    if (!f) return 0;
-    fprintf(f, "P6\n%u %u\n255\n", fb->width, fb->height);
-    for (uint32_t i = 0; i < fb->width * fb->height; ++i) {
-        fwrite(&fb->rgba8[i * 4], 1, 3, f);
+/* Traversal cost on a blue-green-yellow-red ramp, scaled to the costliest pixel, in the output's
+ * format. */
+static int write_heatmap(const char *path, image_format format, const float *cost, uint32_t width, uint32_t height) {
+    size_t pixels = (size_t)width * height;
+    framebuffer fb = {width, height, (uint8_t*)malloc(pixels * 4), NULL};
+    if (format != IMAGE_FORMAT_PPM) fb.rgb32 = (float*)malloc(pixels * 3 * sizeof(float));
+    if (!fb.rgba8 || (format != IMAGE_FORMAT_PPM && !fb.rgb32)) {
+        free(fb.rgba8);
+        free(fb.rgb32);
+        return 0;
     }
-    fclose(f);
-    return 1;
+    float max_cost = 0.0f;
+    for (size_t i = 0; i < pixels; ++i) max_cost = cost[i] > max_cost ? cost[i] : max_cost;
+    for (size_t i = 0; i < pixels; ++i) {
+        float v = max_cost > 0.0f ? 3.0f * cost[i] / max_cost : 0.0f;
+        float rgb[3] = {v < 1.0f ? 0.0f : v < 2.0f ? v - 1.0f : 1.0f, v < 1.0f ? v : v < 2.0f ? 1.0f : 3.0f - v,
+                        v < 1.0f ? 1.0f - v : 0.0f};
+        for (int c = 0; c < 3; ++c) fb.rgba8[i * 4 + c] = (uint8_t)(rgb[c] * 255.0f);
+        fb.rgba8[i * 4 + 3] = 255;
+        if (fb.rgb32) memcpy(fb.rgb32 + i * 3, rgb, sizeof(rgb));
+    }
+    int ok = image_write(path, &fb, format);
+    free(fb.rgba8);
+    free(fb.rgb32);
+    if (ok) printf("Traversal cost heatmap: %s (max %.0f node visits + triangle tests per pixel)\n", path, max_cost);
+    return ok;
 }
 
-int run_app(void) {
-    scene s;
-    if (!build_demo_scene(&s)) {
+typedef struct {
+    image_writer *writer;
+    const char *path;
+    image_format format;
+    /* Set for one-pass renders, which stream tiles into the output as they finish. */
+    image_stream *stream;
+} app_output;
+
+/* Keeps the output current while a progressive render refines it; the writer thread encodes and
+ * writes each estimate while the next pass renders. */
+static void write_progress(void *user, const framebuffer *fb, const render_progress *p) {
+    app_output *out = (app_output*)user;
+    if (p->done) return;
+    printf("  pass %u: %zu/%zu tiles converged, max error %.4f, %.0f ms\n", p->pass, p->converged_tiles,
+           p->tile_count, p->max_error, p->elapsed_ms);
+    image_writer_submit(out->writer, out->path, fb, out->format, NULL, NULL);
+}
+
+static void stream_tile(void *user, const framebuffer *fb, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    image_stream_tile(((app_output*)user)->stream, fb, x0, y0, x1, y1);
+}
+
+static void report_output(void *user, const char *path, int ok, double ms) {
+    (void)user;
+    if (ok) printf("Wrote %s in %.3f ms\n", path, ms);
+}
+
+int app_load_scene(const app_scene_options *opts, scene *out_scene, bvh *out_tree) {
+    scene *s = out_scene;
+    FILE *log = opts->log;
+    memset(out_tree, 0, sizeof(*out_tree));
+    PROFILE_BEGIN(load_zone, "scene_load");
+    if (opts->path && scene_import_supported(opts->path)) {
+        scene_import_options import_opts;
+        scene_import_options_default(&import_opts);
+        import_opts.pool = opts->pool;
+        import_opts.instance_meshes = 1;
+        scene_import_stats stats;
+        if (!scene_import(opts->path, s, &import_opts, &stats)) {
+            fprintf(stderr, "Failed to import %s\n", opts->path);
+            return 0;
+        }
+        if (log) {
+            fprintf(log, "Imported %s: %zu meshes, %zu triangles in %.1f ms (%.1f MB/s)\n", opts->path, stats.mesh_count,
+                    stats.triangle_count, stats.ms, stats.mb_per_s);
+        }
+    } else if (opts->path) {
+        scene_file_info info;
+        if (!scene_file_load(opts->path, s, out_tree, &info)) {
+            fprintf(stderr, "Failed to load scene file %s\n", opts->path);
+            return 0;
+        }
+        char error[256];
+        if (opts->validate && !scene_file_validate(s, info.has_bvh ? out_tree : NULL, error, sizeof(error))) {
+            fprintf(stderr, "Failed to load scene file %s: %s\n", opts->path, error);
+            bvh_destroy(out_tree);
+            destroy_scene(s);
+            return 0;
+        }
+        if (log) {
+            fprintf(log, "Scene file: %s, %.1f MB in %zu sections, mapped in %.3f ms%s\n", opts->path,
+                    (double)info.file_bytes / (1024.0 * 1024.0), info.section_count, info.map_ms,
+                    info.has_bvh ? ", prebuilt BVH" : "");
+        }
+    } else if (!build_demo_scene(s)) {
         fprintf(stderr, "Failed to build scene\n");
-        return 1;
+        return 0;
     }
+    PROFILE_END(load_zone);
+    if (opts->instances > 0) {
+        /* A stored tree cannot serve the instanced scene. */
+        bvh_destroy(out_tree);
+        if (!scene_instance_grid(s, opts->instances)) {
+            fprintf(stderr, "Cannot instance this scene\n");
+            destroy_scene(s);
+            return 0;
+        }
+    }
+    if (s->instance_count > 0 && log) fprintf(log, "Instances: %zu over %zu meshes\n", s->instance_count, s->mesh_count);
+    /* Mapped scenes keep the file's interleaved vertices. */
+    if (!s->file) {
+        size_t before = 0, after = 0;
+        for (size_t i = 0; i < s->mesh_count; ++i) before += mesh_geometry_bytes(&s->meshes[i]);
+        if (scene_set_mesh_layout(s, opts->layout) && log) {
+            for (size_t i = 0; i < s->mesh_count; ++i) after += mesh_geometry_bytes(&s->meshes[i]);
+            fprintf(log, "Mesh layout: %s, geometry %.1f KB -> %.1f KB\n",
+                    opts->layout == MESH_LAYOUT_SOA ? "SoA" : "SoA quantized", (double)before / 1024.0,
+                    (double)after / 1024.0);
+        }
+    }
+    /* The scene and its BVH end up in one arena, so teardown is a single free per block. A scene
+     * that cannot be moved keeps its heap arrays. */
+    scene_move_to_arena(s);
+    if (out_tree->nodes) return 1;
 
-#ifdef ENABLE_HARDWARE_RT
-    vulkan_rt_report report = {0};
-    if (!render_hardware_vulkan(&s, &report)) {
-    if (!render_hardware_vulkan(&s)) {
-        fprintf(stderr, "Hardware path unavailable or failed, continuing with software fallback.\n");
+    bvh_build_options build_opts;
+    bvh_build_options_default(&build_opts);
+    build_opts.pool = opts->pool;
+    bvh_cache_info cache;
+    if (!bvh_cache_build(opts->bvh_cache_dir, out_tree, s, &build_opts, &cache)) {
+        fprintf(stderr, "BVH build failed\n");
+        destroy_scene(s);
+        return 0;
     }
-#endif
+    /* A corrupt cache entry is dropped and the tree built instead. */
+    char error[256];
+    if (cache.hit && opts->validate && !scene_file_validate(s, out_tree, error, sizeof(error))) {
+        fprintf(stderr, "Ignoring cached BVH %s/%016llx.bvh: %s\n", opts->bvh_cache_dir, (unsigned long long)cache.key, error);
+        bvh_destroy(out_tree);
+        cache.hit = 0;
+        if (!bvh_build_with_options(out_tree, s, &build_opts)) {
+            fprintf(stderr, "BVH build failed\n");
+            destroy_scene(s);
+            return 0;
+        }
+    }
+    if (opts->bvh_cache_dir && cache.key && log) {
+        fprintf(log, "BVH cache %s: %s/%016llx.bvh, hashed in %.3f ms, %s in %.3f ms\n", cache.hit ? "hit" : "miss",
+                opts->bvh_cache_dir, (unsigned long long)cache.key, cache.hash_ms, cache.hit ? "mapped" : "built",
+                cache.load_ms);
+    }
+    /* A cached tree stays in its mapping. */
+    if (s->arena && !cache.hit) bvh_move_to_arena(out_tree, s, s->arena);
+    return 1;
+}
 
-#ifdef ENABLE_SOFTWARE_RT
+/* One frame to output_path: one-pass renders stream their tiles into it, progressive ones rewrite
+ * it after passes. */
+static int render_app_frame(const scene *s, render_settings *settings, const char *output_path, int heatmap) {
     framebuffer fb = {0};
     fb.width = 640;
     fb.height = 360;
+    app_output output = {NULL, output_path, image_format_from_path(output_path), NULL};
+    /* A few frames queued at most, so a slow disk holds progressive passes back rather than piling up copies. */
+    output.writer = image_writer_create((size_t)fb.width * fb.height * 32);
     fb.rgba8 = (uint8_t*)calloc((size_t)fb.width * fb.height * 4, 1);
-    if (!fb.rgba8) {
-        destroy_scene(&s);
-        return 1;
+    if (output.format != IMAGE_FORMAT_PPM) fb.rgb32 = (float*)calloc((size_t)fb.width * fb.height * 3, sizeof(float));
+    float *cost = heatmap ? (float*)calloc((size_t)fb.width * fb.height, sizeof(float)) : NULL;
+    settings->traversal_cost = cost;
+    if (!output.writer || !fb.rgba8 || (output.format != IMAGE_FORMAT_PPM && !fb.rgb32) || (heatmap && !cost)) {
+        image_writer_destroy(output.writer);
+        free(fb.rgba8);
+        free(fb.rgb32);
+        free(cost);
+        return 0;
+    }
+    if (settings->progressive.max_samples > 0) {
+        settings->progressive.progress = write_progress;
+        settings->progressive.progress_user = &output;
+    } else {
+        /* Streamed as tiles finish; EXR is written uncompressed then. */
+        output.stream = image_writer_open_stream(output.writer, output_path, fb.width, fb.height, output.format);
+        settings->tile_done = output.stream ? stream_tile : NULL;
+        settings->tile_done_user = &output;
     }
 
-    if (!render_software(&s, &fb)) {
+    int rendered = render_software_ex(s, &fb, settings);
+    if (output.stream) {
+        image_stream_close(output.stream, rendered ? report_output : NULL, NULL);
+    } else if (rendered) {
+        image_writer_submit(output.writer, output_path, &fb, output.format, report_output, NULL);
+    }
+    int written = image_writer_flush(output.writer);
+    image_writer_destroy(output.writer);
+    if (!rendered) {
         fprintf(stderr, "Software rendering failed\n");
         free(fb.rgba8);
-        destroy_scene(&s);
-        return 1;
+        free(fb.rgb32);
+        free(cost);
+        return 0;
     }
 
-    if (!write_ppm("output.ppm", &fb)) {
-        fprintf(stderr, "Failed to write output.ppm\n");
+    if (!written) {
+        fprintf(stderr, "Failed to write %s\n", output_path);
     } else {
-        printf("Software render complete: output.ppm\n");
+        printf("Software render complete: %s\n", output_path);
+    }
+    if (cost) {
+        const char *heatmap_path = output.format == IMAGE_FORMAT_EXR   ? "heatmap.exr"
+                                   : output.format == IMAGE_FORMAT_PFM ? "heatmap.pfm"
+                                                                       : "heatmap.ppm";
+        if (!write_heatmap(heatmap_path, output.format, cost, fb.width, fb.height))
+            fprintf(stderr, "Failed to write %s\n", heatmap_path);
     }
 
     free(fb.rgba8);
+    free(fb.rgb32);
+    free(cost);
+    return 1;
+}
+
+/* Turns the camera about its up axis through its target by orbit_degrees and every mesh about its
+ * own vertical axis by spin_degrees over the sequence, so the last frame leads back into the first. */
+static int render_app_sequence(scene *s, bvh *tree, const render_settings *settings, uint32_t frames, float fps,
+                               float orbit_degrees, float spin_degrees, const char *pattern) {
+    if (!render_sequence_pattern_valid(pattern) || fps <= 0.0f) {
+        fprintf(stderr, "--frames needs --fps above 0 and an --output pattern with one frame number conversion, e.g. frame_%%04u.exr\n");
+        return 0;
+    }
+    render_sequence_options opts;
+    render_sequence_options_default(&opts);
+    opts.frame_count = frames;
+    opts.fps = fps;
+    opts.output_pattern = pattern;
+    opts.log = stdout;
+    float end_time = (float)frames / fps;
+    const float radians = 3.14159265f / 180.0f;
+
+    render_camera_key *camera_keys = orbit_degrees != 0.0f ? (render_camera_key*)malloc(frames * sizeof(render_camera_key)) : NULL;
+    const render_camera *cam = &settings->camera;
+    vec3 axis = vec3_norm(cam->up), offset = vec3_sub(cam->position, cam->target);
+    for (uint32_t i = 0; camera_keys && i < frames; ++i) {
+        /* Rodrigues' rotation of the offset from the target. */
+        float angle = orbit_degrees * radians * (float)i / (float)frames, c = cosf(angle), sn = sinf(angle);
+        vec3 along = vec3_mul(axis, vec3_dot(axis, offset) * (1.0f - c));
+        vec3 rotated = vec3_add(vec3_add(vec3_mul(offset, c), vec3_mul(vec3_cross(axis, offset), sn)), along);
+        camera_keys[i].time = (float)i / fps;
+        camera_keys[i].camera = *cam;
+        camera_keys[i].camera.position = vec3_add(cam->target, rotated);
+    }
+    opts.camera_keys = camera_keys;
+    opts.camera_key_count = camera_keys ? frames : 0;
+
+    render_mesh_key *mesh_keys = spin_degrees != 0.0f ? (render_mesh_key*)malloc(2 * s->mesh_count * sizeof(render_mesh_key)) : NULL;
+    for (size_t m = 0; mesh_keys && m < s->mesh_count; ++m) {
+        mesh_keys[2 * m] = (render_mesh_key){0.0f, (uint32_t)m, {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 1.0f};
+        mesh_keys[2 * m + 1] = (render_mesh_key){end_time, (uint32_t)m, {0.0f, 0.0f, 0.0f}, {0.0f, spin_degrees * radians, 0.0f}, 1.0f};
+    }
+    opts.mesh_keys = mesh_keys;
+    opts.mesh_key_count = mesh_keys ? 2 * s->mesh_count : 0;
+
+    render_sequence_stats stats;
+    int ok = (orbit_degrees == 0.0f || camera_keys) && (spin_degrees == 0.0f || mesh_keys) &&
+             render_sequence_run(s, tree, settings, &opts, &stats);
+    if (ok) {
+        printf("Sequence: %u frames in %.1f ms, %.0f frames/hour (update %.3f ms, render %.1f ms, write wait %.3f ms; "
+               "%zu top-level updates, %zu refits, %zu rebuilds)\n",
+               stats.frames, stats.total_ms, stats.frames_per_hour, stats.update_ms, stats.render_ms,
+               stats.write_wait_ms, stats.top_level_updates, stats.refits, stats.rebuilds);
+    } else {
+        fprintf(stderr, "Sequence rendering failed\n");
+    }
+    free(camera_keys);
+    free(mesh_keys);
+    return ok;
+}
+
+int run_app(int argc, char **argv) {
+    const char *scene_path = NULL;
+    const char *bvh_cache_dir = NULL;
+    const char *output_path = NULL;
+    mesh_layout layout = MESH_LAYOUT_SOA;
+    uint32_t instances = 0;
+    uint32_t max_samples = 0;
+    float target_error = -1.0f;
+    double time_budget_ms = 0.0;
+    int profile = 0, heatmap = 0;
+    int server = 0, validate = 0;
+    uint32_t frames = 0;
+    float fps = 24.0f, orbit_degrees = 0.0f, spin_degrees = 0.0f;
+    render_server_options server_opts;
+    render_server_options_default(&server_opts);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (strcmp(argv[i], "--bvh-cache") == 0 && i + 1 < argc) {
+            bvh_cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--validate-scene") == 0) {
+            validate = 1;
+        } else if (strcmp(argv[i], "--quantize") == 0) {
+            layout = MESH_LAYOUT_SOA_QUANTIZED;
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instances = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) {
+            max_samples = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--target-error") == 0 && i + 1 < argc) {
+            target_error = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--time-budget") == 0 && i + 1 < argc) {
+            time_budget_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--heatmap") == 0) {
+            heatmap = 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            fps = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--orbit") == 0 && i + 1 < argc) {
+            orbit_degrees = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--spin") == 0 && i + 1 < argc) {
+            spin_degrees = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0) {
+            server = 1;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            server = 1;
+            server_opts.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            server_opts.worker_count = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            server_opts.cache_bytes = (size_t)strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        } else {
+            fprintf(stderr, "Usage: %s [--scene file] [--output image] [--bvh-cache dir] [--validate-scene] [--quantize] [--instances count] "
+                            "[--spp max] [--target-error e] [--time-budget ms] [--profile] [--heatmap]\n"
+                            "       %s --frames n [--fps f] [--orbit degrees] [--spin degrees] [--output pattern] [scene and sampling options]\n"
+                            "       %s --server [--socket path] [--threads n] [--cache-mb mb] [--bvh-cache dir] [--quantize]\n",
+                    argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    if (server) {
+        server_opts.layout = layout;
+        server_opts.bvh_cache_dir = bvh_cache_dir;
+        return render_server_run(&server_opts) ? 0 : 1;
+    }
+
+    /* The heatmap is made of the profiling counters. */
+    if (profile || heatmap) {
+        profile_reset();
+        profile_set_enabled(1);
+    }
+
+    /* Loading and the BVH build share one pool; the renderer brings its own. */
+    uint32_t threads = thread_pool_hardware_concurrency();
+    thread_pool *pool = threads > 1 ? thread_pool_create(threads - 1) : NULL;
+    app_scene_options scene_opts = {scene_path, layout, instances, bvh_cache_dir, pool, stdout, validate};
+    scene s;
+    bvh tree;
+    int loaded = app_load_scene(&scene_opts, &s, &tree);
+    thread_pool_destroy(pool);
+    if (!loaded) return 1;
+
+#ifdef ENABLE_HARDWARE_RT
+    vulkan_rt_report report = {0};
+    if (!render_hardware_vulkan(&s, &report)) {
+        fprintf(stderr, "Hardware path unavailable or failed, continuing with software fallback.\n");
+    }
 #endif
 
+    int ok = 1;
+#ifdef ENABLE_SOFTWARE_RT
+    render_settings settings;
+    render_settings_default(&settings);
+    settings.progressive.max_samples = max_samples;
+    if (target_error >= 0.0f) settings.progressive.target_error = target_error;
+    settings.progressive.time_budget_ms = time_budget_ms;
+    settings.prebuilt_bvh = &tree;
+
+    ok = frames > 0 ? render_app_sequence(&s, &tree, &settings, frames, fps, orbit_degrees, spin_degrees,
+                                          output_path ? output_path : "frame_%04u.ppm")
+                    : render_app_frame(&s, &settings, output_path ? output_path : "output.ppm", heatmap);
+#endif
+
+    if (profile) {
+        profile_print_summary(stdout);
+        if (profile_write_trace("trace.json")) printf("Chrome/Perfetto trace: trace.json\n");
+    }
+    profile_shutdown();
+
+    bvh_destroy(&tree);
     destroy_scene(&s);
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,94 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block {
+    arena_block *next;
+    size_t size;
+};
+
+/* Block data starts right after the header, which keeps malloc's alignment. */
+static uint8_t *block_data(arena_block *b) {
+    return (uint8_t*)(b + 1);
+}
+
+void arena_init(arena *a, size_t block_bytes) {
+    memset(a, 0, sizeof(*a));
+    a->block_bytes = block_bytes ? block_bytes : ARENA_DEFAULT_BLOCK_BYTES;
+}
+
+void arena_init_fixed(arena *a, void *memory, size_t bytes) {
+    memset(a, 0, sizeof(*a));
+    a->base = (uint8_t*)memory;
+    a->capacity = memory ? bytes : 0;
+    a->reserved_bytes = a->capacity;
+}
+
+static int push_block(arena *a, size_t size) {
+    if (size > SIZE_MAX - sizeof(arena_block)) return 0;
+    arena_block *b = (arena_block*)malloc(sizeof(arena_block) + size);
+    if (!b) return 0;
+    b->next = a->blocks;
+    b->size = size;
+    a->blocks = b;
+    a->block_count++;
+    a->reserved_bytes += size;
+    a->base = block_data(b);
+    a->capacity = size;
+    a->offset = 0;
+    return 1;
+}
+
+void *arena_alloc(arena *a, size_t bytes, size_t align) {
+    if (align == 0) align = ARENA_DEFAULT_ALIGN;
+    if ((align & (align - 1)) != 0 || bytes > SIZE_MAX - align) return NULL;
+    uintptr_t mask = (uintptr_t)align - 1;
+    size_t pad = a->base ? (size_t)((((uintptr_t)a->base + a->offset + mask) & ~mask) - ((uintptr_t)a->base + a->offset)) : 0;
+    if (!a->base || pad + bytes > a->capacity - a->offset) {
+        /* The rest of the current block is abandoned; the next reset folds it back in. */
+        if (a->block_bytes == 0) return NULL;
+        if (!push_block(a, bytes + align > a->block_bytes ? bytes + align : a->block_bytes)) return NULL;
+        pad = (size_t)((((uintptr_t)a->base + mask) & ~mask) - (uintptr_t)a->base);
+    }
+    uint8_t *p = a->base + a->offset + pad;
+    a->offset += pad + bytes;
+    a->used_bytes += pad + bytes;
+    if (a->used_bytes > a->peak_bytes) a->peak_bytes = a->used_bytes;
+    return p;
+}
+
+void *arena_calloc(arena *a, size_t count, size_t size, size_t align) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void *p = arena_alloc(a, count * size, align);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+static void free_blocks(arena *a) {
+    for (arena_block *b = a->blocks; b;) {
+        arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->blocks = NULL;
+    a->block_count = 0;
+    a->reserved_bytes = 0;
+    a->base = NULL;
+    a->capacity = 0;
+}
+
+void arena_reset(arena *a) {
+    a->offset = 0;
+    a->used_bytes = 0;
+    if (a->block_count <= 1) return;
+    size_t total = a->reserved_bytes;
+    free_blocks(a);
+    /* On failure the arena simply starts empty and grows again. */
+    push_block(a, total);
+}
+
+void arena_destroy(arena *a) {
+    free_blocks(a);
+    memset(a, 0, sizeof(*a));
+}
@@ -1,23 +1,41 @@
 #include "bvh.h"
 
-#include <float.h>
 #include <stdlib.h>
 #include <string.h>
 
-static aabb aabb_empty(void) {
-    return (aabb){{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
-}
+#include "bvh_internal.h"
+#include "scene_file.h"
+#include "timer.h"
 
-static void aabb_include(aabb *b, vec3 p) {
-    if (p.x < b->min.x) b->min.x = p.x;
-    if (p.y < b->min.y) b->min.y = p.y;
-    if (p.z < b->min.z) b->min.z = p.z;
-    if (p.x > b->max.x) b->max.x = p.x;
-    if (p.y > b->max.y) b->max.y = p.y;
-    if (p.z > b->max.z) b->max.z = p.z;
-}
+/* Ranges at least this large are binned in parallel chunks. */
+#define BVH_PARALLEL_BIN_MIN 65536
+/* Node and triangle arrays moved into an arena start on cache lines. */
+#define BVH_ARENA_ALIGN 64
+
+typedef struct {
+    aabb box;
+    size_t count;
+} sah_bin;
+
+typedef struct {
+    bvh_node *nodes;
+    bvh_prim_ref *prims;
+    volatile size_t node_count;
+    size_t max_leaf_size;
+    uint32_t bin_count;
+    thread_pool *pool;
+    thread_pool_group group;
+} sah_builder;
 
-static int intersect_aabb(ray r, aabb b, float tmin, float tmax) {
+typedef struct {
+    sah_builder *b;
+    size_t node_index;
+    size_t start;
+    size_t count;
+    int depth;
+} build_task;
+
+static int intersect_aabb(ray r, aabb b, float tmin, float tmax, float *out_tnear) {
     for (int axis = 0; axis < 3; ++axis) {
         float origin = axis == 0 ? r.origin.x : axis == 1 ? r.origin.y : r.origin.z;
         float dir = axis == 0 ? r.direction.x : axis == 1 ? r.direction.y : r.direction.z;
@@ -33,8 +51,10 @@ static int intersect_aabb(ray r, aabb b, float tmin, float tmax) {
         }
         if (t0 > tmin) tmin = t0;
         if (t1 < tmax) tmax = t1;
-        if (tmax <= tmin) return 0;
+        /* Inclusive so zero-thickness boxes around planar geometry still hit. */
+        if (tmax < tmin) return 0;
     }
+    if (out_tnear) *out_tnear = tmin;
     return 1;
 }
 
@@ -56,80 +76,818 @@ static int intersect_triangle(ray r, vec3 v0, vec3 v1, vec3 v2, float *t, float
     return *t > eps;
 }
 
+typedef struct {
+    const sah_builder *b;
+    size_t start;
+    aabb *boxes;
+    aabb *centroid_boxes;
+} range_bounds_ctx;
+
+static void range_bounds_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    range_bounds_ctx *c = (range_bounds_ctx*)ctx;
+    aabb box = aabb_empty();
+    aabb centroid_box = aabb_empty();
+    for (size_t i = c->start + begin; i < c->start + end; ++i) {
+        const bvh_prim_ref *prim = &c->b->prims[i];
+        vec3 centroid = aabb_center(&prim->box);
+        aabb_merge(&box, &prim->box);
+        aabb centroid_point = {centroid, centroid};
+        aabb_merge(&centroid_box, &centroid_point);
+    }
+    c->boxes[chunk] = box;
+    c->centroid_boxes[chunk] = centroid_box;
+}
+
+static void range_bounds(const sah_builder *b, size_t start, size_t count, aabb *out_box, aabb *out_centroid_box) {
+    aabb local_box, local_centroid;
+    range_bounds_ctx ctx = {b, start, &local_box, &local_centroid};
+    thread_pool *pool = count >= BVH_PARALLEL_BIN_MIN ? b->pool : NULL;
+    size_t chunks = thread_pool_chunk_count(pool, count, BVH_PARALLEL_GRAIN);
+    aabb *scratch = NULL;
+    if (chunks > 1) {
+        scratch = (aabb*)malloc(2 * chunks * sizeof(aabb));
+        if (scratch) {
+            ctx.boxes = scratch;
+            ctx.centroid_boxes = scratch + chunks;
+        } else {
+            pool = NULL;
+            chunks = 1;
+        }
+    }
+    thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, range_bounds_chunk, &ctx);
+
+    *out_box = aabb_empty();
+    *out_centroid_box = aabb_empty();
+    for (size_t c = 0; c < chunks; ++c) {
+        aabb_merge(out_box, &ctx.boxes[c]);
+        aabb_merge(out_centroid_box, &ctx.centroid_boxes[c]);
+    }
+    free(scratch);
+}
+
+typedef struct {
+    const sah_builder *b;
+    size_t start;
+    float cmin[3];
+    float scale[3];
+    uint32_t bin_count;
+    sah_bin *bins;
+} range_bin_ctx;
+
+static void range_bin_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    range_bin_ctx *c = (range_bin_ctx*)ctx;
+    uint32_t bin_count = c->bin_count;
+    sah_bin *bins = c->bins + chunk * 3 * bin_count;
+    for (uint32_t i = 0; i < 3 * bin_count; ++i) {
+        bins[i].box = aabb_empty();
+        bins[i].count = 0;
+    }
+    for (size_t i = c->start + begin; i < c->start + end; ++i) {
+        const bvh_prim_ref *prim = &c->b->prims[i];
+        vec3 centroid = aabb_center(&prim->box);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (c->scale[axis] <= 0.0f) continue;
+            uint32_t bi = (uint32_t)((vec3_axis(centroid, axis) - c->cmin[axis]) * c->scale[axis]);
+            if (bi >= bin_count) bi = bin_count - 1;
+            sah_bin *bin = &bins[axis * bin_count + bi];
+            bin->count++;
+            aabb_merge(&bin->box, &prim->box);
+        }
+    }
+}
+
+/* Fills bins[3 * axes->bin_count]; axes with zero centroid extent are left empty. */
+static void range_bin(const sah_builder *b, size_t start, size_t count, const range_bin_ctx *axes, sah_bin *bins) {
+    uint32_t bin_count = axes->bin_count;
+    range_bin_ctx ctx = *axes;
+    ctx.b = b;
+    ctx.start = start;
+    ctx.bins = bins;
+
+    thread_pool *pool = count >= BVH_PARALLEL_BIN_MIN ? b->pool : NULL;
+    size_t chunks = thread_pool_chunk_count(pool, count, BVH_PARALLEL_GRAIN);
+    sah_bin *scratch = NULL;
+    if (chunks > 1) {
+        scratch = (sah_bin*)malloc(chunks * 3 * bin_count * sizeof(sah_bin));
+        if (scratch) {
+            ctx.bins = scratch;
+        } else {
+            pool = NULL;
+        }
+    }
+    thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, range_bin_chunk, &ctx);
+
+    if (scratch) {
+        for (uint32_t i = 0; i < 3 * bin_count; ++i) {
+            bins[i] = scratch[i];
+            for (size_t c = 1; c < chunks; ++c) {
+                const sah_bin *src = &scratch[c * 3 * bin_count + i];
+                bins[i].count += src->count;
+                aabb_merge(&bins[i].box, &src->box);
+            }
+        }
+        free(scratch);
+    }
+}
+
+static void build_node(sah_builder *b, size_t node_index, size_t start, size_t count, int depth);
+
+static void run_build_task(void *arg) {
+    build_task task = *(build_task*)arg;
+    free(arg);
+    build_node(task.b, task.node_index, task.start, task.count, task.depth);
+}
+
+static void build_child(sah_builder *b, size_t node_index, size_t start, size_t count, int depth) {
+    if (b->pool && count >= BVH_TASK_MIN) {
+        build_task *task = (build_task*)malloc(sizeof(build_task));
+        if (task) {
+            *task = (build_task){b, node_index, start, count, depth};
+            thread_pool_submit(b->pool, &b->group, run_build_task, task);
+            return;
+        }
+    }
+    build_node(b, node_index, start, count, depth);
+}
+
+static void build_node(sah_builder *b, size_t node_index, size_t start, size_t count, int depth) {
+    bvh_prim_ref *prims = b->prims;
+
+    aabb box, centroid_box;
+    range_bounds(b, start, count, &box, &centroid_box);
+    b->nodes[node_index].box = box;
+
+    if (count <= 1 || depth >= BVH_MAX_DEPTH - 1) {
+        bvh_make_leaf(&b->nodes[node_index], start, count);
+        return;
+    }
+
+    /* Small ranges cannot populate more bins than they have primitives. */
+    uint32_t bin_count = count < b->bin_count ? (uint32_t)count : b->bin_count;
+    range_bin_ctx axes = {0};
+    axes.bin_count = bin_count;
+    for (int axis = 0; axis < 3; ++axis) {
+        float cmin = vec3_axis(centroid_box.min, axis);
+        float extent = vec3_axis(centroid_box.max, axis) - cmin;
+        axes.cmin[axis] = cmin;
+        axes.scale[axis] = extent > 0.0f ? (float)bin_count / extent : 0.0f;
+    }
+
+    sah_bin bins[3 * BVH_MAX_BINS];
+    range_bin(b, start, count, &axes, bins);
+
+    int best_axis = -1;
+    uint32_t best_split = 0;
+    float best_cost = FLT_MAX;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (axes.scale[axis] <= 0.0f) continue;
+        const sah_bin *axis_bins = &bins[axis * bin_count];
+
+        float right_area[BVH_MAX_BINS];
+        size_t right_count[BVH_MAX_BINS];
+        aabb acc = aabb_empty();
+        size_t acc_count = 0;
+        for (uint32_t i = bin_count - 1; i > 0; --i) {
+            aabb_merge(&acc, &axis_bins[i].box);
+            acc_count += axis_bins[i].count;
+            right_area[i] = aabb_area(&acc);
+            right_count[i] = acc_count;
+        }
+
+        acc = aabb_empty();
+        acc_count = 0;
+        for (uint32_t i = 1; i < bin_count; ++i) {
+            aabb_merge(&acc, &axis_bins[i - 1].box);
+            acc_count += axis_bins[i - 1].count;
+            if (acc_count == 0 || right_count[i] == 0) continue;
+            float cost = aabb_area(&acc) * (float)acc_count + right_area[i] * (float)right_count[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+            }
+        }
+    }
+
+    size_t mid;
+    if (best_axis < 0) {
+        /* All centroids coincide; only an object-median split can shrink the leaf. */
+        if (count <= b->max_leaf_size) {
+            bvh_make_leaf(&b->nodes[node_index], start, count);
+            return;
+        }
+        mid = start + count / 2;
+    } else {
+        float area = aabb_area(&box);
+        float split_cost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * (area > 0.0f ? best_cost / area : 0.0f);
+        float leaf_cost = BVH_INTERSECT_COST * (float)count;
+        if (count <= b->max_leaf_size && split_cost >= leaf_cost) {
+            bvh_make_leaf(&b->nodes[node_index], start, count);
+            return;
+        }
+
+        float cmin = axes.cmin[best_axis];
+        float scale = axes.scale[best_axis];
+        size_t lo = start;
+        size_t hi = start + count;
+        while (lo < hi) {
+            uint32_t bi = (uint32_t)((vec3_axis(aabb_center(&prims[lo].box), best_axis) - cmin) * scale);
+            if (bi >= bin_count) bi = bin_count - 1;
+            if (bi < best_split) {
+                ++lo;
+            } else {
+                bvh_prim_ref tmp = prims[lo];
+                prims[lo] = prims[--hi];
+                prims[hi] = tmp;
+            }
+        }
+        mid = lo;
+    }
+
+    size_t left = thread_pool_atomic_add(&b->node_count, 2);
+    b->nodes[node_index].left = (int)left;
+    b->nodes[node_index].right = (int)(left + 1);
+    b->nodes[node_index].start = 0;
+    b->nodes[node_index].count = 0;
+
+    build_child(b, left, start, mid - start, depth + 1);
+    build_node(b, left + 1, mid, start + count - mid, depth + 1);
+}
+
+typedef struct {
+    const scene *s;
+    const bvh *tree;
+    bvh_prim_ref *prims;
+} prim_setup_ctx;
+
+static void prim_setup_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    prim_setup_ctx *c = (prim_setup_ctx*)ctx;
+    const bvh *tree = c->tree;
+    for (size_t i = begin; i < end; ++i) {
+        uint32_t m = tree->triangle_mesh[i];
+        const mesh *me = &c->s->meshes[m];
+        triangle tri = mesh_triangle(me, i - tree->mesh_first_triangle[m]);
+        aabb box = aabb_empty();
+        aabb_include(&box, mesh_position(me, tri.i0));
+        aabb_include(&box, mesh_position(me, tri.i1));
+        aabb_include(&box, mesh_position(me, tri.i2));
+        c->prims[i].box = box;
+        c->prims[i].index = i;
+    }
+}
+
+int bvh_build_sah(bvh *tree, bvh_prim_ref *prims, const bvh_build_options *opts) {
+    sah_builder b = {
+        .nodes = tree->nodes,
+        .prims = prims,
+        .node_count = 1,
+        .max_leaf_size = opts->max_leaf_size > 0 ? opts->max_leaf_size : 1,
+        .bin_count = opts->bin_count < 2 ? 2 : opts->bin_count > BVH_MAX_BINS ? BVH_MAX_BINS : opts->bin_count,
+        .pool = opts->pool
+    };
+
+    build_node(&b, 0, 0, tree->triangle_count, 0);
+    thread_pool_wait(b.pool, &b.group);
+    tree->node_count = b.node_count;
+    return 1;
+}
+
+void bvh_build_options_default(bvh_build_options *opts) {
+    opts->builder = BVH_BUILDER_SAH;
+    opts->max_leaf_size = 4;
+    opts->bin_count = 16;
+    opts->morton_bits = 30;
+    opts->treelet_size = 0;
+    opts->width = 4;
+    opts->triangle_block_width = 0;
+    opts->pool = NULL;
+}
+
 int bvh_build(bvh *tree, const scene *s) {
+    bvh_build_options opts;
+    bvh_build_options_default(&opts);
+    return bvh_build_with_options(tree, s, &opts);
+}
+
+static void finish_build(bvh *tree, const bvh_build_options *opts, double start_ms) {
+    bvh_compute_stats(tree, &tree->stats);
+    tree->stats.thread_count = thread_pool_worker_count(opts->pool);
+    tree->stats.build_ms = timer_now_ms() - start_ms;
+    tree->build_sah_cost = tree->stats.sah_cost;
+}
+
+static int build_with_options(bvh *tree, const scene *s, const bvh_build_options *opts) {
+    double start_ms = timer_now_ms();
     memset(tree, 0, sizeof(*tree));
     tree->scene_ref = s;
+    if (s->instance_count > 0) {
+        if (!bvh_build_two_level(tree, s, opts)) {
+            bvh_destroy(tree);
+            return 0;
+        }
+        finish_build(tree, opts, start_ms);
+        return 1;
+    }
 
     size_t tri_total = 0;
     for (size_t i = 0; i < s->mesh_count; ++i) tri_total += s->meshes[i].triangle_count;
     tree->triangle_count = tri_total;
-    tree->triangle_indices = (size_t*)calloc(tri_total, sizeof(size_t));
-    tree->nodes = (bvh_node*)calloc(1, sizeof(bvh_node));
-    tree->node_count = 1;
-    if (!tree->triangle_indices || !tree->nodes) {
+
+    size_t node_capacity = tri_total > 0 ? 2 * tri_total - 1 : 1;
+    tree->triangle_indices = (size_t*)calloc(tri_total > 0 ? tri_total : 1, sizeof(size_t));
+    tree->triangle_mesh = (uint32_t*)calloc(tri_total > 0 ? tri_total : 1, sizeof(uint32_t));
+    tree->mesh_first_triangle = (size_t*)calloc(s->mesh_count + 1, sizeof(size_t));
+    tree->nodes = (bvh_node*)malloc(node_capacity * sizeof(bvh_node));
+    bvh_prim_ref *prims = (bvh_prim_ref*)malloc((tri_total > 0 ? tri_total : 1) * sizeof(bvh_prim_ref));
+    if (!tree->triangle_indices || !tree->triangle_mesh || !tree->mesh_first_triangle || !tree->nodes || !prims) {
+        free(prims);
         bvh_destroy(tree);
         return 0;
     }
 
-    for (size_t i = 0; i < tri_total; ++i) tree->triangle_indices[i] = i;
-    tree->nodes[0].left = -1;
-    tree->nodes[0].right = -1;
-    tree->nodes[0].start = 0;
-    tree->nodes[0].count = tri_total;
-
-    aabb box = aabb_empty();
+    size_t global_idx = 0;
     for (size_t m = 0; m < s->mesh_count; ++m) {
-        for (size_t v = 0; v < s->meshes[m].vertex_count; ++v) {
-            aabb_include(&box, s->meshes[m].vertices[v].position);
+        tree->mesh_first_triangle[m] = global_idx;
+        for (size_t t = 0; t < s->meshes[m].triangle_count; ++t, ++global_idx) {
+            tree->triangle_mesh[global_idx] = (uint32_t)m;
         }
     }
-    tree->nodes[0].box = box;
+    tree->mesh_first_triangle[s->mesh_count] = global_idx;
+
+    prim_setup_ctx setup = {s, tree, prims};
+    thread_pool_parallel_for(opts->pool, tri_total, BVH_PARALLEL_GRAIN, prim_setup_chunk, &setup);
+
+    int built = opts->builder == BVH_BUILDER_LBVH ? bvh_build_lbvh(tree, prims, opts) : bvh_build_sah(tree, prims, opts);
+    if (!built) {
+        free(prims);
+        bvh_destroy(tree);
+        return 0;
+    }
+    if (opts->treelet_size > 0) bvh_optimize_treelets(tree, opts->treelet_size);
+    if ((opts->width == 4 || opts->width == 8) && !bvh_build_wide(tree, opts->width)) {
+        free(prims);
+        bvh_destroy(tree);
+        return 0;
+    }
+
+    for (size_t i = 0; i < tri_total; ++i) tree->triangle_indices[i] = prims[i].index;
+    free(prims);
+    if (opts->triangle_block_width && !bvh_build_triangle_blocks(tree, opts->triangle_block_width)) {
+        bvh_destroy(tree);
+        return 0;
+    }
+
+    bvh_node *shrunk = (bvh_node*)realloc(tree->nodes, tree->node_count * sizeof(bvh_node));
+    if (shrunk) tree->nodes = shrunk;
+
+    finish_build(tree, opts, start_ms);
     return 1;
 }
 
+int bvh_build_with_options(bvh *tree, const scene *s, const bvh_build_options *opts) {
+    PROFILE_BEGIN(zone, "bvh_build");
+    int ok = build_with_options(tree, s, opts);
+    PROFILE_END(zone);
+    return ok;
+}
+
+void bvh_compute_stats(const bvh *tree, bvh_build_stats *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    if (!tree || !tree->nodes || tree->node_count == 0) return;
+
+    float root_area = aabb_area(&tree->nodes[0].box);
+    float inv_root = root_area > 0.0f ? 1.0f / root_area : 0.0f;
+    double cost = 0.0;
+
+    int node_stack[2 * BVH_MAX_DEPTH];
+    int depth_stack[2 * BVH_MAX_DEPTH];
+    int sp = 0;
+    node_stack[sp] = 0;
+    depth_stack[sp++] = 0;
+    while (sp > 0) {
+        --sp;
+        const bvh_node *node = &tree->nodes[node_stack[sp]];
+        int depth = depth_stack[sp];
+        float rel_area = aabb_area(&node->box) * inv_root;
+        out_stats->node_count++;
+        if (depth > out_stats->max_depth) out_stats->max_depth = depth;
+        if (node->left < 0) {
+            out_stats->leaf_count++;
+            cost += BVH_INTERSECT_COST * rel_area * (double)node->count;
+            continue;
+        }
+        cost += BVH_TRAVERSAL_COST * rel_area;
+        node_stack[sp] = node->left;
+        depth_stack[sp++] = depth + 1;
+        node_stack[sp] = node->right;
+        depth_stack[sp++] = depth + 1;
+    }
+    out_stats->sah_cost = (float)cost;
+
+    /* Two-level totals add the per-mesh trees below the top level; the SAH cost stays the top level's. */
+    int blas_depth = 0;
+    for (size_t m = 0; m < tree->blas_count; ++m) {
+        const bvh_build_stats *b = &tree->blas[m].stats;
+        out_stats->node_count += b->node_count;
+        out_stats->leaf_count += b->leaf_count;
+        if (b->max_depth + 1 > blas_depth) blas_depth = b->max_depth + 1;
+    }
+    out_stats->max_depth += blas_depth;
+}
+
+size_t bvh_memory_bytes(const bvh *tree) {
+    if (!tree) return 0;
+    size_t bytes = tree->node_count * sizeof(bvh_node) + tree->triangle_count * sizeof(size_t);
+    if (tree->triangle_mesh) bytes += tree->triangle_count * sizeof(uint32_t);
+    if (tree->mesh_first_triangle && tree->scene_ref) bytes += (tree->scene_ref->mesh_count + 1) * sizeof(size_t);
+    if (tree->nodes4) bytes += tree->wide_node_count * sizeof(bvh4_node);
+    if (tree->nodes8) bytes += tree->wide_node_count * sizeof(bvh8_node);
+    size_t blocks = tree->triangle_block_width
+        ? (tree->triangle_count + tree->triangle_block_width - 1) / tree->triangle_block_width : 0;
+    if (tree->tris4) bytes += blocks * sizeof(bvh_tri4);
+    if (tree->tris8) bytes += blocks * sizeof(bvh_tri8);
+    bytes += tree->instance_count * sizeof(bvh_instance) + tree->blas_count * (sizeof(bvh) + sizeof(scene));
+    for (size_t m = 0; m < tree->blas_count; ++m) bytes += bvh_memory_bytes(&tree->blas[m]);
+    return bytes;
+}
+
 void bvh_destroy(bvh *tree) {
     if (!tree) return;
+    for (size_t m = 0; m < tree->blas_count; ++m) bvh_destroy(&tree->blas[m]);
+    free(tree->blas);
+    free(tree->blas_scenes);
+    free(tree->instances);
+    scene_file_close(tree->file);
+    if (tree->borrowed_storage) {
+        memset(tree, 0, sizeof(*tree));
+        return;
+    }
     free(tree->nodes);
     free(tree->triangle_indices);
+    free(tree->triangle_mesh);
+    free(tree->mesh_first_triangle);
+    free(tree->nodes4);
+    free(tree->nodes8);
+    free(tree->tris4);
+    free(tree->tris8);
     memset(tree, 0, sizeof(*tree));
 }
 
-int bvh_trace_first_hit(const bvh *tree, ray r, float tmin, float tmax, size_t *out_mesh, size_t *out_tri, float *out_t, vec3 *out_normal, float *out_u, float *out_v) {
-    if (!tree || !tree->nodes || !tree->scene_ref) return 0;
-    const scene *s = tree->scene_ref;
-    if (!intersect_aabb(r, tree->nodes[0].box, tmin, tmax)) return 0;
+static aabb refit_node(bvh *tree, const scene *s, int index) {
+    bvh_node *node = &tree->nodes[index];
+    aabb box = aabb_empty();
+    if (node->left < 0) {
+        for (size_t i = node->start; i < node->start + node->count; ++i) {
+            size_t prim = tree->triangle_indices[i];
+            uint32_t m = tree->triangle_mesh[prim];
+            const mesh *me = &s->meshes[m];
+            triangle tri = mesh_triangle(me, prim - tree->mesh_first_triangle[m]);
+            aabb_include(&box, mesh_position(me, tri.i0));
+            aabb_include(&box, mesh_position(me, tri.i1));
+            aabb_include(&box, mesh_position(me, tri.i2));
+        }
+    } else {
+        aabb right = refit_node(tree, s, node->right);
+        box = refit_node(tree, s, node->left);
+        aabb_merge(&box, &right);
+    }
+    node->box = box;
+    return box;
+}
 
-    int hit = 0;
-    size_t global_idx = 0;
-    float best_t = tmax;
+typedef struct {
+    bvh *tree;
+    const scene *s;
+    const int *roots;
+} refit_ctx;
+
+static void refit_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    refit_ctx *c = (refit_ctx*)ctx;
+    for (size_t i = begin; i < end; ++i) refit_node(c->tree, c->s, c->roots[i]);
+}
+
+static void *arena_copy(arena *a, const void *src, size_t bytes) {
+    void *dst = arena_alloc(a, bytes ? bytes : 1, BVH_ARENA_ALIGN);
+    if (dst && src && bytes) memcpy(dst, src, bytes);
+    return dst;
+}
+
+int bvh_move_to_arena(bvh *tree, const scene *s, arena *a) {
+    if (!tree || !tree->nodes || !s || !a) return 0;
+    if (tree->blas) {
+        /* The bulk lives in the per-mesh trees; the top level stays on the heap, where instance
+         * updates rebuild it. */
+        for (size_t m = 0; m < tree->blas_count; ++m) {
+            if (!bvh_move_to_arena(&tree->blas[m], &tree->blas_scenes[m], a)) return 0;
+        }
+        return 1;
+    }
+    if (tree->borrowed_storage) return 1;
+    size_t blocks = tree->triangle_block_width
+        ? (tree->triangle_count + tree->triangle_block_width - 1) / tree->triangle_block_width : 0;
+    if (blocks == 0 && tree->triangle_block_width) blocks = 1;
+    bvh moved = *tree;
+    moved.nodes = (bvh_node*)arena_copy(a, tree->nodes, tree->node_count * sizeof(bvh_node));
+    moved.triangle_indices = (size_t*)arena_copy(a, tree->triangle_indices, tree->triangle_count * sizeof(size_t));
+    moved.triangle_mesh = (uint32_t*)arena_copy(a, tree->triangle_mesh, tree->triangle_count * sizeof(uint32_t));
+    moved.mesh_first_triangle = (size_t*)arena_copy(a, tree->mesh_first_triangle, (s->mesh_count + 1) * sizeof(size_t));
+    int ok = moved.nodes && moved.triangle_indices && moved.triangle_mesh && moved.mesh_first_triangle;
+    if (ok && tree->nodes4) ok = (moved.nodes4 = (bvh4_node*)arena_copy(a, tree->nodes4, tree->wide_node_count * sizeof(bvh4_node))) != NULL;
+    if (ok && tree->nodes8) ok = (moved.nodes8 = (bvh8_node*)arena_copy(a, tree->nodes8, tree->wide_node_count * sizeof(bvh8_node))) != NULL;
+    if (ok && tree->tris4) ok = (moved.tris4 = (bvh_tri4*)arena_copy(a, tree->tris4, blocks * sizeof(bvh_tri4))) != NULL;
+    if (ok && tree->tris8) ok = (moved.tris8 = (bvh_tri8*)arena_copy(a, tree->tris8, blocks * sizeof(bvh_tri8))) != NULL;
+    /* Whatever was already copied stays in the arena until it is freed. */
+    if (!ok) return 0;
+    bvh_destroy(tree);
+    moved.borrowed_storage = 1;
+    *tree = moved;
+    return 1;
+}
 
+static int topology_matches(const bvh *tree, const scene *s) {
+    if (!tree->mesh_first_triangle) return 0;
+    size_t total = 0;
     for (size_t m = 0; m < s->mesh_count; ++m) {
+        if (tree->mesh_first_triangle[m] != total) return 0;
+        total += s->meshes[m].triangle_count;
+    }
+    return total == tree->triangle_count && tree->mesh_first_triangle[s->mesh_count] == total;
+}
+
+static void *copy_array(const void *src, size_t bytes) {
+    void *dst = malloc(bytes ? bytes : 1);
+    if (dst && src && bytes) memcpy(dst, src, bytes);
+    return dst;
+}
+
+/* Swaps borrowed arrays for heap copies so refits can rebuild and free them. The wide nodes and
+ * triangle blocks are not copied: refits regenerate both. */
+static int own_storage(bvh *tree, const scene *s) {
+    if (!tree->borrowed_storage) return 1;
+    bvh_node *nodes = (bvh_node*)copy_array(tree->nodes, tree->node_count * sizeof(bvh_node));
+    size_t *indices = (size_t*)copy_array(tree->triangle_indices, tree->triangle_count * sizeof(size_t));
+    uint32_t *tri_mesh = (uint32_t*)copy_array(tree->triangle_mesh, tree->triangle_count * sizeof(uint32_t));
+    size_t *first = (size_t*)copy_array(tree->mesh_first_triangle, (s->mesh_count + 1) * sizeof(size_t));
+    if (!nodes || !indices || !tri_mesh || !first) {
+        free(nodes);
+        free(indices);
+        free(tri_mesh);
+        free(first);
+        return 0;
+    }
+    tree->nodes = nodes;
+    tree->triangle_indices = indices;
+    tree->triangle_mesh = tri_mesh;
+    tree->mesh_first_triangle = first;
+    tree->nodes4 = NULL;
+    tree->nodes8 = NULL;
+    tree->tris4 = NULL;
+    tree->tris8 = NULL;
+    tree->borrowed_storage = 0;
+    /* Nothing points into a mapped cache file any more. */
+    scene_file_close(tree->file);
+    tree->file = NULL;
+    return 1;
+}
+
+int bvh_refit(bvh *tree, const scene *s) {
+    return bvh_refit_with_pool(tree, s, NULL);
+}
+
+int bvh_refit_with_pool(bvh *tree, const scene *s, thread_pool *pool) {
+    if (tree && tree->blas && s) return bvh_refit_two_level(tree, s, pool);
+    if (!tree || !tree->nodes || !s || s->instance_count > 0 || !topology_matches(tree, s) || !own_storage(tree, s)) return 0;
+    tree->scene_ref = s;
+
+    /* Split the tree into a breadth-first top section and independent subtrees below it. */
+    size_t target = pool ? (size_t)thread_pool_worker_count(pool) * 4 : 1;
+    size_t capacity = 2 * target + 2;
+    int *queue = (int*)malloc(capacity * sizeof(int));
+    int *roots = (int*)malloc(capacity * sizeof(int));
+    if (!pool || !queue || !roots) {
+        free(queue);
+        free(roots);
+        refit_node(tree, s, 0);
+    } else {
+        size_t head = 0, tail = 0, root_count = 0;
+        queue[tail++] = 0;
+        while (head < tail) {
+            int index = queue[head];
+            const bvh_node *node = &tree->nodes[index];
+            if (node->left < 0 || root_count + (tail - head) >= target) {
+                roots[root_count++] = index;
+                ++head;
+                continue;
+            }
+            queue[head++] = -1 - index;
+            queue[tail++] = node->left;
+            queue[tail++] = node->right;
+        }
+
+        refit_ctx ctx = {tree, s, roots};
+        thread_pool_parallel_for(pool, root_count, 1, refit_chunk, &ctx);
+
+        for (size_t i = tail; i-- > 0;) {
+            if (queue[i] >= 0) continue;
+            bvh_node *node = &tree->nodes[-1 - queue[i]];
+            node->box = tree->nodes[node->left].box;
+            aabb_merge(&node->box, &tree->nodes[node->right].box);
+        }
+        free(queue);
+        free(roots);
+    }
+
+    if (tree->width > 2 && !bvh_build_wide(tree, tree->width)) return 0;
+    if (tree->triangle_block_width && !bvh_build_triangle_blocks(tree, tree->triangle_block_width)) return 0;
+
+    double build_ms = tree->stats.build_ms;
+    uint32_t threads = tree->stats.thread_count;
+    bvh_compute_stats(tree, &tree->stats);
+    tree->stats.build_ms = build_ms;
+    tree->stats.thread_count = threads;
+    return 1;
+}
+
+bvh_update_result bvh_update(bvh *tree, const scene *s, const bvh_build_options *opts, float max_sah_growth) {
+    if (tree->blas && s->instance_count > 0 && tree->blas_count == s->mesh_count) {
+        return bvh_update_two_level(tree, s, opts, max_sah_growth);
+    }
+    if (bvh_refit_with_pool(tree, s, opts->pool) && tree->stats.sah_cost <= tree->build_sah_cost * max_sah_growth) {
+        return BVH_UPDATE_REFIT;
+    }
+    bvh_destroy(tree);
+    return bvh_build_with_options(tree, s, opts) ? BVH_UPDATE_REBUILT : BVH_UPDATE_FAILED;
+}
+
+void bvh_intersect_leaf(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit) {
+    if (tree->instances) {
+        bvh_intersect_instances(tree, r, start, count, tmin, hit);
+        return;
+    }
+    PROFILE_COUNT(PROFILE_TRIANGLE_TESTS, count);
+    if (tree->triangle_block_width) {
+        bvh_intersect_leaf_blocks(tree, r, start, count, tmin, hit);
+        return;
+    }
+    const scene *s = tree->scene_ref;
+    for (size_t i = start; i < start + count; ++i) {
+        size_t prim = tree->triangle_indices[i];
+        uint32_t m = tree->triangle_mesh[prim];
         const mesh *me = &s->meshes[m];
-        for (size_t t = 0; t < me->triangle_count; ++t, ++global_idx) {
-            (void)global_idx;
-            triangle tri = me->triangles[t];
-            vec3 v0 = me->vertices[tri.i0].position;
-            vec3 v1 = me->vertices[tri.i1].position;
-            vec3 v2 = me->vertices[tri.i2].position;
-            float tt, uu, vv;
-            if (intersect_triangle(r, v0, v1, v2, &tt, &uu, &vv) && tt < best_t && tt > tmin) {
-                best_t = tt;
-                if (out_mesh) *out_mesh = m;
-                if (out_tri) *out_tri = t;
-                if (out_t) *out_t = tt;
-                if (out_u) *out_u = uu;
-                if (out_v) *out_v = vv;
-                if (out_normal) {
-                    vec3 n0 = me->vertices[tri.i0].normal;
-                    vec3 n1 = me->vertices[tri.i1].normal;
-                    vec3 n2 = me->vertices[tri.i2].normal;
-                    float w = 1.0f - uu - vv;
-                    *out_normal = vec3_norm(vec3_add(vec3_add(vec3_mul(n0, w), vec3_mul(n1, uu)), vec3_mul(n2, vv)));
-                }
-                hit = 1;
+        triangle tri = mesh_triangle(me, prim - tree->mesh_first_triangle[m]);
+        vec3 v0 = mesh_position(me, tri.i0);
+        vec3 v1 = mesh_position(me, tri.i1);
+        vec3 v2 = mesh_position(me, tri.i2);
+        float tt, uu, vv;
+        if (intersect_triangle(r, v0, v1, v2, &tt, &uu, &vv) && tt < hit->t && tt > tmin) {
+            hit->t = tt;
+            hit->u = uu;
+            hit->v = vv;
+            hit->prim = prim;
+        }
+    }
+}
+
+int bvh_occluded_leaf(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax) {
+    if (tree->instances) return bvh_occluded_instances(tree, r, start, count, tmin, tmax);
+    PROFILE_COUNT(PROFILE_TRIANGLE_TESTS, count);
+    if (tree->triangle_block_width) return bvh_occluded_leaf_blocks(tree, r, start, count, tmin, tmax);
+    const scene *s = tree->scene_ref;
+    for (size_t i = start; i < start + count; ++i) {
+        size_t prim = tree->triangle_indices[i];
+        uint32_t m = tree->triangle_mesh[prim];
+        const mesh *me = &s->meshes[m];
+        triangle tri = mesh_triangle(me, prim - tree->mesh_first_triangle[m]);
+        float tt, uu, vv;
+        if (intersect_triangle(r, mesh_position(me, tri.i0), mesh_position(me, tri.i1),
+                               mesh_position(me, tri.i2), &tt, &uu, &vv) && tt < tmax && tt > tmin) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void trace_binary(const bvh *tree, ray r, float tmin, bvh_hit_record *hit) {
+    int stack[2 * BVH_MAX_DEPTH];
+    int sp = 0;
+    float tnear;
+    if (!intersect_aabb(r, tree->nodes[0].box, tmin, hit->t, &tnear)) return;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const bvh_node *node = &tree->nodes[stack[--sp]];
+        PROFILE_COUNT(PROFILE_NODE_VISITS, 1);
+
+        if (node->left < 0) {
+            bvh_intersect_leaf(tree, r, node->start, node->count, tmin, hit);
+            continue;
+        }
+
+        float tl, tr;
+        int hit_l = intersect_aabb(r, tree->nodes[node->left].box, tmin, hit->t, &tl);
+        int hit_r = intersect_aabb(r, tree->nodes[node->right].box, tmin, hit->t, &tr);
+        if (hit_l && hit_r) {
+            /* Push the farther child first so the nearer one is popped next. */
+            if (tl <= tr) {
+                stack[sp++] = node->right;
+                stack[sp++] = node->left;
+            } else {
+                stack[sp++] = node->left;
+                stack[sp++] = node->right;
             }
+        } else if (hit_l) {
+            stack[sp++] = node->left;
+        } else if (hit_r) {
+            stack[sp++] = node->right;
+        }
+    }
+}
+
+void bvh_closest_hit(const bvh *tree, ray r, float tmin, bvh_hit_record *hit) {
+    if (tree->width > 2) {
+        bvh_wide_closest_hit(tree, r, tmin, hit);
+    } else {
+        trace_binary(tree, r, tmin, hit);
+    }
+}
+
+int bvh_trace_closest_hit(const bvh *tree, ray r, float tmin, float tmax, bvh_ray_hit *out) {
+    memset(out, 0, sizeof(*out));
+    if (!tree || !tree->nodes || !tree->scene_ref) return 0;
+
+    bvh_hit_record hit = {tmax, 0.0f, 0.0f, BVH_NO_PRIM, 0};
+    bvh_closest_hit(tree, r, tmin, &hit);
+    PROFILE_COUNT(PROFILE_RAYS, 1);
+    if (hit.prim == BVH_NO_PRIM) return 0;
+    PROFILE_COUNT(PROFILE_HITS, 1);
+
+    bvh_hit_location(tree, &hit, &out->mesh, &out->tri);
+    out->t = hit.t;
+    out->u = hit.u;
+    out->v = hit.v;
+    out->instance = hit.instance;
+    out->hit = 1;
+    return 1;
+}
+
+int bvh_trace_first_hit(const bvh *tree, ray r, float tmin, float tmax, size_t *out_mesh, size_t *out_tri, float *out_t, vec3 *out_normal, float *out_u, float *out_v) {
+    bvh_ray_hit hit;
+    if (!bvh_trace_closest_hit(tree, r, tmin, tmax, &hit)) return 0;
+    if (out_mesh) *out_mesh = hit.mesh;
+    if (out_tri) *out_tri = hit.tri;
+    if (out_t) *out_t = hit.t;
+    if (out_u) *out_u = hit.u;
+    if (out_v) *out_v = hit.v;
+    if (out_normal) *out_normal = bvh_hit_normal(tree, &hit);
+    return 1;
+}
+
+vec3 bvh_hit_normal(const bvh *tree, const bvh_ray_hit *hit) {
+    const mesh *me = &tree->scene_ref->meshes[hit->mesh];
+    triangle tri = mesh_triangle(me, hit->tri);
+    vec3 n0 = mesh_normal(me, tri.i0);
+    vec3 n1 = mesh_normal(me, tri.i1);
+    vec3 n2 = mesh_normal(me, tri.i2);
+    float w = 1.0f - hit->u - hit->v;
+    vec3 n = vec3_add(vec3_add(vec3_mul(n0, w), vec3_mul(n1, hit->u)), vec3_mul(n2, hit->v));
+    if (tree->instances) n = transform3x4_normal(&tree->instances[hit->instance].world_to_object, n);
+    return vec3_norm(n);
+}
+
+vec3 bvh_hit_to_world(const bvh *tree, const bvh_ray_hit *hit, vec3 v) {
+    return tree->instances ? transform3x4_vector(&tree->instances[hit->instance].object_to_world, v) : v;
+}
+
+static int occluded_binary(const bvh *tree, ray r, float tmin, float tmax) {
+    int stack[2 * BVH_MAX_DEPTH];
+    int sp = 0;
+    if (!intersect_aabb(r, tree->nodes[0].box, tmin, tmax, NULL)) return 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const bvh_node *node = &tree->nodes[stack[--sp]];
+        PROFILE_COUNT(PROFILE_NODE_VISITS, 1);
+        if (node->left < 0) {
+            if (bvh_occluded_leaf(tree, r, node->start, node->count, tmin, tmax)) return 1;
+            continue;
         }
+        if (intersect_aabb(r, tree->nodes[node->right].box, tmin, tmax, NULL)) stack[sp++] = node->right;
+        if (intersect_aabb(r, tree->nodes[node->left].box, tmin, tmax, NULL)) stack[sp++] = node->left;
     }
+    return 0;
+}
 
-    return hit;
+int bvh_any_hit(const bvh *tree, ray r, float tmin, float tmax) {
+    return tree->width > 2 ? bvh_wide_occluded(tree, r, tmin, tmax) : occluded_binary(tree, r, tmin, tmax);
+}
+
+int bvh_trace_occluded(const bvh *tree, ray r, float tmin, float tmax) {
+    if (!tree || !tree->nodes || !tree->scene_ref) return 0;
+    int occluded = bvh_any_hit(tree, r, tmin, tmax);
+    PROFILE_COUNT(PROFILE_RAYS, 1);
+    PROFILE_COUNT(PROFILE_HITS, occluded);
+    return occluded;
 }
@@ -0,0 +1,165 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "bvh_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Elements gathered per hash block; fixed so the key does not depend on the mesh layout. */
+#define BVH_CACHE_CHUNK 1024
+
+#define HASH_P1 0x9e3779b185ebca87ull
+#define HASH_P2 0xc2b2ae3d27d4eb4full
+#define HASH_P3 0x165667b19e3779f9ull
+#define HASH_P4 0x85ebca77c2b2ae63ull
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return x << r | x >> (64 - r);
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t word) {
+    return rotl64(acc + word * HASH_P2, 31) * HASH_P1;
+}
+
+/* xxHash64-style: four independent lanes over 32-byte stripes, then the tail and an avalanche. Blocks
+ * chain through the seed. */
+static uint64_t hash_bytes(uint64_t seed, const void *data, size_t bytes) {
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t lanes[4] = {seed + HASH_P1 + HASH_P2, seed + HASH_P2, seed, seed - HASH_P1};
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        for (int l = 0; l < 4; ++l) {
+            uint64_t word;
+            memcpy(&word, p + i + 8 * l, sizeof(word));
+            lanes[l] = hash_round(lanes[l], word);
+        }
+    }
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) + bytes;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        h = rotl64(h ^ hash_round(0, word), 27) * HASH_P1 + HASH_P4;
+    }
+    for (; i < bytes; ++i) h = rotl64(h ^ (p[i] * HASH_P3), 11) * HASH_P1;
+    h ^= h >> 33;
+    h *= HASH_P2;
+    h ^= h >> 29;
+    h *= HASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t bvh_cache_key(const scene *s, const bvh_build_options *opts) {
+    uint64_t params[8] = {SCENE_FILE_VERSION, (uint64_t)opts->builder, opts->max_leaf_size, opts->bin_count,
+                          opts->morton_bits, opts->treelet_size, opts->width, opts->triangle_block_width};
+    uint64_t h = hash_bytes(0, params, sizeof(params));
+    vec3 positions[BVH_CACHE_CHUNK];
+    uint32_t indices[3 * BVH_CACHE_CHUNK];
+    for (size_t m = 0; m < s->mesh_count; ++m) {
+        const mesh *me = &s->meshes[m];
+        uint64_t counts[2] = {me->vertex_count, me->triangle_count};
+        h = hash_bytes(h, counts, sizeof(counts));
+        for (size_t first = 0; first < me->vertex_count; first += BVH_CACHE_CHUNK) {
+            size_t n = me->vertex_count - first < BVH_CACHE_CHUNK ? me->vertex_count - first : BVH_CACHE_CHUNK;
+            for (size_t i = 0; i < n; ++i) positions[i] = mesh_position(me, (uint32_t)(first + i));
+            h = hash_bytes(h, positions, n * sizeof(vec3));
+        }
+        /* Material indices do not shape the tree, so they stay out of the key. */
+        for (size_t first = 0; first < me->triangle_count; first += BVH_CACHE_CHUNK) {
+            size_t n = me->triangle_count - first < BVH_CACHE_CHUNK ? me->triangle_count - first : BVH_CACHE_CHUNK;
+            for (size_t i = 0; i < n; ++i) {
+                triangle tri = mesh_triangle(me, first + i);
+                indices[3 * i] = tri.i0;
+                indices[3 * i + 1] = tri.i1;
+                indices[3 * i + 2] = tri.i2;
+            }
+            h = hash_bytes(h, indices, 3 * n * sizeof(uint32_t));
+        }
+    }
+    return h;
+}
+
+static void make_dir(const char *dir) {
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+}
+
+static unsigned long process_id(void) {
+#ifdef _WIN32
+    return (unsigned long)_getpid();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+/* Writes under a name unique to this process and call, then renames into place, so concurrent
+ * misses on one key never share a temporary file and readers only ever see whole entries. */
+static int store_entry(const char *dir, const char *path, const scene *s, const bvh *tree, uint64_t key) {
+    static volatile size_t sequence;
+    size_t part_bytes = strlen(path) + 64;
+    char *part = (char*)malloc(part_bytes);
+    if (!part) return 0;
+    snprintf(part, part_bytes, "%s.%lu.%zu.part", path, process_id(), thread_pool_atomic_add(&sequence, 1));
+    make_dir(dir);
+    int ok = scene_file_write_bvh(part, s, tree, key);
+    if (ok && rename(part, path) != 0) {
+        remove(part);
+        ok = 0;
+    }
+    free(part);
+    return ok;
+}
+
+int bvh_cache_build(const char *dir, bvh *tree, const scene *s, const bvh_build_options *opts, bvh_cache_info *info) {
+    bvh_cache_info local;
+    if (!info) info = &local;
+    memset(info, 0, sizeof(*info));
+    if (!tree || !s || !opts) return 0;
+    double start_ms = timer_now_ms();
+    /* Two-level trees are not stored; see scene_file_write_bvh. */
+    if (!dir || s->instance_count > 0) {
+        int ok = bvh_build_with_options(tree, s, opts);
+        info->load_ms = timer_now_ms() - start_ms;
+        return ok;
+    }
+
+    PROFILE_BEGIN(zone, "bvh_cache_lookup");
+    info->key = bvh_cache_key(s, opts);
+    size_t path_bytes = strlen(dir) + 24;
+    char *path = (char*)malloc(path_bytes);
+    if (path) snprintf(path, path_bytes, "%s/%016llx.bvh", dir, (unsigned long long)info->key);
+    double mapped_ms = timer_now_ms();
+    info->hash_ms = mapped_ms - start_ms;
+    info->hit = path && scene_file_load_bvh(path, s, info->key, tree);
+    PROFILE_END(zone);
+    if (info->hit) {
+        info->load_ms = timer_now_ms() - mapped_ms;
+        free(path);
+        return 1;
+    }
+
+    int ok = bvh_build_with_options(tree, s, opts);
+    info->load_ms = timer_now_ms() - mapped_ms;
+    if (ok && path) info->stored = store_entry(dir, path, s, tree, info->key);
+    free(path);
+    return ok;
+}
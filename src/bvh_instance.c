@@ -0,0 +1,176 @@
+#include "bvh.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh_internal.h"
+#include "timer.h"
+
+/* The one-mesh scene a bottom-level tree is built and refit against. */
+static scene mesh_view(const scene *s, size_t m) {
+    scene view;
+    memset(&view, 0, sizeof(view));
+    view.meshes = &s->meshes[m];
+    view.mesh_count = 1;
+    view.materials = s->materials;
+    view.material_count = s->material_count;
+    return view;
+}
+
+/* World bounds of an instance: the eight corners of its mesh's root box, transformed. */
+static aabb instance_bounds(const bvh_instance *inst, const bvh *blas) {
+    aabb local = blas->nodes[0].box;
+    aabb box = aabb_empty();
+    for (int corner = 0; corner < 8; ++corner) {
+        vec3 p = {(corner & 1) ? local.max.x : local.min.x,
+                  (corner & 2) ? local.max.y : local.min.y,
+                  (corner & 4) ? local.max.z : local.min.z};
+        aabb_include(&box, transform3x4_point(&inst->object_to_world, p));
+    }
+    return box;
+}
+
+/* (Re)builds the top level from the scene's current instances. Hidden instances, singular transforms
+ * and empty meshes are left out of the nodes, so traversal never meets them. */
+static int build_top_level(bvh *tree, const scene *s, thread_pool *pool) {
+    size_t n = s->instance_count;
+    bvh_instance *instances = (bvh_instance*)malloc((n ? n : 1) * sizeof(bvh_instance));
+    bvh_prim_ref *prims = (bvh_prim_ref*)malloc((n ? n : 1) * sizeof(bvh_prim_ref));
+    if (!instances || !prims) {
+        free(instances);
+        free(prims);
+        return 0;
+    }
+
+    size_t visible = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const mesh_instance *mi = &s->instances[i];
+        bvh_instance *inst = &instances[i];
+        if (mi->mesh_index >= tree->blas_count) {
+            free(instances);
+            free(prims);
+            return 0;
+        }
+        inst->object_to_world = mi->transform;
+        inst->mesh_index = mi->mesh_index;
+        inst->mask = mi->mask;
+        if (!transform3x4_invert(&mi->transform, &inst->world_to_object)) {
+            inst->world_to_object = transform3x4_identity();
+            inst->mask = 0;
+        }
+        const bvh *blas = &tree->blas[mi->mesh_index];
+        if (inst->mask == 0 || blas->triangle_count == 0) continue;
+        prims[visible].box = instance_bounds(inst, blas);
+        prims[visible].index = i;
+        visible++;
+    }
+
+    bvh_node *nodes = (bvh_node*)malloc((visible > 0 ? 2 * visible - 1 : 1) * sizeof(bvh_node));
+    size_t *indices = (size_t*)malloc((visible ? visible : 1) * sizeof(size_t));
+    if (!nodes || !indices) {
+        free(nodes);
+        free(indices);
+        free(instances);
+        free(prims);
+        return 0;
+    }
+    free(tree->nodes);
+    free(tree->triangle_indices);
+    free(tree->instances);
+    tree->nodes = nodes;
+    tree->triangle_indices = indices;
+    tree->instances = instances;
+    tree->instance_count = n;
+    tree->triangle_count = visible;
+
+    /* Every instance leaf costs a whole bottom-level traversal, so the top level splits down to
+     * single instances wherever the centroids allow. */
+    bvh_build_options top;
+    bvh_build_options_default(&top);
+    top.max_leaf_size = 1;
+    top.pool = pool;
+    bvh_build_sah(tree, prims, &top);
+    for (size_t i = 0; i < visible; ++i) tree->triangle_indices[i] = prims[i].index;
+    free(prims);
+
+    bvh_node *shrunk = (bvh_node*)realloc(tree->nodes, tree->node_count * sizeof(bvh_node));
+    if (shrunk) tree->nodes = shrunk;
+    return 1;
+}
+
+int bvh_build_two_level(bvh *tree, const scene *s, const bvh_build_options *opts) {
+    tree->blas = (bvh*)calloc(s->mesh_count ? s->mesh_count : 1, sizeof(bvh));
+    tree->blas_scenes = (scene*)calloc(s->mesh_count ? s->mesh_count : 1, sizeof(scene));
+    if (!tree->blas || !tree->blas_scenes) return 0;
+    tree->blas_count = s->mesh_count;
+    for (size_t m = 0; m < s->mesh_count; ++m) {
+        tree->blas_scenes[m] = mesh_view(s, m);
+        if (!bvh_build_with_options(&tree->blas[m], &tree->blas_scenes[m], opts)) return 0;
+    }
+    /* Instance leaves reuse the binary traversal; the width and triangle blocks apply per mesh. */
+    tree->width = 2;
+    return build_top_level(tree, s, opts->pool);
+}
+
+static int two_level_matches(const bvh *tree, const scene *s) {
+    return tree->blas && s->instance_count > 0 && tree->blas_count == s->mesh_count;
+}
+
+int bvh_update_instances(bvh *tree, const scene *s, thread_pool *pool) {
+    if (!tree || !s || !two_level_matches(tree, s)) return 0;
+    double start_ms = timer_now_ms();
+    tree->scene_ref = s;
+    for (size_t m = 0; m < tree->blas_count; ++m) tree->blas_scenes[m] = mesh_view(s, m);
+    if (!build_top_level(tree, s, pool)) return 0;
+
+    bvh_compute_stats(tree, &tree->stats);
+    tree->stats.thread_count = thread_pool_worker_count(pool);
+    tree->stats.build_ms = timer_now_ms() - start_ms;
+    tree->build_sah_cost = tree->stats.sah_cost;
+    return 1;
+}
+
+int bvh_refit_two_level(bvh *tree, const scene *s, thread_pool *pool) {
+    if (!two_level_matches(tree, s)) return 0;
+    for (size_t m = 0; m < tree->blas_count; ++m) {
+        tree->blas_scenes[m] = mesh_view(s, m);
+        if (!bvh_refit_with_pool(&tree->blas[m], &tree->blas_scenes[m], pool)) return 0;
+    }
+    return bvh_update_instances(tree, s, pool);
+}
+
+bvh_update_result bvh_update_two_level(bvh *tree, const scene *s, const bvh_build_options *opts, float max_sah_growth) {
+    bvh_update_result result = BVH_UPDATE_REFIT;
+    for (size_t m = 0; m < tree->blas_count; ++m) {
+        tree->blas_scenes[m] = mesh_view(s, m);
+        bvh_update_result r = bvh_update(&tree->blas[m], &tree->blas_scenes[m], opts, max_sah_growth);
+        if (r == BVH_UPDATE_FAILED) return BVH_UPDATE_FAILED;
+        if (r == BVH_UPDATE_REBUILT) result = BVH_UPDATE_REBUILT;
+    }
+    return bvh_update_instances(tree, s, opts->pool) ? result : BVH_UPDATE_FAILED;
+}
+
+/* The direction is not renormalized, so t measures the same point along the ray in both spaces and
+ * hits from different instances compare directly. */
+static ray to_object(const bvh_instance *inst, ray r) {
+    return (ray){transform3x4_point(&inst->world_to_object, r.origin),
+                 transform3x4_vector(&inst->world_to_object, r.direction)};
+}
+
+void bvh_intersect_instances(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit) {
+    for (size_t i = start; i < start + count; ++i) {
+        size_t index = tree->triangle_indices[i];
+        const bvh_instance *inst = &tree->instances[index];
+        float before = hit->t;
+        bvh_closest_hit(&tree->blas[inst->mesh_index], to_object(inst, r), tmin, hit);
+        if (hit->t < before) hit->instance = index;
+    }
+}
+
+int bvh_occluded_instances(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax) {
+    for (size_t i = start; i < start + count; ++i) {
+        const bvh_instance *inst = &tree->instances[tree->triangle_indices[i]];
+        if (bvh_any_hit(&tree->blas[inst->mesh_index], to_object(inst, r), tmin, tmax)) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#ifndef BVH_INTERNAL_H
+#define BVH_INTERNAL_H
+
+#include <float.h>
+
+#include "bvh.h"
+#include "profile.h"
+
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECT_COST 1.0f
+#define BVH_PARALLEL_GRAIN 16384
+/* Children at least this large become their own build task. */
+#define BVH_TASK_MIN 1024
+
+/* Primitives are moved by value during builds so builders stream through memory. */
+typedef struct {
+    aabb box;
+    size_t index;
+} bvh_prim_ref;
+
+static inline float bvh_min_f(float a, float b) { return a < b ? a : b; }
+static inline float bvh_max_f(float a, float b) { return a > b ? a : b; }
+
+static inline aabb aabb_empty(void) {
+    return (aabb){{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+}
+
+static inline void aabb_include(aabb *b, vec3 p) {
+    if (p.x < b->min.x) b->min.x = p.x;
+    if (p.y < b->min.y) b->min.y = p.y;
+    if (p.z < b->min.z) b->min.z = p.z;
+    if (p.x > b->max.x) b->max.x = p.x;
+    if (p.y > b->max.y) b->max.y = p.y;
+    if (p.z > b->max.z) b->max.z = p.z;
+}
+
+static inline void aabb_merge(aabb *b, const aabb *o) {
+    b->min.x = bvh_min_f(b->min.x, o->min.x);
+    b->min.y = bvh_min_f(b->min.y, o->min.y);
+    b->min.z = bvh_min_f(b->min.z, o->min.z);
+    b->max.x = bvh_max_f(b->max.x, o->max.x);
+    b->max.y = bvh_max_f(b->max.y, o->max.y);
+    b->max.z = bvh_max_f(b->max.z, o->max.z);
+}
+
+static inline vec3 aabb_center(const aabb *b) {
+    return vec3_mul(vec3_add(b->min, b->max), 0.5f);
+}
+
+static inline float aabb_area(const aabb *b) {
+    if (b->min.x > b->max.x) return 0.0f;
+    vec3 d = vec3_sub(b->max, b->min);
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline float vec3_axis(vec3 v, int axis) {
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static inline void bvh_make_leaf(bvh_node *node, size_t start, size_t count) {
+    node->left = -1;
+    node->right = -1;
+    node->start = start;
+    node->count = count;
+}
+
+#define BVH_NO_PRIM ((size_t)-1)
+
+#if defined(__AVX2__)
+#define BVH_SIMD_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SIMD_SSE 1
+#endif
+
+/* Closest-hit state shared by the traversal kernels; t starts at the ray's tmax. */
+typedef struct {
+    float t;
+    float u;
+    float v;
+    size_t prim;
+    /* Two-level trees only: the instance whose bottom-level tree produced prim. */
+    size_t instance;
+} bvh_hit_record;
+
+/* Mesh and mesh-local triangle of a hit record. Bottom-level trees hold a single mesh, so their
+ * prims are already triangles of the instanced mesh. */
+static inline void bvh_hit_location(const bvh *tree, const bvh_hit_record *hit, size_t *out_mesh, size_t *out_tri) {
+    if (tree->instances) {
+        *out_mesh = tree->instances[hit->instance].mesh_index;
+        *out_tri = hit->prim;
+        return;
+    }
+    size_t m = tree->triangle_mesh[hit->prim];
+    *out_mesh = m;
+    *out_tri = hit->prim - tree->mesh_first_triangle[m];
+}
+
+/* Builders write nodes into tree->nodes (capacity 2N-1) for N = tree->triangle_count prims and
+ * leave prims in leaf order. */
+int bvh_build_sah(bvh *tree, bvh_prim_ref *prims, const bvh_build_options *opts);
+int bvh_build_lbvh(bvh *tree, bvh_prim_ref *prims, const bvh_build_options *opts);
+/* Builds blas, instances and the top level into a zeroed tree; the caller destroys it on failure. */
+int bvh_build_two_level(bvh *tree, const scene *s, const bvh_build_options *opts);
+int bvh_refit_two_level(bvh *tree, const scene *s, thread_pool *pool);
+bvh_update_result bvh_update_two_level(bvh *tree, const scene *s, const bvh_build_options *opts, float max_sah_growth);
+void bvh_optimize_treelets(bvh *tree, uint32_t treelet_size);
+/* Collapses the binary tree into tree->nodes4 / tree->nodes8. */
+int bvh_build_wide(bvh *tree, uint32_t width);
+/* (Re)packs leaf triangles into tree->tris4 / tree->tris8; any other width frees them. */
+int bvh_build_triangle_blocks(bvh *tree, uint32_t width);
+
+/* Whole-tree kernels for one ray, dispatched on the node width. */
+void bvh_closest_hit(const bvh *tree, ray r, float tmin, bvh_hit_record *hit);
+int bvh_any_hit(const bvh *tree, ray r, float tmin, float tmax);
+
+void bvh_intersect_leaf(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit);
+/* Top-level leaves: each instance traces its mesh's tree with the ray in object space. */
+void bvh_intersect_instances(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit);
+int bvh_occluded_instances(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax);
+void bvh_intersect_leaf_blocks(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit);
+void bvh_wide_closest_hit(const bvh *tree, ray r, float tmin, bvh_hit_record *hit);
+/* Any-hit variants: return 1 on the first triangle hit in (tmin, tmax). */
+int bvh_occluded_leaf(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax);
+int bvh_occluded_leaf_blocks(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax);
+int bvh_wide_occluded(const bvh *tree, ray r, float tmin, float tmax);
+
+#endif
@@ -0,0 +1,444 @@
+#include "bvh.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh_internal.h"
+
+#define LBVH_RADIX_BITS 8
+#define LBVH_RADIX_BUCKETS (1u << LBVH_RADIX_BITS)
+#define TREELET_MAX_LEAVES 7
+
+typedef struct {
+    uint64_t code;
+    size_t prim;
+} morton_key;
+
+typedef struct {
+    bvh_node *nodes;
+    const morton_key *keys;
+    volatile size_t node_count;
+    size_t max_leaf_size;
+    thread_pool *pool;
+    thread_pool_group group;
+} lbvh_builder;
+
+typedef struct {
+    lbvh_builder *b;
+    size_t node_index;
+    size_t start;
+    size_t count;
+    int depth;
+} lbvh_task;
+
+static uint64_t expand_bits_10(uint64_t v) {
+    uint64_t x = v & 0x3ffu;
+    x = (x | (x << 16)) & 0x030000ffu;
+    x = (x | (x << 8)) & 0x0300f00fu;
+    x = (x | (x << 4)) & 0x030c30c3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+static uint64_t expand_bits_21(uint64_t v) {
+    uint64_t x = v & 0x1fffffu;
+    x = (x | (x << 32)) & 0x001f00000000ffffull;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+    x = (x | (x << 8)) & 0x100f00f00f00f00full;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+static int highest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(x);
+#else
+    int bit = 0;
+    while (x >>= 1) ++bit;
+    return bit;
+#endif
+}
+
+typedef struct {
+    const bvh_prim_ref *prims;
+    aabb *centroid_boxes;
+} centroid_bounds_ctx;
+
+static void centroid_bounds_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    centroid_bounds_ctx *c = (centroid_bounds_ctx*)ctx;
+    aabb box = aabb_empty();
+    for (size_t i = begin; i < end; ++i) aabb_include(&box, aabb_center(&c->prims[i].box));
+    c->centroid_boxes[chunk] = box;
+}
+
+typedef struct {
+    const bvh_prim_ref *prims;
+    morton_key *keys;
+    vec3 origin;
+    vec3 scale;
+    int wide;
+} morton_ctx;
+
+static void morton_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    morton_ctx *c = (morton_ctx*)ctx;
+    float grid_max = c->wide ? 2097151.0f : 1023.0f;
+    for (size_t i = begin; i < end; ++i) {
+        vec3 p = vec3_sub(aabb_center(&c->prims[i].box), c->origin);
+        float q[3] = {p.x * c->scale.x, p.y * c->scale.y, p.z * c->scale.z};
+        uint64_t g[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            float v = q[axis] < 0.0f ? 0.0f : q[axis] > grid_max ? grid_max : q[axis];
+            g[axis] = (uint64_t)v;
+        }
+        c->keys[i].code = c->wide
+            ? (expand_bits_21(g[0]) << 2) | (expand_bits_21(g[1]) << 1) | expand_bits_21(g[2])
+            : (expand_bits_10(g[0]) << 2) | (expand_bits_10(g[1]) << 1) | expand_bits_10(g[2]);
+        c->keys[i].prim = i;
+    }
+}
+
+typedef struct {
+    const morton_key *src;
+    morton_key *dst;
+    size_t *offsets;
+    uint32_t shift;
+} radix_ctx;
+
+static void radix_histogram_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    radix_ctx *c = (radix_ctx*)ctx;
+    size_t *hist = c->offsets + chunk * LBVH_RADIX_BUCKETS;
+    memset(hist, 0, LBVH_RADIX_BUCKETS * sizeof(size_t));
+    for (size_t i = begin; i < end; ++i) hist[(c->src[i].code >> c->shift) & (LBVH_RADIX_BUCKETS - 1)]++;
+}
+
+static void radix_scatter_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+    radix_ctx *c = (radix_ctx*)ctx;
+    size_t *offsets = c->offsets + chunk * LBVH_RADIX_BUCKETS;
+    for (size_t i = begin; i < end; ++i) {
+        c->dst[offsets[(c->src[i].code >> c->shift) & (LBVH_RADIX_BUCKETS - 1)]++] = c->src[i];
+    }
+}
+
+/* Stable LSD radix sort; the sorted keys end up in *keys. */
+static int radix_sort(thread_pool *pool, morton_key **keys, size_t count, uint32_t key_bits) {
+    size_t chunks = thread_pool_chunk_count(pool, count, BVH_PARALLEL_GRAIN);
+    if (chunks == 0) return 1;
+    morton_key *tmp = (morton_key*)malloc(count * sizeof(morton_key));
+    size_t *offsets = (size_t*)malloc(chunks * LBVH_RADIX_BUCKETS * sizeof(size_t));
+    if (!tmp || !offsets) {
+        free(tmp);
+        free(offsets);
+        return 0;
+    }
+
+    radix_ctx ctx = {*keys, tmp, offsets, 0};
+    for (uint32_t shift = 0; shift < key_bits; shift += LBVH_RADIX_BITS) {
+        ctx.shift = shift;
+        thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, radix_histogram_chunk, &ctx);
+
+        size_t sum = 0;
+        int trivial = 0;
+        for (uint32_t d = 0; d < LBVH_RADIX_BUCKETS; ++d) {
+            size_t digit_total = 0;
+            for (size_t c = 0; c < chunks; ++c) {
+                size_t n = offsets[c * LBVH_RADIX_BUCKETS + d];
+                offsets[c * LBVH_RADIX_BUCKETS + d] = sum;
+                sum += n;
+                digit_total += n;
+            }
+            if (digit_total == count) trivial = 1;
+        }
+        if (trivial) continue;
+
+        thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, radix_scatter_chunk, &ctx);
+        morton_key *swap = (morton_key*)ctx.src;
+        ctx.src = ctx.dst;
+        ctx.dst = swap;
+    }
+
+    if (ctx.src != *keys) {
+        free(*keys);
+        *keys = (morton_key*)ctx.src;
+    } else {
+        free(tmp);
+    }
+    free(offsets);
+    return 1;
+}
+
+static void emit_node(lbvh_builder *b, size_t node_index, size_t start, size_t count, int depth);
+
+static void run_emit_task(void *arg) {
+    lbvh_task task = *(lbvh_task*)arg;
+    free(arg);
+    emit_node(task.b, task.node_index, task.start, task.count, task.depth);
+}
+
+static void emit_node(lbvh_builder *b, size_t node_index, size_t start, size_t count, int depth) {
+    if (count <= b->max_leaf_size || depth >= BVH_MAX_DEPTH - 1) {
+        bvh_make_leaf(&b->nodes[node_index], start, count);
+        return;
+    }
+
+    uint64_t first = b->keys[start].code;
+    uint64_t last = b->keys[start + count - 1].code;
+    size_t mid;
+    if (first == last) {
+        mid = start + count / 2;
+    } else {
+        /* Split where the highest differing Morton bit flips from 0 to 1. */
+        uint64_t bit = 1ull << highest_bit(first ^ last);
+        size_t lo = start;
+        size_t hi = start + count - 1;
+        while (lo + 1 < hi) {
+            size_t probe = lo + (hi - lo) / 2;
+            if (b->keys[probe].code & bit) hi = probe;
+            else lo = probe;
+        }
+        mid = hi;
+    }
+
+    size_t left = thread_pool_atomic_add(&b->node_count, 2);
+    b->nodes[node_index].left = (int)left;
+    b->nodes[node_index].right = (int)(left + 1);
+    b->nodes[node_index].start = 0;
+    b->nodes[node_index].count = 0;
+
+    size_t left_count = mid - start;
+    if (b->pool && left_count >= BVH_TASK_MIN) {
+        lbvh_task *task = (lbvh_task*)malloc(sizeof(lbvh_task));
+        if (task) {
+            *task = (lbvh_task){b, left, start, left_count, depth + 1};
+            thread_pool_submit(b->pool, &b->group, run_emit_task, task);
+        } else {
+            emit_node(b, left, start, left_count, depth + 1);
+        }
+    } else {
+        emit_node(b, left, start, left_count, depth + 1);
+    }
+    emit_node(b, left + 1, mid, start + count - mid, depth + 1);
+}
+
+static aabb fit_node(bvh_node *nodes, const bvh_prim_ref *prims, int index) {
+    bvh_node *node = &nodes[index];
+    aabb box = aabb_empty();
+    if (node->left < 0) {
+        for (size_t i = node->start; i < node->start + node->count; ++i) aabb_merge(&box, &prims[i].box);
+    } else {
+        aabb l = fit_node(nodes, prims, node->left);
+        aabb r = fit_node(nodes, prims, node->right);
+        box = l;
+        aabb_merge(&box, &r);
+    }
+    node->box = box;
+    return box;
+}
+
+int bvh_build_lbvh(bvh *tree, bvh_prim_ref *prims, const bvh_build_options *opts) {
+    size_t count = tree->triangle_count;
+    thread_pool *pool = opts->pool;
+    int wide = opts->morton_bits > 30;
+
+    size_t chunks = thread_pool_chunk_count(pool, count, BVH_PARALLEL_GRAIN);
+    aabb *chunk_boxes = (aabb*)malloc((chunks > 0 ? chunks : 1) * sizeof(aabb));
+    morton_key *keys = (morton_key*)malloc((count > 0 ? count : 1) * sizeof(morton_key));
+    bvh_prim_ref *sorted = (bvh_prim_ref*)malloc((count > 0 ? count : 1) * sizeof(bvh_prim_ref));
+    if (!chunk_boxes || !keys || !sorted) {
+        free(chunk_boxes);
+        free(keys);
+        free(sorted);
+        return 0;
+    }
+
+    centroid_bounds_ctx bounds_ctx = {prims, chunk_boxes};
+    thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, centroid_bounds_chunk, &bounds_ctx);
+    aabb centroid_box = aabb_empty();
+    for (size_t c = 0; c < chunks; ++c) aabb_merge(&centroid_box, &chunk_boxes[c]);
+    free(chunk_boxes);
+
+    float grid = wide ? 2097152.0f : 1024.0f;
+    vec3 extent = count > 0 ? vec3_sub(centroid_box.max, centroid_box.min) : (vec3){0.0f, 0.0f, 0.0f};
+    morton_ctx code_ctx = {
+        prims, keys, centroid_box.min,
+        {extent.x > 0.0f ? grid / extent.x : 0.0f,
+         extent.y > 0.0f ? grid / extent.y : 0.0f,
+         extent.z > 0.0f ? grid / extent.z : 0.0f},
+        wide
+    };
+    thread_pool_parallel_for(pool, count, BVH_PARALLEL_GRAIN, morton_chunk, &code_ctx);
+
+    if (!radix_sort(pool, &keys, count, wide ? 63u : 30u)) {
+        free(keys);
+        free(sorted);
+        return 0;
+    }
+    for (size_t i = 0; i < count; ++i) sorted[i] = prims[keys[i].prim];
+    memcpy(prims, sorted, count * sizeof(bvh_prim_ref));
+    free(sorted);
+
+    lbvh_builder b = {
+        .nodes = tree->nodes,
+        .keys = keys,
+        .node_count = 1,
+        .max_leaf_size = opts->max_leaf_size > 0 ? opts->max_leaf_size : 1,
+        .pool = pool
+    };
+    emit_node(&b, 0, 0, count, 0);
+    thread_pool_wait(pool, &b.group);
+    tree->node_count = b.node_count;
+    free(keys);
+
+    fit_node(tree->nodes, prims, 0);
+    return 1;
+}
+
+typedef struct {
+    bvh_node *nodes;
+    float *cost;
+    int *height;
+    uint32_t treelet_size;
+} treelet_ctx;
+
+typedef struct {
+    int leaves[TREELET_MAX_LEAVES];
+    int leaf_depth[TREELET_MAX_LEAVES];
+    int internals[TREELET_MAX_LEAVES - 1];
+    int next_internal;
+    aabb box[1u << TREELET_MAX_LEAVES];
+    float cost[1u << TREELET_MAX_LEAVES];
+    uint32_t split[1u << TREELET_MAX_LEAVES];
+} treelet;
+
+static int restructure(treelet_ctx *ctx, treelet *t, uint32_t set, int node_index) {
+    if ((set & (set - 1)) == 0) return t->leaves[highest_bit(set)];
+    if (node_index < 0) node_index = t->internals[t->next_internal++];
+    bvh_node *node = &ctx->nodes[node_index];
+    int left = restructure(ctx, t, t->split[set], -1);
+    int right = restructure(ctx, t, set & ~t->split[set], -1);
+    node->left = left;
+    node->right = right;
+    node->start = 0;
+    node->count = 0;
+    node->box = t->box[set];
+    ctx->cost[node_index] = t->cost[set];
+    ctx->height[node_index] = 1 + (ctx->height[left] > ctx->height[right] ? ctx->height[left] : ctx->height[right]);
+    return node_index;
+}
+
+/* Deepest level reached below the treelet root if `set` is rooted at `depth`. */
+static int restructured_height(const treelet_ctx *ctx, const treelet *t, uint32_t set, int depth) {
+    if ((set & (set - 1)) == 0) return depth + ctx->height[t->leaves[highest_bit(set)]];
+    int l = restructured_height(ctx, t, t->split[set], depth + 1);
+    int r = restructured_height(ctx, t, set & ~t->split[set], depth + 1);
+    return l > r ? l : r;
+}
+
+static void optimize_treelet(treelet_ctx *ctx, int root) {
+    bvh_node *nodes = ctx->nodes;
+    treelet t;
+    int leaf_count = 2;
+    int internal_count = 1;
+    t.internals[0] = root;
+    t.leaves[0] = nodes[root].left;
+    t.leaves[1] = nodes[root].right;
+    t.leaf_depth[0] = 1;
+    t.leaf_depth[1] = 1;
+
+    /* Grow the treelet by opening the largest internal leaf, as in Karras and Aila. */
+    while ((uint32_t)leaf_count < ctx->treelet_size) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < leaf_count; ++i) {
+            const bvh_node *n = &nodes[t.leaves[i]];
+            float area = aabb_area(&n->box);
+            if (n->left >= 0 && area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int opened = t.leaves[best];
+        t.internals[internal_count++] = opened;
+        t.leaves[best] = nodes[opened].left;
+        t.leaf_depth[leaf_count] = ++t.leaf_depth[best];
+        t.leaves[leaf_count++] = nodes[opened].right;
+    }
+    if (leaf_count < 3) return;
+
+    uint32_t full = (1u << leaf_count) - 1;
+    for (uint32_t set = 1; set <= full; ++set) {
+        if ((set & (set - 1)) == 0) {
+            int leaf = t.leaves[highest_bit(set)];
+            t.box[set] = nodes[leaf].box;
+            t.cost[set] = ctx->cost[leaf];
+            continue;
+        }
+        uint32_t low = set & (~set + 1);
+        t.box[set] = t.box[low];
+        aabb_merge(&t.box[set], &t.box[set & ~low]);
+
+        /* Enumerate each bipartition once by keeping the lowest leaf on the left. */
+        float best = FLT_MAX;
+        uint32_t best_split = low;
+        uint32_t rest = set & ~low;
+        for (uint32_t sub = rest; ; sub = (sub - 1) & rest) {
+            uint32_t left = sub | low;
+            if (left != set) {
+                float c = t.cost[left] + t.cost[set & ~left];
+                if (c < best) {
+                    best = c;
+                    best_split = left;
+                }
+            }
+            if (sub == 0) break;
+        }
+        t.cost[set] = BVH_TRAVERSAL_COST * aabb_area(&t.box[set]) + best;
+        t.split[set] = best_split;
+    }
+
+    if (t.cost[full] >= ctx->cost[root] * (1.0f - 1e-5f)) return;
+
+    /* Never deepen the tree: traversal and stats rely on the BVH_MAX_DEPTH bound. */
+    int old_height = 0;
+    for (int i = 0; i < leaf_count; ++i) {
+        int h = t.leaf_depth[i] + ctx->height[t.leaves[i]];
+        if (h > old_height) old_height = h;
+    }
+    if (restructured_height(ctx, &t, full, 0) > old_height) return;
+
+    t.next_internal = 1;
+    restructure(ctx, &t, full, root);
+}
+
+static void optimize_subtree(treelet_ctx *ctx, int index) {
+    bvh_node *node = &ctx->nodes[index];
+    if (node->left < 0) {
+        ctx->cost[index] = BVH_INTERSECT_COST * aabb_area(&node->box) * (float)node->count;
+        ctx->height[index] = 0;
+        return;
+    }
+    optimize_subtree(ctx, node->left);
+    optimize_subtree(ctx, node->right);
+    ctx->cost[index] = BVH_TRAVERSAL_COST * aabb_area(&node->box) + ctx->cost[node->left] + ctx->cost[node->right];
+    int hl = ctx->height[node->left];
+    int hr = ctx->height[node->right];
+    ctx->height[index] = 1 + (hl > hr ? hl : hr);
+    optimize_treelet(ctx, index);
+}
+
+void bvh_optimize_treelets(bvh *tree, uint32_t treelet_size) {
+    if (!tree->nodes || tree->node_count < 3) return;
+    if (treelet_size < 3) treelet_size = 3;
+    if (treelet_size > TREELET_MAX_LEAVES) treelet_size = TREELET_MAX_LEAVES;
+
+    float *cost = (float*)malloc(tree->node_count * sizeof(float));
+    int *height = (int*)malloc(tree->node_count * sizeof(int));
+    if (cost && height) {
+        treelet_ctx ctx = {tree->nodes, cost, height, treelet_size};
+        optimize_subtree(&ctx, 0);
+    }
+    free(cost);
+    free(height);
+}
@@ -0,0 +1,289 @@
+#include "bvh.h"
+
+#include <string.h>
+
+#include "bvh_internal.h"
+
+#ifdef BVH_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#define PACKET_STACK_SIZE (2 * BVH_MAX_DEPTH)
+
+/* Per-lane traversal state, padded to whole groups of 4 lanes; unused lanes are zero and masked. */
+typedef struct {
+    float org[3][BVH_PACKET_MAX];
+    float dir[3][BVH_PACKET_MAX];
+    float inv_dir[3][BVH_PACKET_MAX];
+    /* All bits set where the direction is negative, so the max plane is entered first. */
+    uint32_t neg[3][BVH_PACKET_MAX];
+    float tmin[BVH_PACKET_MAX];
+    uint32_t lanes;
+    uint32_t active;
+    bvh_hit_record hit[BVH_PACKET_MAX];
+    float t[BVH_PACKET_MAX];
+
+    /* Interval bounds over the whole packet, valid when every axis has one direction sign. */
+    int frustum;
+    int frustum_neg[3];
+    float org_lo[3], org_hi[3];
+    float inv_lo[3], inv_hi[3];
+    float tmin_lo;
+    /* Largest current closest-hit distance over the active lanes. */
+    float t_hi;
+} packet_state;
+
+typedef struct {
+    int node;
+    uint32_t mask;
+} packet_entry;
+
+static float min4(float a, float b, float c, float d) { return bvh_min_f(bvh_min_f(a, b), bvh_min_f(c, d)); }
+static float max4(float a, float b, float c, float d) { return bvh_max_f(bvh_max_f(a, b), bvh_max_f(c, d)); }
+
+static void setup_frustum(packet_state *p) {
+    p->frustum = 1;
+    p->tmin_lo = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis) {
+        int pos = 0, neg = 0;
+        p->org_lo[axis] = p->inv_lo[axis] = FLT_MAX;
+        p->org_hi[axis] = p->inv_hi[axis] = -FLT_MAX;
+        for (uint32_t i = 0; i < p->lanes; ++i) {
+            if (!(p->active & (1u << i))) continue;
+            float inv = p->inv_dir[axis][i];
+            /* Axis-parallel lanes have infinite inverses that break interval products. */
+            if (!(inv > -FLT_MAX && inv < FLT_MAX)) {
+                p->frustum = 0;
+                return;
+            }
+            if (inv < 0.0f) neg = 1;
+            else pos = 1;
+            p->org_lo[axis] = bvh_min_f(p->org_lo[axis], p->org[axis][i]);
+            p->org_hi[axis] = bvh_max_f(p->org_hi[axis], p->org[axis][i]);
+            p->inv_lo[axis] = bvh_min_f(p->inv_lo[axis], inv);
+            p->inv_hi[axis] = bvh_max_f(p->inv_hi[axis], inv);
+            if (axis == 0) p->tmin_lo = bvh_min_f(p->tmin_lo, p->tmin[i]);
+        }
+        if (pos && neg) {
+            p->frustum = 0;
+            return;
+        }
+        p->frustum_neg[axis] = neg;
+    }
+}
+
+static void update_t_hi(packet_state *p) {
+    float t_hi = -FLT_MAX;
+    for (uint32_t i = 0; i < p->lanes; ++i) {
+        if (p->active & (1u << i)) t_hi = bvh_max_f(t_hi, p->hit[i].t);
+    }
+    p->t_hi = t_hi;
+}
+
+/* Interval-arithmetic slab test of the packet's bounding frustum. Rounding is monotonic, so
+ * every lane's slab distances lie inside the corner products and a miss here misses all lanes. */
+static int frustum_misses(const packet_state *p, const aabb *b) {
+    float lo[3] = {b->min.x, b->min.y, b->min.z};
+    float hi[3] = {b->max.x, b->max.y, b->max.z};
+    float t_enter = p->tmin_lo;
+    float t_exit = p->t_hi;
+    for (int axis = 0; axis < 3; ++axis) {
+        float near_plane = p->frustum_neg[axis] ? hi[axis] : lo[axis];
+        float far_plane = p->frustum_neg[axis] ? lo[axis] : hi[axis];
+        float n0 = near_plane - p->org_hi[axis], n1 = near_plane - p->org_lo[axis];
+        float f0 = far_plane - p->org_hi[axis], f1 = far_plane - p->org_lo[axis];
+        float i0 = p->inv_lo[axis], i1 = p->inv_hi[axis];
+        t_enter = bvh_max_f(t_enter, min4(n0 * i0, n0 * i1, n1 * i0, n1 * i1));
+        t_exit = bvh_min_f(t_exit, max4(f0 * i0, f0 * i1, f1 * i0, f1 * i1));
+    }
+    return t_exit < t_enter;
+}
+
+/* Slab test of one box against the lanes in mask, up to each lane's closest hit. Returns the
+ * lanes that hit and the smallest entry distance among them. Matches intersect_aabb per lane. */
+static uint32_t packet_box(const packet_state *p, const aabb *b, uint32_t mask, float *out_tnear) {
+    float lo[3] = {b->min.x, b->min.y, b->min.z};
+    float hi[3] = {b->max.x, b->max.y, b->max.z};
+    float tnear[BVH_PACKET_MAX];
+    uint32_t result = 0;
+    for (uint32_t g = 0; g < p->lanes; g += 4) {
+        uint32_t group = (mask >> g) & 0xfu;
+        if (!group) continue;
+#ifdef BVH_SIMD_SSE
+        __m128 t_enter = _mm_loadu_ps(p->tmin + g);
+        __m128 t_exit = _mm_loadu_ps(p->t + g);
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 o = _mm_loadu_ps(p->org[axis] + g);
+            __m128 inv = _mm_loadu_ps(p->inv_dir[axis] + g);
+            __m128 neg = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p->neg[axis] + g)));
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[axis]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[axis]), o), inv);
+            __m128 near_t = _mm_or_ps(_mm_and_ps(neg, t1), _mm_andnot_ps(neg, t0));
+            __m128 far_t = _mm_or_ps(_mm_and_ps(neg, t0), _mm_andnot_ps(neg, t1));
+            t_enter = _mm_max_ps(near_t, t_enter);
+            t_exit = _mm_min_ps(far_t, t_exit);
+        }
+        _mm_storeu_ps(tnear + g, t_enter);
+        result |= ((uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)) & group) << g;
+#else
+        for (uint32_t i = g; i < g + 4; ++i) {
+            if (!(mask & (1u << i))) continue;
+            float t_enter = p->tmin[i];
+            float t_exit = p->t[i];
+            for (int axis = 0; axis < 3; ++axis) {
+                float t0 = (lo[axis] - p->org[axis][i]) * p->inv_dir[axis][i];
+                float t1 = (hi[axis] - p->org[axis][i]) * p->inv_dir[axis][i];
+                float near_t = p->neg[axis][i] ? t1 : t0;
+                float far_t = p->neg[axis][i] ? t0 : t1;
+                if (near_t > t_enter) t_enter = near_t;
+                if (far_t < t_exit) t_exit = far_t;
+            }
+            tnear[i] = t_enter;
+            if (t_enter <= t_exit) result |= 1u << i;
+        }
+#endif
+    }
+
+    float best = FLT_MAX;
+    for (uint32_t m = result; m; m &= m - 1) {
+        uint32_t lane = 0;
+        while (!(m & (1u << lane))) ++lane;
+        best = bvh_min_f(best, tnear[lane]);
+    }
+    *out_tnear = best;
+    return result;
+}
+
+static uint32_t packet_node(const packet_state *p, const bvh_node *node, uint32_t mask, float *out_tnear) {
+    if (p->frustum && frustum_misses(p, &node->box)) return 0;
+    return packet_box(p, &node->box, mask, out_tnear);
+}
+
+/* Leaves run the single-ray kernels per lane, so each lane sees the same candidates and tests. */
+static void packet_leaf(packet_state *p, const bvh *tree, const bvh_node *node, uint32_t mask) {
+    for (uint32_t m = mask; m; m &= m - 1) {
+        uint32_t i = 0;
+        while (!(m & (1u << i))) ++i;
+        ray r = {{p->org[0][i], p->org[1][i], p->org[2][i]}, {p->dir[0][i], p->dir[1][i], p->dir[2][i]}};
+        bvh_intersect_leaf(tree, r, node->start, node->count, p->tmin[i], &p->hit[i]);
+        p->t[i] = p->hit[i].t;
+    }
+    update_t_hi(p);
+}
+
+uint32_t bvh_trace_packet(const bvh *tree, const bvh_ray_packet *packet, bvh_packet_hit *out) {
+    if (out) out->hit_mask = 0;
+    if (!tree || !tree->nodes || !tree->scene_ref || !packet || !out) return 0;
+
+    packet_state p;
+    memset(&p, 0, sizeof(p));
+    uint32_t size = packet->size < BVH_PACKET_MAX ? packet->size : BVH_PACKET_MAX;
+    p.lanes = (size + 3) & ~3u;
+    p.active = packet->active_mask & ((1u << size) - 1);
+    if (!p.active) return 0;
+
+    const float *dirs[3] = {packet->dir_x, packet->dir_y, packet->dir_z};
+    const float *orgs[3] = {packet->org_x, packet->org_y, packet->org_z};
+    for (uint32_t i = 0; i < size; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            p.org[axis][i] = orgs[axis][i];
+            p.dir[axis][i] = dirs[axis][i];
+            p.inv_dir[axis][i] = 1.0f / dirs[axis][i];
+            p.neg[axis][i] = p.inv_dir[axis][i] < 0.0f ? ~0u : 0u;
+        }
+        p.tmin[i] = packet->tmin[i];
+        p.hit[i] = (bvh_hit_record){packet->tmax[i], 0.0f, 0.0f, BVH_NO_PRIM, 0};
+        p.t[i] = packet->tmax[i];
+    }
+    update_t_hi(&p);
+    setup_frustum(&p);
+
+    packet_entry stack[PACKET_STACK_SIZE];
+    int sp = 0;
+    float tnear;
+    uint32_t root_mask = packet_node(&p, &tree->nodes[0], p.active, &tnear);
+    if (root_mask) stack[sp++] = (packet_entry){0, root_mask};
+
+    while (sp > 0) {
+        packet_entry e = stack[--sp];
+        const bvh_node *node = &tree->nodes[e.node];
+        PROFILE_COUNT(PROFILE_NODE_VISITS, 1);
+        if (node->left < 0) {
+            packet_leaf(&p, tree, node, e.mask);
+            continue;
+        }
+
+        float tl = 0.0f, tr = 0.0f;
+        uint32_t mask_l = packet_node(&p, &tree->nodes[node->left], e.mask, &tl);
+        uint32_t mask_r = packet_node(&p, &tree->nodes[node->right], e.mask, &tr);
+        if (mask_l && mask_r) {
+            /* Push the child the packet reaches later first so the nearer one is popped next. */
+            if (tl <= tr) {
+                stack[sp++] = (packet_entry){node->right, mask_r};
+                stack[sp++] = (packet_entry){node->left, mask_l};
+            } else {
+                stack[sp++] = (packet_entry){node->left, mask_l};
+                stack[sp++] = (packet_entry){node->right, mask_r};
+            }
+        } else if (mask_l) {
+            stack[sp++] = (packet_entry){node->left, mask_l};
+        } else if (mask_r) {
+            stack[sp++] = (packet_entry){node->right, mask_r};
+        }
+    }
+
+    for (uint32_t i = 0; i < size; ++i) {
+        if (!(p.active & (1u << i)) || p.hit[i].prim == BVH_NO_PRIM) continue;
+        bvh_hit_location(tree, &p.hit[i], &out->mesh[i], &out->tri[i]);
+        out->t[i] = p.hit[i].t;
+        out->u[i] = p.hit[i].u;
+        out->v[i] = p.hit[i].v;
+        out->instance[i] = p.hit[i].instance;
+        out->hit_mask |= 1u << i;
+    }
+#ifdef RT_PROFILE
+    uint32_t rays = 0, hits = 0;
+    for (uint32_t m = p.active; m; m &= m - 1) rays++;
+    for (uint32_t m = out->hit_mask; m; m &= m - 1) hits++;
+    PROFILE_COUNT(PROFILE_RAYS, rays);
+    PROFILE_COUNT(PROFILE_HITS, hits);
+#endif
+    return out->hit_mask;
+}
+
+size_t bvh_trace_stream(const bvh *tree, const ray *rays, size_t count, float tmin, float tmax, bvh_ray_hit *hits) {
+    size_t hit_count = 0;
+    for (size_t first = 0; first < count; first += BVH_PACKET_MAX) {
+        uint32_t n = count - first < BVH_PACKET_MAX ? (uint32_t)(count - first) : BVH_PACKET_MAX;
+        bvh_ray_packet packet;
+        packet.size = n;
+        packet.active_mask = (1u << n) - 1;
+        for (uint32_t i = 0; i < n; ++i) {
+            const ray *r = &rays[first + i];
+            packet.org_x[i] = r->origin.x;
+            packet.org_y[i] = r->origin.y;
+            packet.org_z[i] = r->origin.z;
+            packet.dir_x[i] = r->direction.x;
+            packet.dir_y[i] = r->direction.y;
+            packet.dir_z[i] = r->direction.z;
+            packet.tmin[i] = tmin;
+            packet.tmax[i] = tmax;
+        }
+
+        bvh_packet_hit result;
+        bvh_trace_packet(tree, &packet, &result);
+        for (uint32_t i = 0; i < n; ++i) {
+            bvh_ray_hit *h = &hits[first + i];
+            h->hit = (result.hit_mask >> i) & 1u;
+            if (!h->hit) continue;
+            h->t = result.t[i];
+            h->u = result.u[i];
+            h->v = result.v[i];
+            h->mesh = result.mesh[i];
+            h->tri = result.tri[i];
+            h->instance = result.instance[i];
+            hit_count++;
+        }
+    }
+    return hit_count;
+}
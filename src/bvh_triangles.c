@@ -0,0 +1,248 @@
+#include "bvh.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh_internal.h"
+
+#ifdef BVH_SIMD_SSE
+#include <emmintrin.h>
+#endif
+#ifdef BVH_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+/* Must match intersect_triangle in bvh.c so block hits are bit-identical to the scalar path. */
+#define MT_EPSILON 1e-6f
+
+/* Rows of a block: v0 xyz, e1 xyz, e2 xyz, each `width` floats long. */
+enum { ROW_V0 = 0, ROW_E1 = 3, ROW_E2 = 6, ROW_COUNT = 9 };
+
+typedef struct {
+    float t[8];
+    float u[8];
+    float v[8];
+} mt_lanes;
+
+static float *block_rows(const bvh *tree, size_t block) {
+    if (tree->triangle_block_width == 8) return &tree->tris8[block].v0_x[0];
+    return &tree->tris4[block].v0_x[0];
+}
+
+int bvh_build_triangle_blocks(bvh *tree, uint32_t width) {
+    free(tree->tris4);
+    free(tree->tris8);
+    tree->tris4 = NULL;
+    tree->tris8 = NULL;
+    tree->triangle_block_width = 0;
+    if (width != 4 && width != 8) return 1;
+
+    size_t blocks = (tree->triangle_count + width - 1) / width;
+    if (blocks == 0) blocks = 1;
+    if (width == 8) {
+        tree->tris8 = (bvh_tri8*)calloc(blocks, sizeof(bvh_tri8));
+        if (!tree->tris8) return 0;
+    } else {
+        tree->tris4 = (bvh_tri4*)calloc(blocks, sizeof(bvh_tri4));
+        if (!tree->tris4) return 0;
+    }
+    tree->triangle_block_width = width;
+
+    const scene *s = tree->scene_ref;
+    for (size_t i = 0; i < tree->triangle_count; ++i) {
+        size_t prim = tree->triangle_indices[i];
+        uint32_t m = tree->triangle_mesh[prim];
+        const mesh *me = &s->meshes[m];
+        triangle tri = mesh_triangle(me, prim - tree->mesh_first_triangle[m]);
+        vec3 v0 = mesh_position(me, tri.i0);
+        vec3 e1 = vec3_sub(mesh_position(me, tri.i1), v0);
+        vec3 e2 = vec3_sub(mesh_position(me, tri.i2), v0);
+        float values[ROW_COUNT] = {v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z};
+
+        float *rows = block_rows(tree, i / width);
+        size_t lane = i % width;
+        for (int row = 0; row < ROW_COUNT; ++row) rows[row * width + lane] = values[row];
+    }
+    return 1;
+}
+
+/* Each kernel evaluates Moller-Trumbore for `lanes` triangles in the same operation order as
+ * intersect_triangle and returns the mask of lanes that pass its rejection tests. */
+#ifndef BVH_SIMD_SSE
+static uint32_t mt_scalar(const float *rows, size_t stride, int lanes, ray r, mt_lanes *out) {
+    uint32_t mask = 0;
+    for (int i = 0; i < lanes; ++i) {
+        vec3 v0 = {rows[ROW_V0 * stride + i], rows[(ROW_V0 + 1) * stride + i], rows[(ROW_V0 + 2) * stride + i]};
+        vec3 e1 = {rows[ROW_E1 * stride + i], rows[(ROW_E1 + 1) * stride + i], rows[(ROW_E1 + 2) * stride + i]};
+        vec3 e2 = {rows[ROW_E2 * stride + i], rows[(ROW_E2 + 1) * stride + i], rows[(ROW_E2 + 2) * stride + i]};
+        vec3 p = vec3_cross(r.direction, e2);
+        float det = vec3_dot(e1, p);
+        if (det > -MT_EPSILON && det < MT_EPSILON) continue;
+        float inv_det = 1.0f / det;
+        vec3 s = vec3_sub(r.origin, v0);
+        float u = inv_det * vec3_dot(s, p);
+        if (u < 0.0f || u > 1.0f) continue;
+        vec3 q = vec3_cross(s, e1);
+        float v = inv_det * vec3_dot(r.direction, q);
+        if (v < 0.0f || (u + v) > 1.0f) continue;
+        float t = inv_det * vec3_dot(e2, q);
+        if (!(t > MT_EPSILON)) continue;
+        out->t[i] = t;
+        out->u[i] = u;
+        out->v[i] = v;
+        mask |= 1u << i;
+    }
+    return mask;
+}
+#endif
+
+#ifdef BVH_SIMD_SSE
+static uint32_t mt_sse(const float *rows, size_t stride, ray r, mt_lanes *out) {
+    __m128 dx = _mm_set1_ps(r.direction.x), dy = _mm_set1_ps(r.direction.y), dz = _mm_set1_ps(r.direction.z);
+    __m128 v0x = _mm_loadu_ps(rows + ROW_V0 * stride);
+    __m128 v0y = _mm_loadu_ps(rows + (ROW_V0 + 1) * stride);
+    __m128 v0z = _mm_loadu_ps(rows + (ROW_V0 + 2) * stride);
+    __m128 e1x = _mm_loadu_ps(rows + ROW_E1 * stride);
+    __m128 e1y = _mm_loadu_ps(rows + (ROW_E1 + 1) * stride);
+    __m128 e1z = _mm_loadu_ps(rows + (ROW_E1 + 2) * stride);
+    __m128 e2x = _mm_loadu_ps(rows + ROW_E2 * stride);
+    __m128 e2y = _mm_loadu_ps(rows + (ROW_E2 + 1) * stride);
+    __m128 e2z = _mm_loadu_ps(rows + (ROW_E2 + 2) * stride);
+
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 reject = _mm_and_ps(_mm_cmpgt_ps(det, _mm_set1_ps(-MT_EPSILON)), _mm_cmplt_ps(det, _mm_set1_ps(MT_EPSILON)));
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(r.origin.x), v0x);
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(r.origin.y), v0y);
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(r.origin.z), v0z);
+    __m128 u = _mm_mul_ps(inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)));
+    reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(u, _mm_setzero_ps()), _mm_cmpgt_ps(u, _mm_set1_ps(1.0f))));
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+    reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(v, _mm_setzero_ps()), _mm_cmpgt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+
+    __m128 t = _mm_mul_ps(inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+    __m128 accept = _mm_andnot_ps(reject, _mm_cmpgt_ps(t, _mm_set1_ps(MT_EPSILON)));
+
+    _mm_storeu_ps(out->t, t);
+    _mm_storeu_ps(out->u, u);
+    _mm_storeu_ps(out->v, v);
+    return (uint32_t)_mm_movemask_ps(accept);
+}
+#endif
+
+#ifdef BVH_SIMD_AVX2
+static uint32_t mt_avx2(const float *rows, ray r, mt_lanes *out) {
+    const size_t stride = 8;
+    __m256 dx = _mm256_set1_ps(r.direction.x), dy = _mm256_set1_ps(r.direction.y), dz = _mm256_set1_ps(r.direction.z);
+    __m256 v0x = _mm256_loadu_ps(rows + ROW_V0 * stride);
+    __m256 v0y = _mm256_loadu_ps(rows + (ROW_V0 + 1) * stride);
+    __m256 v0z = _mm256_loadu_ps(rows + (ROW_V0 + 2) * stride);
+    __m256 e1x = _mm256_loadu_ps(rows + ROW_E1 * stride);
+    __m256 e1y = _mm256_loadu_ps(rows + (ROW_E1 + 1) * stride);
+    __m256 e1z = _mm256_loadu_ps(rows + (ROW_E1 + 2) * stride);
+    __m256 e2x = _mm256_loadu_ps(rows + ROW_E2 * stride);
+    __m256 e2y = _mm256_loadu_ps(rows + (ROW_E2 + 1) * stride);
+    __m256 e2z = _mm256_loadu_ps(rows + (ROW_E2 + 2) * stride);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 reject = _mm256_and_ps(_mm256_cmp_ps(det, _mm256_set1_ps(-MT_EPSILON), _CMP_GT_OQ),
+                                  _mm256_cmp_ps(det, _mm256_set1_ps(MT_EPSILON), _CMP_LT_OQ));
+    __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    __m256 sx = _mm256_sub_ps(_mm256_set1_ps(r.origin.x), v0x);
+    __m256 sy = _mm256_sub_ps(_mm256_set1_ps(r.origin.y), v0y);
+    __m256 sz = _mm256_sub_ps(_mm256_set1_ps(r.origin.z), v0z);
+    __m256 u = _mm256_mul_ps(inv_det, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)));
+    reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_LT_OQ),
+                                               _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_GT_OQ)));
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    __m256 v = _mm256_mul_ps(inv_det, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+    reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_LT_OQ),
+                                               _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_GT_OQ)));
+
+    __m256 t = _mm256_mul_ps(inv_det, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+    __m256 accept = _mm256_andnot_ps(reject, _mm256_cmp_ps(t, _mm256_set1_ps(MT_EPSILON), _CMP_GT_OQ));
+
+    _mm256_storeu_ps(out->t, t);
+    _mm256_storeu_ps(out->u, u);
+    _mm256_storeu_ps(out->v, v);
+    return (uint32_t)_mm256_movemask_ps(accept);
+}
+#endif
+
+static uint32_t intersect_block(const bvh *tree, size_t block, ray r, mt_lanes *out) {
+    const float *rows = block_rows(tree, block);
+    if (tree->triangle_block_width == 8) {
+#if defined(BVH_SIMD_AVX2)
+        return mt_avx2(rows, r, out);
+#elif defined(BVH_SIMD_SSE)
+        mt_lanes high;
+        uint32_t mask = mt_sse(rows, 8, r, out);
+        mask |= mt_sse(rows + 4, 8, r, &high) << 4;
+        memcpy(out->t + 4, high.t, 4 * sizeof(float));
+        memcpy(out->u + 4, high.u, 4 * sizeof(float));
+        memcpy(out->v + 4, high.v, 4 * sizeof(float));
+        return mask;
+#else
+        return mt_scalar(rows, 8, 8, r, out);
+#endif
+    }
+#ifdef BVH_SIMD_SSE
+    return mt_sse(rows, 4, r, out);
+#else
+    return mt_scalar(rows, 4, 4, r, out);
+#endif
+}
+
+void bvh_intersect_leaf_blocks(const bvh *tree, ray r, size_t start, size_t count, float tmin, bvh_hit_record *hit) {
+    size_t width = tree->triangle_block_width;
+    size_t end = start + count;
+    for (size_t block = start / width; block * width < end; ++block) {
+        size_t first = block * width;
+        mt_lanes lanes;
+        uint32_t mask = intersect_block(tree, block, r, &lanes);
+
+        /* Lanes are visited in BVH order and only a strictly closer t wins, like the scalar loop. */
+        for (size_t lane = 0; lane < width; ++lane) {
+            size_t pos = first + lane;
+            if (pos < start || pos >= end || !(mask & (1u << lane))) continue;
+            float t = lanes.t[lane];
+            if (t < hit->t && t > tmin) {
+                hit->t = t;
+                hit->u = lanes.u[lane];
+                hit->v = lanes.v[lane];
+                hit->prim = tree->triangle_indices[pos];
+            }
+        }
+    }
+}
+
+int bvh_occluded_leaf_blocks(const bvh *tree, ray r, size_t start, size_t count, float tmin, float tmax) {
+    size_t width = tree->triangle_block_width;
+    size_t end = start + count;
+    for (size_t block = start / width; block * width < end; ++block) {
+        size_t first = block * width;
+        mt_lanes lanes;
+        uint32_t mask = intersect_block(tree, block, r, &lanes);
+        for (size_t lane = 0; mask && lane < width; ++lane) {
+            size_t pos = first + lane;
+            if (pos < start || pos >= end || !(mask & (1u << lane))) continue;
+            if (lanes.t[lane] < tmax && lanes.t[lane] > tmin) return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include "bvh.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh_internal.h"
+
+#ifdef BVH_SIMD_SSE
+#include <emmintrin.h>
+#endif
+#ifdef BVH_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+#define BVH_WIDE_MAX_WIDTH 8
+#define BVH_WIDE_STACK_SIZE (BVH_WIDE_MAX_WIDTH * BVH_MAX_DEPTH)
+
+/* Width-independent view of one bvh4_node / bvh8_node. */
+typedef struct {
+    float *min_x, *min_y, *min_z;
+    float *max_x, *max_y, *max_z;
+    int32_t *child;
+    uint32_t *count;
+} wide_slots;
+
+typedef struct {
+    bvh *tree;
+    uint32_t width;
+    size_t node_count;
+} wide_builder;
+
+typedef struct {
+    float org[3];
+    float inv_dir[3];
+    /* Per axis: 1 when the direction is negative, so the max plane is entered first. */
+    int neg[3];
+} wide_ray;
+
+typedef struct {
+    int32_t child;
+    uint32_t count;
+    float tnear;
+} wide_entry;
+
+static wide_slots slots_of(const bvh *tree, size_t index) {
+    wide_slots v;
+    if (tree->width == 8) {
+        bvh8_node *n = &tree->nodes8[index];
+        v = (wide_slots){n->min_x, n->min_y, n->min_z, n->max_x, n->max_y, n->max_z, n->child, n->count};
+    } else {
+        bvh4_node *n = &tree->nodes4[index];
+        v = (wide_slots){n->min_x, n->min_y, n->min_z, n->max_x, n->max_y, n->max_z, n->child, n->count};
+    }
+    return v;
+}
+
+static void set_slot(wide_slots *v, uint32_t slot, const aabb *box, int32_t child, uint32_t count) {
+    v->min_x[slot] = box->min.x;
+    v->min_y[slot] = box->min.y;
+    v->min_z[slot] = box->min.z;
+    v->max_x[slot] = box->max.x;
+    v->max_y[slot] = box->max.y;
+    v->max_z[slot] = box->max.z;
+    v->child[slot] = child;
+    v->count[slot] = count;
+}
+
+static void collapse(wide_builder *b, int binary_index, size_t wide_index) {
+    const bvh_node *nodes = b->tree->nodes;
+    int children[BVH_WIDE_MAX_WIDTH];
+    uint32_t n = 0;
+
+    if (nodes[binary_index].left < 0) {
+        children[n++] = binary_index;
+    } else {
+        children[n++] = nodes[binary_index].left;
+        children[n++] = nodes[binary_index].right;
+    }
+
+    /* Pull grandchildren up, always opening the inner child with the largest surface area. */
+    while (n < b->width) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (uint32_t i = 0; i < n; ++i) {
+            const bvh_node *c = &nodes[children[i]];
+            float area = aabb_area(&c->box);
+            if (c->left >= 0 && area > best_area) {
+                best_area = area;
+                best = (int)i;
+            }
+        }
+        if (best < 0) break;
+        int opened = children[best];
+        children[best] = nodes[opened].left;
+        children[n++] = nodes[opened].right;
+    }
+
+    aabb empty = aabb_empty();
+    for (uint32_t slot = 0; slot < b->width; ++slot) {
+        wide_slots v = slots_of(b->tree, wide_index);
+        if (slot >= n) {
+            set_slot(&v, slot, &empty, -1, 0);
+            continue;
+        }
+        const bvh_node *c = &nodes[children[slot]];
+        if (c->left < 0) {
+            if (c->count == 0) set_slot(&v, slot, &empty, -1, 0);
+            else set_slot(&v, slot, &c->box, (int32_t)c->start, (uint32_t)c->count);
+        } else {
+            size_t child_index = b->node_count++;
+            set_slot(&v, slot, &c->box, (int32_t)child_index, 0);
+            collapse(b, children[slot], child_index);
+        }
+    }
+}
+
+int bvh_build_wide(bvh *tree, uint32_t width) {
+    free(tree->nodes4);
+    free(tree->nodes8);
+    tree->nodes4 = NULL;
+    tree->nodes8 = NULL;
+    tree->wide_node_count = 0;
+    tree->width = 2;
+    if (!tree->nodes || tree->node_count == 0) return 0;
+
+    /* Every wide node consumes at least one binary inner node, plus one for a leaf root. */
+    size_t capacity = tree->node_count;
+    if (width == 8) {
+        tree->nodes8 = (bvh8_node*)malloc(capacity * sizeof(bvh8_node));
+        if (!tree->nodes8) return 0;
+    } else {
+        width = 4;
+        tree->nodes4 = (bvh4_node*)malloc(capacity * sizeof(bvh4_node));
+        if (!tree->nodes4) return 0;
+    }
+    tree->width = width;
+
+    wide_builder b = {tree, width, 1};
+    collapse(&b, 0, 0);
+    tree->wide_node_count = b.node_count;
+
+    if (width == 8) {
+        bvh8_node *shrunk = (bvh8_node*)realloc(tree->nodes8, b.node_count * sizeof(bvh8_node));
+        if (shrunk) tree->nodes8 = shrunk;
+    } else {
+        bvh4_node *shrunk = (bvh4_node*)realloc(tree->nodes4, b.node_count * sizeof(bvh4_node));
+        if (shrunk) tree->nodes4 = shrunk;
+    }
+    return 1;
+}
+
+/* Slab test of all children against one ray; returns a bit mask of hit slots and fills tnear.
+ * Empty slots carry inverted bounds and therefore never hit. */
+static uint32_t intersect_children4(const bvh4_node *n, const wide_ray *r, float tmin, float tmax, float *tnear) {
+    const float *lo[3] = {n->min_x, n->min_y, n->min_z};
+    const float *hi[3] = {n->max_x, n->max_y, n->max_z};
+#ifdef BVH_SIMD_SSE
+    __m128 t_enter = _mm_set1_ps(tmin);
+    __m128 t_exit = _mm_set1_ps(tmax);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 o = _mm_set1_ps(r->org[axis]);
+        __m128 inv = _mm_set1_ps(r->inv_dir[axis]);
+        __m128 near_plane = _mm_loadu_ps(r->neg[axis] ? hi[axis] : lo[axis]);
+        __m128 far_plane = _mm_loadu_ps(r->neg[axis] ? lo[axis] : hi[axis]);
+        t_enter = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, o), inv), t_enter);
+        t_exit = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, o), inv), t_exit);
+    }
+    _mm_storeu_ps(tnear, t_enter);
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        float t_enter = tmin;
+        float t_exit = tmax;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float *near_plane = r->neg[axis] ? hi[axis] : lo[axis];
+            const float *far_plane = r->neg[axis] ? lo[axis] : hi[axis];
+            t_enter = bvh_max_f((near_plane[i] - r->org[axis]) * r->inv_dir[axis], t_enter);
+            t_exit = bvh_min_f((far_plane[i] - r->org[axis]) * r->inv_dir[axis], t_exit);
+        }
+        tnear[i] = t_enter;
+        if (t_enter <= t_exit) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static uint32_t intersect_children8(const bvh8_node *n, const wide_ray *r, float tmin, float tmax, float *tnear) {
+    const float *lo[3] = {n->min_x, n->min_y, n->min_z};
+    const float *hi[3] = {n->max_x, n->max_y, n->max_z};
+#if defined(BVH_SIMD_AVX2)
+    __m256 t_enter = _mm256_set1_ps(tmin);
+    __m256 t_exit = _mm256_set1_ps(tmax);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m256 o = _mm256_set1_ps(r->org[axis]);
+        __m256 inv = _mm256_set1_ps(r->inv_dir[axis]);
+        __m256 near_plane = _mm256_loadu_ps(r->neg[axis] ? hi[axis] : lo[axis]);
+        __m256 far_plane = _mm256_loadu_ps(r->neg[axis] ? lo[axis] : hi[axis]);
+        t_enter = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(near_plane, o), inv), t_enter);
+        t_exit = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(far_plane, o), inv), t_exit);
+    }
+    _mm256_storeu_ps(tnear, t_enter);
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ));
+#elif defined(BVH_SIMD_SSE)
+    uint32_t mask = 0;
+    for (int half = 0; half < 8; half += 4) {
+        __m128 t_enter = _mm_set1_ps(tmin);
+        __m128 t_exit = _mm_set1_ps(tmax);
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 o = _mm_set1_ps(r->org[axis]);
+            __m128 inv = _mm_set1_ps(r->inv_dir[axis]);
+            __m128 near_plane = _mm_loadu_ps((r->neg[axis] ? hi[axis] : lo[axis]) + half);
+            __m128 far_plane = _mm_loadu_ps((r->neg[axis] ? lo[axis] : hi[axis]) + half);
+            t_enter = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, o), inv), t_enter);
+            t_exit = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, o), inv), t_exit);
+        }
+        _mm_storeu_ps(tnear + half, t_enter);
+        mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)) << half;
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 8; ++i) {
+        float t_enter = tmin;
+        float t_exit = tmax;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float *near_plane = r->neg[axis] ? hi[axis] : lo[axis];
+            const float *far_plane = r->neg[axis] ? lo[axis] : hi[axis];
+            t_enter = bvh_max_f((near_plane[i] - r->org[axis]) * r->inv_dir[axis], t_enter);
+            t_exit = bvh_min_f((far_plane[i] - r->org[axis]) * r->inv_dir[axis], t_exit);
+        }
+        tnear[i] = t_enter;
+        if (t_enter <= t_exit) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static wide_ray make_wide_ray(ray r) {
+    wide_ray w;
+    float dir[3] = {r.direction.x, r.direction.y, r.direction.z};
+    w.org[0] = r.origin.x;
+    w.org[1] = r.origin.y;
+    w.org[2] = r.origin.z;
+    for (int axis = 0; axis < 3; ++axis) {
+        w.inv_dir[axis] = 1.0f / dir[axis];
+        w.neg[axis] = w.inv_dir[axis] < 0.0f;
+    }
+    return w;
+}
+
+void bvh_wide_closest_hit(const bvh *tree, ray r, float tmin, bvh_hit_record *hit) {
+    wide_ray wr = make_wide_ray(r);
+    wide_entry stack[BVH_WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = (wide_entry){0, 0, tmin};
+
+    while (sp > 0) {
+        wide_entry e = stack[--sp];
+        if (e.tnear > hit->t) continue;
+        if (e.count > 0) {
+            bvh_intersect_leaf(tree, r, (size_t)e.child, e.count, tmin, hit);
+            continue;
+        }
+        PROFILE_COUNT(PROFILE_NODE_VISITS, 1);
+
+        float tnear[BVH_WIDE_MAX_WIDTH];
+        uint32_t mask;
+        const int32_t *child;
+        const uint32_t *count;
+        if (tree->width == 8) {
+            const bvh8_node *n = &tree->nodes8[e.child];
+            mask = intersect_children8(n, &wr, tmin, hit->t, tnear);
+            child = n->child;
+            count = n->count;
+        } else {
+            const bvh4_node *n = &tree->nodes4[e.child];
+            mask = intersect_children4(n, &wr, tmin, hit->t, tnear);
+            child = n->child;
+            count = n->count;
+        }
+
+        /* Insertion-sort the hit children far to near, then push so the nearest pops first. */
+        wide_entry hits[BVH_WIDE_MAX_WIDTH];
+        int hit_count = 0;
+        while (mask) {
+            int slot = 0;
+            while (!(mask & (1u << slot))) ++slot;
+            mask &= mask - 1;
+            wide_entry entry = {child[slot], count[slot], tnear[slot]};
+            int j = hit_count++;
+            while (j > 0 && hits[j - 1].tnear < entry.tnear) {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = entry;
+        }
+        for (int i = 0; i < hit_count; ++i) stack[sp++] = hits[i];
+    }
+}
+
+int bvh_wide_occluded(const bvh *tree, ray r, float tmin, float tmax) {
+    wide_ray wr = make_wide_ray(r);
+    wide_entry stack[BVH_WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = (wide_entry){0, 0, tmin};
+
+    /* Any hit ends the query, so children are pushed unsorted. */
+    while (sp > 0) {
+        wide_entry e = stack[--sp];
+        if (e.count > 0) {
+            if (bvh_occluded_leaf(tree, r, (size_t)e.child, e.count, tmin, tmax)) return 1;
+            continue;
+        }
+        PROFILE_COUNT(PROFILE_NODE_VISITS, 1);
+
+        float tnear[BVH_WIDE_MAX_WIDTH];
+        uint32_t mask;
+        const int32_t *child;
+        const uint32_t *count;
+        if (tree->width == 8) {
+            const bvh8_node *n = &tree->nodes8[e.child];
+            mask = intersect_children8(n, &wr, tmin, tmax, tnear);
+            child = n->child;
+            count = n->count;
+        } else {
+            const bvh4_node *n = &tree->nodes4[e.child];
+            mask = intersect_children4(n, &wr, tmin, tmax, tnear);
+            child = n->child;
+            count = n->count;
+        }
+        while (mask) {
+            int slot = 0;
+            while (!(mask & (1u << slot))) ++slot;
+            mask &= mask - 1;
+            stack[sp++] = (wide_entry){child[slot], count[slot], tnear[slot]};
+        }
+    }
+    return 0;
+}
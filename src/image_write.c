@@ -0,0 +1,658 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "image_write.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION writer_mutex;
+typedef CONDITION_VARIABLE writer_cond;
+typedef HANDLE writer_thread;
+static void writer_mutex_init(writer_mutex *m) { InitializeCriticalSection(m); }
+static void writer_mutex_destroy(writer_mutex *m) { DeleteCriticalSection(m); }
+static void writer_lock(writer_mutex *m) { EnterCriticalSection(m); }
+static void writer_unlock(writer_mutex *m) { LeaveCriticalSection(m); }
+static void writer_cond_init(writer_cond *c) { InitializeConditionVariable(c); }
+static void writer_cond_destroy(writer_cond *c) { (void)c; }
+static void writer_cond_wait(writer_cond *c, writer_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void writer_cond_broadcast(writer_cond *c) { WakeAllConditionVariable(c); }
+#else
+#include <pthread.h>
+typedef pthread_mutex_t writer_mutex;
+typedef pthread_cond_t writer_cond;
+typedef pthread_t writer_thread;
+static void writer_mutex_init(writer_mutex *m) { pthread_mutex_init(m, NULL); }
+static void writer_mutex_destroy(writer_mutex *m) { pthread_mutex_destroy(m); }
+static void writer_lock(writer_mutex *m) { pthread_mutex_lock(m); }
+static void writer_unlock(writer_mutex *m) { pthread_mutex_unlock(m); }
+static void writer_cond_init(writer_cond *c) { pthread_cond_init(c, NULL); }
+static void writer_cond_destroy(writer_cond *c) { pthread_cond_destroy(c); }
+static void writer_cond_wait(writer_cond *c, writer_mutex *m) { pthread_cond_wait(c, m); }
+static void writer_cond_broadcast(writer_cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+/* Whole images go through a stdio buffer this large, so the OS sees few big writes. */
+#define IMAGE_WRITE_BUFFER_BYTES (1u << 20)
+
+#define EXR_COMPRESSION_NONE 0
+#define EXR_COMPRESSION_RLE 1
+#define EXR_HALF 1
+#define EXR_CHANNELS 3
+#define EXR_HEADER_MAX 512
+
+image_format image_format_from_path(const char *path) {
+    const char *dot = path ? strrchr(path, '.') : NULL;
+    if (!dot) return IMAGE_FORMAT_PPM;
+    char ext[8] = {0};
+    for (size_t i = 0; i + 1 < sizeof(ext) && dot[i + 1]; ++i) {
+        char c = dot[i + 1];
+        ext[i] = c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+    if (strcmp(ext, "pfm") == 0) return IMAGE_FORMAT_PFM;
+    if (strcmp(ext, "exr") == 0) return IMAGE_FORMAT_EXR;
+    return IMAGE_FORMAT_PPM;
+}
+
+/* Round to nearest even, with subnormals, infinities and NaN. */
+static uint16_t float_to_half(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000u;
+    uint32_t exponent = (f >> 23) & 0xffu;
+    uint32_t mantissa = f & 0x7fffffu;
+    if (exponent == 0xffu) return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u | (mantissa >> 13) : 0u));
+    int e = (int)exponent - 127 + 15;
+    if (e >= 31) return (uint16_t)(sign | 0x7c00u);
+    if (e <= 0) {
+        if (e < -10) return (uint16_t)sign;
+        mantissa |= 0x800000u;
+        uint32_t shift = (uint32_t)(14 - e);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1u), midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1u))) half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = (uint32_t)e << 10 | mantissa >> 13;
+    uint32_t rest = mantissa & 0x1fffu;
+    /* A carry out of the mantissa correctly bumps the exponent, up to infinity. */
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) half++;
+    return (uint16_t)(sign | half);
+}
+
+static void pixel_rgb(const framebuffer *fb, size_t i, float out[3]) {
+    if (fb->rgb32) {
+        memcpy(out, fb->rgb32 + i * 3, 3 * sizeof(float));
+        return;
+    }
+    for (int c = 0; c < 3; ++c) out[c] = (float)fb->rgba8[i * 4 + c] * (1.0f / 255.0f);
+}
+
+static int host_little_endian(void) {
+    uint16_t probe = 1;
+    uint8_t first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) *p++ = (uint8_t)(v >> (8 * i));
+    return p;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) *p++ = (uint8_t)(v >> (8 * i));
+    return p;
+}
+
+static uint8_t *put_f32(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return put_u32(p, bits);
+}
+
+static uint8_t *put_attribute(uint8_t *p, const char *name, const char *type, uint32_t size) {
+    size_t n = strlen(name) + 1, t = strlen(type) + 1;
+    memcpy(p, name, n);
+    memcpy(p + n, type, t);
+    return put_u32(p + n + t, size);
+}
+
+static size_t exr_header(uint8_t *out, uint32_t width, uint32_t height, int compression) {
+    static const char channels[EXR_CHANNELS] = {'B', 'G', 'R'};
+    uint8_t *p = out;
+    *p++ = 0x76;
+    *p++ = 0x2f;
+    *p++ = 0x31;
+    *p++ = 0x01;
+    p = put_u32(p, 2);
+    p = put_attribute(p, "channels", "chlist", EXR_CHANNELS * 18 + 1);
+    for (int c = 0; c < EXR_CHANNELS; ++c) {
+        *p++ = (uint8_t)channels[c];
+        *p++ = 0;
+        p = put_u32(p, EXR_HALF);
+        /* pLinear and three reserved bytes. */
+        p = put_u32(p, 0);
+        p = put_u32(p, 1);
+        p = put_u32(p, 1);
+    }
+    *p++ = 0;
+    p = put_attribute(p, "compression", "compression", 1);
+    *p++ = (uint8_t)compression;
+    for (int w = 0; w < 2; ++w) {
+        p = put_attribute(p, w == 0 ? "dataWindow" : "displayWindow", "box2i", 16);
+        p = put_u32(p, 0);
+        p = put_u32(p, 0);
+        p = put_u32(p, width - 1);
+        p = put_u32(p, height - 1);
+    }
+    p = put_attribute(p, "lineOrder", "lineOrder", 1);
+    *p++ = 0;
+    p = put_attribute(p, "pixelAspectRatio", "float", 4);
+    p = put_f32(p, 1.0f);
+    p = put_attribute(p, "screenWindowCenter", "v2f", 8);
+    p = put_f32(p, 0.0f);
+    p = put_f32(p, 0.0f);
+    p = put_attribute(p, "screenWindowWidth", "float", 4);
+    p = put_f32(p, 1.0f);
+    *p++ = 0;
+    return (size_t)(p - out);
+}
+
+static size_t format_header(char *out, size_t bytes, image_format format, uint32_t width, uint32_t height) {
+    int n = 0;
+    if (format == IMAGE_FORMAT_EXR) return exr_header((uint8_t*)out, width, height, EXR_COMPRESSION_NONE);
+    if (format == IMAGE_FORMAT_PFM) {
+        n = snprintf(out, bytes, "PF\n%u %u\n%s\n", width, height, host_little_endian() ? "-1.0" : "1.0");
+    } else {
+        n = snprintf(out, bytes, "P6\n%u %u\n255\n", width, height);
+    }
+    return n > 0 ? (size_t)n : 0;
+}
+
+/* Encoded bytes of one row: PPM and PFM pixels, or an uncompressed EXR chunk with its y and size. */
+static size_t row_bytes(image_format format, uint32_t width) {
+    if (format == IMAGE_FORMAT_PFM) return (size_t)width * 3 * sizeof(float);
+    if (format == IMAGE_FORMAT_EXR) return 8 + (size_t)width * EXR_CHANNELS * 2;
+    return (size_t)width * 3;
+}
+
+/* EXR lines are written as half B, then G, then R planes, little endian. */
+static void exr_planes(const framebuffer *fb, uint32_t y, uint8_t *out) {
+    size_t plane = (size_t)fb->width * 2;
+    for (uint32_t x = 0; x < fb->width; ++x) {
+        float rgb[3];
+        pixel_rgb(fb, (size_t)y * fb->width + x, rgb);
+        for (int c = 0; c < EXR_CHANNELS; ++c) {
+            uint16_t h = float_to_half(rgb[2 - c]);
+            out[c * plane + 2 * x] = (uint8_t)h;
+            out[c * plane + 2 * x + 1] = (uint8_t)(h >> 8);
+        }
+    }
+}
+
+static void encode_row(const framebuffer *fb, image_format format, uint32_t y, uint8_t *out) {
+    if (format == IMAGE_FORMAT_EXR) {
+        uint8_t *p = put_u32(out, y);
+        p = put_u32(p, (uint32_t)((size_t)fb->width * EXR_CHANNELS * 2));
+        exr_planes(fb, y, p);
+    } else if (format == IMAGE_FORMAT_PFM) {
+        float *f = (float*)out;
+        for (uint32_t x = 0; x < fb->width; ++x) pixel_rgb(fb, (size_t)y * fb->width + x, f + 3 * x);
+    } else {
+        const uint8_t *src = fb->rgba8 + (size_t)y * fb->width * 4;
+        for (uint32_t x = 0; x < fb->width; ++x) {
+            out[3 * x] = src[4 * x];
+            out[3 * x + 1] = src[4 * x + 1];
+            out[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+}
+
+/* File offset of row y after a header_bytes long header (and, for EXR, the line offset table).
+ * PFM stores the bottom row first. */
+static size_t row_offset(image_format format, uint32_t width, uint32_t height, size_t header_bytes, uint32_t y) {
+    size_t first = header_bytes + (format == IMAGE_FORMAT_EXR ? (size_t)height * 8 : 0);
+    uint32_t slot = format == IMAGE_FORMAT_PFM ? height - 1 - y : y;
+    return first + (size_t)slot * row_bytes(format, width);
+}
+
+/* Encodes rows [y0, y1) in file order into row, one at a time, and writes each at the current position. */
+static int write_rows(FILE *f, const framebuffer *fb, image_format format, uint32_t y0, uint32_t y1, uint8_t *row) {
+    size_t bytes = row_bytes(format, fb->width);
+    for (uint32_t i = y0; i < y1; ++i) {
+        uint32_t y = format == IMAGE_FORMAT_PFM ? y1 - 1 - (i - y0) : i;
+        encode_row(fb, format, y, row);
+        if (fwrite(row, 1, bytes, f) != bytes) return 0;
+    }
+    return 1;
+}
+
+/* OpenEXR RLE: bytes split into even and odd halves, delta coded, then runs of up to 127 repeats
+ * and literal spans of up to 127 bytes. Returns 0 when the result would not be smaller. */
+static size_t exr_rle(const uint8_t *raw, size_t bytes, uint8_t *tmp, uint8_t *out) {
+    size_t half = (bytes + 1) / 2;
+    for (size_t i = 0; i < bytes; ++i) tmp[(i & 1) ? half + i / 2 : i / 2] = raw[i];
+    for (size_t i = bytes - 1; i > 0; --i) tmp[i] = (uint8_t)(tmp[i] - tmp[i - 1] + 128);
+    size_t n = 0, start = 0;
+    while (start < bytes) {
+        size_t end = start + 1;
+        while (end < bytes && tmp[end] == tmp[start] && end - start < 128) end++;
+        if (end - start >= 3) {
+            if (n + 2 >= bytes) return 0;
+            out[n++] = (uint8_t)(end - start - 1);
+            out[n++] = tmp[start];
+            start = end;
+            continue;
+        }
+        end = start;
+        while (end < bytes && end - start < 127 &&
+               !(end + 2 < bytes && tmp[end] == tmp[end + 1] && tmp[end + 1] == tmp[end + 2])) {
+            end++;
+        }
+        if (n + 1 + (end - start) >= bytes) return 0;
+        out[n++] = (uint8_t)(-(int)(end - start));
+        memcpy(out + n, tmp + start, end - start);
+        n += end - start;
+        start = end;
+    }
+    return n;
+}
+
+/* Chunks vary in size, so the offset table is filled in after them. */
+static int write_exr_rle(FILE *f, const framebuffer *fb) {
+    uint8_t header[EXR_HEADER_MAX];
+    size_t header_bytes = exr_header(header, fb->width, fb->height, EXR_COMPRESSION_RLE);
+    size_t line = (size_t)fb->width * EXR_CHANNELS * 2;
+    uint8_t *raw = (uint8_t*)malloc(3 * line + 8);
+    uint64_t *offsets = (uint64_t*)malloc((size_t)fb->height * sizeof(uint64_t));
+    uint8_t *table = (uint8_t*)calloc(fb->height, 8);
+    int ok = raw && offsets && table && fwrite(header, 1, header_bytes, f) == header_bytes &&
+             fwrite(table, 8, fb->height, f) == fb->height;
+    uint64_t offset = header_bytes + (uint64_t)fb->height * 8;
+    for (uint32_t y = 0; ok && y < fb->height; ++y) {
+        uint8_t *tmp = raw + line, *packed = raw + 2 * line + 8;
+        exr_planes(fb, y, raw);
+        size_t size = exr_rle(raw, line, tmp, packed);
+        const uint8_t *data = size ? packed : raw;
+        if (!size) size = line;
+        uint8_t chunk[8];
+        put_u32(put_u32(chunk, y), (uint32_t)size);
+        offsets[y] = offset;
+        ok = fwrite(chunk, 1, 8, f) == 8 && fwrite(data, 1, size, f) == size;
+        offset += 8 + size;
+    }
+    for (uint32_t y = 0; ok && y < fb->height; ++y) put_u64(table + (size_t)y * 8, offsets[y]);
+    ok = ok && fseek(f, (long)header_bytes, SEEK_SET) == 0 && fwrite(table, 8, fb->height, f) == fb->height;
+    free(table);
+    free(offsets);
+    free(raw);
+    return ok;
+}
+
+int image_write(const char *path, const framebuffer *fb, image_format format) {
+    if (!path || !fb || !fb->rgba8 || fb->width == 0 || fb->height == 0) return 0;
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    PROFILE_BEGIN(zone, "image_write");
+    char *buffer = (char*)malloc(IMAGE_WRITE_BUFFER_BYTES);
+    if (buffer) setvbuf(f, buffer, _IOFBF, IMAGE_WRITE_BUFFER_BYTES);
+    int ok;
+    if (format == IMAGE_FORMAT_EXR) {
+        ok = write_exr_rle(f, fb);
+    } else {
+        char header[64];
+        size_t header_bytes = format_header(header, sizeof(header), format, fb->width, fb->height);
+        uint8_t *row = (uint8_t*)malloc(row_bytes(format, fb->width));
+        ok = row && fwrite(header, 1, header_bytes, f) == header_bytes && write_rows(f, fb, format, 0, fb->height, row);
+        free(row);
+    }
+    ok = fclose(f) == 0 && ok;
+    free(buffer);
+    PROFILE_END(zone);
+    return ok;
+}
+
+typedef enum {
+    WRITER_OP_IMAGE = 0,
+    WRITER_OP_STREAM_OPEN,
+    WRITER_OP_STREAM_ROWS,
+    WRITER_OP_STREAM_CLOSE
+} writer_op_kind;
+
+typedef struct writer_op {
+    struct writer_op *next;
+    writer_op_kind kind;
+    /* Copy held by the op, counted against max_queued_bytes. */
+    size_t bytes;
+    /* WRITER_OP_IMAGE: path and fb are owned copies. */
+    char *path;
+    framebuffer fb;
+    image_format format;
+    image_stream *stream;
+    uint32_t y0, y1;
+    image_write_done_fn done;
+    void *user;
+    double queued_ms;
+} writer_op;
+
+struct image_writer {
+    writer_mutex lock;
+    /* Ops queued, or shutdown. */
+    writer_cond work_cv;
+    /* An op finished. */
+    writer_cond idle_cv;
+    writer_op *head;
+    writer_op *tail;
+    size_t queued_bytes;
+    size_t max_queued_bytes;
+    int busy;
+    int failures;
+    int shutdown;
+    writer_thread thread;
+};
+
+struct image_stream {
+    image_writer *writer;
+    char *path;
+    image_format format;
+    /* Finished tiles are copied here; rgb32 only for float formats. */
+    framebuffer staging;
+    /* Pixels delivered per row; the tile that fills a row queues it. */
+    volatile size_t *row_pixels;
+    /* Writer thread only from here on. */
+    FILE *file;
+    size_t header_bytes;
+    uint8_t *row;
+    uint32_t rows_written;
+    int failed;
+    /* Time spent encoding and writing. */
+    double write_ms;
+};
+
+static void free_op(writer_op *op) {
+    free(op->path);
+    free(op->fb.rgba8);
+    free(op->fb.rgb32);
+    free(op);
+}
+
+static void free_stream(image_stream *s) {
+    free(s->path);
+    free(s->staging.rgba8);
+    free(s->staging.rgb32);
+    free((void*)s->row_pixels);
+    free(s->row);
+    free(s);
+}
+
+static int run_stream_op(writer_op *op) {
+    image_stream *s = op->stream;
+    double start_ms = timer_now_ms();
+    if (op->kind == WRITER_OP_STREAM_OPEN) {
+        char header[EXR_HEADER_MAX];
+        s->header_bytes = format_header(header, sizeof(header), s->format, s->staging.width, s->staging.height);
+        s->file = fopen(s->path, "wb");
+        s->failed = !s->file || fwrite(header, 1, s->header_bytes, s->file) != s->header_bytes;
+        if (!s->failed && s->format == IMAGE_FORMAT_EXR) {
+            /* Uncompressed chunks all have the same size, so the offset table is known up front. */
+            for (uint32_t y = 0; !s->failed && y < s->staging.height; ++y) {
+                uint8_t entry[8];
+                put_u64(entry, row_offset(s->format, s->staging.width, s->staging.height, s->header_bytes, y));
+                s->failed = fwrite(entry, 1, 8, s->file) != 8;
+            }
+        }
+        s->write_ms += timer_now_ms() - start_ms;
+        return !s->failed;
+    }
+    if (op->kind == WRITER_OP_STREAM_ROWS) {
+        if (s->failed) return 0;
+        PROFILE_BEGIN(zone, "image_write");
+        /* PFM runs start at the bottom row of the run. */
+        uint32_t first = s->format == IMAGE_FORMAT_PFM ? op->y1 - 1 : op->y0;
+        size_t offset = row_offset(s->format, s->staging.width, s->staging.height, s->header_bytes, first);
+        s->failed = fseek(s->file, (long)offset, SEEK_SET) != 0 ||
+                    !write_rows(s->file, &s->staging, s->format, op->y0, op->y1, s->row);
+        if (!s->failed) s->rows_written += op->y1 - op->y0;
+        PROFILE_END(zone);
+        s->write_ms += timer_now_ms() - start_ms;
+        return !s->failed;
+    }
+    int ok = !s->failed && s->rows_written == s->staging.height;
+    if (s->file) ok = fclose(s->file) == 0 && ok;
+    s->write_ms += timer_now_ms() - start_ms;
+    if (op->done) op->done(op->user, s->path, ok, s->write_ms);
+    free_stream(s);
+    return ok;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI writer_main(LPVOID param) {
+#else
+static void *writer_main(void *param) {
+#endif
+    image_writer *w = (image_writer*)param;
+    writer_lock(&w->lock);
+    for (;;) {
+        while (!w->head && !w->shutdown) writer_cond_wait(&w->work_cv, &w->lock);
+        if (!w->head) break;
+        writer_op *op = w->head;
+        w->head = op->next;
+        if (!w->head) w->tail = NULL;
+        w->busy = 1;
+        writer_unlock(&w->lock);
+
+        int ok;
+        if (op->kind == WRITER_OP_IMAGE) {
+            double start_ms = timer_now_ms();
+            ok = image_write(op->path, &op->fb, op->format);
+            if (op->done) op->done(op->user, op->path, ok, timer_now_ms() - start_ms);
+        } else {
+            ok = run_stream_op(op);
+        }
+
+        writer_lock(&w->lock);
+        w->queued_bytes -= op->bytes;
+        if (!ok && op->kind != WRITER_OP_STREAM_ROWS) w->failures++;
+        w->busy = 0;
+        writer_cond_broadcast(&w->idle_cv);
+        free_op(op);
+    }
+    writer_unlock(&w->lock);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Takes ownership of op; waits while the copies already queued would exceed the limit. */
+static void enqueue(image_writer *w, writer_op *op) {
+    writer_lock(&w->lock);
+    while (op->bytes > 0 && w->queued_bytes > 0 && w->queued_bytes + op->bytes > w->max_queued_bytes) {
+        writer_cond_wait(&w->idle_cv, &w->lock);
+    }
+    op->next = NULL;
+    if (w->tail) {
+        w->tail->next = op;
+    } else {
+        w->head = op;
+    }
+    w->tail = op;
+    w->queued_bytes += op->bytes;
+    writer_cond_broadcast(&w->work_cv);
+    writer_unlock(&w->lock);
+}
+
+image_writer *image_writer_create(size_t max_queued_bytes) {
+    image_writer *w = (image_writer*)calloc(1, sizeof(image_writer));
+    if (!w) return NULL;
+    w->max_queued_bytes = max_queued_bytes;
+    writer_mutex_init(&w->lock);
+    writer_cond_init(&w->work_cv);
+    writer_cond_init(&w->idle_cv);
+#ifdef _WIN32
+    w->thread = CreateThread(NULL, 0, writer_main, w, 0, NULL);
+    int ok = w->thread != NULL;
+#else
+    int ok = pthread_create(&w->thread, NULL, writer_main, w) == 0;
+#endif
+    if (!ok) {
+        writer_cond_destroy(&w->idle_cv);
+        writer_cond_destroy(&w->work_cv);
+        writer_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int image_writer_flush(image_writer *w) {
+    if (!w) return 0;
+    writer_lock(&w->lock);
+    while (w->head || w->busy) writer_cond_wait(&w->idle_cv, &w->lock);
+    int ok = w->failures == 0;
+    w->failures = 0;
+    writer_unlock(&w->lock);
+    return ok;
+}
+
+void image_writer_destroy(image_writer *w) {
+    if (!w) return;
+    image_writer_flush(w);
+    writer_lock(&w->lock);
+    w->shutdown = 1;
+    writer_cond_broadcast(&w->work_cv);
+    writer_unlock(&w->lock);
+#ifdef _WIN32
+    WaitForSingleObject(w->thread, INFINITE);
+    CloseHandle(w->thread);
+#else
+    pthread_join(w->thread, NULL);
+#endif
+    writer_cond_destroy(&w->idle_cv);
+    writer_cond_destroy(&w->work_cv);
+    writer_mutex_destroy(&w->lock);
+    free(w);
+}
+
+static char *copy_string(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *out = (char*)malloc(n);
+    if (out) memcpy(out, s, n);
+    return out;
+}
+
+int image_writer_submit(image_writer *w, const char *path, const framebuffer *fb, image_format format,
+                        image_write_done_fn done, void *user) {
+    if (!w || !path || !fb || !fb->rgba8 || fb->width == 0 || fb->height == 0) return 0;
+    size_t pixels = (size_t)fb->width * fb->height;
+    /* PPM never reads the float values. */
+    int floats = fb->rgb32 && format != IMAGE_FORMAT_PPM;
+    writer_op *op = (writer_op*)calloc(1, sizeof(writer_op));
+    if (!op) return 0;
+    op->kind = WRITER_OP_IMAGE;
+    op->path = copy_string(path);
+    op->fb.width = fb->width;
+    op->fb.height = fb->height;
+    op->fb.rgba8 = (uint8_t*)malloc(pixels * 4);
+    op->fb.rgb32 = floats ? (float*)malloc(pixels * 3 * sizeof(float)) : NULL;
+    if (!op->path || !op->fb.rgba8 || (floats && !op->fb.rgb32)) {
+        free_op(op);
+        return 0;
+    }
+    memcpy(op->fb.rgba8, fb->rgba8, pixels * 4);
+    if (floats) memcpy(op->fb.rgb32, fb->rgb32, pixels * 3 * sizeof(float));
+    op->bytes = pixels * (4 + (floats ? 3 * sizeof(float) : 0));
+    op->format = format;
+    op->done = done;
+    op->user = user;
+    enqueue(w, op);
+    return 1;
+}
+
+static int queue_stream_op(image_stream *s, writer_op_kind kind, uint32_t y0, uint32_t y1,
+                           image_write_done_fn done, void *user) {
+    writer_op *op = (writer_op*)calloc(1, sizeof(writer_op));
+    if (!op) return 0;
+    op->kind = kind;
+    op->stream = s;
+    op->y0 = y0;
+    op->y1 = y1;
+    op->done = done;
+    op->user = user;
+    enqueue(s->writer, op);
+    return 1;
+}
+
+image_stream *image_writer_open_stream(image_writer *w, const char *path, uint32_t width, uint32_t height,
+                                       image_format format) {
+    if (!w || !path || width == 0 || height == 0) return NULL;
+    size_t pixels = (size_t)width * height;
+    image_stream *s = (image_stream*)calloc(1, sizeof(image_stream));
+    if (!s) return NULL;
+    s->writer = w;
+    s->format = format;
+    s->path = copy_string(path);
+    s->staging.width = width;
+    s->staging.height = height;
+    s->staging.rgba8 = (uint8_t*)malloc(pixels * 4);
+    s->staging.rgb32 = format != IMAGE_FORMAT_PPM ? (float*)malloc(pixels * 3 * sizeof(float)) : NULL;
+    s->row_pixels = (volatile size_t*)calloc(height, sizeof(size_t));
+    s->row = (uint8_t*)malloc(row_bytes(format, width));
+    if (!s->path || !s->staging.rgba8 || (format != IMAGE_FORMAT_PPM && !s->staging.rgb32) || !s->row_pixels ||
+        !s->row || !queue_stream_op(s, WRITER_OP_STREAM_OPEN, 0, 0, NULL, NULL)) {
+        free_stream(s);
+        return NULL;
+    }
+    return s;
+}
+
+void image_stream_tile(image_stream *s, const framebuffer *fb, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    if (!s || !fb || fb->width != s->staging.width || fb->height != s->staging.height || x1 > fb->width ||
+        y1 > fb->height || x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    size_t w = x1 - x0;
+    uint32_t run_start = y1;
+    for (uint32_t y = y0; y < y1; ++y) {
+        size_t first = (size_t)y * fb->width + x0;
+        memcpy(s->staging.rgba8 + first * 4, fb->rgba8 + first * 4, w * 4);
+        if (s->staging.rgb32) {
+            float *dst = s->staging.rgb32 + first * 3;
+            if (fb->rgb32) {
+                memcpy(dst, fb->rgb32 + first * 3, w * 3 * sizeof(float));
+            } else {
+                for (size_t i = 0; i < w; ++i) pixel_rgb(fb, first + i, dst + 3 * i);
+            }
+        }
+        /* The atomic add orders the copy before the row can be queued by whichever tile completes it. */
+        int complete = thread_pool_atomic_add(&s->row_pixels[y], w) + w == s->staging.width;
+        if (complete && run_start == y1) run_start = y;
+        if (!complete && run_start != y1) {
+            queue_stream_op(s, WRITER_OP_STREAM_ROWS, run_start, y, NULL, NULL);
+            run_start = y1;
+        }
+    }
+    if (run_start != y1) queue_stream_op(s, WRITER_OP_STREAM_ROWS, run_start, y1, NULL, NULL);
+}
+
+int image_stream_close(image_stream *s, image_write_done_fn done, void *user) {
+    if (!s) return 0;
+    if (!queue_stream_op(s, WRITER_OP_STREAM_CLOSE, 0, 0, done, user)) {
+        /* Nothing can reach the writer thread any more; rows already queued still reference the stream. */
+        image_writer_flush(s->writer);
+        if (s->file) fclose(s->file);
+        free_stream(s);
+        return 0;
+    }
+    return 1;
+}
@@ -1,5 +1,5 @@
 #include "app.h"
 
-int main(void) {
-    return run_app();
+int main(int argc, char **argv) {
+    return run_app(argc, argv);
 }
@@ -0,0 +1,245 @@
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+#include "timer.h"
+
+int profile_active = 0;
+
+#ifdef RT_PROFILE
+
+#if defined(_MSC_VER)
+#define PROFILE_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILE_THREAD_LOCAL _Thread_local
+#endif
+
+#define PROFILE_MAX_ZONE_NAMES 128
+
+typedef struct {
+    const char *name;
+    double start_ms;
+    double ms;
+} profile_event;
+
+typedef struct {
+    profile_counters counters;
+    profile_event *events;
+    size_t event_count;
+    size_t dropped_events;
+} profile_thread;
+
+static profile_thread threads[PROFILE_MAX_THREADS];
+static volatile size_t thread_count;
+/* Bumped by profile_reset so threads register again instead of keeping stale slots. */
+static uint32_t generation = 1;
+static double epoch_ms;
+
+static PROFILE_THREAD_LOCAL profile_thread *tls_thread;
+static PROFILE_THREAD_LOCAL uint32_t tls_generation;
+/* Set for threads past PROFILE_MAX_THREADS, which share the last slot. */
+static PROFILE_THREAD_LOCAL int tls_shared;
+
+static profile_thread *current_thread(void) {
+    if (tls_thread && tls_generation == generation) return tls_thread;
+    size_t slot = thread_pool_atomic_add(&thread_count, 1);
+    profile_thread *t = &threads[slot < PROFILE_MAX_THREADS ? slot : PROFILE_MAX_THREADS - 1];
+    if (slot < PROFILE_MAX_THREADS && !t->events) {
+        t->events = (profile_event*)malloc(PROFILE_MAX_EVENTS_PER_THREAD * sizeof(profile_event));
+    }
+    tls_thread = t;
+    tls_generation = generation;
+    tls_shared = slot >= PROFILE_MAX_THREADS;
+    return t;
+}
+
+static size_t registered_threads(void) {
+    return thread_count < PROFILE_MAX_THREADS ? thread_count : PROFILE_MAX_THREADS;
+}
+
+void profile_set_enabled(int enabled) {
+    if (enabled && epoch_ms == 0.0) epoch_ms = timer_now_ms();
+    profile_active = enabled;
+}
+
+void profile_reset(void) {
+    for (size_t i = 0; i < PROFILE_MAX_THREADS; ++i) {
+        memset(&threads[i].counters, 0, sizeof(threads[i].counters));
+        threads[i].event_count = 0;
+        threads[i].dropped_events = 0;
+    }
+    thread_count = 0;
+    generation++;
+    epoch_ms = timer_now_ms();
+}
+
+void profile_shutdown(void) {
+    for (size_t i = 0; i < PROFILE_MAX_THREADS; ++i) {
+        free(threads[i].events);
+        threads[i].events = NULL;
+    }
+    profile_reset();
+}
+
+profile_counters *profile_thread_counters(void) {
+    return &current_thread()->counters;
+}
+
+uint64_t profile_thread_cost(void) {
+    if (!profile_active) return 0;
+    const profile_counters *c = profile_thread_counters();
+    return c->values[PROFILE_NODE_VISITS] + c->values[PROFILE_TRIANGLE_TESTS];
+}
+
+profile_zone profile_begin(const char *name) {
+    profile_zone zone = {NULL, 0.0};
+    if (!profile_active) return zone;
+    zone.name = name;
+    zone.start_ms = timer_now_ms();
+    return zone;
+}
+
+void profile_end(const profile_zone *zone) {
+    if (!zone->name) return;
+    double end_ms = timer_now_ms();
+    profile_thread *t = current_thread();
+    /* A shared slot's buffer would be raced on. */
+    if (!t->events || tls_shared || t->event_count >= PROFILE_MAX_EVENTS_PER_THREAD) {
+        t->dropped_events++;
+        return;
+    }
+    t->events[t->event_count++] = (profile_event){zone->name, zone->start_ms, end_ms - zone->start_ms};
+}
+
+void profile_get_totals(profile_counters *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < registered_threads(); ++i) {
+        for (int c = 0; c < PROFILE_COUNTER_COUNT; ++c) out->values[c] += threads[i].counters.values[c];
+    }
+}
+
+static const char *counter_names[PROFILE_COUNTER_COUNT] = {"rays", "node_visits", "triangle_tests", "hits"};
+
+int profile_write_trace(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    fputs("{\"traceEvents\": [\n", f);
+    int first = 1;
+    for (size_t i = 0; i < registered_threads(); ++i) {
+        const profile_thread *t = &threads[i];
+        fprintf(f, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"thread %zu\"}}",
+                first ? "" : ",\n", i, i);
+        first = 0;
+        for (size_t e = 0; e < t->event_count; ++e) {
+            const profile_event *ev = &t->events[e];
+            fprintf(f, ",\n  {\"name\": \"%s\", \"cat\": \"rt\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}",
+                    ev->name, i, (ev->start_ms - epoch_ms) * 1000.0, ev->ms * 1000.0);
+        }
+    }
+    profile_counters totals;
+    profile_get_totals(&totals);
+    fputs("\n],\n\"displayTimeUnit\": \"ms\",\n\"otherData\": {", f);
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; ++c) {
+        fprintf(f, "%s\"%s\": \"%llu\"", c ? ", " : "", counter_names[c], (unsigned long long)totals.values[c]);
+    }
+    fputs("}}\n", f);
+    return fclose(f) == 0;
+}
+
+typedef struct {
+    const char *name;
+    size_t count;
+    double total_ms;
+    double max_ms;
+} zone_summary;
+
+void profile_print_summary(FILE *f) {
+    zone_summary zones[PROFILE_MAX_ZONE_NAMES];
+    size_t zone_count = 0, dropped = 0;
+    for (size_t i = 0; i < registered_threads(); ++i) {
+        const profile_thread *t = &threads[i];
+        dropped += t->dropped_events;
+        for (size_t e = 0; e < t->event_count; ++e) {
+            const profile_event *ev = &t->events[e];
+            size_t z = 0;
+            while (z < zone_count && strcmp(zones[z].name, ev->name) != 0) ++z;
+            if (z == zone_count) {
+                if (zone_count == PROFILE_MAX_ZONE_NAMES) continue;
+                zones[zone_count++] = (zone_summary){ev->name, 0, 0.0, 0.0};
+            }
+            zones[z].count++;
+            zones[z].total_ms += ev->ms;
+            if (ev->ms > zones[z].max_ms) zones[z].max_ms = ev->ms;
+        }
+    }
+
+    fprintf(f, "%-24s %8s %12s %12s %12s\n", "zone", "count", "total ms", "mean ms", "max ms");
+    for (size_t z = 0; z < zone_count; ++z) {
+        fprintf(f, "%-24s %8zu %12.3f %12.3f %12.3f\n", zones[z].name, zones[z].count, zones[z].total_ms,
+                zones[z].total_ms / (double)zones[z].count, zones[z].max_ms);
+    }
+    if (dropped) fprintf(f, "(%zu events dropped)\n", dropped);
+
+    fprintf(f, "%-8s %14s %14s %14s %14s %10s\n", "thread", counter_names[0], counter_names[1], counter_names[2],
+            counter_names[3], "nodes/ray");
+    profile_counters totals;
+    profile_get_totals(&totals);
+    for (size_t i = 0; i <= registered_threads(); ++i) {
+        const profile_counters *c = i < registered_threads() ? &threads[i].counters : &totals;
+        const uint64_t *v = c->values;
+        char label[24];
+        if (i < registered_threads()) snprintf(label, sizeof(label), "%zu", i);
+        else snprintf(label, sizeof(label), "total");
+        fprintf(f, "%-8s %14llu %14llu %14llu %14llu %10.2f\n", label, (unsigned long long)v[PROFILE_RAYS],
+                (unsigned long long)v[PROFILE_NODE_VISITS], (unsigned long long)v[PROFILE_TRIANGLE_TESTS],
+                (unsigned long long)v[PROFILE_HITS],
+                v[PROFILE_RAYS] ? (double)v[PROFILE_NODE_VISITS] / (double)v[PROFILE_RAYS] : 0.0);
+    }
+}
+
+#else
+
+void profile_set_enabled(int enabled) {
+    (void)enabled;
+}
+
+void profile_reset(void) {
+}
+
+void profile_shutdown(void) {
+}
+
+profile_counters *profile_thread_counters(void) {
+    static profile_counters unused;
+    return &unused;
+}
+
+uint64_t profile_thread_cost(void) {
+    return 0;
+}
+
+profile_zone profile_begin(const char *name) {
+    (void)name;
+    return (profile_zone){NULL, 0.0};
+}
+
+void profile_end(const profile_zone *zone) {
+    (void)zone;
+}
+
+void profile_get_totals(profile_counters *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+int profile_write_trace(const char *path) {
+    (void)path;
+    return 0;
+}
+
+void profile_print_summary(FILE *f) {
+    fputs("Profiling is compiled out (configure with -DENABLE_PROFILING=ON).\n", f);
+}
+
+#endif
@@ -0,0 +1,340 @@
+#include "render_sequence.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_write.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+/* Widest field the output pattern may give the frame number; frame numbers take at most 10 digits. */
+#define SEQUENCE_MAX_FRAME_WIDTH 20u
+
+void render_sequence_options_default(render_sequence_options *opts) {
+    opts->frame_count = 1;
+    opts->width = 640;
+    opts->height = 360;
+    opts->fps = 24.0f;
+    opts->camera_keys = NULL;
+    opts->camera_key_count = 0;
+    opts->mesh_keys = NULL;
+    opts->mesh_key_count = 0;
+    opts->update = NULL;
+    opts->update_user = NULL;
+    opts->max_sah_growth = 1.5f;
+    opts->output_pattern = "frame_%04u.ppm";
+    opts->log = NULL;
+}
+
+static vec3 lerp3(vec3 a, vec3 b, float w) {
+    return vec3_add(a, vec3_mul(vec3_sub(b, a), w));
+}
+
+static render_camera camera_at(const render_sequence_options *opts, const render_camera *fixed, float time) {
+    const render_camera_key *keys = opts->camera_keys;
+    size_t n = opts->camera_key_count;
+    if (n == 0) return *fixed;
+    if (time <= keys[0].time) return keys[0].camera;
+    size_t next = 1;
+    while (next < n && keys[next].time <= time) ++next;
+    if (next == n) return keys[n - 1].camera;
+    const render_camera *a = &keys[next - 1].camera, *b = &keys[next].camera;
+    float span = keys[next].time - keys[next - 1].time;
+    float w = span > 0.0f ? (time - keys[next - 1].time) / span : 1.0f;
+    render_camera c;
+    c.position = lerp3(a->position, b->position, w);
+    c.target = lerp3(a->target, b->target, w);
+    c.up = lerp3(a->up, b->up, w);
+    c.focal_length = a->focal_length + (b->focal_length - a->focal_length) * w;
+    return c;
+}
+
+/* a applied after b. */
+static transform3x4 transform3x4_mul(const transform3x4 *a, const transform3x4 *b) {
+    transform3x4 out;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            out.m[r][c] = a->m[r][0] * b->m[0][c] + a->m[r][1] * b->m[1][c] + a->m[r][2] * b->m[2][c];
+        }
+        out.m[r][3] += a->m[r][3];
+    }
+    return out;
+}
+
+static transform3x4 key_transform(const render_mesh_key *k, vec3 pivot) {
+    float cx = cosf(k->rotation.x), sx = sinf(k->rotation.x);
+    float cy = cosf(k->rotation.y), sy = sinf(k->rotation.y);
+    float cz = cosf(k->rotation.z), sz = sinf(k->rotation.z);
+    /* Rz * Ry * Rx, scaled. */
+    float l[3][3] = {{cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx},
+                     {sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx},
+                     {-sy, cy * sx, cy * cx}};
+    transform3x4 t;
+    const float p[3] = {pivot.x, pivot.y, pivot.z};
+    const float move[3] = {k->translation.x, k->translation.y, k->translation.z};
+    for (int r = 0; r < 3; ++r) {
+        t.m[r][3] = p[r] + move[r];
+        for (int c = 0; c < 3; ++c) {
+            t.m[r][c] = l[r][c] * k->scale;
+            t.m[r][3] -= t.m[r][c] * p[c];
+        }
+    }
+    return t;
+}
+
+/* Motion of mesh m at time; identity for meshes without keys. */
+static transform3x4 mesh_motion(const render_sequence_options *opts, uint32_t m, vec3 pivot, float time) {
+    const render_mesh_key *before = NULL, *after = NULL;
+    for (size_t i = 0; i < opts->mesh_key_count; ++i) {
+        const render_mesh_key *k = &opts->mesh_keys[i];
+        if (k->mesh_index != m) continue;
+        if (k->time <= time) {
+            before = k;
+        } else {
+            after = k;
+            break;
+        }
+    }
+    if (!before && !after) return transform3x4_identity();
+    if (!before || !after) return key_transform(before ? before : after, pivot);
+    float span = after->time - before->time;
+    float w = span > 0.0f ? (time - before->time) / span : 1.0f;
+    render_mesh_key k;
+    k.translation = lerp3(before->translation, after->translation, w);
+    k.rotation = lerp3(before->rotation, after->rotation, w);
+    k.scale = before->scale + (after->scale - before->scale) * w;
+    return key_transform(&k, pivot);
+}
+
+typedef struct {
+    const render_sequence_options *opts;
+    scene *s;
+    /* The scene as rendered when meshes move: s with instances replaced by animated. */
+    scene view;
+    mesh_instance *animated;
+    mesh_instance *previous;
+    size_t capacity;
+    vec3 *pivots;
+} sequence_state;
+
+/* Places every instance of s (one identity instance per mesh without any) with its mesh's motion;
+ * returns 1 when a placement differs from the last frame's. */
+static int animate_instances(sequence_state *st, float time) {
+    scene *s = st->s;
+    size_t n = s->instance_count ? s->instance_count : s->mesh_count;
+    if (n > st->capacity) {
+        mesh_instance *animated = (mesh_instance*)realloc(st->animated, n * sizeof(mesh_instance));
+        if (animated) st->animated = animated;
+        mesh_instance *previous = animated ? (mesh_instance*)realloc(st->previous, n * sizeof(mesh_instance)) : NULL;
+        if (previous) st->previous = previous;
+        if (!animated || !previous) return -1;
+        st->capacity = n;
+    }
+    int changed = n != st->view.instance_count;
+    if (!changed) memcpy(st->previous, st->animated, n * sizeof(mesh_instance));
+    for (size_t i = 0; i < n; ++i) {
+        mesh_instance base = s->instance_count ? s->instances[i]
+                                               : (mesh_instance){transform3x4_identity(), (uint32_t)i, 0xffu};
+        mesh_instance *out = &st->animated[i];
+        *out = base;
+        if (base.mesh_index < s->mesh_count) {
+            transform3x4 motion = mesh_motion(st->opts, base.mesh_index, st->pivots[base.mesh_index], time);
+            out->transform = transform3x4_mul(&base.transform, &motion);
+        }
+    }
+    if (!changed) changed = memcmp(st->previous, st->animated, n * sizeof(mesh_instance)) != 0;
+    st->view = *s;
+    st->view.instances = st->animated;
+    st->view.instance_count = n;
+    return changed;
+}
+
+static vec3 mesh_center(const mesh *me) {
+    vec3 lo = {INFINITY, INFINITY, INFINITY}, hi = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t v = 0; v < me->vertex_count; ++v) {
+        vec3 p = mesh_position(me, (uint32_t)v);
+        lo = (vec3){fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z)};
+        hi = (vec3){fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z)};
+    }
+    return me->vertex_count ? vec3_mul(vec3_add(lo, hi), 0.5f) : (vec3){0.0f, 0.0f, 0.0f};
+}
+
+static int two_level_for(const bvh *tree, const scene *s) {
+    return tree->blas && s->instance_count > 0 && tree->blas_count == s->mesh_count;
+}
+
+int render_sequence_pattern_valid(const char *pattern) {
+    if (!pattern) return 0;
+    int conversions = 0;
+    for (const char *p = pattern; *p; ++p) {
+        if (*p != '%') continue;
+        if (*++p == '%') continue;
+        while (*p == '0') ++p;
+        uint32_t width = 0;
+        for (; *p >= '0' && *p <= '9'; ++p) {
+            width = width * 10 + (uint32_t)(*p - '0');
+            if (width > SEQUENCE_MAX_FRAME_WIDTH) return 0;
+        }
+        if ((*p != 'u' && *p != 'd') || ++conversions > 1) return 0;
+    }
+    return conversions == 1;
+}
+
+int render_sequence_run(scene *s, bvh *tree, const render_settings *settings, const render_sequence_options *opts,
+                        render_sequence_stats *stats) {
+    render_sequence_stats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    if (!s || !tree || tree->scene_ref != s || !settings || !opts || opts->frame_count == 0 || opts->fps <= 0.0f ||
+        opts->width == 0 || opts->height == 0 || !render_sequence_pattern_valid(opts->output_pattern)) {
+        return 0;
+    }
+
+    /* Everything that does not depend on the frame is set up once. */
+    thread_pool *pool = settings->pool;
+    if (!pool) {
+        uint32_t threads = settings->worker_count ? settings->worker_count : thread_pool_hardware_concurrency();
+        pool = threads > 1 ? thread_pool_create(threads - 1) : NULL;
+    }
+    thread_pool *owned_pool = settings->pool ? NULL : pool;
+    arena local_frame;
+    arena *frame = settings->frame_arena;
+    if (!frame) {
+        arena_init(&local_frame, 0);
+        frame = &local_frame;
+    }
+    bvh_build_options build_opts = settings->bvh;
+    if (!build_opts.pool) build_opts.pool = pool;
+
+    image_format format = image_format_from_path(opts->output_pattern);
+    size_t pixels = (size_t)opts->width * opts->height;
+    framebuffer fb = {opts->width, opts->height, (uint8_t*)calloc(pixels * 4, 1), NULL};
+    if (format != IMAGE_FORMAT_PPM) fb.rgb32 = (float*)calloc(pixels * 3, sizeof(float));
+    /* Two frames may queue, so the writer never holds up more than one render. */
+    image_writer *writer = image_writer_create(2 * pixels * (4 + (fb.rgb32 ? 3 * sizeof(float) : 0)));
+    /* The one conversion prints at most SEQUENCE_MAX_FRAME_WIDTH characters. */
+    size_t path_bytes = strlen(opts->output_pattern) + SEQUENCE_MAX_FRAME_WIDTH + 1;
+    char *path = (char*)malloc(path_bytes);
+
+    sequence_state st;
+    memset(&st, 0, sizeof(st));
+    st.opts = opts;
+    st.s = s;
+    int moving = opts->mesh_key_count > 0;
+    if (moving) st.pivots = (vec3*)malloc((s->mesh_count ? s->mesh_count : 1) * sizeof(vec3));
+    for (size_t m = 0; st.pivots && m < s->mesh_count; ++m) st.pivots[m] = mesh_center(&s->meshes[m]);
+
+    bvh local_tree;
+    memset(&local_tree, 0, sizeof(local_tree));
+    bvh *active = tree;
+    int ok = fb.rgba8 && (format == IMAGE_FORMAT_PPM || fb.rgb32) && writer && path && (!moving || st.pivots);
+    int geometry_changed = 0;
+    double start_ms = timer_now_ms();
+    for (uint32_t i = 0; ok && i < opts->frame_count; ++i) {
+        float time = (float)i / opts->fps;
+        double update_ms = timer_now_ms();
+        PROFILE_BEGIN(update_zone, "sequence_update");
+        uint32_t changed = opts->update ? opts->update(opts->update_user, s, i, time) : 0;
+        geometry_changed |= (changed & RENDER_SEQUENCE_GEOMETRY) != 0;
+        int instances_dirty = (changed & RENDER_SEQUENCE_INSTANCES) != 0;
+        const scene *target = s;
+        const char *work = "none";
+        if (moving) {
+            int moved = animate_instances(&st, time);
+            ok = moved >= 0;
+            instances_dirty |= moved > 0;
+            target = &st.view;
+            /* Moving meshes need per-mesh trees under a top level that can be rebuilt alone. */
+            if (ok && active == tree && !two_level_for(tree, target)) {
+                ok = bvh_build_with_options(&local_tree, target, &build_opts);
+                active = &local_tree;
+                stats->rebuilds++;
+                instances_dirty = 0;
+                work = "two-level build";
+            }
+        }
+        if (ok && active->scene_ref != target) instances_dirty = 1;
+        if (ok && (changed & RENDER_SEQUENCE_GEOMETRY)) {
+            bvh_update_result r = bvh_update(active, target, &build_opts, opts->max_sah_growth);
+            ok = r != BVH_UPDATE_FAILED;
+            work = r == BVH_UPDATE_REBUILT ? "rebuild" : "refit";
+            if (r == BVH_UPDATE_REBUILT) stats->rebuilds++;
+            if (r == BVH_UPDATE_REFIT) stats->refits++;
+        } else if (ok && instances_dirty) {
+            if (two_level_for(active, target)) {
+                ok = bvh_update_instances(active, target, pool);
+                stats->top_level_updates++;
+                work = "top level";
+            } else {
+                /* The instance set changed shape (e.g. the hook added the first instances). */
+                bvh_destroy(&local_tree);
+                ok = bvh_build_with_options(&local_tree, target, &build_opts);
+                active = &local_tree;
+                stats->rebuilds++;
+                work = "rebuild";
+            }
+        }
+        PROFILE_END(update_zone);
+        double render_start_ms = timer_now_ms();
+        stats->update_ms += render_start_ms - update_ms;
+        if (!ok) {
+            fprintf(stderr, "Frame %u: scene update failed\n", i);
+            break;
+        }
+
+        render_settings frame_settings = *settings;
+        frame_settings.pool = pool;
+        frame_settings.frame_arena = frame;
+        frame_settings.prebuilt_bvh = active;
+        frame_settings.camera = camera_at(opts, &settings->camera, time);
+        frame_settings.quiet = 1;
+        ok = render_software_ex(target, &fb, &frame_settings);
+        double render_end_ms = timer_now_ms();
+        stats->render_ms += render_end_ms - render_start_ms;
+        if (!ok) {
+            fprintf(stderr, "Frame %u: rendering failed\n", i);
+            break;
+        }
+
+        /* Returns once the copy is queued; the write overlaps the next frame. */
+        snprintf(path, path_bytes, opts->output_pattern, i);
+        ok = image_writer_submit(writer, path, &fb, format, NULL, NULL);
+        stats->write_wait_ms += timer_now_ms() - render_end_ms;
+        stats->frames++;
+        if (opts->log) {
+            fprintf(opts->log, "  frame %u/%u t=%.3f s: update %.3f ms (BVH: %s), render %.3f ms -> %s\n", i + 1,
+                    opts->frame_count, time, render_start_ms - update_ms, work, render_end_ms - render_start_ms, path);
+        }
+    }
+    if (writer) {
+        double flush_ms = timer_now_ms();
+        if (!image_writer_flush(writer)) {
+            fprintf(stderr, "Failed to write some frames of %s\n", opts->output_pattern);
+            ok = 0;
+        }
+        stats->write_wait_ms += timer_now_ms() - flush_ms;
+    }
+    stats->total_ms = timer_now_ms() - start_ms;
+    stats->frames_per_hour = stats->total_ms > 0.0 ? (double)stats->frames * 3600000.0 / stats->total_ms : 0.0;
+
+    /* Leave the caller's tree describing s again. */
+    if (active == tree && tree->scene_ref != s && two_level_for(tree, s)) {
+        if (!bvh_update_instances(tree, s, pool)) ok = 0;
+    } else if (active != tree && geometry_changed) {
+        if (bvh_update(tree, s, &build_opts, opts->max_sah_growth) == BVH_UPDATE_FAILED) ok = 0;
+    }
+
+    bvh_destroy(&local_tree);
+    image_writer_destroy(writer);
+    free(path);
+    free(st.animated);
+    free(st.previous);
+    free(st.pivots);
+    free(fb.rgba8);
+    free(fb.rgb32);
+    if (frame == &local_frame) arena_destroy(&local_frame);
+    thread_pool_destroy(owned_pool);
+    return ok;
+}
@@ -0,0 +1,591 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "render_server.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "app.h"
+#include "bvh.h"
+#include "image_write.h"
+#include "software_rt.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION server_mutex;
+typedef CONDITION_VARIABLE server_cond;
+typedef HANDLE server_thread;
+static void server_mutex_init(server_mutex *m) { InitializeCriticalSection(m); }
+static void server_mutex_destroy(server_mutex *m) { DeleteCriticalSection(m); }
+static void server_lock(server_mutex *m) { EnterCriticalSection(m); }
+static void server_unlock(server_mutex *m) { LeaveCriticalSection(m); }
+static void server_cond_init(server_cond *c) { InitializeConditionVariable(c); }
+static void server_cond_destroy(server_cond *c) { (void)c; }
+static void server_cond_wait(server_cond *c, server_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void server_cond_broadcast(server_cond *c) { WakeAllConditionVariable(c); }
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef pthread_mutex_t server_mutex;
+typedef pthread_cond_t server_cond;
+typedef pthread_t server_thread;
+static void server_mutex_init(server_mutex *m) { pthread_mutex_init(m, NULL); }
+static void server_mutex_destroy(server_mutex *m) { pthread_mutex_destroy(m); }
+static void server_lock(server_mutex *m) { pthread_mutex_lock(m); }
+static void server_unlock(server_mutex *m) { pthread_mutex_unlock(m); }
+static void server_cond_init(server_cond *c) { pthread_cond_init(c, NULL); }
+static void server_cond_destroy(server_cond *c) { pthread_cond_destroy(c); }
+static void server_cond_wait(server_cond *c, server_mutex *m) { pthread_cond_wait(c, m); }
+static void server_cond_broadcast(server_cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+#define SERVER_LINE_BYTES 4096
+#define SERVER_ID_BYTES 64
+#define SERVER_MAX_EXTENT 16384u
+/* Frame copies waiting for the writer thread; jobs finishing beyond this wait to hand theirs over. */
+#define SERVER_WRITE_QUEUE_BYTES ((size_t)256 * 1024 * 1024)
+
+/* A resident scene. Only the dispatcher thread looks scenes up, loads, renders and evicts them; the
+ * scene of the job being dispatched is never evicted. */
+typedef struct server_scene {
+    /* NULL for the demo scene. */
+    char *path;
+    uint32_t instances;
+    scene s;
+    bvh tree;
+    size_t bytes;
+    size_t users;
+    uint64_t last_used;
+    struct server_scene *next;
+} server_scene;
+
+struct server_job;
+
+typedef struct {
+    render_server_options opts;
+    thread_pool *pool;
+    /* Encodes and writes finished frames, and replies for them, while the pool renders on. */
+    image_writer *writer;
+    /* Dispatcher thread state: jobs queued by the reading thread, run one at a time in order. */
+    server_mutex queue_lock;
+    /* Jobs queued, or shutdown. */
+    server_cond work_cv;
+    /* A job finished. */
+    server_cond idle_cv;
+    struct server_job *head;
+    struct server_job *tail;
+    int busy;
+    int shutdown;
+    server_thread dispatcher;
+    /* Dispatcher thread only. */
+    server_scene *scenes;
+    size_t resident_bytes;
+    uint64_t clock;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    volatile size_t jobs;
+    volatile size_t failed;
+} render_server;
+
+/* Reply stream of one connection (or stdout); the reading, dispatcher and writer threads reply under lock. */
+typedef struct {
+    FILE *out;
+    server_mutex lock;
+} server_client;
+
+typedef enum {
+    SERVER_JOB_RENDER = 0,
+    SERVER_JOB_STATS = 1
+} server_job_kind;
+
+typedef struct server_job {
+    server_job_kind kind;
+    render_server *server;
+    server_client *client;
+    char *scene_path;
+    uint32_t instances;
+    server_scene *entry;
+    char id[SERVER_ID_BYTES];
+    char *out_path;
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    float error;
+    render_camera camera;
+    int loaded;
+    double load_ms;
+    double render_ms;
+    struct server_job *next;
+} server_job;
+
+void render_server_options_default(render_server_options *opts) {
+    opts->socket_path = NULL;
+    opts->worker_count = 0;
+    opts->cache_bytes = (size_t)1024 * 1024 * 1024;
+    opts->layout = MESH_LAYOUT_SOA;
+    opts->bvh_cache_dir = NULL;
+}
+
+static void reply(server_client *client, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    server_lock(&client->lock);
+    vfprintf(client->out, format, args);
+    fputc('\n', client->out);
+    fflush(client->out);
+    server_unlock(&client->lock);
+    va_end(args);
+}
+
+static char *copy_string(const char *s) {
+    size_t bytes = strlen(s) + 1;
+    char *copy = (char*)malloc(bytes);
+    if (copy) memcpy(copy, s, bytes);
+    return copy;
+}
+
+static size_t load_size(volatile size_t *value) {
+    return thread_pool_atomic_add(value, 0);
+}
+
+static void destroy_entry(server_scene *e) {
+    bvh_destroy(&e->tree);
+    destroy_scene(&e->s);
+    free(e->path);
+    free(e);
+}
+
+/* Drops idle scenes, least recently used first, until the resident set fits the budget. */
+static void evict(render_server *server) {
+    while (server->resident_bytes > server->opts.cache_bytes) {
+        server_scene **victim = NULL;
+        for (server_scene **e = &server->scenes; *e; e = &(*e)->next) {
+            if ((*e)->users == 0 && (!victim || (*e)->last_used < (*victim)->last_used)) victim = e;
+        }
+        if (!victim) return;
+        server_scene *e = *victim;
+        *victim = e->next;
+        server->resident_bytes -= e->bytes;
+        server->evictions++;
+        fprintf(stderr, "Evicted %s (%.1f MB)\n", e->path ? e->path : "demo scene", (double)e->bytes / (1024.0 * 1024.0));
+        destroy_entry(e);
+    }
+}
+
+/* Returns the scene in use by one more job, loading it on a miss. */
+static server_scene *acquire_scene(render_server *server, const char *path, uint32_t instances, int *loaded, double *load_ms) {
+    *loaded = 0;
+    *load_ms = 0.0;
+    for (server_scene *e = server->scenes; e; e = e->next) {
+        int same = path ? e->path && strcmp(e->path, path) == 0 : !e->path;
+        if (!same || e->instances != instances) continue;
+        e->users++;
+        e->last_used = ++server->clock;
+        server->hits++;
+        return e;
+    }
+
+    server->misses++;
+    server_scene *e = (server_scene*)calloc(1, sizeof(server_scene));
+    if (!e || (path && !(e->path = copy_string(path)))) {
+        free(e);
+        return NULL;
+    }
+    double start_ms = timer_now_ms();
+    /* Paths come from clients, so every file is validated: a corrupt one fails its request rather
+     * than the server, and never enters the cache. */
+    app_scene_options load_opts = {path, server->opts.layout, instances, server->opts.bvh_cache_dir, server->pool, NULL, 1};
+    if (!app_load_scene(&load_opts, &e->s, &e->tree)) {
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    *loaded = 1;
+    *load_ms = timer_now_ms() - start_ms;
+    e->instances = instances;
+    for (size_t i = 0; i < e->s.mesh_count; ++i) e->bytes += mesh_geometry_bytes(&e->s.meshes[i]);
+    e->bytes += bvh_memory_bytes(&e->tree);
+    e->users = 1;
+    e->last_used = ++server->clock;
+    e->next = server->scenes;
+    server->scenes = e;
+    server->resident_bytes += e->bytes;
+    evict(server);
+    fprintf(stderr, "Loaded %s: %.1f MB in %.1f ms, %.1f MB resident\n", path ? path : "demo scene",
+            (double)e->bytes / (1024.0 * 1024.0), *load_ms, (double)server->resident_bytes / (1024.0 * 1024.0));
+    return e;
+}
+
+static void free_job(server_job *job) {
+    free(job->scene_path);
+    free(job->out_path);
+    free(job);
+}
+
+/* Runs on the writer thread. */
+static void job_written(void *user, const char *path, int ok, double write_ms) {
+    server_job *job = (server_job*)user;
+    if (ok) {
+        thread_pool_atomic_add(&job->server->jobs, 1);
+        reply(job->client, "ok id=%s out=%s scene=%s load_ms=%.3f render_ms=%.3f write_ms=%.3f", job->id, path,
+              job->loaded ? "loaded" : "resident", job->load_ms, job->render_ms, write_ms);
+    } else {
+        thread_pool_atomic_add(&job->server->failed, 1);
+        reply(job->client, "error id=%s cannot write output", job->id);
+    }
+    free_job(job);
+}
+
+static void reply_stats(render_server *server, server_client *client) {
+    size_t count = 0;
+    for (server_scene *e = server->scenes; e; e = e->next) count++;
+    reply(client, "stats scenes=%zu resident_mb=%.1f hits=%zu misses=%zu evictions=%zu jobs=%zu failed=%zu", count,
+          (double)server->resident_bytes / (1024.0 * 1024.0), server->hits, server->misses, server->evictions,
+          load_size(&server->jobs), load_size(&server->failed));
+}
+
+/* Runs on the dispatcher thread, the only thread outside the pool that waits on it, so a job's
+ * render never picks up another job and tile scratch slots are never shared. */
+static void run_job(server_job *job) {
+    render_server *server = job->server;
+    if (job->kind == SERVER_JOB_STATS) {
+        reply_stats(server, job->client);
+        free_job(job);
+        return;
+    }
+    job->entry = acquire_scene(server, job->scene_path, job->instances, &job->loaded, &job->load_ms);
+    if (!job->entry) {
+        thread_pool_atomic_add(&server->failed, 1);
+        reply(job->client, "error id=%s cannot load scene", job->id);
+        free_job(job);
+        return;
+    }
+
+    image_format format = image_format_from_path(job->out_path);
+    size_t pixels = (size_t)job->width * job->height;
+    framebuffer fb = {job->width, job->height, (uint8_t*)calloc(pixels * 4, 1), NULL};
+    if (format != IMAGE_FORMAT_PPM) fb.rgb32 = (float*)calloc(pixels * 3, sizeof(float));
+    render_settings settings;
+    render_settings_default(&settings);
+    settings.pool = server->pool;
+    settings.prebuilt_bvh = &job->entry->tree;
+    settings.camera = job->camera;
+    settings.quiet = 1;
+    if (job->spp > 1) {
+        settings.progressive.max_samples = job->spp;
+        settings.progressive.target_error = job->error;
+    }
+
+    double start_ms = timer_now_ms();
+    int rendered = fb.rgba8 && (format == IMAGE_FORMAT_PPM || fb.rgb32) && render_software_ex(&job->entry->s, &fb, &settings);
+    job->render_ms = timer_now_ms() - start_ms;
+    job->entry->users--;
+    /* The writer takes a copy, so the next job renders while this frame is written. */
+    int queued = rendered && image_writer_submit(server->writer, job->out_path, &fb, format, job_written, job);
+    free(fb.rgba8);
+    free(fb.rgb32);
+    if (!queued) {
+        thread_pool_atomic_add(&server->failed, 1);
+        reply(job->client, "error id=%s %s", job->id, rendered ? "cannot write output" : "render failed");
+        free_job(job);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI dispatcher_main(LPVOID param) {
+#else
+static void *dispatcher_main(void *param) {
+#endif
+    render_server *server = (render_server*)param;
+    server_lock(&server->queue_lock);
+    for (;;) {
+        while (!server->head && !server->shutdown) server_cond_wait(&server->work_cv, &server->queue_lock);
+        if (!server->head) break;
+        server_job *job = server->head;
+        server->head = job->next;
+        if (!server->head) server->tail = NULL;
+        server->busy = 1;
+        server_unlock(&server->queue_lock);
+
+        run_job(job);
+
+        server_lock(&server->queue_lock);
+        server->busy = 0;
+        server_cond_broadcast(&server->idle_cv);
+    }
+    server_unlock(&server->queue_lock);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+static void dispatch(render_server *server, server_job *job) {
+    server_lock(&server->queue_lock);
+    job->next = NULL;
+    if (server->tail) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    server_cond_broadcast(&server->work_cv);
+    server_unlock(&server->queue_lock);
+}
+
+/* Waits until every queued job has been dispatched. */
+static void dispatch_wait(render_server *server) {
+    server_lock(&server->queue_lock);
+    while (server->head || server->busy) server_cond_wait(&server->idle_cv, &server->queue_lock);
+    server_unlock(&server->queue_lock);
+}
+
+static int dispatcher_start(render_server *server) {
+    server_mutex_init(&server->queue_lock);
+    server_cond_init(&server->work_cv);
+    server_cond_init(&server->idle_cv);
+#ifdef _WIN32
+    server->dispatcher = CreateThread(NULL, 0, dispatcher_main, server, 0, NULL);
+    int ok = server->dispatcher != NULL;
+#else
+    int ok = pthread_create(&server->dispatcher, NULL, dispatcher_main, server) == 0;
+#endif
+    if (!ok) {
+        server_cond_destroy(&server->idle_cv);
+        server_cond_destroy(&server->work_cv);
+        server_mutex_destroy(&server->queue_lock);
+    }
+    return ok;
+}
+
+static void dispatcher_stop(render_server *server) {
+    dispatch_wait(server);
+    server_lock(&server->queue_lock);
+    server->shutdown = 1;
+    server_cond_broadcast(&server->work_cv);
+    server_unlock(&server->queue_lock);
+#ifdef _WIN32
+    WaitForSingleObject(server->dispatcher, INFINITE);
+    CloseHandle(server->dispatcher);
+#else
+    pthread_join(server->dispatcher, NULL);
+#endif
+    server_cond_destroy(&server->idle_cv);
+    server_cond_destroy(&server->work_cv);
+    server_mutex_destroy(&server->queue_lock);
+}
+
+static int parse_vec3(const char *s, vec3 *out) {
+    return sscanf(s, "%f,%f,%f", &out->x, &out->y, &out->z) == 3;
+}
+
+/* Parses a render request's words into job and returns NULL, or the message of the first bad word. */
+static const char *parse_render(server_job *job) {
+    char *word;
+    while ((word = strtok(NULL, " \t\r\n")) != NULL) {
+        char *value = strchr(word, '=');
+        if (!value) return "expected key=value";
+        *value++ = '\0';
+        int ok = 1;
+        if (strcmp(word, "id") == 0) {
+            snprintf(job->id, sizeof(job->id), "%s", value);
+        } else if (strcmp(word, "scene") == 0) {
+            free(job->scene_path);
+            ok = (job->scene_path = copy_string(value)) != NULL;
+        } else if (strcmp(word, "out") == 0) {
+            free(job->out_path);
+            ok = (job->out_path = copy_string(value)) != NULL;
+        } else if (strcmp(word, "width") == 0) {
+            job->width = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(word, "height") == 0) {
+            job->height = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(word, "spp") == 0) {
+            job->spp = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(word, "error") == 0) {
+            job->error = (float)atof(value);
+        } else if (strcmp(word, "instances") == 0) {
+            job->instances = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(word, "camera") == 0) {
+            ok = parse_vec3(value, &job->camera.position);
+        } else if (strcmp(word, "target") == 0) {
+            ok = parse_vec3(value, &job->camera.target);
+        } else if (strcmp(word, "up") == 0) {
+            ok = parse_vec3(value, &job->camera.up);
+        } else if (strcmp(word, "focal") == 0) {
+            job->camera.focal_length = (float)atof(value);
+            ok = job->camera.focal_length > 0.0f;
+        } else {
+            return "unknown key";
+        }
+        if (!ok) return "bad value";
+    }
+    if (!job->out_path) return "missing out";
+    if (job->width == 0 || job->height == 0 || job->width > SERVER_MAX_EXTENT || job->height > SERVER_MAX_EXTENT) {
+        return "bad resolution";
+    }
+    return NULL;
+}
+
+/* Handles one request line; returns 0 for quit. */
+static int handle_request(render_server *server, server_client *client, char *line, size_t *sequence) {
+    char *command = strtok(line, " \t\r\n");
+    if (!command) return 1;
+    if (strcmp(command, "quit") == 0) return 0;
+
+    server_job *job = (server_job*)calloc(1, sizeof(server_job));
+    if (!job) {
+        reply(client, "error id=%zu out of memory", *sequence);
+        return 1;
+    }
+    render_settings defaults;
+    render_settings_default(&defaults);
+    job->server = server;
+    job->client = client;
+    job->width = 640;
+    job->height = 360;
+    job->spp = 1;
+    job->camera = defaults.camera;
+    snprintf(job->id, sizeof(job->id), "%zu", (*sequence)++);
+    const char *problem = NULL;
+    if (strcmp(command, "stats") == 0) {
+        /* Queued like a job, so its scene counters include every request before it. */
+        job->kind = SERVER_JOB_STATS;
+    } else {
+        problem = strcmp(command, "render") == 0 ? parse_render(job) : "unknown command";
+    }
+    if (problem) {
+        thread_pool_atomic_add(&server->failed, 1);
+        reply(client, "error id=%s %s", job->id, problem);
+        free_job(job);
+        return 1;
+    }
+    dispatch(server, job);
+    return 1;
+}
+
+/* Reads requests until end of input or quit, then waits for the stream's jobs; returns 0 after quit. */
+static int serve_stream(render_server *server, FILE *in, FILE *out) {
+    server_client client;
+    client.out = out;
+    server_mutex_init(&client.lock);
+    char line[SERVER_LINE_BYTES];
+    size_t sequence = 0;
+    int running = 1;
+    while (running && fgets(line, sizeof(line), in)) {
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {
+            }
+            reply(&client, "error id=%zu request too long", sequence++);
+            continue;
+        }
+        running = handle_request(server, &client, line, &sequence);
+    }
+    dispatch_wait(server);
+    /* The last replies come from the writer thread. */
+    image_writer_flush(server->writer);
+    server_mutex_destroy(&client.lock);
+    return running;
+}
+
+#ifndef _WIN32
+static int serve_socket(render_server *server, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 0;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+    /* Only a stale socket from an earlier run is replaced; any other file is left alone. */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Not a socket, refusing to replace: %s\n", path);
+            return 0;
+        }
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        fprintf(stderr, "Cannot listen on %s\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    /* A client that hangs up early must not kill the server on the next reply. */
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Listening on %s\n", path);
+
+    int running = 1;
+    while (running) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int conn_out = dup(conn);
+        FILE *in = fdopen(conn, "r");
+        FILE *out = conn_out >= 0 ? fdopen(conn_out, "w") : NULL;
+        if (in && out) running = serve_stream(server, in, out);
+        if (in) fclose(in);
+        else close(conn);
+        if (out) fclose(out);
+        else if (conn_out >= 0) close(conn_out);
+    }
+    close(fd);
+    unlink(path);
+    return 1;
+}
+#endif
+
+int render_server_run(const render_server_options *opts) {
+    render_server server;
+    memset(&server, 0, sizeof(server));
+    server.opts = *opts;
+    /* The reading and dispatcher threads mostly wait, so every hardware thread gets a worker. */
+    uint32_t workers = opts->worker_count ? opts->worker_count : thread_pool_hardware_concurrency();
+    server.pool = thread_pool_create(workers ? workers : 1);
+    server.writer = image_writer_create(SERVER_WRITE_QUEUE_BYTES);
+    if (!server.pool || !server.writer || !dispatcher_start(&server)) {
+        thread_pool_destroy(server.pool);
+        image_writer_destroy(server.writer);
+        return 0;
+    }
+
+    int ok = 1;
+    if (opts->socket_path) {
+#ifdef _WIN32
+        fprintf(stderr, "Unix sockets are not supported on this platform; serve stdin instead\n");
+        ok = 0;
+#else
+        ok = serve_socket(&server, opts->socket_path);
+#endif
+    } else {
+        serve_stream(&server, stdin, stdout);
+    }
+    dispatcher_stop(&server);
+
+    while (server.scenes) {
+        server_scene *e = server.scenes;
+        server.scenes = e->next;
+        destroy_entry(e);
+    }
+    image_writer_destroy(server.writer);
+    thread_pool_destroy(server.pool);
+    return ok;
+}
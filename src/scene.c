@@ -1,16 +1,72 @@
 #include "scene.h"
+#include "texture_cache.h"
+#include "texture_compress.h"
+#include "scene_file.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/* Cache-line alignment for every array of an arena-backed scene. */
+#define SCENE_ARENA_ALIGN 64
+
 static uint8_t clamp255(float f) {
     if (f < 0.0f) f = 0.0f;
     if (f > 1.0f) f = 1.0f;
     return (uint8_t)(f * 255.0f + 0.5f);
 }
 
+static size_t texel_offset(texture_layout layout, uint32_t width, uint32_t x, uint32_t y) {
+    if (layout == TEXTURE_LAYOUT_TILED) {
+        size_t tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        size_t tile = (size_t)(y / TEXTURE_TILE_SIZE) * tiles_x + x / TEXTURE_TILE_SIZE;
+        return (tile * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE + (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE) * 4;
+    }
+    return ((size_t)y * width + x) * 4;
+}
+
+static size_t level_bytes(texture_layout layout, uint32_t width, uint32_t height) {
+    if (layout == TEXTURE_LAYOUT_TILED) {
+        size_t tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        size_t tiles_y = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        return tiles_x * tiles_y * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4;
+    }
+    return (size_t)width * height * 4;
+}
+
+size_t texture_level_bytes(const texture *tx, uint32_t level) {
+    const texture_mip *m = tx->mips ? &tx->mips[level] : NULL;
+    uint32_t width = m ? m->width : tx->width;
+    uint32_t height = m ? m->height : tx->height;
+    if (tx->format != TEXTURE_FORMAT_RGBA8) {
+        size_t blocks_x = (width + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+        size_t blocks_y = (height + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+        return blocks_x * blocks_y * texture_format_block_bytes(tx->format);
+    }
+    return level_bytes(tx->layout, width, height);
+}
+
+static texture_mip level_of(const texture *tx, uint32_t level) {
+    if (level == 0 || !tx->mips) return (texture_mip){tx->width, tx->height, tx->rgba8, NULL};
+    return tx->mips[level];
+}
+
+/* x, y must be inside the level. */
+static vec3 fetch_texel(const texture *tx, uint32_t level, uint32_t x, uint32_t y) {
+    uint8_t c[4];
+    const uint8_t *p = c;
+    if (tx->loader) {
+        if (!texture_cache_fetch(tx->cache, tx, level, x, y, c)) return (vec3){1.0f, 1.0f, 1.0f};
+    } else if (tx->format != TEXTURE_FORMAT_RGBA8) {
+        texture_fetch_compressed(tx, level, x, y, c);
+    } else {
+        texture_mip m = level_of(tx, level);
+        p = m.rgba8 + texel_offset(tx->layout, m.width, x, y);
+    }
+    return (vec3){p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f};
+}
+
 vec3 sample_texture(const texture *tx, float u, float v) {
-    if (!tx || !tx->rgba8 || tx->width == 0 || tx->height == 0) {
+    if (!tx || (!tx->rgba8 && !tx->loader && tx->format == TEXTURE_FORMAT_RGBA8) || tx->width == 0 || tx->height == 0) {
         return (vec3){1.0f, 1.0f, 1.0f};
     }
     u = u - (int)u;
@@ -20,12 +76,190 @@ vec3 sample_texture(const texture *tx, float u, float v) {
 
     uint32_t x = (uint32_t)(u * (float)(tx->width - 1));
     uint32_t y = (uint32_t)(v * (float)(tx->height - 1));
-    size_t idx = (size_t)(y * tx->width + x) * 4;
-    return (vec3){
-        tx->rgba8[idx + 0] / 255.0f,
-        tx->rgba8[idx + 1] / 255.0f,
-        tx->rgba8[idx + 2] / 255.0f
-    };
+    return fetch_texel(tx, 0, x, y);
+}
+
+static vec3 wrapped_texel(const texture *tx, uint32_t level, const texture_mip *m, int x, int y) {
+    x %= (int)m->width;
+    y %= (int)m->height;
+    if (x < 0) x += (int)m->width;
+    if (y < 0) y += (int)m->height;
+    return fetch_texel(tx, level, (uint32_t)x, (uint32_t)y);
+}
+
+/* u, v in [0, 1); texel centres sit at half-integer coordinates and the image repeats. */
+static vec3 sample_bilinear(const texture *tx, uint32_t level, float u, float v) {
+    texture_mip m = level_of(tx, level);
+    float fx = u * (float)m.width - 0.5f;
+    float fy = v * (float)m.height - 0.5f;
+    float x0 = floorf(fx);
+    float y0 = floorf(fy);
+    float ax = fx - x0;
+    float ay = fy - y0;
+    int ix = (int)x0;
+    int iy = (int)y0;
+    vec3 top = vec3_add(vec3_mul(wrapped_texel(tx, level, &m, ix, iy), 1.0f - ax),
+                        vec3_mul(wrapped_texel(tx, level, &m, ix + 1, iy), ax));
+    vec3 bottom = vec3_add(vec3_mul(wrapped_texel(tx, level, &m, ix, iy + 1), 1.0f - ax),
+                           vec3_mul(wrapped_texel(tx, level, &m, ix + 1, iy + 1), ax));
+    return vec3_add(vec3_mul(top, 1.0f - ay), vec3_mul(bottom, ay));
+}
+
+vec3 sample_texture_filtered(const texture *tx, float u, float v, float footprint, texture_filter filter) {
+    if (filter == TEXTURE_FILTER_NEAREST || !tx || !tx->mips || tx->mip_count == 0) {
+        return sample_texture(tx, u, v);
+    }
+    u = u - (int)u;
+    v = v - (int)v;
+    if (u < 0.0f) u += 1.0f;
+    if (v < 0.0f) v += 1.0f;
+
+    uint32_t size = tx->width > tx->height ? tx->width : tx->height;
+    float texels = footprint * (float)size;
+    float lod = texels > 1.0f ? log2f(texels) : 0.0f;
+    float max_lod = (float)(tx->mip_count - 1);
+    if (lod > max_lod) lod = max_lod;
+
+    if (filter == TEXTURE_FILTER_BILINEAR) {
+        return sample_bilinear(tx, (uint32_t)(lod + 0.5f), u, v);
+    }
+    uint32_t level = (uint32_t)lod;
+    float frac = lod - (float)level;
+    vec3 fine = sample_bilinear(tx, level, u, v);
+    if (frac <= 0.0f || level + 1 >= tx->mip_count) return fine;
+    vec3 coarse = sample_bilinear(tx, level + 1, u, v);
+    return vec3_add(vec3_mul(fine, 1.0f - frac), vec3_mul(coarse, frac));
+}
+
+static void free_mips(texture *tx) {
+    for (uint32_t i = 0; i < tx->mip_count; ++i) {
+        if (i > 0) free(tx->mips[i].rgba8);
+        free(tx->mips[i].blocks);
+    }
+    free(tx->mips);
+    tx->mips = NULL;
+    tx->mip_count = 0;
+}
+
+static uint32_t full_mip_count(uint32_t width, uint32_t height) {
+    uint32_t count = 1;
+    for (uint32_t w = width, h = height; w > 1 || h > 1; ++count) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return count;
+}
+
+int texture_build_mips(texture *tx) {
+    if (!tx || !tx->rgba8 || tx->width == 0 || tx->height == 0) return 0;
+    /* The box filter reads and writes linear rows. */
+    texture_layout layout = tx->layout;
+    if (layout != TEXTURE_LAYOUT_LINEAR && !texture_set_layout(tx, TEXTURE_LAYOUT_LINEAR)) return 0;
+    free_mips(tx);
+
+    uint32_t count = full_mip_count(tx->width, tx->height);
+    tx->mips = (texture_mip*)calloc(count, sizeof(texture_mip));
+    if (!tx->mips) return 0;
+    tx->mips[0] = (texture_mip){tx->width, tx->height, tx->rgba8, NULL};
+    tx->mip_count = 1;
+
+    for (uint32_t level = 1; level < count; ++level) {
+        const texture_mip *src = &tx->mips[level - 1];
+        texture_mip dst;
+        dst.width = src->width > 1 ? src->width / 2 : 1;
+        dst.height = src->height > 1 ? src->height / 2 : 1;
+        dst.rgba8 = (uint8_t*)malloc((size_t)dst.width * dst.height * 4);
+        if (!dst.rgba8) {
+            free_mips(tx);
+            return 0;
+        }
+        /* 2x2 box filter; odd source edges reuse their last row/column. */
+        for (uint32_t y = 0; y < dst.height; ++y) {
+            uint32_t y0 = 2 * y < src->height ? 2 * y : src->height - 1;
+            uint32_t y1 = 2 * y + 1 < src->height ? 2 * y + 1 : src->height - 1;
+            for (uint32_t x = 0; x < dst.width; ++x) {
+                uint32_t x0 = 2 * x < src->width ? 2 * x : src->width - 1;
+                uint32_t x1 = 2 * x + 1 < src->width ? 2 * x + 1 : src->width - 1;
+                const uint8_t *p00 = &src->rgba8[((size_t)y0 * src->width + x0) * 4];
+                const uint8_t *p10 = &src->rgba8[((size_t)y0 * src->width + x1) * 4];
+                const uint8_t *p01 = &src->rgba8[((size_t)y1 * src->width + x0) * 4];
+                const uint8_t *p11 = &src->rgba8[((size_t)y1 * src->width + x1) * 4];
+                uint8_t *out = &dst.rgba8[((size_t)y * dst.width + x) * 4];
+                for (int c = 0; c < 4; ++c) {
+                    out[c] = (uint8_t)((p00[c] + p10[c] + p01[c] + p11[c] + 2) / 4);
+                }
+            }
+        }
+        tx->mips[level] = dst;
+        tx->mip_count = level + 1;
+    }
+    return layout == TEXTURE_LAYOUT_LINEAR || texture_set_layout(tx, layout);
+}
+
+int scene_build_texture_mips(scene *s) {
+    for (size_t i = 0; i < s->texture_count; ++i) {
+        if (s->textures[i].loader || s->textures[i].format != TEXTURE_FORMAT_RGBA8) continue;
+        if (!texture_build_mips(&s->textures[i])) return 0;
+    }
+    return 1;
+}
+
+int texture_set_layout(texture *tx, texture_layout layout) {
+    if (!tx || !tx->rgba8 || tx->loader) return 0;
+    if (tx->layout == layout) return 1;
+
+    /* Allocate every level first so a failure leaves the texture untouched. */
+    uint32_t levels = tx->mips ? tx->mip_count : 1;
+    uint8_t **converted = (uint8_t**)calloc(levels, sizeof(uint8_t*));
+    if (!converted) return 0;
+    for (uint32_t level = 0; level < levels; ++level) {
+        texture_mip m = level_of(tx, level);
+        converted[level] = (uint8_t*)calloc(level_bytes(layout, m.width, m.height), 1);
+        if (!converted[level]) {
+            for (uint32_t i = 0; i < level; ++i) free(converted[i]);
+            free(converted);
+            return 0;
+        }
+    }
+
+    for (uint32_t level = 0; level < levels; ++level) {
+        texture_mip m = level_of(tx, level);
+        for (uint32_t y = 0; y < m.height; ++y) {
+            for (uint32_t x = 0; x < m.width; ++x) {
+                memcpy(converted[level] + texel_offset(layout, m.width, x, y),
+                       m.rgba8 + texel_offset(tx->layout, m.width, x, y), 4);
+            }
+        }
+        free(m.rgba8);
+        if (level == 0) tx->rgba8 = converted[0];
+        if (tx->mips) tx->mips[level].rgba8 = converted[level];
+    }
+    free(converted);
+    tx->layout = layout;
+    return 1;
+}
+
+int texture_init_streamed(texture *tx, uint32_t width, uint32_t height, uint32_t mip_count,
+                          texture_cache *cache, texture_tile_loader loader, void *user) {
+    if (!tx || width == 0 || height == 0 || !cache || !loader) return 0;
+    memset(tx, 0, sizeof(*tx));
+    uint32_t full = full_mip_count(width, height);
+    if (mip_count == 0 || mip_count > full) mip_count = full;
+    tx->mips = (texture_mip*)calloc(mip_count, sizeof(texture_mip));
+    if (!tx->mips) return 0;
+    for (uint32_t level = 0; level < mip_count; ++level) {
+        tx->mips[level] = (texture_mip){width, height, NULL, NULL};
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    tx->width = tx->mips[0].width;
+    tx->height = tx->mips[0].height;
+    tx->mip_count = mip_count;
+    tx->layout = TEXTURE_LAYOUT_TILED;
+    tx->cache = cache;
+    tx->loader = loader;
+    tx->loader_user = user;
+    return 1;
 }
 
 int build_demo_scene(scene *out_scene) {
@@ -104,20 +338,316 @@ int build_demo_scene(scene *out_scene) {
         }
     }
 
+    if (!scene_build_texture_mips(out_scene) ||
+        !texture_compress(albedo, TEXTURE_FORMAT_BC1) ||
+        !texture_compress(normal, TEXTURE_FORMAT_BC5)) {
+        destroy_scene(out_scene);
+        return 0;
+    }
     return 1;
 }
 
-void destroy_scene(scene *s) {
-    if (!s) return;
+static void free_mesh_arrays(mesh *m) {
+    free(m->vertices);
+    free(m->triangles);
+    free(m->positions);
+    free(m->normals);
+    free(m->uvs);
+    free(m->packed_normals);
+    free(m->packed_uvs);
+    free(m->triangles16);
+}
+
+size_t mesh_geometry_bytes(const mesh *m) {
+    size_t v = m->vertex_count, t = m->triangle_count;
+    return (m->vertices ? v * sizeof(vertex) : 0) + (m->triangles ? t * sizeof(triangle) : 0) +
+           (m->positions ? v * sizeof(vec3) : 0) + (m->normals ? v * sizeof(vec3) : 0) +
+           (m->uvs ? v * 2 * sizeof(float) : 0) + (m->packed_normals ? v * sizeof(uint32_t) : 0) +
+           (m->packed_uvs ? v * sizeof(uint32_t) : 0) + (m->triangles16 ? t * sizeof(triangle16) : 0);
+}
+
+static uint16_t quantize_unorm16(float x, float offset, float scale) {
+    float q = scale > 0.0f ? (x - offset) / scale : 0.0f;
+    return (uint16_t)(q <= 0.0f ? 0 : q >= 65535.0f ? 65535 : lrintf(q));
+}
+
+static int fits_triangle16(const mesh *m) {
+    if (m->vertex_count > 65536) return 0;
+    for (size_t t = 0; t < m->triangle_count; ++t) {
+        int material_index = mesh_triangle(m, t).material_index;
+        if (material_index < 0 || material_index > 65535) return 0;
+    }
+    return 1;
+}
+
+int mesh_set_layout(mesh *m, mesh_layout layout) {
+    if (!m || (layout != MESH_LAYOUT_AOS && layout != MESH_LAYOUT_SOA && layout != MESH_LAYOUT_SOA_QUANTIZED)) return 0;
+    if (m->layout == layout) return 1;
+
+    /* Built beside the current arrays and read through the accessors, so any layout converts to any
+     * other and a failure leaves the mesh untouched. */
+    mesh out;
+    memset(&out, 0, sizeof(out));
+    out.vertex_count = m->vertex_count;
+    out.triangle_count = m->triangle_count;
+    out.layout = layout;
+    size_t vn = m->vertex_count ? m->vertex_count : 1, tn = m->triangle_count ? m->triangle_count : 1;
+    int ok;
+    if (layout == MESH_LAYOUT_AOS) {
+        ok = (out.vertices = (vertex*)malloc(vn * sizeof(vertex))) != NULL;
+        for (uint32_t i = 0; ok && i < m->vertex_count; ++i) {
+            vertex *v = &out.vertices[i];
+            v->position = mesh_position(m, i);
+            v->normal = mesh_normal(m, i);
+            mesh_uv(m, i, &v->u, &v->v);
+        }
+    } else {
+        out.positions = (vec3*)malloc(vn * sizeof(vec3));
+        ok = out.positions != NULL;
+        for (uint32_t i = 0; ok && i < m->vertex_count; ++i) out.positions[i] = mesh_position(m, i);
+    }
+    if (ok && layout == MESH_LAYOUT_SOA) {
+        out.normals = (vec3*)malloc(vn * sizeof(vec3));
+        out.uvs = (float*)malloc(vn * 2 * sizeof(float));
+        ok = out.normals && out.uvs;
+        for (uint32_t i = 0; ok && i < m->vertex_count; ++i) {
+            out.normals[i] = mesh_normal(m, i);
+            mesh_uv(m, i, &out.uvs[2 * (size_t)i], &out.uvs[2 * (size_t)i + 1]);
+        }
+    }
+    if (ok && layout == MESH_LAYOUT_SOA_QUANTIZED) {
+        out.packed_normals = (uint32_t*)malloc(vn * sizeof(uint32_t));
+        out.packed_uvs = (uint32_t*)malloc(vn * sizeof(uint32_t));
+        ok = out.packed_normals && out.packed_uvs;
+        float lo[2] = {0.0f, 0.0f}, hi[2] = {0.0f, 0.0f};
+        for (uint32_t i = 0; ok && i < m->vertex_count; ++i) {
+            float uv[2];
+            mesh_uv(m, i, &uv[0], &uv[1]);
+            for (int c = 0; c < 2; ++c) {
+                lo[c] = i == 0 || uv[c] < lo[c] ? uv[c] : lo[c];
+                hi[c] = i == 0 || uv[c] > hi[c] ? uv[c] : hi[c];
+            }
+        }
+        for (int c = 0; c < 2; ++c) {
+            out.uv_offset[c] = lo[c];
+            out.uv_scale[c] = (hi[c] - lo[c]) / 65535.0f;
+        }
+        for (uint32_t i = 0; ok && i < m->vertex_count; ++i) {
+            float u, v;
+            mesh_uv(m, i, &u, &v);
+            out.packed_normals[i] = mesh_pack_normal(mesh_normal(m, i));
+            out.packed_uvs[i] = (uint32_t)quantize_unorm16(u, out.uv_offset[0], out.uv_scale[0]) |
+                                (uint32_t)quantize_unorm16(v, out.uv_offset[1], out.uv_scale[1]) << 16;
+        }
+    }
+    if (ok && layout == MESH_LAYOUT_SOA_QUANTIZED && fits_triangle16(m)) {
+        ok = (out.triangles16 = (triangle16*)malloc(tn * sizeof(triangle16))) != NULL;
+        for (size_t t = 0; ok && t < m->triangle_count; ++t) {
+            triangle tr = mesh_triangle(m, t);
+            out.triangles16[t] = (triangle16){(uint16_t)tr.i0, (uint16_t)tr.i1, (uint16_t)tr.i2, (uint16_t)tr.material_index};
+        }
+    } else if (ok) {
+        ok = (out.triangles = (triangle*)malloc(tn * sizeof(triangle))) != NULL;
+        for (size_t t = 0; ok && t < m->triangle_count; ++t) out.triangles[t] = mesh_triangle(m, t);
+    }
+    if (!ok) {
+        free_mesh_arrays(&out);
+        return 0;
+    }
+    free_mesh_arrays(m);
+    *m = out;
+    return 1;
+}
+
+int scene_set_mesh_layout(scene *s, mesh_layout layout) {
+    if (!s || s->file || s->arena) return 0;
     for (size_t i = 0; i < s->mesh_count; ++i) {
-        free(s->meshes[i].vertices);
-        free(s->meshes[i].triangles);
+        if (!mesh_set_layout(&s->meshes[i], layout)) return 0;
+    }
+    return 1;
+}
+
+int transform3x4_invert(const transform3x4 *t, transform3x4 *out) {
+    const float (*m)[4] = t->m;
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    if (det == 0.0f || !isfinite(det)) return 0;
+    float inv = 1.0f / det;
+    transform3x4 r;
+    r.m[0][0] = c00 * inv;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+    r.m[1][0] = c01 * inv;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+    r.m[2][0] = c02 * inv;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+    for (int row = 0; row < 3; ++row) {
+        r.m[row][3] = -(r.m[row][0] * m[0][3] + r.m[row][1] * m[1][3] + r.m[row][2] * m[2][3]);
+    }
+    *out = r;
+    return 1;
+}
+
+int scene_instance_grid(scene *s, uint32_t count) {
+    if (!s || s->file || s->arena || count == 0 || s->mesh_count == 0) return 0;
+    if ((size_t)count > SIZE_MAX / sizeof(mesh_instance) / s->mesh_count) return 0;
+    vec3 lo = {INFINITY, INFINITY, INFINITY}, hi = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = 0; i < s->mesh_count; ++i) {
+        for (size_t v = 0; v < s->meshes[i].vertex_count; ++v) {
+            vec3 p = mesh_position(&s->meshes[i], (uint32_t)v);
+            lo = (vec3){fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z)};
+            hi = (vec3){fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z)};
+        }
+    }
+    if (lo.x > hi.x) return 0;
+
+    uint32_t side = (uint32_t)sqrt((double)count);
+    while ((uint64_t)side * side < count) ++side;
+    float scale = 1.0f / (float)side;
+    mesh_instance *instances = (mesh_instance*)malloc((size_t)count * s->mesh_count * sizeof(mesh_instance));
+    if (!instances) return 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        /* The scaled scene's min corner lands on its cell's min corner. */
+        float x = lo.x + (float)(i % side) * (hi.x - lo.x) * scale;
+        float y = lo.y + (float)(i / side) * (hi.y - lo.y) * scale;
+        transform3x4 t = {{{scale, 0.0f, 0.0f, x - lo.x * scale},
+                           {0.0f, scale, 0.0f, y - lo.y * scale},
+                           {0.0f, 0.0f, scale, lo.z - lo.z * scale}}};
+        for (size_t m = 0; m < s->mesh_count; ++m) {
+            instances[(size_t)i * s->mesh_count + m] = (mesh_instance){t, (uint32_t)m, 0xffu};
+        }
     }
+    free(s->instances);
+    s->instances = instances;
+    s->instance_count = (size_t)count * s->mesh_count;
+    return 1;
+}
+
+/* Frees the arrays of a scene that owns them individually. */
+static void free_scene_arrays(scene *s) {
+    for (size_t i = 0; i < s->mesh_count; ++i) free_mesh_arrays(&s->meshes[i]);
     for (size_t i = 0; i < s->texture_count; ++i) {
+        free_mips(&s->textures[i]);
         free(s->textures[i].rgba8);
     }
     free(s->meshes);
     free(s->textures);
     free(s->materials);
+    free(s->instances);
+}
+
+void destroy_scene(scene *s) {
+    if (!s) return;
+    if (s->file) {
+        /* Mapped scenes only own their mesh, texture and mip descriptors. */
+        for (size_t i = 0; i < s->texture_count; ++i) free(s->textures[i].mips);
+        free(s->meshes);
+        free(s->textures);
+    } else if (!s->arena) {
+        free_scene_arrays(s);
+    }
+    texture_cache_destroy(s->texture_cache);
+    scene_file_close(s->file);
+    if (s->arena) {
+        arena_destroy(s->arena);
+        free(s->arena);
+    }
     memset(s, 0, sizeof(*s));
 }
+
+static size_t arena_span(size_t bytes) {
+    return ((bytes ? bytes : 1) + SCENE_ARENA_ALIGN - 1) / SCENE_ARENA_ALIGN * SCENE_ARENA_ALIGN;
+}
+
+static void *arena_copy(arena *a, const void *src, size_t bytes) {
+    void *dst = arena_alloc(a, bytes ? bytes : 1, SCENE_ARENA_ALIGN);
+    if (dst && src && bytes) memcpy(dst, src, bytes);
+    return dst;
+}
+
+static int copy_mesh(arena *a, const mesh *src, mesh *dst) {
+    size_t v = src->vertex_count, t = src->triangle_count;
+    *dst = *src;
+    int ok = 1;
+    if (ok && src->vertices) ok = (dst->vertices = (vertex*)arena_copy(a, src->vertices, v * sizeof(vertex))) != NULL;
+    if (ok && src->triangles) ok = (dst->triangles = (triangle*)arena_copy(a, src->triangles, t * sizeof(triangle))) != NULL;
+    if (ok && src->positions) ok = (dst->positions = (vec3*)arena_copy(a, src->positions, v * sizeof(vec3))) != NULL;
+    if (ok && src->normals) ok = (dst->normals = (vec3*)arena_copy(a, src->normals, v * sizeof(vec3))) != NULL;
+    if (ok && src->uvs) ok = (dst->uvs = (float*)arena_copy(a, src->uvs, v * 2 * sizeof(float))) != NULL;
+    if (ok && src->packed_normals) ok = (dst->packed_normals = (uint32_t*)arena_copy(a, src->packed_normals, v * sizeof(uint32_t))) != NULL;
+    if (ok && src->packed_uvs) ok = (dst->packed_uvs = (uint32_t*)arena_copy(a, src->packed_uvs, v * sizeof(uint32_t))) != NULL;
+    if (ok && src->triangles16) ok = (dst->triangles16 = (triangle16*)arena_copy(a, src->triangles16, t * sizeof(triangle16))) != NULL;
+    return ok;
+}
+
+static int copy_texture(arena *a, const texture *src, texture *dst) {
+    *dst = *src;
+    if (src->rgba8 && !(dst->rgba8 = (uint8_t*)arena_copy(a, src->rgba8, texture_level_bytes(src, 0)))) return 0;
+    if (!src->mips) return 1;
+    if (!(dst->mips = (texture_mip*)arena_copy(a, src->mips, src->mip_count * sizeof(texture_mip)))) return 0;
+    for (uint32_t level = 0; level < src->mip_count; ++level) {
+        const texture_mip *from = &src->mips[level];
+        texture_mip *to = &dst->mips[level];
+        size_t bytes = texture_level_bytes(src, level);
+        if (from->rgba8 && from->rgba8 == src->rgba8) {
+            to->rgba8 = dst->rgba8;
+        } else if (from->rgba8 && !(to->rgba8 = (uint8_t*)arena_copy(a, from->rgba8, bytes))) {
+            return 0;
+        }
+        if (from->blocks && !(to->blocks = (uint8_t*)arena_copy(a, from->blocks, bytes))) return 0;
+    }
+    return 1;
+}
+
+int scene_move_to_arena(scene *s) {
+    if (!s) return 0;
+    if (s->file || s->arena) return 1;
+
+    /* Sized up front so the whole scene lands in a single block. */
+    size_t total = SCENE_ARENA_ALIGN + arena_span(s->mesh_count * sizeof(mesh)) +
+                   arena_span(s->material_count * sizeof(material)) + arena_span(s->texture_count * sizeof(texture)) +
+                   arena_span(s->instance_count * sizeof(mesh_instance));
+    for (size_t i = 0; i < s->mesh_count; ++i) {
+        /* Covers the rounding of up to four arrays per layout. */
+        total += mesh_geometry_bytes(&s->meshes[i]) + 4 * SCENE_ARENA_ALIGN;
+    }
+    for (size_t i = 0; i < s->texture_count; ++i) {
+        const texture *tx = &s->textures[i];
+        if (tx->rgba8) total += arena_span(texture_level_bytes(tx, 0));
+        if (tx->mips) total += arena_span(tx->mip_count * sizeof(texture_mip));
+        for (uint32_t level = 0; tx->mips && level < tx->mip_count; ++level) {
+            if (tx->mips[level].rgba8 && tx->mips[level].rgba8 != tx->rgba8) total += arena_span(texture_level_bytes(tx, level));
+            if (tx->mips[level].blocks) total += arena_span(texture_level_bytes(tx, level));
+        }
+    }
+
+    arena *a = (arena*)malloc(sizeof(arena));
+    if (!a) return 0;
+    arena_init(a, total);
+    mesh *meshes = (mesh*)arena_copy(a, s->meshes, s->mesh_count * sizeof(mesh));
+    material *materials = (material*)arena_copy(a, s->materials, s->material_count * sizeof(material));
+    texture *textures = (texture*)arena_copy(a, NULL, s->texture_count * sizeof(texture));
+    mesh_instance *instances = s->instances
+        ? (mesh_instance*)arena_copy(a, s->instances, s->instance_count * sizeof(mesh_instance)) : NULL;
+    int ok = meshes && materials && textures && (instances || !s->instances);
+    for (size_t i = 0; ok && i < s->mesh_count; ++i) ok = copy_mesh(a, &s->meshes[i], &meshes[i]);
+    for (size_t i = 0; ok && i < s->texture_count; ++i) ok = copy_texture(a, &s->textures[i], &textures[i]);
+    if (!ok) {
+        /* The scene still owns its original arrays. */
+        arena_destroy(a);
+        free(a);
+        return 0;
+    }
+
+    free_scene_arrays(s);
+    s->meshes = meshes;
+    s->materials = materials;
+    s->textures = textures;
+    s->instances = instances;
+    s->arena = a;
+    return 1;
+}
@@ -0,0 +1,719 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "scene_file.h"
+#include "texture_compress.h"
+#include "timer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SCENE_FILE_MAGIC "VKHRSCN"
+#define SCENE_FILE_BYTE_ORDER 0x01020304u
+
+typedef enum {
+    SECTION_MATERIALS = 1,
+    /* index: mesh */
+    SECTION_VERTICES = 2,
+    SECTION_TRIANGLES = 3,
+    /* file_texture per texture; precedes the texel sections. */
+    SECTION_TEXTURES = 4,
+    /* index: texture, level: mip level; RGBA8 in the texture's layout, or compressed blocks. */
+    SECTION_TEXELS = 5,
+    /* file_bvh; precedes the other BVH sections. */
+    SECTION_BVH = 6,
+    SECTION_BVH_NODES = 7,
+    SECTION_BVH_TRIANGLE_INDICES = 8,
+    SECTION_BVH_TRIANGLE_MESH = 9,
+    SECTION_BVH_MESH_FIRST_TRIANGLE = 10,
+    SECTION_BVH_NODES4 = 11,
+    SECTION_BVH_NODES8 = 12,
+    SECTION_BVH_TRIS4 = 13,
+    SECTION_BVH_TRIS8 = 14,
+    /* mesh_instance records; absent for scenes without instances. */
+    SECTION_INSTANCES = 15,
+    /* file_bvh_key; only in BVH-only files, which hold the BVH sections and no scene arrays. */
+    SECTION_BVH_KEY = 16
+} section_type;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    /* Sizes of the in-memory records; a mismatch means a different ABI. */
+    uint32_t size_t_bytes;
+    uint32_t vertex_bytes;
+    uint32_t triangle_bytes;
+    uint32_t material_bytes;
+    uint32_t bvh_node_bytes;
+    uint32_t section_count;
+    uint64_t file_bytes;
+    uint64_t mesh_count;
+    uint64_t texture_count;
+    uint64_t material_count;
+} file_header;
+
+typedef struct {
+    uint32_t type;
+    uint32_t index;
+    uint32_t level;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+} file_section;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    /* 0 when the texture has no mip chain; one texel section is stored either way. */
+    uint32_t mip_count;
+    uint32_t format;
+    uint32_t layout;
+    uint32_t reserved;
+} file_texture;
+
+typedef struct {
+    uint64_t node_count;
+    uint64_t triangle_count;
+    uint64_t wide_node_count;
+    uint32_t width;
+    uint32_t triangle_block_width;
+    float build_sah_cost;
+    uint32_t reserved;
+    bvh_build_stats stats;
+} file_bvh;
+
+typedef struct {
+    uint64_t key;
+    /* Checked against the scene along with the header's mesh count and the tree's triangle count. */
+    uint64_t vertex_count;
+} file_bvh_key;
+
+struct scene_file {
+    uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE handle;
+    HANDLE mapping;
+#endif
+};
+
+typedef struct {
+    file_section header;
+    const void *data;
+} pending_section;
+
+typedef struct {
+    pending_section *items;
+    size_t count;
+    size_t capacity;
+} section_list;
+
+static size_t align_up(size_t value) {
+    return (value + SCENE_FILE_ALIGN - 1) & ~(size_t)(SCENE_FILE_ALIGN - 1);
+}
+
+static uint32_t texture_levels(const texture *tx) {
+    return tx->mips && tx->mip_count > 0 ? tx->mip_count : 1;
+}
+
+static const void *texture_level_data(const texture *tx, uint32_t level) {
+    if (tx->format != TEXTURE_FORMAT_RGBA8) return tx->mips[level].blocks;
+    return level == 0 ? tx->rgba8 : tx->mips[level].rgba8;
+}
+
+static int add_section(section_list *list, section_type type, uint32_t index, uint32_t level, const void *data, size_t bytes) {
+    if (bytes == 0) return 1;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        pending_section *grown = (pending_section*)realloc(list->items, capacity * sizeof(pending_section));
+        if (!grown) return 0;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    pending_section *p = &list->items[list->count++];
+    memset(p, 0, sizeof(*p));
+    p->header.type = (uint32_t)type;
+    p->header.index = index;
+    p->header.level = level;
+    p->header.bytes = bytes;
+    p->data = data;
+    return 1;
+}
+
+static int collect_bvh_sections(section_list *list, const bvh *tree, size_t mesh_count, file_bvh *bvh_info) {
+    *bvh_info = (file_bvh){tree->node_count, tree->triangle_count, tree->wide_node_count, tree->width,
+                           tree->triangle_block_width, tree->build_sah_cost, 0, tree->stats};
+    size_t blocks = tree->triangle_block_width
+        ? (tree->triangle_count + tree->triangle_block_width - 1) / tree->triangle_block_width : 0;
+    if (blocks == 0 && tree->triangle_block_width) blocks = 1;
+    return add_section(list, SECTION_BVH, 0, 0, bvh_info, sizeof(*bvh_info)) &&
+           add_section(list, SECTION_BVH_NODES, 0, 0, tree->nodes, tree->node_count * sizeof(bvh_node)) &&
+           add_section(list, SECTION_BVH_TRIANGLE_INDICES, 0, 0, tree->triangle_indices, tree->triangle_count * sizeof(size_t)) &&
+           add_section(list, SECTION_BVH_TRIANGLE_MESH, 0, 0, tree->triangle_mesh, tree->triangle_count * sizeof(uint32_t)) &&
+           add_section(list, SECTION_BVH_MESH_FIRST_TRIANGLE, 0, 0, tree->mesh_first_triangle, (mesh_count + 1) * sizeof(size_t)) &&
+           add_section(list, SECTION_BVH_NODES4, 0, 0, tree->nodes4, tree->nodes4 ? tree->wide_node_count * sizeof(bvh4_node) : 0) &&
+           add_section(list, SECTION_BVH_NODES8, 0, 0, tree->nodes8, tree->nodes8 ? tree->wide_node_count * sizeof(bvh8_node) : 0) &&
+           add_section(list, SECTION_BVH_TRIS4, 0, 0, tree->tris4, tree->tris4 ? blocks * sizeof(bvh_tri4) : 0) &&
+           add_section(list, SECTION_BVH_TRIS8, 0, 0, tree->tris8, tree->tris8 ? blocks * sizeof(bvh_tri8) : 0);
+}
+
+static int collect_sections(section_list *list, const scene *s, const bvh *tree,
+                            file_texture *textures, file_bvh *bvh_info) {
+    int ok = add_section(list, SECTION_MATERIALS, 0, 0, s->materials, s->material_count * sizeof(material));
+    for (size_t i = 0; i < s->mesh_count && ok; ++i) {
+        const mesh *m = &s->meshes[i];
+        /* Files hold the interleaved layout; convert SoA meshes back before writing. */
+        if (m->layout != MESH_LAYOUT_AOS) return 0;
+        ok = add_section(list, SECTION_VERTICES, (uint32_t)i, 0, m->vertices, m->vertex_count * sizeof(vertex)) &&
+             add_section(list, SECTION_TRIANGLES, (uint32_t)i, 0, m->triangles, m->triangle_count * sizeof(triangle));
+    }
+    if (ok) ok = add_section(list, SECTION_INSTANCES, 0, 0, s->instances, s->instance_count * sizeof(mesh_instance));
+    if (ok) ok = add_section(list, SECTION_TEXTURES, 0, 0, textures, s->texture_count * sizeof(file_texture));
+    for (size_t i = 0; i < s->texture_count && ok; ++i) {
+        const texture *tx = &s->textures[i];
+        if (tx->loader) return 0;
+        textures[i] = (file_texture){tx->width, tx->height, tx->mips ? tx->mip_count : 0,
+                                     (uint32_t)tx->format, (uint32_t)tx->layout, 0};
+        for (uint32_t level = 0; level < texture_levels(tx) && ok; ++level) {
+            const void *data = texture_level_data(tx, level);
+            if (!data) return 0;
+            ok = add_section(list, SECTION_TEXELS, (uint32_t)i, level, data, texture_level_bytes(tx, level));
+        }
+    }
+    if (!ok || !tree) return ok;
+    return collect_bvh_sections(list, tree, s->mesh_count, bvh_info);
+}
+
+static int write_padding(FILE *f, size_t from, size_t to) {
+    static const uint8_t zeros[SCENE_FILE_ALIGN] = {0};
+    return to == from || fwrite(zeros, 1, to - from, f) == to - from;
+}
+
+/* Lays out and writes the sections behind a header with the given counts. */
+static int write_container(const char *path, section_list *list, size_t mesh_count, size_t texture_count,
+                           size_t material_count) {
+    size_t offset = align_up(sizeof(file_header) + list->count * sizeof(file_section));
+    for (size_t i = 0; i < list->count; ++i) {
+        list->items[i].header.offset = offset;
+        offset = align_up(offset + (size_t)list->items[i].header.bytes);
+    }
+    file_header header = {0};
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+    header.version = SCENE_FILE_VERSION;
+    header.byte_order = SCENE_FILE_BYTE_ORDER;
+    header.size_t_bytes = (uint32_t)sizeof(size_t);
+    header.vertex_bytes = (uint32_t)sizeof(vertex);
+    header.triangle_bytes = (uint32_t)sizeof(triangle);
+    header.material_bytes = (uint32_t)sizeof(material);
+    header.bvh_node_bytes = (uint32_t)sizeof(bvh_node);
+    header.section_count = (uint32_t)list->count;
+    header.file_bytes = offset;
+    header.mesh_count = mesh_count;
+    header.texture_count = texture_count;
+    header.material_count = material_count;
+
+    /* Written beside the target and renamed, so readers never map a half-written file. */
+    size_t path_len = strlen(path);
+    char *tmp_path = (char*)malloc(path_len + 5);
+    FILE *f = NULL;
+    if (tmp_path) {
+        memcpy(tmp_path, path, path_len);
+        memcpy(tmp_path + path_len, ".tmp", 5);
+        f = fopen(tmp_path, "wb");
+    }
+    int ok = f != NULL;
+    size_t pos = 0;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        for (size_t i = 0; i < list->count && ok; ++i) ok = fwrite(&list->items[i].header, sizeof(file_section), 1, f) == 1;
+        pos = sizeof(header) + list->count * sizeof(file_section);
+    }
+    for (size_t i = 0; i < list->count && ok; ++i) {
+        const file_section *sec = &list->items[i].header;
+        ok = write_padding(f, pos, (size_t)sec->offset) &&
+             fwrite(list->items[i].data, 1, (size_t)sec->bytes, f) == (size_t)sec->bytes;
+        pos = (size_t)(sec->offset + sec->bytes);
+    }
+    if (ok) ok = write_padding(f, pos, offset);
+    if (f && fclose(f) != 0) ok = 0;
+    if (ok) {
+        remove(path);
+        ok = rename(tmp_path, path) == 0;
+    }
+    if (!ok && f) remove(tmp_path);
+    free(tmp_path);
+    return ok;
+}
+
+int scene_file_write(const char *path, const scene *s, const bvh *tree) {
+    /* Two-level trees are not stored; their top level is cheap to rebuild after loading. */
+    if (!path || !s || (tree && (tree->scene_ref != s || tree->blas))) return 0;
+    section_list list = {0};
+    file_bvh bvh_info;
+    file_texture *textures = (file_texture*)calloc(s->texture_count ? s->texture_count : 1, sizeof(file_texture));
+    int ok = textures && collect_sections(&list, s, tree, textures, &bvh_info) &&
+             write_container(path, &list, s->mesh_count, s->texture_count, s->material_count);
+    free(textures);
+    free(list.items);
+    return ok;
+}
+
+static size_t scene_vertex_count(const scene *s) {
+    size_t count = 0;
+    for (size_t i = 0; i < s->mesh_count; ++i) count += s->meshes[i].vertex_count;
+    return count;
+}
+
+int scene_file_write_bvh(const char *path, const scene *s, const bvh *tree, uint64_t key) {
+    if (!path || !s || !tree || !tree->nodes || tree->scene_ref != s || tree->blas) return 0;
+    section_list list = {0};
+    file_bvh bvh_info;
+    file_bvh_key key_info = {key, scene_vertex_count(s)};
+    int ok = add_section(&list, SECTION_BVH_KEY, 0, 0, &key_info, sizeof(key_info)) &&
+             collect_bvh_sections(&list, tree, s->mesh_count, &bvh_info) &&
+             write_container(path, &list, s->mesh_count, 0, 0);
+    free(list.items);
+    return ok;
+}
+
+static scene_file *map_file(const char *path) {
+    scene_file *file = (scene_file*)calloc(1, sizeof(scene_file));
+    if (!file) return NULL;
+#ifdef _WIN32
+    file->handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (file->handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->handle, &size) || size.QuadPart == 0) {
+        if (file->handle != INVALID_HANDLE_VALUE) CloseHandle(file->handle);
+        free(file);
+        return NULL;
+    }
+    file->size = (size_t)size.QuadPart;
+    file->mapping = CreateFileMappingA(file->handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    file->data = file->mapping ? (uint8_t*)MapViewOfFile(file->mapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+    if (!file->data) {
+        if (file->mapping) CloseHandle(file->mapping);
+        CloseHandle(file->handle);
+        free(file);
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (fd >= 0) close(fd);
+        free(file);
+        return NULL;
+    }
+    file->size = (size_t)st.st_size;
+    void *data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(file);
+        return NULL;
+    }
+    file->data = (uint8_t*)data;
+#endif
+    return file;
+}
+
+void scene_file_close(scene_file *file) {
+    if (!file) return;
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    CloseHandle(file->handle);
+#else
+    munmap(file->data, file->size);
+#endif
+    free(file);
+}
+
+static int header_matches(const scene_file *file, const file_header *h) {
+    return file->size >= sizeof(file_header) &&
+           memcmp(h->magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) == 0 &&
+           h->version == SCENE_FILE_VERSION &&
+           h->byte_order == SCENE_FILE_BYTE_ORDER &&
+           h->size_t_bytes == sizeof(size_t) &&
+           h->vertex_bytes == sizeof(vertex) &&
+           h->triangle_bytes == sizeof(triangle) &&
+           h->material_bytes == sizeof(material) &&
+           h->bvh_node_bytes == sizeof(bvh_node) &&
+           h->file_bytes == file->size &&
+           h->mesh_count <= file->size && h->texture_count <= file->size &&
+           h->section_count <= (file->size - sizeof(file_header)) / sizeof(file_section);
+}
+
+/* Resolves one section; rejects misaligned, out-of-range or ragged sections. */
+static void *section_data(const scene_file *file, const file_section *sec, size_t element_bytes, size_t *out_count) {
+    if (sec->offset % SCENE_FILE_ALIGN != 0 || sec->offset > file->size || sec->bytes > file->size - sec->offset ||
+        sec->bytes % element_bytes != 0) {
+        return NULL;
+    }
+    *out_count = (size_t)(sec->bytes / element_bytes);
+    return file->data + sec->offset;
+}
+
+static int attach_texture(texture *tx, const file_texture *ft) {
+    if (ft->width == 0 || ft->height == 0 || ft->format > TEXTURE_FORMAT_BC7 || ft->layout > TEXTURE_LAYOUT_TILED) return 0;
+    tx->width = ft->width;
+    tx->height = ft->height;
+    tx->format = (texture_format)ft->format;
+    tx->layout = (texture_layout)ft->layout;
+    if (ft->mip_count == 0) return tx->format == TEXTURE_FORMAT_RGBA8;
+    if (ft->mip_count > 32) return 0;
+    tx->mips = (texture_mip*)calloc(ft->mip_count, sizeof(texture_mip));
+    if (!tx->mips) return 0;
+    tx->mip_count = ft->mip_count;
+    uint32_t w = ft->width, h = ft->height;
+    for (uint32_t level = 0; level < ft->mip_count; ++level) {
+        tx->mips[level] = (texture_mip){w, h, NULL, NULL};
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    if (tx->format != TEXTURE_FORMAT_RGBA8) tx->block_id = texture_next_block_id();
+    return 1;
+}
+
+static int attach_texels(texture *tx, const file_section *sec, void *data) {
+    if (!tx->width || sec->level >= texture_levels(tx) || sec->bytes != texture_level_bytes(tx, sec->level)) return 0;
+    if (tx->format != TEXTURE_FORMAT_RGBA8) {
+        tx->mips[sec->level].blocks = (uint8_t*)data;
+    } else {
+        if (tx->mips) tx->mips[sec->level].rgba8 = (uint8_t*)data;
+        if (sec->level == 0) tx->rgba8 = (uint8_t*)data;
+    }
+    return 1;
+}
+
+static int attach_bvh_section(bvh *tree, const scene_file *file, const file_section *sec, size_t mesh_count) {
+    size_t count = 0;
+    switch ((section_type)sec->type) {
+        case SECTION_BVH_NODES:
+            tree->nodes = (bvh_node*)section_data(file, sec, sizeof(bvh_node), &count);
+            return tree->nodes && count == tree->node_count;
+        case SECTION_BVH_TRIANGLE_INDICES:
+            tree->triangle_indices = (size_t*)section_data(file, sec, sizeof(size_t), &count);
+            return tree->triangle_indices && count == tree->triangle_count;
+        case SECTION_BVH_TRIANGLE_MESH:
+            tree->triangle_mesh = (uint32_t*)section_data(file, sec, sizeof(uint32_t), &count);
+            return tree->triangle_mesh && count == tree->triangle_count;
+        case SECTION_BVH_MESH_FIRST_TRIANGLE:
+            tree->mesh_first_triangle = (size_t*)section_data(file, sec, sizeof(size_t), &count);
+            return tree->mesh_first_triangle && count == mesh_count + 1;
+        case SECTION_BVH_NODES4:
+            tree->nodes4 = (bvh4_node*)section_data(file, sec, sizeof(bvh4_node), &count);
+            return tree->nodes4 && count == tree->wide_node_count;
+        case SECTION_BVH_NODES8:
+            tree->nodes8 = (bvh8_node*)section_data(file, sec, sizeof(bvh8_node), &count);
+            return tree->nodes8 && count == tree->wide_node_count;
+        case SECTION_BVH_TRIS4:
+            tree->tris4 = (bvh_tri4*)section_data(file, sec, sizeof(bvh_tri4), &count);
+            return tree->tris4 && count * 4 >= tree->triangle_count;
+        case SECTION_BVH_TRIS8:
+            tree->tris8 = (bvh_tri8*)section_data(file, sec, sizeof(bvh_tri8), &count);
+            return tree->tris8 && count * 8 >= tree->triangle_count;
+        default:
+            return 0;
+    }
+}
+
+static int bvh_complete(const bvh *tree) {
+    return tree->nodes &&
+           (tree->triangle_count == 0 || (tree->triangle_indices && tree->triangle_mesh)) &&
+           tree->mesh_first_triangle &&
+           (tree->width <= 2 || (tree->width == 4 && tree->nodes4) || (tree->width == 8 && tree->nodes8)) &&
+           (tree->triangle_block_width == 0 || (tree->triangle_block_width == 4 && tree->tris4) ||
+            (tree->triangle_block_width == 8 && tree->tris8));
+}
+
+int scene_file_load(const char *path, scene *out_scene, bvh *out_tree, scene_file_info *info) {
+    if (!path || !out_scene) return 0;
+    double start_ms = timer_now_ms();
+    memset(out_scene, 0, sizeof(*out_scene));
+    if (out_tree) memset(out_tree, 0, sizeof(*out_tree));
+    scene_file *file = map_file(path);
+    if (!file) return 0;
+
+    const file_header *h = (const file_header*)file->data;
+    if (!header_matches(file, h)) {
+        scene_file_close(file);
+        return 0;
+    }
+    scene *s = out_scene;
+    s->file = file;
+    s->mesh_count = (size_t)h->mesh_count;
+    s->texture_count = (size_t)h->texture_count;
+    s->meshes = (mesh*)calloc(s->mesh_count ? s->mesh_count : 1, sizeof(mesh));
+    s->textures = (texture*)calloc(s->texture_count ? s->texture_count : 1, sizeof(texture));
+    int ok = s->meshes && s->textures;
+    if (!ok) s->mesh_count = s->texture_count = 0;
+
+    const file_section *sections = (const file_section*)(file->data + sizeof(file_header));
+    bvh tree;
+    memset(&tree, 0, sizeof(tree));
+    int has_bvh = 0;
+    int have_textures = 0;
+    for (uint32_t i = 0; i < h->section_count && ok; ++i) {
+        const file_section *sec = &sections[i];
+        size_t count = 0;
+        switch ((section_type)sec->type) {
+            case SECTION_MATERIALS:
+                s->materials = (material*)section_data(file, sec, sizeof(material), &count);
+                s->material_count = count;
+                ok = s->materials && count == h->material_count;
+                break;
+            case SECTION_VERTICES:
+                ok = sec->index < s->mesh_count;
+                if (ok) s->meshes[sec->index].vertices = (vertex*)section_data(file, sec, sizeof(vertex), &count);
+                if (ok) s->meshes[sec->index].vertex_count = count;
+                ok = ok && s->meshes[sec->index].vertices;
+                break;
+            case SECTION_TRIANGLES:
+                ok = sec->index < s->mesh_count;
+                if (ok) s->meshes[sec->index].triangles = (triangle*)section_data(file, sec, sizeof(triangle), &count);
+                if (ok) s->meshes[sec->index].triangle_count = count;
+                ok = ok && s->meshes[sec->index].triangles;
+                break;
+            case SECTION_INSTANCES:
+                s->instances = (mesh_instance*)section_data(file, sec, sizeof(mesh_instance), &count);
+                s->instance_count = count;
+                ok = s->instances != NULL;
+                break;
+            case SECTION_TEXTURES: {
+                const file_texture *ft = (const file_texture*)section_data(file, sec, sizeof(file_texture), &count);
+                ok = ft && count == s->texture_count;
+                for (size_t t = 0; t < count && ok; ++t) ok = attach_texture(&s->textures[t], &ft[t]);
+                have_textures = ok;
+                break;
+            }
+            case SECTION_TEXELS: {
+                void *data = section_data(file, sec, 1, &count);
+                ok = have_textures && data && sec->index < s->texture_count &&
+                     attach_texels(&s->textures[sec->index], sec, data);
+                break;
+            }
+            case SECTION_BVH: {
+                const file_bvh *fb = (const file_bvh*)section_data(file, sec, sizeof(file_bvh), &count);
+                ok = fb && count == 1;
+                if (ok) {
+                    tree.node_count = (size_t)fb->node_count;
+                    tree.triangle_count = (size_t)fb->triangle_count;
+                    tree.wide_node_count = (size_t)fb->wide_node_count;
+                    tree.width = fb->width;
+                    tree.triangle_block_width = fb->triangle_block_width;
+                    tree.build_sah_cost = fb->build_sah_cost;
+                    tree.stats = fb->stats;
+                    has_bvh = 1;
+                }
+                break;
+            }
+            default:
+                /* BVH arrays; unknown types are reserved for later versions and fail the load. */
+                ok = has_bvh && attach_bvh_section(&tree, file, sec, s->mesh_count);
+                break;
+        }
+    }
+
+    for (size_t t = 0; t < s->texture_count && ok; ++t) {
+        const texture *tx = &s->textures[t];
+        for (uint32_t level = 0; level < texture_levels(tx) && ok; ++level) ok = texture_level_data(tx, level) != NULL;
+    }
+    /* A stored tree is single-level and cannot serve an instanced scene. */
+    if (ok && has_bvh) ok = bvh_complete(&tree) && s->instance_count == 0;
+    if (!ok) {
+        destroy_scene(s);
+        return 0;
+    }
+    if (out_tree && has_bvh) {
+        tree.scene_ref = s;
+        tree.borrowed_storage = 1;
+        *out_tree = tree;
+    }
+    if (info) {
+        info->file_bytes = file->size;
+        info->section_count = h->section_count;
+        info->has_bvh = has_bvh;
+        info->map_ms = timer_now_ms() - start_ms;
+    }
+    return 1;
+}
+
+int scene_file_load_bvh(const char *path, const scene *s, uint64_t key, bvh *out_tree) {
+    if (!path || !s || !out_tree || s->instance_count > 0) return 0;
+    memset(out_tree, 0, sizeof(*out_tree));
+    scene_file *file = map_file(path);
+    if (!file) return 0;
+
+    const file_header *h = (const file_header*)file->data;
+    int ok = header_matches(file, h) && h->mesh_count == s->mesh_count && h->texture_count == 0 && h->material_count == 0;
+    const file_section *sections = (const file_section*)(file->data + sizeof(file_header));
+    bvh tree;
+    memset(&tree, 0, sizeof(tree));
+    int has_key = 0, has_bvh = 0;
+    for (uint32_t i = 0; ok && i < h->section_count; ++i) {
+        const file_section *sec = &sections[i];
+        size_t count = 0;
+        if (sec->type == SECTION_BVH_KEY) {
+            const file_bvh_key *fk = (const file_bvh_key*)section_data(file, sec, sizeof(file_bvh_key), &count);
+            ok = fk && count == 1 && fk->key == key && fk->vertex_count == scene_vertex_count(s);
+            has_key = ok;
+        } else if (sec->type == SECTION_BVH) {
+            const file_bvh *fb = (const file_bvh*)section_data(file, sec, sizeof(file_bvh), &count);
+            ok = has_key && fb && count == 1;
+            if (ok) {
+                tree.node_count = (size_t)fb->node_count;
+                tree.triangle_count = (size_t)fb->triangle_count;
+                tree.wide_node_count = (size_t)fb->wide_node_count;
+                tree.width = fb->width;
+                tree.triangle_block_width = fb->triangle_block_width;
+                tree.build_sah_cost = fb->build_sah_cost;
+                tree.stats = fb->stats;
+                has_bvh = 1;
+            }
+        } else {
+            /* Scene arrays have no place here, so anything else must be a BVH array. */
+            ok = has_bvh && attach_bvh_section(&tree, file, sec, s->mesh_count);
+        }
+    }
+    /* The key already covers the geometry; these catch a hash collision before it reads out of bounds. */
+    ok = ok && has_bvh && bvh_complete(&tree);
+    size_t first = 0;
+    for (size_t m = 0; ok && m < s->mesh_count; ++m) {
+        ok = tree.mesh_first_triangle[m] == first;
+        first += s->meshes[m].triangle_count;
+    }
+    ok = ok && tree.mesh_first_triangle[s->mesh_count] == first && tree.triangle_count == first;
+    if (!ok) {
+        scene_file_close(file);
+        return 0;
+    }
+    tree.scene_ref = s;
+    tree.borrowed_storage = 1;
+    tree.file = file;
+    *out_tree = tree;
+    return 1;
+}
+
+static int fail(char *error, size_t error_size, const char *message, size_t a, size_t b) {
+    if (error && error_size) snprintf(error, error_size, message, a, b);
+    return 0;
+}
+
+static int finite3(vec3 v) {
+    return isfinite(v.x) && isfinite(v.y) && isfinite(v.z);
+}
+
+int scene_file_validate(const scene *s, const bvh *tree, char *error, size_t error_size) {
+    if (!s) return fail(error, error_size, "no scene", 0, 0);
+    size_t triangle_total = 0;
+    for (size_t i = 0; i < s->mesh_count; ++i) {
+        const mesh *m = &s->meshes[i];
+        for (size_t v = 0; v < m->vertex_count; ++v) {
+            if (!finite3(mesh_position(m, (uint32_t)v))) return fail(error, error_size, "mesh %zu: vertex %zu is not finite", i, v);
+        }
+        for (size_t t = 0; t < m->triangle_count; ++t) {
+            triangle tr = mesh_triangle(m, t);
+            if (tr.i0 >= m->vertex_count || tr.i1 >= m->vertex_count || tr.i2 >= m->vertex_count) {
+                return fail(error, error_size, "mesh %zu: triangle %zu indexes past the vertices", i, t);
+            }
+            if (tr.material_index < 0 || (size_t)tr.material_index >= s->material_count) {
+                return fail(error, error_size, "mesh %zu: triangle %zu has no valid material", i, t);
+            }
+        }
+        triangle_total += m->triangle_count;
+    }
+    for (size_t i = 0; i < s->instance_count; ++i) {
+        const mesh_instance *inst = &s->instances[i];
+        if (inst->mesh_index >= s->mesh_count) return fail(error, error_size, "instance %zu references missing mesh %zu", i, inst->mesh_index);
+        for (int row = 0; row < 3; ++row) {
+            const float *m = inst->transform.m[row];
+            if (!isfinite(m[0]) || !isfinite(m[1]) || !isfinite(m[2]) || !isfinite(m[3])) {
+                return fail(error, error_size, "instance %zu: transform is not finite", i, 0);
+            }
+        }
+    }
+    for (size_t i = 0; i < s->material_count; ++i) {
+        const material *mat = &s->materials[i];
+        if ((mat->albedo_texture >= 0 && (size_t)mat->albedo_texture >= s->texture_count) ||
+            (mat->normal_texture >= 0 && (size_t)mat->normal_texture >= s->texture_count)) {
+            return fail(error, error_size, "material %zu references a missing texture", i, 0);
+        }
+    }
+    for (size_t i = 0; i < s->texture_count; ++i) {
+        const texture *tx = &s->textures[i];
+        if (tx->loader) continue;
+        for (uint32_t level = 0; level < texture_levels(tx); ++level) {
+            if (!texture_level_data(tx, level)) return fail(error, error_size, "texture %zu: level %zu has no texels", i, level);
+        }
+    }
+    if (!tree) return 1;
+    if (tree->blas) return fail(error, error_size, "two-level BVHs are not stored", 0, 0);
+
+    if (tree->triangle_count != triangle_total) return fail(error, error_size, "BVH holds %zu triangles, scene %zu", tree->triangle_count, triangle_total);
+    for (size_t m = 0; m < s->mesh_count; ++m) {
+        if (tree->mesh_first_triangle[m + 1] - tree->mesh_first_triangle[m] != s->meshes[m].triangle_count) {
+            return fail(error, error_size, "BVH mesh %zu triangle range does not match the scene", m, 0);
+        }
+    }
+    for (size_t i = 0; i < tree->triangle_count; ++i) {
+        size_t prim = tree->triangle_indices[i];
+        if (prim >= tree->triangle_count || tree->triangle_mesh[prim] >= s->mesh_count) {
+            return fail(error, error_size, "BVH triangle slot %zu is out of range", i, 0);
+        }
+    }
+    /* Walk from the root so a shared or cyclic child is caught, not just an out-of-range one. */
+    uint8_t *seen = (uint8_t*)calloc(tree->node_count ? tree->node_count : 1, 1);
+    int *stack = (int*)malloc((tree->node_count ? tree->node_count : 1) * sizeof(int));
+    if (!seen || !stack) {
+        free(seen);
+        free(stack);
+        return fail(error, error_size, "out of memory", 0, 0);
+    }
+    size_t top = 0;
+    int ok = tree->node_count > 0;
+    if (ok) stack[top++] = 0;
+    while (top > 0 && ok) {
+        int index = stack[--top];
+        const bvh_node *n = &tree->nodes[index];
+        ok = !seen[index];
+        seen[index] = 1;
+        if (ok && n->left < 0) {
+            ok = n->start <= tree->triangle_count && n->count <= tree->triangle_count - n->start;
+        } else if (ok) {
+            ok = (size_t)n->left < tree->node_count && n->right >= 0 && (size_t)n->right < tree->node_count &&
+                 top + 2 <= tree->node_count;
+            if (ok) {
+                stack[top++] = n->left;
+                stack[top++] = n->right;
+            }
+        }
+    }
+    free(seen);
+    free(stack);
+    if (!ok) return fail(error, error_size, "BVH binary nodes do not form a tree (%zu nodes)", tree->node_count, 0);
+    for (size_t i = 0; i < tree->wide_node_count; ++i) {
+        uint32_t lanes = tree->width == 8 ? 8 : 4;
+        for (uint32_t c = 0; c < lanes; ++c) {
+            int32_t child = tree->width == 8 ? tree->nodes8[i].child[c] : tree->nodes4[i].child[c];
+            uint32_t count = tree->width == 8 ? tree->nodes8[i].count[c] : tree->nodes4[i].count[c];
+            if (child < 0) continue;
+            if (count ? (size_t)child + count > tree->triangle_count : (size_t)child >= tree->wide_node_count) {
+                return fail(error, error_size, "BVH wide node %zu child %zu is out of range", i, c);
+            }
+        }
+    }
+    return 1;
+}
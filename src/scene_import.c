@@ -0,0 +1,75 @@
+#include "scene_import_internal.h"
+#include "timer.h"
+
+#include <string.h>
+
+#define SCENE_IMPORT_CHUNK_BYTES (16u << 20)
+
+void scene_import_options_default(scene_import_options *opts) {
+    opts->chunk_bytes = SCENE_IMPORT_CHUNK_BYTES;
+    opts->pool = NULL;
+    opts->instance_meshes = 0;
+}
+
+static int has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path), ext_len = strlen(ext);
+    if (len < ext_len) return 0;
+    for (size_t i = 0; i < ext_len; ++i) {
+        char c = path[len - ext_len + i];
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        if (c != ext[i]) return 0;
+    }
+    return 1;
+}
+
+int scene_import_supported(const char *path) {
+    return path && (has_extension(path, ".obj") || has_extension(path, ".glb"));
+}
+
+int scene_import(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats) {
+    if (!path) return 0;
+    if (has_extension(path, ".obj")) return scene_import_obj(path, out_scene, opts, stats);
+    if (has_extension(path, ".glb")) return scene_import_glb(path, out_scene, opts, stats);
+    return 0;
+}
+
+material import_default_material(void) {
+    return (material){{0.8f, 0.8f, 0.8f}, 0.5f, 0.0f, -1, -1};
+}
+
+void import_smooth_normals(mesh *m, const uint8_t *missing) {
+    for (size_t i = 0; i < m->vertex_count; ++i) {
+        if (!missing || missing[i]) m->vertices[i].normal = (vec3){0.0f, 0.0f, 0.0f};
+    }
+    for (size_t t = 0; t < m->triangle_count; ++t) {
+        const triangle *tr = &m->triangles[t];
+        vec3 p0 = m->vertices[tr->i0].position;
+        /* Unnormalized, so larger faces weigh more. */
+        vec3 n = vec3_cross(vec3_sub(m->vertices[tr->i1].position, p0), vec3_sub(m->vertices[tr->i2].position, p0));
+        uint32_t corners[3] = {tr->i0, tr->i1, tr->i2};
+        for (int c = 0; c < 3; ++c) {
+            if (missing && !missing[corners[c]]) continue;
+            vertex *v = &m->vertices[corners[c]];
+            v->normal = vec3_add(v->normal, n);
+        }
+    }
+    for (size_t i = 0; i < m->vertex_count; ++i) {
+        if (missing && !missing[i]) continue;
+        vec3 n = m->vertices[i].normal;
+        m->vertices[i].normal = vec3_dot(n, n) > 0.0f ? vec3_norm(n) : (vec3){0.0f, 0.0f, 1.0f};
+    }
+}
+
+void import_finish_stats(scene_import_stats *stats, const scene *s, size_t bytes, double start_ms) {
+    if (!stats) return;
+    stats->bytes = bytes;
+    stats->mesh_count = s->mesh_count;
+    stats->vertex_count = 0;
+    stats->triangle_count = 0;
+    for (size_t i = 0; i < s->mesh_count; ++i) {
+        stats->vertex_count += s->meshes[i].vertex_count;
+        stats->triangle_count += s->meshes[i].triangle_count;
+    }
+    stats->ms = timer_now_ms() - start_ms;
+    stats->mb_per_s = stats->ms > 0.0 ? (double)bytes / (1024.0 * 1024.0) / (stats->ms / 1000.0) : 0.0;
+}
@@ -0,0 +1,609 @@
+#include "scene_import_internal.h"
+#include "timer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLB_MAGIC 0x46546c67u
+#define GLB_CHUNK_JSON 0x4e4f534au
+#define GLB_CHUNK_BIN 0x004e4942u
+#define JSON_MAX_DEPTH 64
+#define GLTF_MAX_NODE_DEPTH 64
+
+/* ---- Minimal JSON DOM; strings are left escaped since glTF keys and the fields read here are ASCII. ---- */
+
+typedef enum {
+    JSON_NULL = 0,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} json_type;
+
+typedef struct json_value json_value;
+
+struct json_value {
+    json_type type;
+    double number;
+    const char *string;
+    size_t length;
+    /* Array elements, or object values with keys[i] naming items[i]. */
+    json_value *items;
+    const char **keys;
+    size_t *key_lengths;
+    size_t count;
+};
+
+typedef struct {
+    const char *p;
+    const char *end;
+} json_reader;
+
+static void json_free(json_value *v) {
+    for (size_t i = 0; i < v->count; ++i) json_free(&v->items[i]);
+    free(v->items);
+    free(v->keys);
+    free(v->key_lengths);
+    memset(v, 0, sizeof(*v));
+}
+
+static void json_skip(json_reader *r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')) ++r->p;
+}
+
+static int json_string(json_reader *r, const char **out, size_t *length) {
+    if (r->p >= r->end || *r->p != '"') return 0;
+    const char *start = ++r->p;
+    while (r->p < r->end && *r->p != '"') r->p += *r->p == '\\' ? 2 : 1;
+    if (r->p >= r->end) return 0;
+    *out = start;
+    *length = (size_t)(r->p - start);
+    ++r->p;
+    return 1;
+}
+
+static int json_parse(json_reader *r, json_value *out, int depth);
+
+static int json_push(json_value *v, size_t *cap, int object) {
+    if (v->count < *cap) return 1;
+    size_t next = *cap ? *cap * 2 : 8;
+    json_value *items = (json_value*)realloc(v->items, next * sizeof(json_value));
+    if (!items) return 0;
+    v->items = items;
+    if (object) {
+        const char **keys = (const char**)realloc(v->keys, next * sizeof(char*));
+        if (keys) v->keys = keys;
+        size_t *lengths = (size_t*)realloc(v->key_lengths, next * sizeof(size_t));
+        if (lengths) v->key_lengths = lengths;
+        if (!keys || !lengths) return 0;
+    }
+    *cap = next;
+    return 1;
+}
+
+static int json_container(json_reader *r, json_value *out, int depth, int object) {
+    out->type = object ? JSON_OBJECT : JSON_ARRAY;
+    char close = object ? '}' : ']';
+    size_t cap = 0;
+    ++r->p;
+    json_skip(r);
+    if (r->p < r->end && *r->p == close) {
+        ++r->p;
+        return 1;
+    }
+    for (;;) {
+        if (!json_push(out, &cap, object)) return 0;
+        json_value *item = &out->items[out->count];
+        memset(item, 0, sizeof(*item));
+        if (object) {
+            json_skip(r);
+            if (!json_string(r, &out->keys[out->count], &out->key_lengths[out->count])) return 0;
+            json_skip(r);
+            if (r->p >= r->end || *r->p++ != ':') return 0;
+        }
+        /* Counted before parsing so a failed item is still freed. */
+        ++out->count;
+        if (!json_parse(r, item, depth + 1)) return 0;
+        json_skip(r);
+        if (r->p < r->end && *r->p == ',') {
+            ++r->p;
+            continue;
+        }
+        if (r->p < r->end && *r->p == close) {
+            ++r->p;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+static int json_parse(json_reader *r, json_value *out, int depth) {
+    if (depth > JSON_MAX_DEPTH) return 0;
+    json_skip(r);
+    if (r->p >= r->end) return 0;
+    char c = *r->p;
+    if (c == '{' || c == '[') return json_container(r, out, depth, c == '{');
+    if (c == '"') {
+        out->type = JSON_STRING;
+        return json_string(r, &out->string, &out->length);
+    }
+    static const char *const words[3] = {"true", "false", "null"};
+    for (int i = 0; i < 3; ++i) {
+        size_t n = strlen(words[i]);
+        if ((size_t)(r->end - r->p) >= n && memcmp(r->p, words[i], n) == 0) {
+            out->type = i < 2 ? JSON_BOOL : JSON_NULL;
+            out->number = i == 0 ? 1.0 : 0.0;
+            r->p += n;
+            return 1;
+        }
+    }
+    /* The DOM is built from a NUL-terminated copy, so strtod cannot run off the end. */
+    char *stop = NULL;
+    out->number = strtod(r->p, &stop);
+    if (stop == r->p) return 0;
+    out->type = JSON_NUMBER;
+    r->p = stop;
+    return 1;
+}
+
+static const json_value *json_get(const json_value *object, const char *key) {
+    if (!object || object->type != JSON_OBJECT) return NULL;
+    size_t n = strlen(key);
+    for (size_t i = 0; i < object->count; ++i) {
+        if (object->key_lengths[i] == n && memcmp(object->keys[i], key, n) == 0) return &object->items[i];
+    }
+    return NULL;
+}
+
+static const json_value *json_at(const json_value *array, size_t index) {
+    if (!array || array->type != JSON_ARRAY || index >= array->count) return NULL;
+    return &array->items[index];
+}
+
+static double json_number(const json_value *v, double fallback) {
+    return v && v->type == JSON_NUMBER ? v->number : fallback;
+}
+
+/* Index-valued fields; -1 when absent or out of the array's range. */
+static long json_index(const json_value *object, const char *key, const json_value *array) {
+    const json_value *v = json_get(object, key);
+    if (!v || v->type != JSON_NUMBER || v->number < 0.0) return -1;
+    size_t index = (size_t)v->number;
+    return array && array->type == JSON_ARRAY && index < array->count ? (long)index : -1;
+}
+
+/* ---- glTF ---- */
+
+typedef struct {
+    float m[16];
+} mat4;
+
+/* One triangle primitive placed by one node, converted into its own output mesh unless meshes are
+ * instanced. */
+typedef struct {
+    const json_value *primitive;
+    mat4 world;
+} gltf_instance;
+
+typedef struct {
+    const char *path;
+    const json_value *root;
+    size_t bin_offset;
+    size_t bin_length;
+    gltf_instance *instances;
+    scene *out;
+    /* Material for primitives without one. */
+    int default_material;
+    volatile size_t failures;
+} gltf_ctx;
+
+static mat4 mat4_identity(void) {
+    mat4 r;
+    memset(&r, 0, sizeof(r));
+    r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+    return r;
+}
+
+/* Column-major, as glTF stores them. */
+static mat4 mat4_mul(const mat4 *a, const mat4 *b) {
+    mat4 r;
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) sum += a->m[k * 4 + row] * b->m[col * 4 + k];
+            r.m[col * 4 + row] = sum;
+        }
+    }
+    return r;
+}
+
+static mat4 node_local(const json_value *node) {
+    mat4 r = mat4_identity();
+    const json_value *matrix = json_get(node, "matrix");
+    if (matrix && matrix->type == JSON_ARRAY && matrix->count == 16) {
+        for (int i = 0; i < 16; ++i) r.m[i] = (float)json_number(&matrix->items[i], r.m[i]);
+        return r;
+    }
+    float t[3] = {0.0f, 0.0f, 0.0f}, q[4] = {0.0f, 0.0f, 0.0f, 1.0f}, s[3] = {1.0f, 1.0f, 1.0f};
+    const json_value *tv = json_get(node, "translation"), *qv = json_get(node, "rotation"), *sv = json_get(node, "scale");
+    for (int i = 0; i < 3; ++i) t[i] = (float)json_number(json_at(tv, (size_t)i), t[i]);
+    for (int i = 0; i < 4; ++i) q[i] = (float)json_number(json_at(qv, (size_t)i), q[i]);
+    for (int i = 0; i < 3; ++i) s[i] = (float)json_number(json_at(sv, (size_t)i), s[i]);
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    /* T * R * S */
+    float rot[9] = {
+        1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+        2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+        2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+    };
+    for (int col = 0; col < 3; ++col) {
+        for (int row = 0; row < 3; ++row) r.m[col * 4 + row] = rot[col * 3 + row] * s[col];
+    }
+    r.m[12] = t[0];
+    r.m[13] = t[1];
+    r.m[14] = t[2];
+    return r;
+}
+
+typedef struct {
+    gltf_instance *items;
+    size_t count, cap;
+} instance_list;
+
+static int collect_node(const json_value *root, long node_index, const mat4 *parent, instance_list *list, int depth) {
+    const json_value *nodes = json_get(root, "nodes");
+    const json_value *node = json_at(nodes, (size_t)node_index);
+    if (!node || depth > GLTF_MAX_NODE_DEPTH) return 0;
+    mat4 local = node_local(node);
+    mat4 world = mat4_mul(parent, &local);
+
+    const json_value *meshes = json_get(root, "meshes");
+    long mesh_index = json_index(node, "mesh", meshes);
+    const json_value *primitives = mesh_index >= 0 ? json_get(&meshes->items[mesh_index], "primitives") : NULL;
+    for (size_t p = 0; primitives && primitives->type == JSON_ARRAY && p < primitives->count; ++p) {
+        const json_value *prim = &primitives->items[p];
+        /* Triangle lists only. */
+        if (json_number(json_get(prim, "mode"), 4.0) != 4.0) continue;
+        if (list->count == list->cap) {
+            size_t cap = list->cap ? list->cap * 2 : 16;
+            gltf_instance *grown = (gltf_instance*)realloc(list->items, cap * sizeof(gltf_instance));
+            if (!grown) return 0;
+            list->items = grown;
+            list->cap = cap;
+        }
+        list->items[list->count++] = (gltf_instance){prim, world};
+    }
+
+    const json_value *children = json_get(node, "children");
+    for (size_t c = 0; children && children->type == JSON_ARRAY && c < children->count; ++c) {
+        double child = json_number(&children->items[c], -1.0);
+        if (child < 0.0 || !collect_node(root, (long)child, &world, list, depth + 1)) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    size_t offset;
+    size_t count;
+    size_t stride;
+    int components;
+    uint32_t component_type;
+    int normalized;
+} gltf_accessor;
+
+static size_t component_bytes(uint32_t type) {
+    switch (type) {
+        case 5120: case 5121: return 1;
+        case 5122: case 5123: return 2;
+        case 5125: case 5126: return 4;
+        default: return 0;
+    }
+}
+
+/* Resolves an accessor to a byte range of the BIN chunk; sparse accessors are not supported. */
+static int resolve_accessor(const gltf_ctx *ctx, long index, int components, gltf_accessor *out) {
+    const json_value *accessors = json_get(ctx->root, "accessors");
+    const json_value *acc = json_at(accessors, (size_t)index);
+    const json_value *views = json_get(ctx->root, "bufferViews");
+    if (!acc || json_get(acc, "sparse")) return 0;
+    long view_index = json_index(acc, "bufferView", views);
+    if (view_index < 0) return 0;
+    const json_value *view = &views->items[view_index];
+    if (json_number(json_get(view, "buffer"), 0.0) != 0.0) return 0;
+
+    out->component_type = (uint32_t)json_number(json_get(acc, "componentType"), 0.0);
+    out->count = (size_t)json_number(json_get(acc, "count"), 0.0);
+    out->components = components;
+    out->normalized = json_number(json_get(acc, "normalized"), 0.0) != 0.0;
+    size_t element = component_bytes(out->component_type) * (size_t)components;
+    if (element == 0) return 0;
+    size_t view_offset = (size_t)json_number(json_get(view, "byteOffset"), 0.0);
+    size_t view_length = (size_t)json_number(json_get(view, "byteLength"), 0.0);
+    size_t acc_offset = (size_t)json_number(json_get(acc, "byteOffset"), 0.0);
+    out->stride = (size_t)json_number(json_get(view, "byteStride"), 0.0);
+    if (out->stride == 0) out->stride = element;
+    out->offset = ctx->bin_offset + view_offset + acc_offset;
+    size_t span = out->count ? (out->count - 1) * out->stride + element : 0;
+    return out->stride >= element && view_offset + view_length <= ctx->bin_length &&
+           acc_offset + span <= view_length;
+}
+
+static float read_component(const uint8_t *p, uint32_t type, int normalized) {
+    switch (type) {
+        case 5126: {
+            float f;
+            memcpy(&f, p, 4);
+            return f;
+        }
+        case 5121: return normalized ? p[0] / 255.0f : (float)p[0];
+        case 5123: {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return normalized ? v / 65535.0f : (float)v;
+        }
+        case 5120: return normalized ? fmaxf((int8_t)p[0] / 127.0f, -1.0f) : (float)(int8_t)p[0];
+        case 5122: {
+            int16_t v;
+            memcpy(&v, p, 2);
+            return normalized ? fmaxf(v / 32767.0f, -1.0f) : (float)v;
+        }
+        case 5125: {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return (float)v;
+        }
+        default: return 0.0f;
+    }
+}
+
+/* Reads the accessor's byte range into scratch, growing it as needed. */
+static const uint8_t *read_accessor(FILE *f, const gltf_accessor *acc, uint8_t **scratch, size_t *scratch_bytes) {
+    size_t span = acc->count ? (acc->count - 1) * acc->stride + component_bytes(acc->component_type) * (size_t)acc->components : 0;
+    if (span > *scratch_bytes) {
+        uint8_t *grown = (uint8_t*)realloc(*scratch, span);
+        if (!grown) return NULL;
+        *scratch = grown;
+        *scratch_bytes = span;
+    }
+    if (span == 0) return *scratch;
+    if (fseek(f, (long)acc->offset, SEEK_SET) != 0 || fread(*scratch, 1, span, f) != span) return NULL;
+    return *scratch;
+}
+
+static int convert_instance(const gltf_ctx *ctx, FILE *f, const gltf_instance *inst, mesh *m, uint8_t **scratch, size_t *scratch_bytes) {
+    const json_value *attributes = json_get(inst->primitive, "attributes");
+    const json_value *accessors = json_get(ctx->root, "accessors");
+    long position = json_index(attributes, "POSITION", accessors);
+    long normal = json_index(attributes, "NORMAL", accessors);
+    long uv = json_index(attributes, "TEXCOORD_0", accessors);
+    long indices = json_index(inst->primitive, "indices", accessors);
+    gltf_accessor acc;
+    if (position < 0 || !resolve_accessor(ctx, position, 3, &acc) || acc.count == 0 || acc.count >= UINT32_MAX) return 0;
+
+    m->vertex_count = acc.count;
+    m->vertices = (vertex*)calloc(m->vertex_count, sizeof(vertex));
+    if (!m->vertices) return 0;
+    const float *w = inst->world.m;
+    /* Cofactors of the upper 3x3: the inverse transpose up to scale, fine for normals that get renormalized. */
+    float n[9] = {
+        w[5] * w[10] - w[6] * w[9], w[6] * w[8] - w[4] * w[10], w[4] * w[9] - w[5] * w[8],
+        w[2] * w[9] - w[1] * w[10], w[0] * w[10] - w[2] * w[8], w[1] * w[8] - w[0] * w[9],
+        w[1] * w[6] - w[2] * w[5], w[2] * w[4] - w[0] * w[6], w[0] * w[5] - w[1] * w[4]
+    };
+
+    const uint8_t *data = read_accessor(f, &acc, scratch, scratch_bytes);
+    if (!data) return 0;
+    size_t cb = component_bytes(acc.component_type);
+    for (size_t i = 0; i < acc.count; ++i) {
+        const uint8_t *e = data + i * acc.stride;
+        float x = read_component(e, acc.component_type, acc.normalized);
+        float y = read_component(e + cb, acc.component_type, acc.normalized);
+        float z = read_component(e + 2 * cb, acc.component_type, acc.normalized);
+        m->vertices[i].position = (vec3){w[0] * x + w[4] * y + w[8] * z + w[12],
+                                         w[1] * x + w[5] * y + w[9] * z + w[13],
+                                         w[2] * x + w[6] * y + w[10] * z + w[14]};
+    }
+
+    if (normal >= 0 && resolve_accessor(ctx, normal, 3, &acc) && acc.count == m->vertex_count) {
+        if (!(data = read_accessor(f, &acc, scratch, scratch_bytes))) return 0;
+        cb = component_bytes(acc.component_type);
+        for (size_t i = 0; i < acc.count; ++i) {
+            const uint8_t *e = data + i * acc.stride;
+            float x = read_component(e, acc.component_type, acc.normalized);
+            float y = read_component(e + cb, acc.component_type, acc.normalized);
+            float z = read_component(e + 2 * cb, acc.component_type, acc.normalized);
+            vec3 t = {n[0] * x + n[3] * y + n[6] * z, n[1] * x + n[4] * y + n[7] * z, n[2] * x + n[5] * y + n[8] * z};
+            m->vertices[i].normal = vec3_dot(t, t) > 0.0f ? vec3_norm(t) : (vec3){0.0f, 0.0f, 1.0f};
+        }
+    } else {
+        normal = -1;
+    }
+
+    if (uv >= 0 && resolve_accessor(ctx, uv, 2, &acc) && acc.count == m->vertex_count) {
+        if (!(data = read_accessor(f, &acc, scratch, scratch_bytes))) return 0;
+        cb = component_bytes(acc.component_type);
+        for (size_t i = 0; i < acc.count; ++i) {
+            const uint8_t *e = data + i * acc.stride;
+            m->vertices[i].u = read_component(e, acc.component_type, acc.normalized);
+            m->vertices[i].v = read_component(e + cb, acc.component_type, acc.normalized);
+        }
+    }
+
+    const json_value *materials = json_get(ctx->root, "materials");
+    long mat = json_index(inst->primitive, "material", materials);
+    int material_index = mat >= 0 ? (int)mat : ctx->default_material;
+    if (indices >= 0) {
+        if (!resolve_accessor(ctx, indices, 1, &acc) || acc.component_type == 5126 || acc.count % 3 != 0) return 0;
+        if (!(data = read_accessor(f, &acc, scratch, scratch_bytes))) return 0;
+        m->triangle_count = acc.count / 3;
+        m->triangles = (triangle*)malloc((m->triangle_count ? m->triangle_count : 1) * sizeof(triangle));
+        if (!m->triangles) return 0;
+        for (size_t t = 0; t < m->triangle_count; ++t) {
+            uint32_t idx[3];
+            for (int k = 0; k < 3; ++k) {
+                idx[k] = (uint32_t)read_component(data + (t * 3 + (size_t)k) * acc.stride, acc.component_type, 0);
+                if (idx[k] >= m->vertex_count) return 0;
+            }
+            m->triangles[t] = (triangle){idx[0], idx[1], idx[2], material_index};
+        }
+    } else {
+        m->triangle_count = m->vertex_count / 3;
+        m->triangles = (triangle*)malloc((m->triangle_count ? m->triangle_count : 1) * sizeof(triangle));
+        if (!m->triangles) return 0;
+        for (size_t t = 0; t < m->triangle_count; ++t) {
+            m->triangles[t] = (triangle){(uint32_t)(t * 3), (uint32_t)(t * 3 + 1), (uint32_t)(t * 3 + 2), material_index};
+        }
+    }
+    if (normal < 0) import_smooth_normals(m, NULL);
+    return 1;
+}
+
+static void convert_instances(void *arg, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    gltf_ctx *ctx = (gltf_ctx*)arg;
+    /* Each task reads through its own handle, so seeks do not race. */
+    FILE *f = fopen(ctx->path, "rb");
+    uint8_t *scratch = NULL;
+    size_t scratch_bytes = 0;
+    for (size_t i = begin; i < end; ++i) {
+        if (!f || !convert_instance(ctx, f, &ctx->instances[i], &ctx->out->meshes[i], &scratch, &scratch_bytes)) {
+            thread_pool_atomic_add(&ctx->failures, 1);
+        }
+    }
+    free(scratch);
+    if (f) fclose(f);
+}
+
+/* Reduces the placements to one identity-placed entry per distinct primitive, to be converted once,
+ * and points one scene instance per placement at it. */
+static int split_instances(instance_list *list, scene *s) {
+    gltf_instance *unique = (gltf_instance*)malloc(list->count * sizeof(gltf_instance));
+    s->instances = (mesh_instance*)malloc(list->count * sizeof(mesh_instance));
+    if (!unique || !s->instances) {
+        free(unique);
+        return 0;
+    }
+    size_t unique_count = 0;
+    mat4 identity = mat4_identity();
+    for (size_t i = 0; i < list->count; ++i) {
+        size_t u = 0;
+        while (u < unique_count && unique[u].primitive != list->items[i].primitive) ++u;
+        if (u == unique_count) unique[unique_count++] = (gltf_instance){list->items[i].primitive, identity};
+        mesh_instance *inst = &s->instances[i];
+        const float *w = list->items[i].world.m;
+        for (int row = 0; row < 3; ++row) {
+            for (int col = 0; col < 4; ++col) inst->transform.m[row][col] = w[col * 4 + row];
+        }
+        inst->mesh_index = (uint32_t)u;
+        inst->mask = 0xffu;
+    }
+    s->instance_count = list->count;
+    free(list->items);
+    list->items = unique;
+    list->cap = list->count;
+    list->count = unique_count;
+    return 1;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int import_materials(const json_value *root, scene *s, int *default_material) {
+    const json_value *materials = json_get(root, "materials");
+    size_t count = materials && materials->type == JSON_ARRAY ? materials->count : 0;
+    s->material_count = count + 1;
+    s->materials = (material*)malloc(s->material_count * sizeof(material));
+    if (!s->materials) return 0;
+    for (size_t i = 0; i < count; ++i) {
+        const json_value *pbr = json_get(&materials->items[i], "pbrMetallicRoughness");
+        const json_value *base = json_get(pbr, "baseColorFactor");
+        material m = import_default_material();
+        m.albedo = (vec3){(float)json_number(json_at(base, 0), 1.0), (float)json_number(json_at(base, 1), 1.0),
+                          (float)json_number(json_at(base, 2), 1.0)};
+        m.metallic = (float)json_number(json_get(pbr, "metallicFactor"), 1.0);
+        m.roughness = (float)json_number(json_get(pbr, "roughnessFactor"), 1.0);
+        s->materials[i] = m;
+    }
+    s->materials[count] = import_default_material();
+    *default_material = (int)count;
+    return 1;
+}
+
+int scene_import_glb(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats) {
+    if (!path || !out_scene) return 0;
+    double start_ms = timer_now_ms();
+    memset(out_scene, 0, sizeof(*out_scene));
+    if (stats) memset(stats, 0, sizeof(*stats));
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    uint8_t header[20];
+    int ok = fread(header, 1, sizeof(header), f) == sizeof(header) &&
+             read_u32(header) == GLB_MAGIC && read_u32(header + 4) == 2 && read_u32(header + 16) == GLB_CHUNK_JSON;
+    size_t total = ok ? read_u32(header + 8) : 0;
+    size_t json_length = ok ? read_u32(header + 12) : 0;
+    ok = ok && 20 + json_length <= total;
+    char *json_text = ok ? (char*)malloc(json_length + 1) : NULL;
+    ok = ok && json_text && fread(json_text, 1, json_length, f) == json_length;
+
+    /* The BIN chunk stays on disk; only its position is recorded. */
+    gltf_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.path = path;
+    ctx.out = out_scene;
+    size_t bin_header = 20 + ((json_length + 3) & ~(size_t)3);
+    uint8_t chunk[8];
+    if (ok && bin_header + 8 <= total && fseek(f, (long)bin_header, SEEK_SET) == 0 &&
+        fread(chunk, 1, 8, f) == 8 && read_u32(chunk + 4) == GLB_CHUNK_BIN) {
+        ctx.bin_offset = bin_header + 8;
+        ctx.bin_length = read_u32(chunk);
+        ok = ctx.bin_offset + ctx.bin_length <= total;
+    }
+    fclose(f);
+
+    json_value root;
+    memset(&root, 0, sizeof(root));
+    if (ok) {
+        json_text[json_length] = '\0';
+        json_reader reader = {json_text, json_text + json_length};
+        ok = json_parse(&reader, &root, 0) && root.type == JSON_OBJECT;
+    }
+    ctx.root = &root;
+
+    instance_list list = {0};
+    if (ok) {
+        const json_value *scenes = json_get(&root, "scenes");
+        long scene_index = json_index(&root, "scene", scenes);
+        const json_value *roots = json_get(json_at(scenes, scene_index >= 0 ? (size_t)scene_index : 0), "nodes");
+        mat4 identity = mat4_identity();
+        for (size_t i = 0; ok && roots && roots->type == JSON_ARRAY && i < roots->count; ++i) {
+            ok = collect_node(&root, (long)json_number(&roots->items[i], -1.0), &identity, &list, 0);
+        }
+    }
+    ok = ok && list.count > 0 && import_materials(&root, out_scene, &ctx.default_material);
+    if (ok && opts && opts->instance_meshes) ok = split_instances(&list, out_scene);
+    if (ok) {
+        out_scene->mesh_count = list.count;
+        out_scene->meshes = (mesh*)calloc(list.count, sizeof(mesh));
+        ok = out_scene->meshes != NULL;
+    }
+    if (ok) {
+        ctx.instances = list.items;
+        thread_pool_parallel_for(opts ? opts->pool : NULL, list.count, 1, convert_instances, &ctx);
+        ok = ctx.failures == 0;
+    }
+    free(list.items);
+    json_free(&root);
+    free(json_text);
+    if (!ok) {
+        destroy_scene(out_scene);
+        return 0;
+    }
+    if (stats) stats->chunk_count = out_scene->mesh_count;
+    import_finish_stats(stats, out_scene, total, start_ms);
+    return 1;
+}
@@ -0,0 +1,11 @@
+#ifndef SCENE_IMPORT_INTERNAL_H
+#define SCENE_IMPORT_INTERNAL_H
+
+#include "scene_import.h"
+
+material import_default_material(void);
+/* Area-weighted face normals summed into the vertices flagged in missing (all when NULL). */
+void import_smooth_normals(mesh *m, const uint8_t *missing);
+void import_finish_stats(scene_import_stats *stats, const scene *s, size_t bytes, double start_ms);
+
+#endif
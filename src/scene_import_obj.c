@@ -0,0 +1,596 @@
+#include "scene_import_internal.h"
+#include "timer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Slices smaller than this are not worth a task. */
+#define OBJ_MIN_PART_BYTES (64u << 10)
+#define OBJ_PARTS_PER_WORKER 4
+#define OBJ_NO_INDEX UINT32_MAX
+
+/* One face corner as parsed. Relative (negative) references are stored as an offset from the
+ * part's first element of that kind and fixed up once the preceding parts' counts are known. */
+typedef struct {
+    int64_t index[3];
+    uint8_t present;
+    uint8_t relative;
+} obj_corner;
+
+typedef struct {
+    uint32_t first_corner;
+    uint32_t corner_count;
+    /* Index into the part's usemtl names, or -1 to keep the material in effect. */
+    int32_t material;
+} obj_face;
+
+/* Parse output of one slice of a chunk; buffers keep their capacity from chunk to chunk. */
+typedef struct {
+    const char *begin;
+    const char *end;
+    float *positions;
+    size_t position_count, position_cap;
+    float *normals;
+    size_t normal_count, normal_cap;
+    float *uvs;
+    size_t uv_count, uv_cap;
+    obj_corner *corners;
+    size_t corner_count, corner_cap;
+    obj_face *faces;
+    size_t face_count, face_cap;
+    char **names;
+    size_t name_count, name_cap;
+    char **libraries;
+    size_t library_count, library_cap;
+    int failed;
+} obj_part;
+
+typedef struct {
+    uint32_t key[3];
+    uint32_t vertex;
+} dedup_slot;
+
+typedef struct {
+    float *positions;
+    size_t position_count, position_cap;
+    float *normals;
+    size_t normal_count, normal_cap;
+    float *uvs;
+    size_t uv_count, uv_cap;
+    mesh *out;
+    size_t vertex_cap, triangle_cap;
+    uint8_t *missing_normal;
+    dedup_slot *slots;
+    size_t slot_count, slot_used;
+    char **materials;
+    size_t material_count, material_cap;
+    int32_t current_material;
+    char **libraries;
+    size_t library_count, library_cap;
+    size_t deduplicated;
+} obj_importer;
+
+static int reserve(void **ptr, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) return 1;
+    size_t next = *cap ? *cap : 64;
+    while (next < need) next *= 2;
+    void *grown = realloc(*ptr, next * elem);
+    if (!grown) return 0;
+    *ptr = grown;
+    *cap = next;
+    return 1;
+}
+
+static char *copy_string(const char *begin, const char *end) {
+    char *s = (char*)malloc((size_t)(end - begin) + 1);
+    if (!s) return NULL;
+    memcpy(s, begin, (size_t)(end - begin));
+    s[end - begin] = '\0';
+    return s;
+}
+
+static int push_string(char ***list, size_t *count, size_t *cap, const char *begin, const char *end) {
+    if (!reserve((void**)list, cap, *count + 1, sizeof(char*))) return 0;
+    char *s = copy_string(begin, end);
+    if (!s) return 0;
+    (*list)[(*count)++] = s;
+    return 1;
+}
+
+static void free_strings(char **list, size_t count) {
+    for (size_t i = 0; i < count; ++i) free(list[i]);
+}
+
+static const char *skip_blank(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    return p;
+}
+
+/* Trims trailing blanks and a CR from [begin, end). */
+static const char *trim_end(const char *begin, const char *end) {
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) --end;
+    return end;
+}
+
+/* Decimal float with optional exponent; never reads past end, unlike strtof, which would also skip newlines. */
+static int parse_float(const char **cursor, const char *end, float *out) {
+    const char *p = skip_blank(*cursor, end);
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else ++exponent;
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (digits == 0) return 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int exp_negative = 0, exp_value = 0, exp_digits = 0;
+        if (q < end && (*q == '-' || *q == '+')) exp_negative = *q++ == '-';
+        for (; q < end && *q >= '0' && *q <= '9'; ++q, ++exp_digits) {
+            if (exp_value < 10000) exp_value = exp_value * 10 + (*q - '0');
+        }
+        if (exp_digits > 0) {
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = q;
+        }
+    }
+    double value = (double)mantissa * pow(10.0, (double)exponent);
+    *out = (float)(negative ? -value : value);
+    *cursor = p;
+    return 1;
+}
+
+static int parse_index(const char **cursor, const char *end, int64_t *out) {
+    const char *p = *cursor;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    int64_t value = 0;
+    const char *start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        if (value < ((int64_t)1 << 40)) value = value * 10 + (*p - '0');
+    }
+    if (p == start) return 0;
+    *out = negative ? -value : value;
+    *cursor = p;
+    return 1;
+}
+
+static int parse_floats(const char *p, const char *end, float **array, size_t *count, size_t *cap, int n) {
+    if (!reserve((void**)array, cap, (*count + 1) * (size_t)n, sizeof(float))) return 0;
+    float *dst = *array + *count * (size_t)n;
+    for (int i = 0; i < n; ++i) {
+        /* Missing trailing components (e.g. 1D texcoords) read as 0. */
+        if (!parse_float(&p, end, &dst[i])) dst[i] = 0.0f;
+    }
+    ++*count;
+    return 1;
+}
+
+static int parse_face(obj_part *part, const char *p, const char *end) {
+    size_t locals[3] = {part->position_count, part->uv_count, part->normal_count};
+    obj_face face = {(uint32_t)part->corner_count, 0, -1};
+    if (part->name_count > 0) face.material = (int32_t)part->name_count - 1;
+    for (;;) {
+        p = skip_blank(p, end);
+        if (p >= end || *p == '\r') break;
+        obj_corner c = {{0, 0, 0}, 0, 0};
+        for (int k = 0; k < 3; ++k) {
+            int64_t value;
+            if (parse_index(&p, end, &value)) {
+                if (value == 0) return 0;
+                c.present |= (uint8_t)(1u << k);
+                if (value < 0) {
+                    c.relative |= (uint8_t)(1u << k);
+                    c.index[k] = (int64_t)locals[k] + value;
+                } else {
+                    c.index[k] = value - 1;
+                }
+            } else if (k == 0) {
+                return 0;
+            }
+            if (k < 2 && p < end && *p == '/') ++p;
+            else break;
+        }
+        if (!reserve((void**)&part->corners, &part->corner_cap, part->corner_count + 1, sizeof(obj_corner))) return 0;
+        part->corners[part->corner_count++] = c;
+        ++face.corner_count;
+    }
+    if (face.corner_count < 3) {
+        part->corner_count = face.first_corner;
+        return 1;
+    }
+    if (!reserve((void**)&part->faces, &part->face_cap, part->face_count + 1, sizeof(obj_face))) return 0;
+    part->faces[part->face_count++] = face;
+    return 1;
+}
+
+static int keyword(const char *p, const char *end, const char *word) {
+    size_t n = strlen(word);
+    return (size_t)(end - p) > n && memcmp(p, word, n) == 0 && (p[n] == ' ' || p[n] == '\t');
+}
+
+static void parse_part(obj_part *part) {
+    part->position_count = part->normal_count = part->uv_count = 0;
+    part->corner_count = part->face_count = 0;
+    free_strings(part->names, part->name_count);
+    free_strings(part->libraries, part->library_count);
+    part->name_count = part->library_count = 0;
+    part->failed = 0;
+
+    /* Faces before the part's first usemtl keep material -1 and inherit the one in effect at merge time. */
+    const char *p = part->begin;
+    while (p < part->end && !part->failed) {
+        const char *line_end = (const char*)memchr(p, '\n', (size_t)(part->end - p));
+        if (!line_end) line_end = part->end;
+        const char *q = skip_blank(p, line_end);
+        int ok = 1;
+        if (keyword(q, line_end, "v")) {
+            ok = parse_floats(q + 1, line_end, &part->positions, &part->position_count, &part->position_cap, 3);
+        } else if (keyword(q, line_end, "vn")) {
+            ok = parse_floats(q + 2, line_end, &part->normals, &part->normal_count, &part->normal_cap, 3);
+        } else if (keyword(q, line_end, "vt")) {
+            ok = parse_floats(q + 2, line_end, &part->uvs, &part->uv_count, &part->uv_cap, 2);
+        } else if (keyword(q, line_end, "f")) {
+            ok = parse_face(part, q + 1, line_end);
+        } else if (keyword(q, line_end, "usemtl")) {
+            const char *name = skip_blank(q + 6, line_end);
+            ok = push_string(&part->names, &part->name_count, &part->name_cap, name, trim_end(name, line_end));
+        } else if (keyword(q, line_end, "mtllib")) {
+            const char *name = skip_blank(q + 6, line_end);
+            ok = push_string(&part->libraries, &part->library_count, &part->library_cap, name, trim_end(name, line_end));
+        }
+        part->failed = !ok;
+        p = line_end + 1;
+    }
+}
+
+static void parse_parts(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    obj_part *parts = (obj_part*)ctx;
+    for (size_t i = begin; i < end; ++i) parse_part(&parts[i]);
+}
+
+static int32_t find_or_add_material(obj_importer *imp, const char *name) {
+    for (size_t i = 0; i < imp->material_count; ++i) {
+        if (strcmp(imp->materials[i], name) == 0) return (int32_t)i;
+    }
+    if (!push_string(&imp->materials, &imp->material_count, &imp->material_cap, name, name + strlen(name))) return -1;
+    return (int32_t)imp->material_count - 1;
+}
+
+static int append_floats(float **dst, size_t *count, size_t *cap, const float *src, size_t n, int width) {
+    if (!reserve((void**)dst, cap, (*count + n) * (size_t)width, sizeof(float))) return 0;
+    memcpy(*dst + *count * (size_t)width, src, n * (size_t)width * sizeof(float));
+    *count += n;
+    return 1;
+}
+
+static size_t hash_key(const uint32_t key[3]) {
+    uint64_t h = key[0] * 0x9e3779b97f4a7c15ull;
+    h ^= (key[1] + 0x632be59bd9b4e019ull) * 0xc2b2ae3d27d4eb4full;
+    h ^= (key[2] + 0x165667b19e3779f9ull) * 0x94d049bb133111ebull;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static int grow_dedup(obj_importer *imp) {
+    size_t count = imp->slot_count ? imp->slot_count * 2 : 4096;
+    dedup_slot *slots = (dedup_slot*)malloc(count * sizeof(dedup_slot));
+    if (!slots) return 0;
+    for (size_t i = 0; i < count; ++i) slots[i].vertex = UINT32_MAX;
+    for (size_t i = 0; i < imp->slot_count; ++i) {
+        if (imp->slots[i].vertex == UINT32_MAX) continue;
+        size_t s = hash_key(imp->slots[i].key) & (count - 1);
+        while (slots[s].vertex != UINT32_MAX) s = (s + 1) & (count - 1);
+        slots[s] = imp->slots[i];
+    }
+    free(imp->slots);
+    imp->slots = slots;
+    imp->slot_count = count;
+    return 1;
+}
+
+/* Returns the output vertex for a resolved corner, creating it on first use. */
+static int corner_vertex(obj_importer *imp, const uint32_t key[3], uint32_t *out) {
+    if ((imp->slot_used + 1) * 2 > imp->slot_count && !grow_dedup(imp)) return 0;
+    size_t s = hash_key(key) & (imp->slot_count - 1);
+    for (; imp->slots[s].vertex != UINT32_MAX; s = (s + 1) & (imp->slot_count - 1)) {
+        if (memcmp(imp->slots[s].key, key, sizeof(imp->slots[s].key)) == 0) {
+            ++imp->deduplicated;
+            *out = imp->slots[s].vertex;
+            return 1;
+        }
+    }
+    mesh *m = imp->out;
+    if (m->vertex_count >= UINT32_MAX - 1) return 0;
+    vertex *v = &m->vertices[m->vertex_count];
+    memcpy(&v->position, &imp->positions[(size_t)key[0] * 3], sizeof(vec3));
+    v->normal = (vec3){0.0f, 0.0f, 0.0f};
+    if (key[2] != OBJ_NO_INDEX) memcpy(&v->normal, &imp->normals[(size_t)key[2] * 3], sizeof(vec3));
+    v->u = key[1] != OBJ_NO_INDEX ? imp->uvs[(size_t)key[1] * 2] : 0.0f;
+    v->v = key[1] != OBJ_NO_INDEX ? imp->uvs[(size_t)key[1] * 2 + 1] : 0.0f;
+    imp->missing_normal[m->vertex_count] = key[2] == OBJ_NO_INDEX;
+    imp->slots[s].key[0] = key[0];
+    imp->slots[s].key[1] = key[1];
+    imp->slots[s].key[2] = key[2];
+    imp->slots[s].vertex = (uint32_t)m->vertex_count;
+    ++imp->slot_used;
+    *out = (uint32_t)m->vertex_count++;
+    return 1;
+}
+
+/* Appends one parsed part in file order: attributes, then its faces fanned into triangles. */
+static int merge_part(obj_importer *imp, const obj_part *part) {
+    size_t bases[3] = {imp->position_count, imp->uv_count, imp->normal_count};
+    if (!append_floats(&imp->positions, &imp->position_count, &imp->position_cap, part->positions, part->position_count, 3) ||
+        !append_floats(&imp->uvs, &imp->uv_count, &imp->uv_cap, part->uvs, part->uv_count, 2) ||
+        !append_floats(&imp->normals, &imp->normal_count, &imp->normal_cap, part->normals, part->normal_count, 3)) {
+        return 0;
+    }
+    size_t counts[3] = {imp->position_count, imp->uv_count, imp->normal_count};
+    for (size_t i = 0; i < part->library_count; ++i) {
+        const char *lib = part->libraries[i];
+        if (!push_string(&imp->libraries, &imp->library_count, &imp->library_cap, lib, lib + strlen(lib))) return 0;
+    }
+
+    int32_t *material_map = (int32_t*)malloc((part->name_count ? part->name_count : 1) * sizeof(int32_t));
+    if (!material_map) return 0;
+    int ok = 1;
+    for (size_t i = 0; i < part->name_count && ok; ++i) {
+        material_map[i] = find_or_add_material(imp, part->names[i]);
+        ok = material_map[i] >= 0;
+    }
+
+    /* Size the mesh arrays once per part rather than per element. */
+    size_t new_triangles = 0;
+    for (size_t i = 0; i < part->face_count; ++i) new_triangles += part->faces[i].corner_count - 2;
+    mesh *m = imp->out;
+    size_t vertex_cap = imp->vertex_cap;
+    ok = ok && reserve((void**)&m->triangles, &imp->triangle_cap, m->triangle_count + new_triangles, sizeof(triangle)) &&
+         reserve((void**)&m->vertices, &imp->vertex_cap, m->vertex_count + part->corner_count, sizeof(vertex));
+    if (ok && imp->vertex_cap != vertex_cap) {
+        uint8_t *missing = (uint8_t*)realloc(imp->missing_normal, imp->vertex_cap);
+        ok = missing != NULL;
+        if (ok) imp->missing_normal = missing;
+    }
+    if (ok && imp->current_material < 0 && part->face_count > 0 && part->faces[0].material < 0) {
+        imp->current_material = find_or_add_material(imp, "");
+        ok = imp->current_material >= 0;
+    }
+
+    for (size_t f = 0; f < part->face_count && ok; ++f) {
+        const obj_face *face = &part->faces[f];
+        if (face->material >= 0) imp->current_material = material_map[face->material];
+        uint32_t first = 0, previous = 0;
+        for (uint32_t c = 0; c < face->corner_count && ok; ++c) {
+            const obj_corner *corner = &part->corners[face->first_corner + c];
+            uint32_t key[3];
+            for (int k = 0; k < 3 && ok; ++k) {
+                if (!(corner->present & (1u << k))) {
+                    key[k] = OBJ_NO_INDEX;
+                    continue;
+                }
+                int64_t index = corner->index[k] + ((corner->relative & (1u << k)) ? (int64_t)bases[k] : 0);
+                ok = index >= 0 && index < (int64_t)counts[k];
+                key[k] = (uint32_t)index;
+            }
+            /* A position is required; missing attributes are fine. */
+            uint32_t vertex_index = 0;
+            ok = ok && key[0] != OBJ_NO_INDEX && corner_vertex(imp, key, &vertex_index);
+            if (!ok) break;
+            if (c == 0) {
+                first = vertex_index;
+            } else if (c >= 2) {
+                m->triangles[m->triangle_count++] = (triangle){first, previous, vertex_index, imp->current_material};
+            }
+            previous = vertex_index;
+        }
+    }
+    /* A trailing usemtl with no face after it in this part still applies to the next one. */
+    if (ok && part->name_count > 0) imp->current_material = material_map[part->name_count - 1];
+    free(material_map);
+    return ok;
+}
+
+/* Splits [begin, end) into parts that start at line beginnings. */
+static size_t split_parts(obj_part *parts, size_t max_parts, const char *begin, const char *end) {
+    size_t len = (size_t)(end - begin);
+    size_t count = len / OBJ_MIN_PART_BYTES;
+    if (count < 1) count = 1;
+    if (count > max_parts) count = max_parts;
+    const char *p = begin;
+    for (size_t i = 0; i < count; ++i) {
+        const char *stop = i + 1 == count ? end : begin + len * (i + 1) / count;
+        if (stop < p) stop = p;
+        if (stop < end) {
+            const char *nl = (const char*)memchr(stop, '\n', (size_t)(end - stop));
+            stop = nl ? nl + 1 : end;
+        }
+        parts[i].begin = p;
+        parts[i].end = stop;
+        p = stop;
+    }
+    return count;
+}
+
+static void parse_mtl(obj_importer *imp, scene *s, const char *obj_path, const char *library) {
+    size_t dir_len = 0;
+    for (size_t i = 0; obj_path[i]; ++i) {
+        if (obj_path[i] == '/' || obj_path[i] == '\\') dir_len = i + 1;
+    }
+    size_t lib_len = strlen(library);
+    char *path = (char*)malloc(dir_len + lib_len + 1);
+    if (!path) return;
+    memcpy(path, obj_path, dir_len);
+    memcpy(path + dir_len, library, lib_len + 1);
+    FILE *f = fopen(path, "rb");
+    free(path);
+    if (!f) return;
+
+    char line[1024];
+    material *current = NULL;
+    while (fgets(line, sizeof(line), f)) {
+        const char *end = line + strlen(line);
+        if (end > line && end[-1] == '\n') --end;
+        const char *p = skip_blank(line, end);
+        if (keyword(p, end, "newmtl")) {
+            const char *name = skip_blank(p + 6, end);
+            const char *name_end = trim_end(name, end);
+            current = NULL;
+            for (size_t i = 0; i < imp->material_count; ++i) {
+                if (strlen(imp->materials[i]) == (size_t)(name_end - name) &&
+                    memcmp(imp->materials[i], name, (size_t)(name_end - name)) == 0) {
+                    current = &s->materials[i];
+                }
+            }
+        } else if (current && keyword(p, end, "Kd")) {
+            const char *q = p + 2;
+            parse_float(&q, end, &current->albedo.x);
+            parse_float(&q, end, &current->albedo.y);
+            parse_float(&q, end, &current->albedo.z);
+        } else if (current && keyword(p, end, "Ns")) {
+            /* Phong exponent to roughness, the usual Beckmann-style mapping. */
+            const char *q = p + 2;
+            float ns;
+            if (parse_float(&q, end, &ns)) current->roughness = sqrtf(2.0f / (ns + 2.0f));
+        } else if (current && keyword(p, end, "Pr")) {
+            const char *q = p + 2;
+            parse_float(&q, end, &current->roughness);
+        } else if (current && keyword(p, end, "Pm")) {
+            const char *q = p + 2;
+            parse_float(&q, end, &current->metallic);
+        }
+    }
+    fclose(f);
+}
+
+static void free_importer(obj_importer *imp) {
+    free(imp->positions);
+    free(imp->normals);
+    free(imp->uvs);
+    free(imp->missing_normal);
+    free(imp->slots);
+    free_strings(imp->materials, imp->material_count);
+    free(imp->materials);
+    free_strings(imp->libraries, imp->library_count);
+    free(imp->libraries);
+}
+
+static void free_parts(obj_part *parts, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(parts[i].positions);
+        free(parts[i].normals);
+        free(parts[i].uvs);
+        free(parts[i].corners);
+        free(parts[i].faces);
+        free_strings(parts[i].names, parts[i].name_count);
+        free(parts[i].names);
+        free_strings(parts[i].libraries, parts[i].library_count);
+        free(parts[i].libraries);
+    }
+    free(parts);
+}
+
+int scene_import_obj(const char *path, scene *out_scene, const scene_import_options *opts, scene_import_stats *stats) {
+    if (!path || !out_scene) return 0;
+    double start_ms = timer_now_ms();
+    scene_import_options defaults;
+    scene_import_options_default(&defaults);
+    if (!opts) opts = &defaults;
+    memset(out_scene, 0, sizeof(*out_scene));
+    if (stats) memset(stats, 0, sizeof(*stats));
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    size_t cap = opts->chunk_bytes ? opts->chunk_bytes : defaults.chunk_bytes;
+    size_t max_parts = opts->pool ? (size_t)thread_pool_worker_count(opts->pool) * OBJ_PARTS_PER_WORKER : 1;
+    char *buffer = (char*)malloc(cap);
+    obj_part *parts = (obj_part*)calloc(max_parts, sizeof(obj_part));
+    obj_importer imp;
+    memset(&imp, 0, sizeof(imp));
+    imp.current_material = -1;
+    out_scene->mesh_count = 1;
+    out_scene->meshes = (mesh*)calloc(1, sizeof(mesh));
+    imp.out = out_scene->meshes;
+    int ok = buffer && parts && imp.out;
+
+    size_t filled = 0, total_bytes = 0, chunk_count = 0;
+    int eof = 0;
+    while (ok && (!eof || filled > 0)) {
+        if (!eof) {
+            size_t n = fread(buffer + filled, 1, cap - filled, f);
+            ok = !ferror(f);
+            eof = n < cap - filled;
+            filled += n;
+            total_bytes += n;
+        }
+        /* Only whole lines are parsed; the tail moves to the front of the next chunk. */
+        size_t usable = filled;
+        if (!eof) {
+            while (usable > 0 && buffer[usable - 1] != '\n') --usable;
+            if (usable == 0) {
+                /* A line longer than the buffer. */
+                char *grown = (char*)realloc(buffer, cap * 2);
+                ok = ok && grown != NULL;
+                if (grown) buffer = grown;
+                cap *= 2;
+                continue;
+            }
+        }
+        if (!ok || usable == 0) break;
+
+        size_t part_count = split_parts(parts, max_parts, buffer, buffer + usable);
+        thread_pool_parallel_for(opts->pool, part_count, 1, parse_parts, parts);
+        for (size_t i = 0; i < part_count && ok; ++i) ok = !parts[i].failed && merge_part(&imp, &parts[i]);
+        memmove(buffer, buffer + usable, filled - usable);
+        filled -= usable;
+        ++chunk_count;
+    }
+    fclose(f);
+    free(buffer);
+
+    if (ok) {
+        mesh *m = imp.out;
+        if (imp.material_count == 0) ok = find_or_add_material(&imp, "") >= 0;
+        out_scene->material_count = imp.material_count;
+        out_scene->materials = (material*)malloc(imp.material_count * sizeof(material));
+        ok = ok && out_scene->materials;
+        for (size_t i = 0; ok && i < imp.material_count; ++i) out_scene->materials[i] = import_default_material();
+        for (size_t i = 0; ok && i < imp.library_count; ++i) parse_mtl(&imp, out_scene, path, imp.libraries[i]);
+
+        int any_missing = 0;
+        for (size_t i = 0; i < m->vertex_count && !any_missing; ++i) any_missing = imp.missing_normal[i];
+        if (ok && any_missing) import_smooth_normals(m, imp.missing_normal);
+
+        /* One shrink per array now that the final sizes are known. */
+        if (ok && m->vertex_count > 0) {
+            vertex *v = (vertex*)realloc(m->vertices, m->vertex_count * sizeof(vertex));
+            if (v) m->vertices = v;
+            triangle *t = (triangle*)realloc(m->triangles, (m->triangle_count ? m->triangle_count : 1) * sizeof(triangle));
+            if (t) m->triangles = t;
+        }
+    }
+    if (stats && ok) {
+        stats->chunk_count = chunk_count;
+        stats->deduplicated_corners = imp.deduplicated;
+    }
+    free_parts(parts, parts ? max_parts : 0);
+    free_importer(&imp);
+    if (!ok) {
+        destroy_scene(out_scene);
+        return 0;
+    }
+    import_finish_stats(stats, out_scene, total_bytes, start_ms);
+    return 1;
+}
@@ -0,0 +1,165 @@
+#include "software_rt_internal.h"
+
+#include <float.h>
+#include <string.h>
+
+#include "timer.h"
+
+/* Hash indices within one sample (sample << 16): shadow samples count up from 0 as in the tiled
+ * renderer, the sub-pixel jitter uses the top two. */
+#define PROGRESSIVE_SEQ_JITTER 0xfffeu
+#define PROGRESSIVE_MAX_SAMPLES 65536u
+
+/* Running sums of one pixel; its estimate is sum / samples. */
+typedef struct {
+    vec3 sum;
+    float luminance2;
+} progressive_pixel;
+
+typedef struct progressive_state progressive_state;
+
+typedef struct {
+    const progressive_state *state;
+    const render_tile *tile;
+    /* Samples per pixel taken so far and added by the running pass. */
+    uint32_t samples;
+    uint32_t pass_samples;
+    float error;
+    int converged;
+} progressive_tile;
+
+struct progressive_state {
+    const render_ctx *ctx;
+    progressive_pixel *pixels;
+};
+
+static float luminance(vec3 c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+/* Adds the pass's samples to every pixel of the tile, stores the new means and re-estimates the tile
+ * error. Samples depend only on pixel and sample index, so neither scheduling nor the pass split
+ * changes the image. */
+static void progressive_tile_task(void *arg) {
+    progressive_tile *pt = (progressive_tile*)arg;
+    const render_ctx *ctx = pt->state->ctx;
+    const render_tile *t = pt->tile;
+    PROFILE_BEGIN(zone, "progressive_tile");
+    uint32_t first = pt->samples, last = pt->samples + pt->pass_samples;
+    float n = (float)last;
+    float error2 = 0.0f;
+
+    for (uint32_t y = t->y0; y < t->y1; ++y) {
+        for (uint32_t x = t->x0; x < t->x1; ++x) {
+            progressive_pixel *px = &pt->state->pixels[(size_t)y * ctx->fb->width + x];
+            uint64_t cost = ctx->traversal_cost ? profile_thread_cost() : 0;
+            for (uint32_t i = first; i < last; ++i) {
+                uint32_t seq = i << 16;
+                float jx = render_hash_unit(x, y, seq | PROGRESSIVE_SEQ_JITTER);
+                float jy = render_hash_unit(x, y, (seq | PROGRESSIVE_SEQ_JITTER) + 1);
+                ray r = render_camera_ray(ctx, (float)x + jx, (float)y + jy);
+                bvh_ray_hit hit;
+                bvh_trace_closest_hit(ctx->tree, r, 0.001f, 1e30f, &hit);
+                vec3 c = render_shade_primary(ctx, x, y, r, &hit, seq);
+                float l = luminance(c);
+                px->sum = vec3_add(px->sum, c);
+                px->luminance2 += l * l;
+            }
+            if (ctx->traversal_cost) ctx->traversal_cost[(size_t)y * ctx->fb->width + x] += (float)(profile_thread_cost() - cost);
+            vec3 mean = vec3_mul(px->sum, 1.0f / n);
+            render_store_pixel(ctx->fb, x, y, mean);
+            if (last > 1) {
+                /* Squared standard error of the mean, relative to the pixel's brightness. */
+                float m = luminance(mean);
+                float variance = (px->luminance2 / n - m * m) * n / (n - 1.0f);
+                float rel = m + RENDER_ERROR_LUMINANCE_BIAS;
+                if (variance > 0.0f) error2 += variance / (n * rel * rel);
+            }
+        }
+    }
+    size_t count = (size_t)(t->x1 - t->x0) * (t->y1 - t->y0);
+    pt->samples = last;
+    pt->error = last > 1 ? sqrtf(error2 / (float)count) : FLT_MAX;
+    PROFILE_END(zone);
+}
+
+int render_progressive(const render_ctx *ctx, thread_pool *pool, const render_settings *settings,
+                       const render_tile *tiles, size_t tile_count, render_progress *progress) {
+    const render_progressive_options *opts = &settings->progressive;
+    uint32_t max_samples = opts->max_samples < PROGRESSIVE_MAX_SAMPLES ? opts->max_samples : PROGRESSIVE_MAX_SAMPLES;
+    /* A variance needs two samples. */
+    uint32_t min_samples = opts->min_samples > 2 ? opts->min_samples : 2;
+    uint32_t per_pass = opts->samples_per_pass ? opts->samples_per_pass : 1;
+
+    progressive_state state;
+    state.ctx = ctx;
+    state.pixels = (progressive_pixel*)arena_calloc(ctx->frame, (size_t)ctx->fb->width * ctx->fb->height,
+                                                     sizeof(progressive_pixel), RENDER_FRAME_ALIGN);
+    progressive_tile *pts = (progressive_tile*)arena_calloc(ctx->frame, tile_count, sizeof(progressive_tile), RENDER_FRAME_ALIGN);
+    if (!state.pixels || !pts) return 0;
+    for (size_t i = 0; i < tile_count; ++i) {
+        pts[i].state = &state;
+        pts[i].tile = &tiles[i];
+    }
+
+    memset(progress, 0, sizeof(*progress));
+    progress->tile_count = tile_count;
+    double start_ms = timer_now_ms(), reported_ms = start_ms, pass_ms = 0.0;
+    size_t active = tile_count;
+    while (active > 0) {
+        /* The first pass always runs so every pixel has an estimate. */
+        double now_ms = timer_now_ms();
+        if (opts->time_budget_ms > 0.0 && progress->pass > 0 && now_ms - start_ms + pass_ms > opts->time_budget_ms) {
+            progress->budget_exhausted = 1;
+            break;
+        }
+
+        PROFILE_BEGIN(zone, "progressive_pass");
+        thread_pool_group group = {0};
+        for (size_t i = 0; i < tile_count; ++i) {
+            progressive_tile *pt = &pts[i];
+            if (pt->converged) continue;
+            pt->pass_samples = max_samples - pt->samples < per_pass ? max_samples - pt->samples : per_pass;
+            thread_pool_submit(pool, &group, progressive_tile_task, pt);
+        }
+        thread_pool_wait(pool, &group);
+        PROFILE_END(zone);
+        double end_ms = timer_now_ms();
+        pass_ms = end_ms - now_ms;
+        progress->pass++;
+
+        active = 0;
+        progress->max_error = 0.0f;
+        for (size_t i = 0; i < tile_count; ++i) {
+            progressive_tile *pt = &pts[i];
+            if (pt->converged) continue;
+            const render_tile *t = pt->tile;
+            progress->samples += (size_t)pt->pass_samples * (t->x1 - t->x0) * (t->y1 - t->y0);
+            if (pt->samples > progress->max_pixel_samples) progress->max_pixel_samples = pt->samples;
+            int below = opts->target_error > 0.0f && pt->samples >= min_samples && pt->error <= opts->target_error;
+            if (below || pt->samples >= max_samples) {
+                pt->converged = 1;
+                progress->converged_tiles++;
+                if (ctx->tile_done) ctx->tile_done(ctx->tile_done_user, ctx->fb, t->x0, t->y0, t->x1, t->y1);
+                continue;
+            }
+            active++;
+            if (pt->error != FLT_MAX && pt->error > progress->max_error) progress->max_error = pt->error;
+        }
+        progress->elapsed_ms = end_ms - start_ms;
+        if (opts->progress && active > 0 && end_ms - reported_ms >= opts->progress_interval_ms) {
+            opts->progress(opts->progress_user, ctx->fb, progress);
+            reported_ms = end_ms;
+        }
+    }
+
+    /* Tiles still sampling when the budget ran out are final now. */
+    for (size_t i = 0; ctx->tile_done && i < tile_count; ++i) {
+        const render_tile *t = pts[i].tile;
+        if (!pts[i].converged) ctx->tile_done(ctx->tile_done_user, ctx->fb, t->x0, t->y0, t->x1, t->y1);
+    }
+    progress->done = 1;
+    progress->elapsed_ms = timer_now_ms() - start_ms;
+    if (opts->progress) opts->progress(opts->progress_user, ctx->fb, progress);
+    return 1;
+}
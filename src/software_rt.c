@@ -1,71 +1,535 @@
 #include "software_rt.h"
 #include "bvh.h"
+#include "bvh_cache.h"
+#include "software_rt_internal.h"
+#include "timer.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static vec3 mul(vec3 a, vec3 b) { return (vec3){a.x*b.x,a.y*b.y,a.z*b.z}; }
+void render_settings_default(render_settings *settings) {
+    bvh_build_options_default(&settings->bvh);
+    settings->prebuilt_bvh = NULL;
+    settings->bvh_cache_dir = NULL;
+    settings->worker_count = 0;
+    settings->pool = NULL;
+    settings->camera.position = (vec3){0.0f, 0.0f, -3.0f};
+    settings->camera.target = (vec3){0.0f, 0.0f, 0.0f};
+    settings->camera.up = (vec3){0.0f, 1.0f, 0.0f};
+    settings->camera.focal_length = 1.5f;
+    settings->tile_size = 32;
+    settings->shadow_samples = 1;
+    settings->light_angle = 0.0f;
+    settings->packet_size = 16;
+    settings->mode = RENDER_MODE_TILED;
+    settings->max_bounces = 2;
+    settings->ray_sort = RENDER_SORT_RAY;
+    settings->texture_filter = TEXTURE_FILTER_TRILINEAR;
+    settings->progressive.max_samples = 0;
+    settings->progressive.min_samples = 8;
+    settings->progressive.samples_per_pass = 4;
+    settings->progressive.target_error = 0.02f;
+    settings->progressive.time_budget_ms = 0.0;
+    settings->progressive.progress = NULL;
+    settings->progressive.progress_user = NULL;
+    settings->progressive.progress_interval_ms = 1000.0;
+    settings->traversal_cost = NULL;
+    settings->tile_done = NULL;
+    settings->tile_done_user = NULL;
+    settings->stats = NULL;
+    settings->frame_arena = NULL;
+    settings->quiet = 0;
+}
 
 int render_software(const scene *s, framebuffer *fb) {
-    if (!s || !fb || !fb->rgba8 || fb->width == 0 || fb->height == 0) return 0;
+    render_settings settings;
+    render_settings_default(&settings);
+    return render_software_ex(s, fb, &settings);
+}
 
-    bvh tree;
-    if (!bvh_build(&tree, s)) return 0;
-
-    vec3 cam_pos = {0.0f, 0.0f, -3.0f};
-    vec3 light_dir = vec3_norm((vec3){1.0f, 1.0f, -1.0f});
-
-    for (uint32_t y = 0; y < fb->height; ++y) {
-        for (uint32_t x = 0; x < fb->width; ++x) {
-            float ndc_x = ((float)x + 0.5f) / (float)fb->width;
-            float ndc_y = ((float)y + 0.5f) / (float)fb->height;
-            float px = (2.0f * ndc_x - 1.0f);
-            float py = (1.0f - 2.0f * ndc_y);
-
-            ray r = {cam_pos, vec3_norm((vec3){px, py, 1.5f})};
-            size_t mesh_idx = 0;
-            size_t tri_idx = 0;
-            float t = 0.0f;
-            vec3 geom_n = {0};
-            float bu = 0.0f, bv = 0.0f;
-            vec3 color = {0.03f, 0.03f, 0.05f};
-
-            if (bvh_trace_first_hit(&tree, r, 0.001f, 1e30f, &mesh_idx, &tri_idx, &t, &geom_n, &bu, &bv)) {
-                const mesh *m = &s->meshes[mesh_idx];
-                triangle tr = m->triangles[tri_idx];
-                const material *mat = &s->materials[tr.material_index];
-                vertex v0 = m->vertices[tr.i0];
-                vertex v1 = m->vertices[tr.i1];
-                vertex v2 = m->vertices[tr.i2];
-                float bw = 1.0f - bu - bv;
-                float u = bw * v0.u + bu * v1.u + bv * v2.u;
-                float v = bw * v0.v + bu * v1.v + bv * v2.v;
-
-                vec3 albedo = mat->albedo;
-                if (mat->albedo_texture >= 0 && (size_t)mat->albedo_texture < s->texture_count) {
-                    albedo = mul(albedo, sample_texture(&s->textures[mat->albedo_texture], u, v));
-                }
-
-                vec3 mapped_n = geom_n;
-                if (mat->normal_texture >= 0 && (size_t)mat->normal_texture < s->texture_count) {
-                    vec3 ntex = sample_texture(&s->textures[mat->normal_texture], u, v);
-                    mapped_n = vec3_norm((vec3){2.0f * ntex.x - 1.0f, 2.0f * ntex.y - 1.0f, 2.0f * ntex.z - 1.0f});
-                }
-
-                float ndotl = vec3_dot(mapped_n, vec3_mul(light_dir, -1.0f));
-                if (ndotl < 0.0f) ndotl = 0.0f;
-                float ambient = 0.08f;
-                float gloss = (1.0f - mat->roughness);
-                color = vec3_add(vec3_mul(albedo, ambient + ndotl), (vec3){0.04f*gloss,0.04f*gloss,0.04f*gloss});
+float render_hash_unit(uint32_t x, uint32_t y, uint32_t i) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ i * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+float render_light_visibility(const render_ctx *ctx, vec3 p, uint32_t x, uint32_t y, uint32_t seq) {
+    if (ctx->shadow_samples == 0) return 1.0f;
+    if (ctx->shadow_samples == 1 || ctx->light_radius <= 0.0f) {
+        return bvh_trace_occluded(ctx->tree, (ray){p, ctx->to_light}, 0.001f, 1e30f) ? 0.0f : 1.0f;
+    }
+
+    uint32_t visible = 0;
+    for (uint32_t i = 0; i < ctx->shadow_samples; ++i) {
+        /* Uniform point on the disk subtended by the light. */
+        float radius = ctx->light_radius * sqrtf(render_hash_unit(x, y, seq + 2 * i));
+        float phi = 6.28318531f * render_hash_unit(x, y, seq + 2 * i + 1);
+        vec3 offset = vec3_add(vec3_mul(ctx->light_t, radius * cosf(phi)), vec3_mul(ctx->light_b, radius * sinf(phi)));
+        ray shadow = {p, vec3_norm(vec3_add(ctx->to_light, offset))};
+        if (!bvh_trace_occluded(ctx->tree, shadow, 0.001f, 1e30f)) visible++;
+    }
+    return (float)visible / (float)ctx->shadow_samples;
+}
+
+/* Unnormalized direction through image-plane point (px, py). */
+static vec3 camera_direction(const render_ctx *ctx, float px, float py) {
+    return vec3_add(vec3_add(vec3_mul(ctx->cam_right, px), vec3_mul(ctx->cam_up, py)), ctx->cam_forward);
+}
+
+ray render_primary_ray(const render_ctx *ctx, uint32_t x, uint32_t y) {
+    return render_camera_ray(ctx, (float)x + 0.5f, (float)y + 0.5f);
+}
+
+ray render_camera_ray(const render_ctx *ctx, float fx, float fy) {
+    const framebuffer *fb = ctx->fb;
+    float ndc_x = fx / (float)fb->width;
+    float ndc_y = fy / (float)fb->height;
+    float px = (2.0f * ndc_x - 1.0f);
+    float py = (1.0f - 2.0f * ndc_y);
+    return (ray){ctx->cam_pos, vec3_norm(camera_direction(ctx, px, py))};
+}
+
+void render_primary_differentials(const render_ctx *ctx, uint32_t x, uint32_t y, vec3 *ddx, vec3 *ddy) {
+    const framebuffer *fb = ctx->fb;
+    float ndc_x = ((float)x + 0.5f) / (float)fb->width;
+    float ndc_y = ((float)y + 0.5f) / (float)fb->height;
+    vec3 d = camera_direction(ctx, 2.0f * ndc_x - 1.0f, 1.0f - 2.0f * ndc_y);
+    float len2 = vec3_dot(d, d);
+    float inv_len3 = 1.0f / (len2 * sqrtf(len2));
+    /* d(d/|d|) = (|d|^2 dd - (d . dd) d) / |d|^3 for the unnormalized direction d. */
+    vec3 dx = vec3_mul(ctx->cam_right, 2.0f / (float)fb->width);
+    vec3 dy = vec3_mul(ctx->cam_up, -2.0f / (float)fb->height);
+    *ddx = vec3_mul(vec3_sub(vec3_mul(dx, len2), vec3_mul(d, vec3_dot(d, dx))), inv_len3);
+    *ddy = vec3_mul(vec3_sub(vec3_mul(dy, len2), vec3_mul(d, vec3_dot(d, dy))), inv_len3);
+}
+
+typedef struct {
+    vec3 e1, e2, n;
+    float du1, dv1, du2, dv2;
+} uv_frame;
+
+static void hit_uv_frame(const render_ctx *ctx, const bvh_ray_hit *hit, uv_frame *f) {
+    const mesh *m = &ctx->s->meshes[hit->mesh];
+    triangle tr = mesh_triangle(m, hit->tri);
+    vec3 p0 = mesh_position(m, tr.i0);
+    float u0, v0, u1, v1, u2, v2;
+    mesh_uv(m, tr.i0, &u0, &v0);
+    mesh_uv(m, tr.i1, &u1, &v1);
+    mesh_uv(m, tr.i2, &u2, &v2);
+    f->e1 = bvh_hit_to_world(ctx->tree, hit, vec3_sub(mesh_position(m, tr.i1), p0));
+    f->e2 = bvh_hit_to_world(ctx->tree, hit, vec3_sub(mesh_position(m, tr.i2), p0));
+    f->n = vec3_cross(f->e1, f->e2);
+    f->du1 = u1 - u0;
+    f->dv1 = v1 - v0;
+    f->du2 = u2 - u0;
+    f->dv2 = v2 - v0;
+}
+
+/* Length in UV space of a world-space offset dp lying in the triangle plane. */
+static float uv_length(const uv_frame *f, vec3 dp) {
+    float a = vec3_dot(f->e1, f->e1), b = vec3_dot(f->e1, f->e2), c = vec3_dot(f->e2, f->e2);
+    float det = a * c - b * b;
+    if (det <= 0.0f) return 0.0f;
+    float p = vec3_dot(f->e1, dp), q = vec3_dot(f->e2, dp);
+    float db1 = (c * p - b * q) / det;
+    float db2 = (a * q - b * p) / det;
+    float du = db1 * f->du1 + db2 * f->du2;
+    float dv = db1 * f->dv1 + db2 * f->dv2;
+    return sqrtf(du * du + dv * dv);
+}
+
+float render_differential_footprint(const render_ctx *ctx, const bvh_ray_hit *hit, ray r, vec3 ddx, vec3 ddy) {
+    uv_frame f;
+    hit_uv_frame(ctx, hit, &f);
+    float dn = vec3_dot(r.direction, f.n);
+    if (dn == 0.0f) return 0.0f;
+    /* Pinhole rays share their origin, so dP = t dD + dt D with dt keeping dP on the plane. */
+    vec3 tdx = vec3_mul(ddx, hit->t);
+    vec3 tdy = vec3_mul(ddy, hit->t);
+    vec3 dpdx = vec3_add(tdx, vec3_mul(r.direction, -vec3_dot(tdx, f.n) / dn));
+    vec3 dpdy = vec3_add(tdy, vec3_mul(r.direction, -vec3_dot(tdy, f.n) / dn));
+    float fx = uv_length(&f, dpdx);
+    float fy = uv_length(&f, dpdy);
+    return fx > fy ? fx : fy;
+}
+
+float render_cone_footprint(const render_ctx *ctx, const bvh_ray_hit *hit, float world_width) {
+    uv_frame f;
+    hit_uv_frame(ctx, hit, &f);
+    float world_area = vec3_len(f.n);
+    float uv_area = fabsf(f.du1 * f.dv2 - f.du2 * f.dv1);
+    return world_area > 0.0f ? world_width * sqrtf(uv_area / world_area) : 0.0f;
+}
+
+void render_surface_at(const render_ctx *ctx, const bvh_ray_hit *hit, float footprint, render_surface *out) {
+    const scene *s = ctx->s;
+    const mesh *m = &s->meshes[hit->mesh];
+    triangle tr = mesh_triangle(m, hit->tri);
+    const material *mat = &s->materials[tr.material_index];
+    float u0, v0, u1, v1, u2, v2;
+    mesh_uv(m, tr.i0, &u0, &v0);
+    mesh_uv(m, tr.i1, &u1, &v1);
+    mesh_uv(m, tr.i2, &u2, &v2);
+    float bw = 1.0f - hit->u - hit->v;
+    float u = bw * u0 + hit->u * u1 + hit->v * u2;
+    float v = bw * v0 + hit->u * v1 + hit->v * v2;
+
+    out->mat = mat;
+    out->albedo = mat->albedo;
+    if (mat->albedo_texture >= 0 && (size_t)mat->albedo_texture < s->texture_count) {
+        vec3 tex = sample_texture_filtered(&s->textures[mat->albedo_texture], u, v, footprint, ctx->filter);
+        out->albedo = (vec3){out->albedo.x * tex.x, out->albedo.y * tex.y, out->albedo.z * tex.z};
+    }
+
+    if (mat->normal_texture >= 0 && (size_t)mat->normal_texture < s->texture_count) {
+        vec3 ntex = sample_texture_filtered(&s->textures[mat->normal_texture], u, v, footprint, ctx->filter);
+        out->normal = vec3_norm((vec3){2.0f * ntex.x - 1.0f, 2.0f * ntex.y - 1.0f, 2.0f * ntex.z - 1.0f});
+    } else {
+        out->normal = bvh_hit_normal(ctx->tree, hit);
+    }
+}
+
+void render_store_pixel(framebuffer *fb, uint32_t x, uint32_t y, vec3 color) {
+    size_t idx = ((size_t)y * fb->width + x) * 4;
+    fb->rgba8[idx + 0] = (uint8_t)(fminf(color.x, 1.0f) * 255.0f);
+    fb->rgba8[idx + 1] = (uint8_t)(fminf(color.y, 1.0f) * 255.0f);
+    fb->rgba8[idx + 2] = (uint8_t)(fminf(color.z, 1.0f) * 255.0f);
+    fb->rgba8[idx + 3] = 255;
+    if (fb->rgb32) {
+        float *out = fb->rgb32 + ((size_t)y * fb->width + x) * 3;
+        out[0] = color.x;
+        out[1] = color.y;
+        out[2] = color.z;
+    }
+}
+
+vec3 render_shade_primary(const render_ctx *ctx, uint32_t x, uint32_t y, ray r, const bvh_ray_hit *hit, uint32_t seq) {
+    vec3 color = RENDER_BACKGROUND;
+
+    if (hit->hit) {
+        float footprint = 0.0f;
+        if (ctx->filter != TEXTURE_FILTER_NEAREST) {
+            vec3 ddx, ddy;
+            render_primary_differentials(ctx, x, y, &ddx, &ddy);
+            footprint = render_differential_footprint(ctx, hit, r, ddx, ddy);
+        }
+        render_surface surf;
+        render_surface_at(ctx, hit, footprint, &surf);
+        float ndotl = vec3_dot(surf.normal, ctx->to_light);
+        if (ndotl < 0.0f) ndotl = 0.0f;
+        if (ndotl > 0.0f) ndotl *= render_light_visibility(ctx, vec3_add(r.origin, vec3_mul(r.direction, hit->t)), x, y, seq);
+        float gloss = RENDER_GLOSS * (1.0f - surf.mat->roughness);
+        color = vec3_add(vec3_mul(surf.albedo, RENDER_AMBIENT + ndotl), (vec3){gloss, gloss, gloss});
+    }
+    return color;
+}
+
+/* Tile pixels accumulate in the thread's scratch buffer and reach the framebuffer in one pass per
+ * tile; without a buffer they are stored directly. */
+static void put_pixel(const render_ctx *ctx, const render_tile *tile, vec3 *colors, uint32_t x, uint32_t y, vec3 color) {
+    if (colors) {
+        colors[(size_t)(y - tile->y0) * (tile->x1 - tile->x0) + (x - tile->x0)] = color;
+    } else {
+        render_store_pixel(ctx->fb, x, y, color);
+    }
+}
+
+static void trace_pixel(const render_ctx *ctx, const render_tile *tile, vec3 *colors, uint32_t x, uint32_t y) {
+    uint64_t cost = ctx->traversal_cost ? profile_thread_cost() : 0;
+    ray r = render_primary_ray(ctx, x, y);
+    bvh_ray_hit hit;
+    bvh_trace_closest_hit(ctx->tree, r, 0.001f, 1e30f, &hit);
+    put_pixel(ctx, tile, colors, x, y, render_shade_primary(ctx, x, y, r, &hit, 0));
+    if (ctx->traversal_cost) ctx->traversal_cost[(size_t)y * ctx->fb->width + x] += (float)(profile_thread_cost() - cost);
+}
+
+/* Traces one block of pixels as a single packet; pixels outside the tile are masked off. */
+static void trace_pixel_block(const render_ctx *ctx, const render_tile *tile, vec3 *colors, uint32_t x0, uint32_t y0) {
+    uint64_t cost = ctx->traversal_cost ? profile_thread_cost() : 0;
+    bvh_ray_packet packet;
+    ray rays[BVH_PACKET_MAX];
+    packet.size = ctx->block_w * ctx->block_h;
+    packet.active_mask = 0;
+    for (uint32_t i = 0; i < packet.size; ++i) {
+        uint32_t x = x0 + i % ctx->block_w;
+        uint32_t y = y0 + i / ctx->block_w;
+        rays[i] = render_primary_ray(ctx, x < tile->x1 ? x : tile->x1 - 1, y < tile->y1 ? y : tile->y1 - 1);
+        packet.org_x[i] = rays[i].origin.x;
+        packet.org_y[i] = rays[i].origin.y;
+        packet.org_z[i] = rays[i].origin.z;
+        packet.dir_x[i] = rays[i].direction.x;
+        packet.dir_y[i] = rays[i].direction.y;
+        packet.dir_z[i] = rays[i].direction.z;
+        packet.tmin[i] = 0.001f;
+        packet.tmax[i] = 1e30f;
+        if (x < tile->x1 && y < tile->y1) packet.active_mask |= 1u << i;
+    }
+
+    bvh_packet_hit hits;
+    bvh_trace_packet(ctx->tree, &packet, &hits);
+    for (uint32_t i = 0; i < packet.size; ++i) {
+        if (!(packet.active_mask & (1u << i))) continue;
+        bvh_ray_hit hit = {0};
+        if (hits.hit_mask & (1u << i)) {
+            hit = (bvh_ray_hit){hits.t[i], hits.u[i], hits.v[i], hits.mesh[i], hits.tri[i], 1, hits.instance[i]};
+        }
+        uint32_t x = x0 + i % ctx->block_w, y = y0 + i / ctx->block_w;
+        put_pixel(ctx, tile, colors, x, y, render_shade_primary(ctx, x, y, rays[i], &hit, 0));
+    }
+    if (!ctx->traversal_cost) return;
+    uint32_t active = 0;
+    for (uint32_t m = packet.active_mask; m; m &= m - 1) active++;
+    float share = (float)(profile_thread_cost() - cost) / (float)active;
+    for (uint32_t i = 0; i < packet.size; ++i) {
+        if (packet.active_mask & (1u << i)) {
+            ctx->traversal_cost[(size_t)(y0 + i / ctx->block_w) * ctx->fb->width + x0 + i % ctx->block_w] += share;
+        }
+    }
+}
+
+/* Pixels depend only on their coordinates, so the image does not depend on which thread ran a tile. */
+static void render_tile_task(void *arg) {
+    const render_tile *tile = (const render_tile*)arg;
+    const render_ctx *ctx = tile->ctx;
+    PROFILE_BEGIN(zone, "render_tile");
+    arena *scratch = &ctx->tile_scratch[thread_pool_current_slot(ctx->pool)];
+    arena_reset(scratch);
+    uint32_t w = tile->x1 - tile->x0, h = tile->y1 - tile->y0;
+    vec3 *colors = (vec3*)arena_alloc(scratch, (size_t)w * h * sizeof(vec3), RENDER_FRAME_ALIGN);
+    if (ctx->block_w == 0) {
+        for (uint32_t y = tile->y0; y < tile->y1; ++y) {
+            for (uint32_t x = tile->x0; x < tile->x1; ++x) {
+                trace_pixel(ctx, tile, colors, x, y);
+            }
+        }
+    } else {
+        for (uint32_t y = tile->y0; y < tile->y1; y += ctx->block_h) {
+            for (uint32_t x = tile->x0; x < tile->x1; x += ctx->block_w) {
+                trace_pixel_block(ctx, tile, colors, x, y);
             }
+        }
+    }
+    for (uint32_t y = 0; colors && y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x) render_store_pixel(ctx->fb, tile->x0 + x, tile->y0 + y, colors[(size_t)y * w + x]);
+    }
+    PROFILE_END(zone);
+    if (ctx->tile_done) ctx->tile_done(ctx->tile_done_user, ctx->fb, tile->x0, tile->y0, tile->x1, tile->y1);
+}
+
+static void fill_render_stats(render_stats *stats, thread_pool *pool, size_t tile_count, double render_ms) {
+    memset(stats, 0, sizeof(*stats));
+    stats->render_ms = render_ms;
+    stats->tile_count = tile_count;
+    if (!pool) {
+        stats->thread_count = 1;
+        stats->thread_stats_count = 1;
+        stats->threads[0] = (thread_pool_worker_stats){tile_count, 0, render_ms};
+        return;
+    }
+    stats->thread_count = thread_pool_stats_slot_count(pool);
+    for (uint32_t i = 0; i < stats->thread_count && i < RENDER_STATS_MAX_THREADS; ++i) {
+        thread_pool_get_worker_stats(pool, i, &stats->threads[i]);
+        stats->thread_stats_count++;
+    }
+}
+
+static void print_render_stats(const framebuffer *fb, const render_stats *stats, render_mode mode, int progressive) {
+    double lo = 1.0, hi = 0.0, sum = 0.0;
+    for (uint32_t i = 0; i < stats->thread_stats_count; ++i) {
+        double u = stats->render_ms > 0.0 ? stats->threads[i].busy_ms / stats->render_ms : 0.0;
+        if (u < lo) lo = u;
+        if (u > hi) hi = u;
+        sum += u;
+    }
+    double avg = stats->thread_stats_count ? sum / stats->thread_stats_count : 0.0;
+    printf("Render: %ux%u in %zu tiles, %.3f ms on %u threads, utilization min %.0f%% avg %.0f%% max %.0f%%\n",
+           fb->width, fb->height, stats->tile_count, stats->render_ms, stats->thread_count,
+           lo * 100.0, avg * 100.0, hi * 100.0);
+    const texture_cache_stats *tc = &stats->texture_cache;
+    size_t lookups = tc->hits + tc->misses;
+    if (lookups > 0) {
+        printf("Texture cache: %zu lookups, hit rate %.2f%%, %zu evictions, %zu tiles capacity\n",
+               lookups, 100.0 * (double)tc->hits / (double)lookups, tc->evictions, tc->capacity_tiles);
+    }
+    if (progressive) {
+        const render_progress *p = &stats->progressive;
+        double pixels = (double)fb->width * (double)fb->height;
+        printf("Progressive: %u passes, %.2f samples/pixel (max %u), %zu/%zu tiles converged%s\n",
+               p->pass, (double)p->samples / pixels, p->max_pixel_samples, p->converged_tiles, p->tile_count,
+               p->budget_exhausted ? ", stopped by time budget" : "");
+    }
+    if (mode != RENDER_MODE_WAVEFRONT) return;
+
+    static const char *names[RENDER_STAGE_COUNT] = {"generate", "sort", "extend", "shade", "connect"};
+    for (int i = 0; i < RENDER_STAGE_COUNT; ++i) {
+        const render_stage_stats *st = &stats->stages[i];
+        double mrays = st->ms > 0.0 ? (double)st->rays / (st->ms * 1000.0) : 0.0;
+        printf("  %-8s %10zu rays %9.3f ms %9.2f Mrays/s\n", names[i], st->rays, st->ms, mrays);
+    }
+}
+
+int render_software_ex(const scene *s, framebuffer *fb, const render_settings *settings) {
+    if (!s || !fb || !fb->rgba8 || fb->width == 0 || fb->height == 0 || !settings) return 0;
+
+    /* The calling thread renders tiles while it waits, so the pool gets one worker fewer. */
+    thread_pool *pool = settings->pool;
+    if (!pool) {
+        uint32_t threads = settings->worker_count ? settings->worker_count : thread_pool_hardware_concurrency();
+        pool = threads > 1 ? thread_pool_create(threads - 1) : NULL;
+    }
+    thread_pool *owned_pool = settings->pool ? NULL : pool;
+
+    bvh_build_options build_opts = settings->bvh;
+    if (!build_opts.pool) build_opts.pool = pool;
 
-            size_t idx = (size_t)(y * fb->width + x) * 4;
-            fb->rgba8[idx + 0] = (uint8_t)(fminf(color.x, 1.0f) * 255.0f);
-            fb->rgba8[idx + 1] = (uint8_t)(fminf(color.y, 1.0f) * 255.0f);
-            fb->rgba8[idx + 2] = (uint8_t)(fminf(color.z, 1.0f) * 255.0f);
-            fb->rgba8[idx + 3] = 255;
+    bvh tree;
+    memset(&tree, 0, sizeof(tree));
+    const bvh *active = settings->prebuilt_bvh;
+    if (active && active->scene_ref != s) {
+        thread_pool_destroy(owned_pool);
+        return 0;
+    }
+    bvh_cache_info cache;
+    memset(&cache, 0, sizeof(cache));
+    if (!active) {
+        if (!bvh_cache_build(settings->bvh_cache_dir, &tree, s, &build_opts, &cache)) {
+            thread_pool_destroy(owned_pool);
+            return 0;
+        }
+        active = &tree;
+    }
+    if (!settings->quiet) {
+        if (cache.hit) {
+            printf("BVH cache hit %016llx: hashed in %.3f ms, mapped in %.3f ms\n", (unsigned long long)cache.key,
+                   cache.hash_ms, cache.load_ms);
         }
+        printf("BVH %s: %zu nodes, %zu leaves, depth %d, SAH cost %.2f, %.3f ms on %u threads\n",
+               active != &tree ? "prebuilt" : cache.hit ? "cached" : "build", active->stats.node_count,
+               active->stats.leaf_count, active->stats.max_depth, active->stats.sah_cost, active->stats.build_ms,
+               active->stats.thread_count);
+        if (active->blas) printf("  two-level: %zu instances over %zu per-mesh trees\n", active->instance_count, active->blas_count);
+    }
+
+    render_ctx ctx = {0};
+    ctx.s = s;
+    ctx.tree = active;
+    ctx.fb = fb;
+    const render_camera *cam = &settings->camera;
+    vec3 forward = vec3_norm(vec3_sub(cam->target, cam->position));
+    ctx.cam_pos = cam->position;
+    ctx.cam_right = vec3_norm(vec3_cross(cam->up, forward));
+    ctx.cam_up = vec3_cross(forward, ctx.cam_right);
+    ctx.cam_forward = vec3_mul(forward, cam->focal_length);
+    ctx.light_dir = vec3_norm((vec3){1.0f, 1.0f, -1.0f});
+    ctx.to_light = vec3_mul(ctx.light_dir, -1.0f);
+    vec3 up = fabsf(ctx.to_light.y) < 0.99f ? (vec3){0.0f, 1.0f, 0.0f} : (vec3){1.0f, 0.0f, 0.0f};
+    ctx.light_t = vec3_norm(vec3_cross(up, ctx.to_light));
+    ctx.light_b = vec3_cross(ctx.to_light, ctx.light_t);
+    ctx.shadow_samples = settings->shadow_samples;
+    ctx.light_radius = tanf(settings->light_angle);
+    ctx.filter = settings->texture_filter;
+    ctx.traversal_cost = settings->traversal_cost;
+    ctx.tile_done = settings->tile_done;
+    ctx.tile_done_user = settings->tile_done_user;
+    if (ctx.traversal_cost) memset(ctx.traversal_cost, 0, (size_t)fb->width * fb->height * sizeof(float));
+    /* The image plane spans [-1, 1] at distance focal_length. */
+    float pixel_extent = 2.0f / (float)(fb->width < fb->height ? fb->width : fb->height);
+    ctx.pixel_angle = pixel_extent / cam->focal_length;
+    /* Square-ish pixel blocks keep packet rays within a narrow frustum. */
+    if (settings->packet_size == 16) {
+        ctx.block_w = 4;
+        ctx.block_h = 4;
+    } else if (settings->packet_size == 8) {
+        ctx.block_w = 4;
+        ctx.block_h = 2;
+    } else if (settings->packet_size == 4) {
+        ctx.block_w = 2;
+        ctx.block_h = 2;
+    }
+
+    /* Everything per-frame comes out of one arena: the tile list, the wavefront queues and a fixed
+     * scratch region per thread slot, sized for one tile. */
+    arena local_frame;
+    arena *frame = settings->frame_arena;
+    if (!frame) {
+        arena_init(&local_frame, 0);
+        frame = &local_frame;
+    }
+    arena_reset(frame);
+    uint32_t tile = settings->tile_size ? settings->tile_size : 32;
+    uint32_t slots = pool ? thread_pool_stats_slot_count(pool) : 1;
+    size_t scratch_bytes = (size_t)tile * tile * sizeof(vec3) + RENDER_FRAME_ALIGN;
+    ctx.frame = frame;
+    ctx.pool = pool;
+    ctx.tile_scratch = (arena*)arena_alloc(frame, slots * sizeof(arena), RENDER_FRAME_ALIGN);
+    for (uint32_t i = 0; ctx.tile_scratch && i < slots; ++i) {
+        arena_init_fixed(&ctx.tile_scratch[i], arena_alloc(frame, scratch_bytes, RENDER_FRAME_ALIGN), scratch_bytes);
+    }
+
+    render_stats local_stats;
+    render_stats *stats = settings->stats ? settings->stats : &local_stats;
+    render_stage_stats stages[RENDER_STAGE_COUNT];
+    memset(stages, 0, sizeof(stages));
+    size_t tile_count = 0;
+    render_progress progress;
+    memset(&progress, 0, sizeof(progress));
+    int progressive = settings->mode == RENDER_MODE_TILED && settings->progressive.max_samples > 0;
+    if (owned_pool) thread_pool_reset_stats(pool);
+    /* The cache may be shared with other renders, so its counters are diffed rather than reset. */
+    texture_cache_stats texture_start;
+    texture_cache_get_stats(s->texture_cache, &texture_start);
+    double start_ms = timer_now_ms();
+    PROFILE_BEGIN(zone, "render");
+
+    int ok = ctx.tile_scratch != NULL;
+    if (ok && settings->mode == RENDER_MODE_WAVEFRONT) {
+        ok = render_wavefront(&ctx, pool, settings, stages);
+    } else if (ok) {
+        uint32_t tiles_x = (fb->width + tile - 1) / tile;
+        uint32_t tiles_y = (fb->height + tile - 1) / tile;
+        tile_count = (size_t)tiles_x * tiles_y;
+        render_tile *tiles = (render_tile*)arena_alloc(frame, tile_count * sizeof(render_tile), RENDER_FRAME_ALIGN);
+        for (uint32_t ty = 0; tiles && ty < tiles_y; ++ty) {
+            for (uint32_t tx = 0; tx < tiles_x; ++tx) {
+                render_tile *t = &tiles[(size_t)ty * tiles_x + tx];
+                t->ctx = &ctx;
+                t->x0 = tx * tile;
+                t->y0 = ty * tile;
+                t->x1 = t->x0 + tile < fb->width ? t->x0 + tile : fb->width;
+                t->y1 = t->y0 + tile < fb->height ? t->y0 + tile : fb->height;
+            }
+        }
+        ok = tiles != NULL;
+        if (ok && progressive) {
+            ok = render_progressive(&ctx, pool, settings, tiles, tile_count, &progress);
+        } else if (ok) {
+            thread_pool_group group = {0};
+            for (size_t i = 0; i < tile_count; ++i) thread_pool_submit(pool, &group, render_tile_task, &tiles[i]);
+            thread_pool_wait(pool, &group);
+        }
+    }
+
+    PROFILE_END(zone);
+    if (ok) {
+        fill_render_stats(stats, pool, tile_count, timer_now_ms() - start_ms);
+        memcpy(stats->stages, stages, sizeof(stages));
+        stats->progressive = progress;
+        texture_cache_stats *tc = &stats->texture_cache;
+        texture_cache_get_stats(s->texture_cache, tc);
+        tc->hits -= texture_start.hits;
+        tc->misses -= texture_start.misses;
+        tc->evictions -= texture_start.evictions;
+        tc->load_failures -= texture_start.load_failures;
+        if (!settings->quiet) print_render_stats(fb, stats, settings->mode, progressive);
     }
 
+    if (frame == &local_frame) arena_destroy(&local_frame);
     bvh_destroy(&tree);
-    return 1;
+    thread_pool_destroy(owned_pool);
+    return ok;
 }
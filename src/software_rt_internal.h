@@ -0,0 +1,85 @@
+#ifndef SOFTWARE_RT_INTERNAL_H
+#define SOFTWARE_RT_INTERNAL_H
+
+#include "profile.h"
+#include "software_rt.h"
+
+#define RENDER_BACKGROUND ((vec3){0.03f, 0.03f, 0.05f})
+/* Constant stand-in for the indirect light a path does not trace any further. */
+#define RENDER_AMBIENT 0.08f
+#define RENDER_GLOSS 0.04f
+/* Frame arena allocations start on cache lines so threads do not share lines at array edges. */
+#define RENDER_FRAME_ALIGN 64
+
+typedef struct {
+    const scene *s;
+    const bvh *tree;
+    framebuffer *fb;
+    vec3 cam_pos;
+    /* Camera basis; cam_forward reaches the image plane (focal_length long). */
+    vec3 cam_right;
+    vec3 cam_up;
+    vec3 cam_forward;
+    vec3 light_dir;
+    /* Orthonormal basis around the direction towards the light, for soft shadow samples. */
+    vec3 to_light;
+    vec3 light_t;
+    vec3 light_b;
+    uint32_t shadow_samples;
+    float light_radius;
+    /* Primary ray packet footprint in pixels; 0 traces one ray per pixel. */
+    uint32_t block_w;
+    uint32_t block_h;
+    texture_filter filter;
+    /* Angle subtended by one pixel, for ray cones on secondary hits. */
+    float pixel_angle;
+    /* Per-frame allocations; reset by render_software_ex. */
+    arena *frame;
+    /* render_settings.traversal_cost; NULL when not requested. */
+    float *traversal_cost;
+    /* render_settings.tile_done; NULL when not requested. */
+    render_tile_fn tile_done;
+    void *tile_done_user;
+    /* One fixed scratch arena per thread pool slot, reset at the start of every tile. */
+    arena *tile_scratch;
+    thread_pool *pool;
+} render_ctx;
+
+typedef struct {
+    const render_ctx *ctx;
+    uint32_t x0, y0, x1, y1;
+} render_tile;
+
+typedef struct {
+    const material *mat;
+    vec3 albedo;
+    vec3 normal;
+} render_surface;
+
+/* Stateless per-sample hash so results do not depend on scheduling. */
+float render_hash_unit(uint32_t x, uint32_t y, uint32_t i);
+ray render_primary_ray(const render_ctx *ctx, uint32_t x, uint32_t y);
+/* Camera ray through continuous pixel coordinates; (x + 0.5, y + 0.5) is the center of pixel (x, y). */
+ray render_camera_ray(const render_ctx *ctx, float fx, float fy);
+/* Derivatives of the primary ray direction with respect to the pixel coordinates. */
+void render_primary_differentials(const render_ctx *ctx, uint32_t x, uint32_t y, vec3 *ddx, vec3 *ddy);
+/* Pixel footprint in UV units at a primary hit: the direction differentials are transferred to
+ * the hit plane and mapped through the triangle's UV parameterization. */
+float render_differential_footprint(const render_ctx *ctx, const bvh_ray_hit *hit, ray r, vec3 ddx, vec3 ddy);
+/* Footprint in UV units of a ray cone that is world_width wide at the hit. */
+float render_cone_footprint(const render_ctx *ctx, const bvh_ray_hit *hit, float world_width);
+/* Fraction of shadow rays from p that reach the light; samples use hash indices seq, seq + 1, ... */
+float render_light_visibility(const render_ctx *ctx, vec3 p, uint32_t x, uint32_t y, uint32_t seq);
+/* Textured albedo and mapped normal at a hit; footprint selects the texture LOD. */
+void render_surface_at(const render_ctx *ctx, const bvh_ray_hit *hit, float footprint, render_surface *out);
+void render_store_pixel(framebuffer *fb, uint32_t x, uint32_t y, vec3 color);
+/* Direct lighting of a primary ray through pixel (x, y); shadow samples start at hash index seq. */
+vec3 render_shade_primary(const render_ctx *ctx, uint32_t x, uint32_t y, ray r, const bvh_ray_hit *hit, uint32_t seq);
+
+/* Renders the whole frame in wavefront stages; fills stages[RENDER_STAGE_COUNT]. */
+int render_wavefront(const render_ctx *ctx, thread_pool *pool, const render_settings *settings, render_stage_stats *stages);
+/* Samples the tiles in passes until they converge or the time budget runs out; fills progress. */
+int render_progressive(const render_ctx *ctx, thread_pool *pool, const render_settings *settings,
+                       const render_tile *tiles, size_t tile_count, render_progress *progress);
+
+#endif
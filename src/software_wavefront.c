@@ -0,0 +1,329 @@
+#include "software_rt_internal.h"
+
+#include <string.h>
+
+#include "timer.h"
+
+#define WAVEFRONT_GRAIN 1024
+#define WAVEFRONT_TMIN 0.001f
+#define WAVEFRONT_TMAX 1e30f
+/* Hash indices within one bounce (bounce << 16): shadow samples count up from 0, the bounce
+ * direction uses the top two, so bounce 0 shadows match the tiled renderer. */
+#define WAVEFRONT_SEQ_DIR 0xfffeu
+
+typedef struct {
+    ray r;
+    vec3 throughput;
+    /* Light arriving at hit_point if the connect rays reach the light. */
+    vec3 direct;
+    vec3 hit_point;
+    bvh_ray_hit hit;
+    /* Distance travelled before this segment, for the ray cone footprint after a bounce. */
+    float distance;
+    uint32_t pixel;
+    uint32_t bounce;
+    int connect;
+    int alive;
+} wf_path;
+
+typedef struct {
+    uint32_t key;
+    uint32_t index;
+} wf_key;
+
+typedef struct {
+    const render_ctx *ctx;
+    uint32_t max_bounces;
+    wf_path *paths;
+    wf_path *scratch;
+    wf_key *keys;
+    wf_key *keys_tmp;
+    size_t count;
+    vec3 *radiance;
+} wavefront;
+
+static vec3 mul3(vec3 a, vec3 b) { return (vec3){a.x * b.x, a.y * b.y, a.z * b.z}; }
+
+static void add_radiance(wavefront *wf, uint32_t pixel, vec3 c) {
+    wf->radiance[pixel] = vec3_add(wf->radiance[pixel], c);
+}
+
+/* Paths start in packet-block order so the primary extend can trace coherent packets. */
+static size_t generate(wavefront *wf) {
+    const render_ctx *ctx = wf->ctx;
+    const framebuffer *fb = ctx->fb;
+    uint32_t bw = ctx->block_w ? ctx->block_w : 1;
+    uint32_t bh = ctx->block_w ? ctx->block_h : 1;
+    size_t n = 0;
+    for (uint32_t by = 0; by < fb->height; by += bh) {
+        for (uint32_t bx = 0; bx < fb->width; bx += bw) {
+            for (uint32_t y = by; y < by + bh && y < fb->height; ++y) {
+                for (uint32_t x = bx; x < bx + bw && x < fb->width; ++x) {
+                    wf_path *p = &wf->paths[n++];
+                    memset(p, 0, sizeof(*p));
+                    p->r = render_primary_ray(ctx, x, y);
+                    p->throughput = (vec3){1.0f, 1.0f, 1.0f};
+                    p->pixel = y * fb->width + x;
+                    p->alive = 1;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+static void extend_chunk(void *arg, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    wavefront *wf = (wavefront*)arg;
+    const bvh *tree = wf->ctx->tree;
+    if (wf->ctx->block_w && wf->paths[begin].bounce == 0) {
+        for (size_t first = begin; first < end; first += BVH_PACKET_MAX) {
+            size_t n = end - first < BVH_PACKET_MAX ? end - first : BVH_PACKET_MAX;
+            ray rays[BVH_PACKET_MAX];
+            bvh_ray_hit hits[BVH_PACKET_MAX];
+            uint64_t cost = wf->ctx->traversal_cost ? profile_thread_cost() : 0;
+            for (size_t i = 0; i < n; ++i) rays[i] = wf->paths[first + i].r;
+            bvh_trace_stream(tree, rays, n, WAVEFRONT_TMIN, WAVEFRONT_TMAX, hits);
+            for (size_t i = 0; i < n; ++i) wf->paths[first + i].hit = hits[i];
+            if (!wf->ctx->traversal_cost) continue;
+            float share = (float)(profile_thread_cost() - cost) / (float)n;
+            for (size_t i = 0; i < n; ++i) wf->ctx->traversal_cost[wf->paths[first + i].pixel] += share;
+        }
+        return;
+    }
+    for (size_t i = begin; i < end; ++i) {
+        wf_path *p = &wf->paths[i];
+        uint64_t cost = wf->ctx->traversal_cost ? profile_thread_cost() : 0;
+        bvh_trace_closest_hit(tree, p->r, WAVEFRONT_TMIN, WAVEFRONT_TMAX, &p->hit);
+        if (wf->ctx->traversal_cost) wf->ctx->traversal_cost[p->pixel] += (float)(profile_thread_cost() - cost);
+    }
+}
+
+/* Cosine-weighted direction around n; with that pdf a Lambertian bounce weighs by albedo alone. */
+static vec3 sample_cosine(vec3 n, float r1, float r2) {
+    vec3 up = fabsf(n.y) < 0.99f ? (vec3){0.0f, 1.0f, 0.0f} : (vec3){1.0f, 0.0f, 0.0f};
+    vec3 t = vec3_norm(vec3_cross(up, n));
+    vec3 b = vec3_cross(n, t);
+    float radius = sqrtf(r1);
+    float phi = 6.28318531f * r2;
+    float z = sqrtf(1.0f - r1);
+    vec3 d = vec3_add(vec3_mul(t, radius * cosf(phi)), vec3_mul(b, radius * sinf(phi)));
+    return vec3_norm(vec3_add(d, vec3_mul(n, z)));
+}
+
+static void shade_chunk(void *arg, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    wavefront *wf = (wavefront*)arg;
+    const render_ctx *ctx = wf->ctx;
+    uint32_t width = ctx->fb->width;
+    for (size_t i = begin; i < end; ++i) {
+        wf_path *p = &wf->paths[i];
+        p->connect = 0;
+        if (!p->hit.hit) {
+            vec3 sky = p->bounce == 0 ? RENDER_BACKGROUND : (vec3){RENDER_AMBIENT, RENDER_AMBIENT, RENDER_AMBIENT};
+            add_radiance(wf, p->pixel, mul3(p->throughput, sky));
+            p->alive = 0;
+            continue;
+        }
+
+        uint32_t x = p->pixel % width, y = p->pixel / width;
+        float footprint = 0.0f;
+        if (ctx->filter != TEXTURE_FILTER_NEAREST && p->bounce == 0) {
+            vec3 ddx, ddy;
+            render_primary_differentials(ctx, x, y, &ddx, &ddy);
+            footprint = render_differential_footprint(ctx, &p->hit, p->r, ddx, ddy);
+        } else if (ctx->filter != TEXTURE_FILTER_NEAREST) {
+            footprint = render_cone_footprint(ctx, &p->hit, (p->distance + p->hit.t) * ctx->pixel_angle);
+        }
+        render_surface surf;
+        render_surface_at(ctx, &p->hit, footprint, &surf);
+        vec3 weight = mul3(p->throughput, surf.albedo);
+        if (p->bounce == 0) {
+            float gloss = RENDER_GLOSS * (1.0f - surf.mat->roughness);
+            add_radiance(wf, p->pixel, (vec3){gloss, gloss, gloss});
+        }
+
+        p->hit_point = vec3_add(p->r.origin, vec3_mul(p->r.direction, p->hit.t));
+        float ndotl = vec3_dot(surf.normal, ctx->to_light);
+        if (ndotl > 0.0f) {
+            p->direct = vec3_mul(weight, ndotl);
+            if (ctx->shadow_samples > 0) p->connect = 1;
+            else add_radiance(wf, p->pixel, p->direct);
+        }
+
+        if (p->bounce >= wf->max_bounces) {
+            add_radiance(wf, p->pixel, vec3_mul(weight, RENDER_AMBIENT));
+            p->alive = 0;
+            continue;
+        }
+        uint32_t seq = (p->bounce << 16) | WAVEFRONT_SEQ_DIR;
+        p->distance += p->hit.t;
+        p->r.origin = p->hit_point;
+        p->r.direction = sample_cosine(surf.normal, render_hash_unit(x, y, seq), render_hash_unit(x, y, seq + 1));
+        p->throughput = weight;
+        p->alive = 1;
+    }
+}
+
+static void connect_chunk(void *arg, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    wavefront *wf = (wavefront*)arg;
+    const render_ctx *ctx = wf->ctx;
+    uint32_t width = ctx->fb->width;
+    for (size_t i = begin; i < end; ++i) {
+        wf_path *p = &wf->paths[i];
+        if (!p->connect) continue;
+        uint64_t cost = ctx->traversal_cost ? profile_thread_cost() : 0;
+        float vis = render_light_visibility(ctx, p->hit_point, p->pixel % width, p->pixel / width, p->bounce << 16);
+        add_radiance(wf, p->pixel, vec3_mul(p->direct, vis));
+        if (ctx->traversal_cost) ctx->traversal_cost[p->pixel] += (float)(profile_thread_cost() - cost);
+    }
+}
+
+static uint32_t spread_bits_8(uint32_t v) {
+    uint32_t x = v & 0xffu;
+    x = (x | (x << 8)) & 0x0000f00fu;
+    x = (x | (x << 4)) & 0x000c30c3u;
+    x = (x | (x << 2)) & 0x00249249u;
+    return x;
+}
+
+static uint32_t ray_key(const ray *r, const aabb *bounds) {
+    vec3 extent = vec3_sub(bounds->max, bounds->min);
+    float o[3] = {r->origin.x - bounds->min.x, r->origin.y - bounds->min.y, r->origin.z - bounds->min.z};
+    float e[3] = {extent.x, extent.y, extent.z};
+    uint32_t q[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float f = e[axis] > 0.0f ? o[axis] / e[axis] * 255.0f : 0.0f;
+        q[axis] = f <= 0.0f ? 0u : f >= 255.0f ? 255u : (uint32_t)f;
+    }
+    uint32_t octant = (r->direction.x < 0.0f) | (r->direction.y < 0.0f) << 1 | (r->direction.z < 0.0f) << 2;
+    return octant << 24 | spread_bits_8(q[0]) << 2 | spread_bits_8(q[1]) << 1 | spread_bits_8(q[2]);
+}
+
+static uint32_t material_key(const render_ctx *ctx, const wf_path *p) {
+    if (!p->hit.hit) return 0;
+    const mesh *m = &ctx->s->meshes[p->hit.mesh];
+    return (uint32_t)mesh_triangle(m, p->hit.tri).material_index + 1;
+}
+
+/* Stable LSD radix sort of the queue by keys[].key, 8 bits per pass. */
+static void sort_paths(wavefront *wf, uint32_t key_bits) {
+    for (size_t i = 0; i < wf->count; ++i) wf->keys[i].index = (uint32_t)i;
+    for (uint32_t shift = 0; shift < key_bits; shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < wf->count; ++i) offsets[(wf->keys[i].key >> shift) & 0xffu]++;
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t c = offsets[d];
+            offsets[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < wf->count; ++i) wf->keys_tmp[offsets[(wf->keys[i].key >> shift) & 0xffu]++] = wf->keys[i];
+        wf_key *swap = wf->keys;
+        wf->keys = wf->keys_tmp;
+        wf->keys_tmp = swap;
+    }
+    for (size_t i = 0; i < wf->count; ++i) wf->scratch[i] = wf->paths[wf->keys[i].index];
+    wf_path *swap = wf->paths;
+    wf->paths = wf->scratch;
+    wf->scratch = swap;
+}
+
+static uint32_t key_bits_for(uint32_t max_key) {
+    uint32_t bits = 0;
+    while (bits < 32 && (max_key >> bits)) bits += 8;
+    return bits;
+}
+
+static void run_stage(thread_pool *pool, wavefront *wf, thread_pool_range_fn fn, const char *name,
+                      render_stage_stats *stage, size_t rays) {
+    double start_ms = timer_now_ms();
+    PROFILE_BEGIN(zone, name);
+    thread_pool_parallel_for(pool, wf->count, WAVEFRONT_GRAIN, fn, wf);
+    PROFILE_END(zone);
+    (void)name;
+    stage->ms += timer_now_ms() - start_ms;
+    stage->rays += rays;
+}
+
+/* Each pixel owns exactly one path, so stages write its radiance without synchronization and
+ * the image does not depend on queue order or thread count. */
+int render_wavefront(const render_ctx *ctx, thread_pool *pool, const render_settings *settings, render_stage_stats *stages) {
+    const framebuffer *fb = ctx->fb;
+    size_t pixels = (size_t)fb->width * fb->height;
+    wavefront wf = {0};
+    wf.ctx = ctx;
+    wf.max_bounces = settings->max_bounces;
+    /* Queues live in the frame arena, so repeated frames of the same size reuse one block. */
+    wf.paths = (wf_path*)arena_alloc(ctx->frame, pixels * sizeof(wf_path), RENDER_FRAME_ALIGN);
+    wf.scratch = (wf_path*)arena_alloc(ctx->frame, pixels * sizeof(wf_path), RENDER_FRAME_ALIGN);
+    wf.keys = (wf_key*)arena_alloc(ctx->frame, pixels * sizeof(wf_key), RENDER_FRAME_ALIGN);
+    wf.keys_tmp = (wf_key*)arena_alloc(ctx->frame, pixels * sizeof(wf_key), RENDER_FRAME_ALIGN);
+    wf.radiance = (vec3*)arena_calloc(ctx->frame, pixels, sizeof(vec3), RENDER_FRAME_ALIGN);
+    int ok = wf.paths && wf.scratch && wf.keys && wf.keys_tmp && wf.radiance;
+
+    if (ok) {
+        double start_ms = timer_now_ms();
+        PROFILE_BEGIN(zone, "wavefront_generate");
+        wf.count = generate(&wf);
+        PROFILE_END(zone);
+        stages[RENDER_STAGE_GENERATE].ms = timer_now_ms() - start_ms;
+        stages[RENDER_STAGE_GENERATE].rays = wf.count;
+    }
+
+    const aabb *bounds = &ctx->tree->nodes[0].box;
+    while (ok && wf.count > 0) {
+        /* Generated paths are already in coherent packet order. */
+        if (settings->ray_sort == RENDER_SORT_RAY && wf.paths[0].bounce > 0) {
+            double start_ms = timer_now_ms();
+            PROFILE_BEGIN(zone, "wavefront_sort");
+            for (size_t i = 0; i < wf.count; ++i) wf.keys[i].key = ray_key(&wf.paths[i].r, bounds);
+            sort_paths(&wf, 32);
+            PROFILE_END(zone);
+            stages[RENDER_STAGE_SORT].ms += timer_now_ms() - start_ms;
+            stages[RENDER_STAGE_SORT].rays += wf.count;
+        }
+
+        run_stage(pool, &wf, extend_chunk, "wavefront_extend", &stages[RENDER_STAGE_EXTEND], wf.count);
+
+        if (settings->ray_sort == RENDER_SORT_MATERIAL) {
+            double start_ms = timer_now_ms();
+            PROFILE_BEGIN(zone, "wavefront_sort");
+            uint32_t max_key = 0;
+            for (size_t i = 0; i < wf.count; ++i) {
+                wf.keys[i].key = material_key(ctx, &wf.paths[i]);
+                if (wf.keys[i].key > max_key) max_key = wf.keys[i].key;
+            }
+            sort_paths(&wf, key_bits_for(max_key));
+            PROFILE_END(zone);
+            stages[RENDER_STAGE_SORT].ms += timer_now_ms() - start_ms;
+            stages[RENDER_STAGE_SORT].rays += wf.count;
+        }
+
+        run_stage(pool, &wf, shade_chunk, "wavefront_shade", &stages[RENDER_STAGE_SHADE], wf.count);
+
+        size_t per_connect = ctx->shadow_samples == 1 || ctx->light_radius <= 0.0f ? 1 : ctx->shadow_samples;
+        size_t connects = 0;
+        for (size_t i = 0; i < wf.count; ++i) connects += (size_t)wf.paths[i].connect;
+        if (connects > 0) run_stage(pool, &wf, connect_chunk, "wavefront_connect", &stages[RENDER_STAGE_CONNECT], connects * per_connect);
+
+        /* Order-preserving compaction of the surviving bounce rays. */
+        size_t alive = 0;
+        for (size_t i = 0; i < wf.count; ++i) {
+            if (!wf.paths[i].alive) continue;
+            wf.paths[alive] = wf.paths[i];
+            wf.paths[alive].bounce++;
+            alive++;
+        }
+        wf.count = alive;
+    }
+
+    if (ok) {
+        for (size_t i = 0; i < pixels; ++i) {
+            render_store_pixel(ctx->fb, (uint32_t)(i % fb->width), (uint32_t)(i / fb->width), wf.radiance[i]);
+        }
+        if (ctx->tile_done) ctx->tile_done(ctx->tile_done_user, ctx->fb, 0, 0, fb->width, fb->height);
+    }
+    return ok;
+}
@@ -0,0 +1,150 @@
+#include "texture_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION tc_mutex;
+static void tc_mutex_init(tc_mutex *m) { InitializeCriticalSection(m); }
+static void tc_mutex_destroy(tc_mutex *m) { DeleteCriticalSection(m); }
+static void tc_lock(tc_mutex *m) { EnterCriticalSection(m); }
+static void tc_unlock(tc_mutex *m) { LeaveCriticalSection(m); }
+#else
+#include <pthread.h>
+typedef pthread_mutex_t tc_mutex;
+static void tc_mutex_init(tc_mutex *m) { pthread_mutex_init(m, NULL); }
+static void tc_mutex_destroy(tc_mutex *m) { pthread_mutex_destroy(m); }
+static void tc_lock(tc_mutex *m) { pthread_mutex_lock(m); }
+static void tc_unlock(tc_mutex *m) { pthread_mutex_unlock(m); }
+#endif
+
+#define TEXTURE_CACHE_WAYS 8
+/* Sets are striped over this many locks; each stripe keeps its own counters. */
+#define TEXTURE_CACHE_STRIPES 64
+#define TEXTURE_TILE_BYTES (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4)
+
+typedef struct {
+    const texture *tx;
+    uint32_t level;
+    uint32_t tile;
+    uint32_t last_use;
+    int valid;
+} tc_way;
+
+typedef struct {
+    tc_mutex lock;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t load_failures;
+    uint32_t clock;
+} tc_stripe;
+
+struct texture_cache {
+    tc_way *ways;
+    uint8_t *data;
+    size_t set_count;
+    tc_stripe stripes[TEXTURE_CACHE_STRIPES];
+};
+
+texture_cache *texture_cache_create(size_t budget_bytes) {
+    texture_cache *cache = (texture_cache*)calloc(1, sizeof(texture_cache));
+    if (!cache) return NULL;
+    cache->set_count = budget_bytes / ((size_t)TEXTURE_CACHE_WAYS * TEXTURE_TILE_BYTES);
+    if (cache->set_count == 0) cache->set_count = 1;
+    size_t way_count = cache->set_count * TEXTURE_CACHE_WAYS;
+    cache->ways = (tc_way*)calloc(way_count, sizeof(tc_way));
+    cache->data = (uint8_t*)malloc(way_count * TEXTURE_TILE_BYTES);
+    if (!cache->ways || !cache->data) {
+        free(cache->ways);
+        free(cache->data);
+        free(cache);
+        return NULL;
+    }
+    for (int i = 0; i < TEXTURE_CACHE_STRIPES; ++i) tc_mutex_init(&cache->stripes[i].lock);
+    return cache;
+}
+
+void texture_cache_destroy(texture_cache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < TEXTURE_CACHE_STRIPES; ++i) tc_mutex_destroy(&cache->stripes[i].lock);
+    free(cache->ways);
+    free(cache->data);
+    free(cache);
+}
+
+static size_t tile_hash(const texture *tx, uint32_t level, uint32_t tile) {
+    uint64_t h = (uint64_t)(uintptr_t)tx * 0x9e3779b97f4a7c15ull;
+    h ^= ((uint64_t)level << 32 | tile) * 0xc2b2ae3d27d4eb4full;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 32;
+    return (size_t)h;
+}
+
+int texture_cache_fetch(texture_cache *cache, const texture *tx, uint32_t level, uint32_t x, uint32_t y, uint8_t out_rgba8[4]) {
+    if (!cache || !tx || !tx->loader || level >= tx->mip_count) return 0;
+    const texture_mip *m = &tx->mips[level];
+    uint32_t tiles_x = (m->width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    uint32_t tile_x = x / TEXTURE_TILE_SIZE, tile_y = y / TEXTURE_TILE_SIZE;
+    uint32_t tile = tile_y * tiles_x + tile_x;
+
+    size_t set = tile_hash(tx, level, tile) % cache->set_count;
+    tc_stripe *stripe = &cache->stripes[set % TEXTURE_CACHE_STRIPES];
+    tc_way *ways = &cache->ways[set * TEXTURE_CACHE_WAYS];
+    size_t texel = ((size_t)(y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE) * 4;
+
+    tc_lock(&stripe->lock);
+    uint32_t now = ++stripe->clock;
+    int victim = 0;
+    for (int w = 0; w < TEXTURE_CACHE_WAYS; ++w) {
+        tc_way *way = &ways[w];
+        if (way->valid && way->tx == tx && way->level == level && way->tile == tile) {
+            way->last_use = now;
+            memcpy(out_rgba8, cache->data + (set * TEXTURE_CACHE_WAYS + w) * TEXTURE_TILE_BYTES + texel, 4);
+            stripe->hits++;
+            tc_unlock(&stripe->lock);
+            return 1;
+        }
+        /* Prefer an empty way, otherwise the least recently used one. */
+        if (!ways[victim].valid) continue;
+        if (!way->valid || way->last_use < ways[victim].last_use) victim = w;
+    }
+
+    stripe->misses++;
+    if (ways[victim].valid) stripe->evictions++;
+    uint8_t *slot = cache->data + (set * TEXTURE_CACHE_WAYS + victim) * TEXTURE_TILE_BYTES;
+    int loaded = tx->loader(tx->loader_user, tx, level, tile_x, tile_y, slot);
+    ways[victim] = (tc_way){tx, level, tile, now, loaded};
+    if (loaded) {
+        memcpy(out_rgba8, slot + texel, 4);
+    } else {
+        stripe->load_failures++;
+    }
+    tc_unlock(&stripe->lock);
+    return loaded;
+}
+
+void texture_cache_get_stats(const texture_cache *cache, texture_cache_stats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!cache) return;
+    for (int i = 0; i < TEXTURE_CACHE_STRIPES; ++i) {
+        const tc_stripe *s = &cache->stripes[i];
+        out->hits += s->hits;
+        out->misses += s->misses;
+        out->evictions += s->evictions;
+        out->load_failures += s->load_failures;
+    }
+    out->capacity_tiles = cache->set_count * TEXTURE_CACHE_WAYS;
+}
+
+void texture_cache_reset_stats(texture_cache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < TEXTURE_CACHE_STRIPES; ++i) {
+        tc_stripe *s = &cache->stripes[i];
+        tc_lock(&s->lock);
+        s->hits = s->misses = s->evictions = s->load_failures = 0;
+        tc_unlock(&s->lock);
+    }
+}
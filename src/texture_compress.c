@@ -0,0 +1,488 @@
+#include "texture_compress.h"
+#include "thread_pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#define TX_THREAD_LOCAL __declspec(thread)
+#else
+#define TX_THREAD_LOCAL _Thread_local
+#endif
+
+/* Direct-mapped, per thread, so fetches take no locks; bilinear footprints touch at most four blocks. */
+#define DECODED_BLOCK_CACHE_SIZE 64
+
+typedef struct {
+    size_t block_id;
+    uint32_t level;
+    uint32_t block;
+    uint8_t rgba8[64];
+} decoded_block;
+
+static TX_THREAD_LOCAL decoded_block t_decoded[DECODED_BLOCK_CACHE_SIZE];
+/* 0 never names a texture, so zeroed cache entries never match. */
+static volatile size_t g_last_block_id = 0;
+
+/* ---- BC1 / BC4 ---- */
+
+static void unpack_565(uint16_t c, uint8_t out[4]) {
+    uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    out[0] = (uint8_t)((r << 3) | (r >> 2));
+    out[1] = (uint8_t)((g << 2) | (g >> 4));
+    out[2] = (uint8_t)((b << 3) | (b >> 2));
+    out[3] = 255;
+}
+
+static uint16_t pack_565(const uint8_t c[4]) {
+    return (uint16_t)(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+}
+
+static void bc1_palette(uint16_t c0, uint16_t c1, uint8_t pal[4][4]) {
+    unpack_565(c0, pal[0]);
+    unpack_565(c1, pal[1]);
+    for (int c = 0; c < 3; ++c) {
+        if (c0 > c1) {
+            pal[2][c] = (uint8_t)((2 * pal[0][c] + pal[1][c] + 1) / 3);
+            pal[3][c] = (uint8_t)((pal[0][c] + 2 * pal[1][c] + 1) / 3);
+        } else {
+            pal[2][c] = (uint8_t)((pal[0][c] + pal[1][c] + 1) / 2);
+            pal[3][c] = 0;
+        }
+    }
+    pal[2][3] = 255;
+    /* Three-colour mode: index 3 is transparent black. */
+    pal[3][3] = c0 > c1 ? 255 : 0;
+}
+
+static void bc1_decode(const uint8_t *block, uint8_t out[64]) {
+    uint8_t pal[4][4];
+    bc1_palette((uint16_t)(block[0] | block[1] << 8), (uint16_t)(block[2] | block[3] << 8), pal);
+    uint32_t indices = (uint32_t)block[4] | (uint32_t)block[5] << 8 | (uint32_t)block[6] << 16 | (uint32_t)block[7] << 24;
+    for (int t = 0; t < 16; ++t) memcpy(out + t * 4, pal[(indices >> (2 * t)) & 3], 4);
+}
+
+static void bc4_palette(uint8_t r0, uint8_t r1, uint8_t pal[8]) {
+    pal[0] = r0;
+    pal[1] = r1;
+    if (r0 > r1) {
+        for (int i = 1; i < 7; ++i) pal[i + 1] = (uint8_t)(((7 - i) * r0 + i * r1 + 3) / 7);
+    } else {
+        for (int i = 1; i < 5; ++i) pal[i + 1] = (uint8_t)(((5 - i) * r0 + i * r1 + 2) / 5);
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+}
+
+/* Writes one channel of 16 texels at stride 4. */
+static void bc4_decode(const uint8_t *block, uint8_t *out) {
+    uint8_t pal[8];
+    bc4_palette(block[0], block[1], pal);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i) indices |= (uint64_t)block[2 + i] << (8 * i);
+    for (int t = 0; t < 16; ++t) out[t * 4] = pal[(indices >> (3 * t)) & 7];
+}
+
+static void bc5_decode(const uint8_t *block, uint8_t out[64]) {
+    bc4_decode(block, out);
+    bc4_decode(block + 8, out + 1);
+    for (int t = 0; t < 16; ++t) {
+        float x = out[t * 4] / 127.5f - 1.0f;
+        float y = out[t * 4 + 1] / 127.5f - 1.0f;
+        float zz = 1.0f - x * x - y * y;
+        float z = zz > 0.0f ? sqrtf(zz) : 0.0f;
+        out[t * 4 + 2] = (uint8_t)((z * 0.5f + 0.5f) * 255.0f + 0.5f);
+        out[t * 4 + 3] = 255;
+    }
+}
+
+/* ---- BC7 ---- */
+
+typedef struct {
+    uint8_t subsets;
+    uint8_t partition_bits;
+    uint8_t rotation_bits;
+    uint8_t index_select_bits;
+    uint8_t color_bits;
+    uint8_t alpha_bits;
+    /* One p-bit per endpoint, or one shared by both endpoints of a subset. */
+    uint8_t endpoint_pbits;
+    uint8_t shared_pbits;
+    uint8_t index_bits;
+    uint8_t index2_bits;
+} bc7_mode;
+
+static const bc7_mode k_bc7_modes[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+    {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+    {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+    {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+    {2, 6, 0, 0, 5, 5, 1, 0, 2, 0}
+};
+
+/* Subset of texel t is bit t (two subsets) or bits 2t..2t+1 (three subsets). */
+static const uint16_t k_bc7_partitions2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80, 0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce, 0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a, 0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c, 0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22
+};
+
+static const uint32_t k_bc7_partitions3[64] = {
+    0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+    0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+    0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+    0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+    0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+    0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+    0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+    0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254
+};
+
+/* Anchor texels (index stored one bit shorter) of the second and third subsets; texel 0 anchors the first. */
+static const uint8_t k_bc7_anchor2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+static const uint8_t k_bc7_anchor3_second[64] = {
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+};
+
+static const uint8_t k_bc7_anchor3_third[64] = {
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+};
+
+static const uint8_t k_bc7_weights2[4] = {0, 21, 43, 64};
+static const uint8_t k_bc7_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+static const uint8_t k_bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t pos;
+} bit_reader;
+
+/* Blocks are little-endian 128-bit fields. */
+static uint32_t read_bits(bit_reader *r, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; ++i, ++r->pos) {
+        value |= (uint32_t)((r->data[r->pos >> 3] >> (r->pos & 7)) & 1) << i;
+    }
+    return value;
+}
+
+static uint8_t expand_bits(uint32_t value, uint32_t bits) {
+    value <<= 8 - bits;
+    return (uint8_t)(value | (value >> bits));
+}
+
+static uint8_t bc7_interpolate(uint8_t e0, uint8_t e1, uint32_t index, uint32_t bits) {
+    uint32_t w = bits == 2 ? k_bc7_weights2[index] : bits == 3 ? k_bc7_weights3[index] : k_bc7_weights4[index];
+    return (uint8_t)(((64 - w) * e0 + w * e1 + 32) >> 6);
+}
+
+static void bc7_decode(const uint8_t *block, uint8_t out[64]) {
+    uint32_t mode = 0;
+    while (mode < 8 && !(block[0] & (1u << mode))) ++mode;
+    if (mode == 8) {
+        /* Reserved mode: defined to decode as transparent black. */
+        memset(out, 0, 64);
+        return;
+    }
+    const bc7_mode *m = &k_bc7_modes[mode];
+    bit_reader r = {block, mode + 1};
+    uint32_t partition = read_bits(&r, m->partition_bits);
+    uint32_t rotation = read_bits(&r, m->rotation_bits);
+    uint32_t index_select = read_bits(&r, m->index_select_bits);
+
+    uint32_t endpoints = 2u * m->subsets;
+    uint32_t raw[6][4];
+    for (int c = 0; c < 3; ++c) {
+        for (uint32_t e = 0; e < endpoints; ++e) raw[e][c] = read_bits(&r, m->color_bits);
+    }
+    for (uint32_t e = 0; e < endpoints; ++e) raw[e][3] = read_bits(&r, m->alpha_bits);
+
+    uint32_t pbit[6] = {0};
+    if (m->endpoint_pbits) {
+        for (uint32_t e = 0; e < endpoints; ++e) pbit[e] = read_bits(&r, 1);
+    } else if (m->shared_pbits) {
+        for (uint32_t s = 0; s < m->subsets; ++s) pbit[2 * s] = pbit[2 * s + 1] = read_bits(&r, 1);
+    }
+    int has_pbits = m->endpoint_pbits || m->shared_pbits;
+
+    uint8_t ep[6][4];
+    for (uint32_t e = 0; e < endpoints; ++e) {
+        for (int c = 0; c < 4; ++c) {
+            uint32_t bits = c < 3 ? m->color_bits : m->alpha_bits;
+            if (bits == 0) {
+                ep[e][c] = 255;
+                continue;
+            }
+            uint32_t value = raw[e][c];
+            if (has_pbits) {
+                value = (value << 1) | pbit[e];
+                ++bits;
+            }
+            ep[e][c] = expand_bits(value, bits);
+        }
+    }
+
+    uint32_t subset[16];
+    uint32_t index[16];
+    uint32_t index2[16] = {0};
+    for (uint32_t t = 0; t < 16; ++t) {
+        uint32_t s = 0;
+        uint32_t anchor = 0;
+        if (m->subsets == 2) {
+            s = (k_bc7_partitions2[partition] >> t) & 1;
+            anchor = s ? k_bc7_anchor2[partition] : 0;
+        } else if (m->subsets == 3) {
+            s = (k_bc7_partitions3[partition] >> (2 * t)) & 3;
+            anchor = s == 1 ? k_bc7_anchor3_second[partition] : s == 2 ? k_bc7_anchor3_third[partition] : 0;
+        }
+        subset[t] = s;
+        index[t] = read_bits(&r, m->index_bits - (t == anchor));
+    }
+    if (m->index2_bits) {
+        for (uint32_t t = 0; t < 16; ++t) index2[t] = read_bits(&r, m->index2_bits - (t == 0));
+    }
+
+    for (uint32_t t = 0; t < 16; ++t) {
+        const uint8_t *e0 = ep[2 * subset[t]];
+        const uint8_t *e1 = ep[2 * subset[t] + 1];
+        uint32_t color_index = index[t], color_bits = m->index_bits;
+        uint32_t alpha_index = index[t], alpha_bits = m->index_bits;
+        if (m->index2_bits) {
+            if (index_select) {
+                color_index = index2[t];
+                color_bits = m->index2_bits;
+            } else {
+                alpha_index = index2[t];
+                alpha_bits = m->index2_bits;
+            }
+        }
+        uint8_t *px = out + t * 4;
+        for (int c = 0; c < 3; ++c) px[c] = bc7_interpolate(e0[c], e1[c], color_index, color_bits);
+        px[3] = bc7_interpolate(e0[3], e1[3], alpha_index, alpha_bits);
+        if (rotation) {
+            uint8_t a = px[3];
+            px[3] = px[rotation - 1];
+            px[rotation - 1] = a;
+        }
+    }
+}
+
+/* ---- Encoders ---- */
+
+static void bc1_encode(const uint8_t in[64], uint8_t *block) {
+    uint8_t lo[4] = {255, 255, 255, 255}, hi[4] = {0, 0, 0, 0};
+    for (int t = 0; t < 16; ++t) {
+        for (int c = 0; c < 3; ++c) {
+            if (in[t * 4 + c] < lo[c]) lo[c] = in[t * 4 + c];
+            if (in[t * 4 + c] > hi[c]) hi[c] = in[t * 4 + c];
+        }
+    }
+    /* Per-channel max packs to the larger value, which selects the four-colour mode. */
+    uint16_t c0 = pack_565(hi), c1 = pack_565(lo);
+    uint8_t pal[4][4];
+    bc1_palette(c0, c1, pal);
+    uint32_t indices = 0;
+    for (int t = 0; t < 16 && c0 != c1; ++t) {
+        uint32_t best = 0, best_d = UINT32_MAX;
+        for (uint32_t i = 0; i < 4; ++i) {
+            uint32_t d = 0;
+            for (int c = 0; c < 3; ++c) {
+                int diff = (int)in[t * 4 + c] - (int)pal[i][c];
+                d += (uint32_t)(diff * diff);
+            }
+            if (d < best_d) {
+                best_d = d;
+                best = i;
+            }
+        }
+        indices |= best << (2 * t);
+    }
+    block[0] = (uint8_t)c0;
+    block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)c1;
+    block[3] = (uint8_t)(c1 >> 8);
+    for (int i = 0; i < 4; ++i) block[4 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+/* Encodes one channel of 16 texels at stride 4. */
+static void bc4_encode(const uint8_t *in, uint8_t *block) {
+    uint8_t lo = 255, hi = 0;
+    for (int t = 0; t < 16; ++t) {
+        if (in[t * 4] < lo) lo = in[t * 4];
+        if (in[t * 4] > hi) hi = in[t * 4];
+    }
+    uint8_t pal[8];
+    bc4_palette(hi, lo, pal);
+    uint64_t indices = 0;
+    for (int t = 0; t < 16 && hi != lo; ++t) {
+        uint64_t best = 0;
+        int best_d = 256;
+        for (int i = 0; i < 8; ++i) {
+            int d = abs((int)in[t * 4] - (int)pal[i]);
+            if (d < best_d) {
+                best_d = d;
+                best = (uint64_t)i;
+            }
+        }
+        indices |= best << (3 * t);
+    }
+    block[0] = hi;
+    block[1] = lo;
+    for (int i = 0; i < 6; ++i) block[2 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+/* ---- Public API ---- */
+
+size_t texture_format_block_bytes(texture_format format) {
+    switch (format) {
+        case TEXTURE_FORMAT_BC1: return 8;
+        case TEXTURE_FORMAT_BC5:
+        case TEXTURE_FORMAT_BC7: return 16;
+        default: return 0;
+    }
+}
+
+int texture_decode_block(texture_format format, const uint8_t *block, uint8_t out_rgba8[64]) {
+    switch (format) {
+        case TEXTURE_FORMAT_BC1: bc1_decode(block, out_rgba8); return 1;
+        case TEXTURE_FORMAT_BC5: bc5_decode(block, out_rgba8); return 1;
+        case TEXTURE_FORMAT_BC7: bc7_decode(block, out_rgba8); return 1;
+        default: return 0;
+    }
+}
+
+int texture_encode_block(texture_format format, const uint8_t in_rgba8[64], uint8_t *out_block) {
+    switch (format) {
+        case TEXTURE_FORMAT_BC1: bc1_encode(in_rgba8, out_block); return 1;
+        case TEXTURE_FORMAT_BC5:
+            bc4_encode(in_rgba8, out_block);
+            bc4_encode(in_rgba8 + 1, out_block + 8);
+            return 1;
+        default: return 0;
+    }
+}
+
+static size_t blocks_across(uint32_t texels) {
+    return (texels + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+}
+
+size_t texture_next_block_id(void) {
+    return thread_pool_atomic_add(&g_last_block_id, 1) + 1;
+}
+
+int texture_compress(texture *tx, texture_format format) {
+    if (!tx || !tx->rgba8 || tx->loader || tx->format != TEXTURE_FORMAT_RGBA8) return 0;
+    if (format != TEXTURE_FORMAT_BC1 && format != TEXTURE_FORMAT_BC5) return 0;
+    /* The encoder gathers blocks from linear rows. */
+    if (tx->layout != TEXTURE_LAYOUT_LINEAR && !texture_set_layout(tx, TEXTURE_LAYOUT_LINEAR)) return 0;
+    if (!tx->mips) {
+        tx->mips = (texture_mip*)calloc(1, sizeof(texture_mip));
+        if (!tx->mips) return 0;
+        tx->mips[0] = (texture_mip){tx->width, tx->height, tx->rgba8, NULL};
+        tx->mip_count = 1;
+    }
+
+    /* Allocate every level first so a failure leaves the texels in place. */
+    size_t block_bytes = texture_format_block_bytes(format);
+    for (uint32_t level = 0; level < tx->mip_count; ++level) {
+        texture_mip *m = &tx->mips[level];
+        m->blocks = (uint8_t*)malloc(blocks_across(m->width) * blocks_across(m->height) * block_bytes);
+        if (!m->blocks) {
+            for (uint32_t i = 0; i <= level; ++i) {
+                free(tx->mips[i].blocks);
+                tx->mips[i].blocks = NULL;
+            }
+            return 0;
+        }
+    }
+
+    for (uint32_t level = 0; level < tx->mip_count; ++level) {
+        texture_mip *m = &tx->mips[level];
+        size_t bx_count = blocks_across(m->width);
+        size_t by_count = blocks_across(m->height);
+        for (size_t by = 0; by < by_count; ++by) {
+            for (size_t bx = 0; bx < bx_count; ++bx) {
+                /* Partial edge blocks repeat the last row/column. */
+                uint8_t texels[64];
+                for (uint32_t t = 0; t < 16; ++t) {
+                    size_t x = bx * TEXTURE_BLOCK_SIZE + t % TEXTURE_BLOCK_SIZE;
+                    size_t y = by * TEXTURE_BLOCK_SIZE + t / TEXTURE_BLOCK_SIZE;
+                    if (x >= m->width) x = m->width - 1;
+                    if (y >= m->height) y = m->height - 1;
+                    memcpy(texels + t * 4, m->rgba8 + (y * m->width + x) * 4, 4);
+                }
+                texture_encode_block(format, texels, m->blocks + (by * bx_count + bx) * block_bytes);
+            }
+        }
+        free(m->rgba8);
+        m->rgba8 = NULL;
+    }
+    tx->rgba8 = NULL;
+    tx->format = format;
+    tx->block_id = texture_next_block_id();
+    return 1;
+}
+
+int texture_init_compressed(texture *tx, uint32_t width, uint32_t height, uint32_t mip_count, texture_format format) {
+    size_t block_bytes = texture_format_block_bytes(format);
+    if (!tx || width == 0 || height == 0 || block_bytes == 0) return 0;
+    memset(tx, 0, sizeof(*tx));
+    uint32_t full = 1;
+    for (uint32_t w = width, h = height; w > 1 || h > 1; ++full) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    if (mip_count == 0 || mip_count > full) mip_count = full;
+    tx->mips = (texture_mip*)calloc(mip_count, sizeof(texture_mip));
+    if (!tx->mips) return 0;
+    tx->mip_count = mip_count;
+    for (uint32_t level = 0; level < mip_count; ++level) {
+        uint8_t *blocks = (uint8_t*)calloc(blocks_across(width) * blocks_across(height), block_bytes);
+        if (!blocks) {
+            for (uint32_t i = 0; i < level; ++i) free(tx->mips[i].blocks);
+            free(tx->mips);
+            memset(tx, 0, sizeof(*tx));
+            return 0;
+        }
+        tx->mips[level] = (texture_mip){width, height, NULL, blocks};
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    tx->width = tx->mips[0].width;
+    tx->height = tx->mips[0].height;
+    tx->format = format;
+    tx->block_id = texture_next_block_id();
+    return 1;
+}
+
+void texture_fetch_compressed(const texture *tx, uint32_t level, uint32_t x, uint32_t y, uint8_t out_rgba8[4]) {
+    const texture_mip *m = &tx->mips[level];
+    size_t bx_count = blocks_across(m->width);
+    uint32_t block = (uint32_t)((y / TEXTURE_BLOCK_SIZE) * bx_count + x / TEXTURE_BLOCK_SIZE);
+    size_t slot = (tx->block_id * 0x9e3779b1u + level * 0x85ebca6bu + block) % DECODED_BLOCK_CACHE_SIZE;
+    decoded_block *d = &t_decoded[slot];
+    if (d->block_id != tx->block_id || d->level != level || d->block != block) {
+        texture_decode_block(tx->format, m->blocks + (size_t)block * texture_format_block_bytes(tx->format), d->rgba8);
+        d->block_id = tx->block_id;
+        d->level = level;
+        d->block = block;
+    }
+    memcpy(out_rgba8, d->rgba8 + ((y % TEXTURE_BLOCK_SIZE) * TEXTURE_BLOCK_SIZE + x % TEXTURE_BLOCK_SIZE) * 4, 4);
+}
@@ -0,0 +1,435 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thread_pool.h"
+#include "timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION tp_mutex;
+typedef CONDITION_VARIABLE tp_cond;
+typedef HANDLE tp_thread;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t tp_mutex;
+typedef pthread_cond_t tp_cond;
+typedef pthread_t tp_thread;
+#endif
+
+#ifdef _MSC_VER
+#define TP_THREAD_LOCAL __declspec(thread)
+#else
+#define TP_THREAD_LOCAL _Thread_local
+#endif
+
+#define THREAD_POOL_CHUNKS_PER_WORKER 4
+
+typedef struct {
+    thread_pool_task_fn fn;
+    void *arg;
+    thread_pool_group *group;
+} tp_task;
+
+/* Per-worker deque: the owner pushes and pops at the back, thieves take from the front. */
+typedef struct {
+    tp_mutex lock;
+    tp_task *items;
+    size_t capacity;
+    size_t head;
+    size_t size;
+} tp_deque;
+
+typedef struct {
+    volatile size_t tasks_run;
+    volatile size_t tasks_stolen;
+    volatile size_t busy_us;
+} tp_counters;
+
+typedef struct {
+    thread_pool *pool;
+    uint32_t index;
+} tp_worker_arg;
+
+struct thread_pool {
+    /* Guards sleeping and group completion only; tasks live in the deques. */
+    tp_mutex lock;
+    tp_cond work_cv;
+    tp_cond done_cv;
+    tp_deque *deques;
+    uint32_t deque_count;
+    /* Upper bound on queued tasks; raised before a push and lowered after a pop. */
+    volatile size_t queued;
+    volatile size_t next_deque;
+    size_t waiters;
+    int shutdown;
+    /* deque_count + 1 slots; the last collects threads outside the pool. */
+    tp_counters *counters;
+    tp_worker_arg *worker_args;
+    tp_thread *threads;
+    uint32_t worker_count;
+};
+
+static TP_THREAD_LOCAL const thread_pool *tp_self_pool;
+static TP_THREAD_LOCAL uint32_t tp_self_index;
+static TP_THREAD_LOCAL uint32_t tp_task_depth;
+
+#ifdef _WIN32
+static void tp_mutex_init(tp_mutex *m) { InitializeCriticalSection(m); }
+static void tp_mutex_destroy(tp_mutex *m) { DeleteCriticalSection(m); }
+static void tp_lock(tp_mutex *m) { EnterCriticalSection(m); }
+static void tp_unlock(tp_mutex *m) { LeaveCriticalSection(m); }
+static void tp_cond_init(tp_cond *c) { InitializeConditionVariable(c); }
+static void tp_cond_destroy(tp_cond *c) { (void)c; }
+static void tp_cond_wait(tp_cond *c, tp_mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void tp_cond_signal(tp_cond *c) { WakeConditionVariable(c); }
+static void tp_cond_broadcast(tp_cond *c) { WakeAllConditionVariable(c); }
+#else
+static void tp_mutex_init(tp_mutex *m) { pthread_mutex_init(m, NULL); }
+static void tp_mutex_destroy(tp_mutex *m) { pthread_mutex_destroy(m); }
+static void tp_lock(tp_mutex *m) { pthread_mutex_lock(m); }
+static void tp_unlock(tp_mutex *m) { pthread_mutex_unlock(m); }
+static void tp_cond_init(tp_cond *c) { pthread_cond_init(c, NULL); }
+static void tp_cond_destroy(tp_cond *c) { pthread_cond_destroy(c); }
+static void tp_cond_wait(tp_cond *c, tp_mutex *m) { pthread_cond_wait(c, m); }
+static void tp_cond_signal(tp_cond *c) { pthread_cond_signal(c); }
+static void tp_cond_broadcast(tp_cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+uint32_t thread_pool_hardware_concurrency(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1u;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1u;
+#endif
+}
+
+size_t thread_pool_atomic_add(volatile size_t *value, size_t delta) {
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return (size_t)_InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)delta);
+#else
+    return (size_t)_InterlockedExchangeAdd((volatile LONG*)value, (LONG)delta);
+#endif
+#else
+    return __atomic_fetch_add(value, delta, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static size_t atomic_load_size(volatile size_t *value) {
+    return thread_pool_atomic_add(value, 0);
+}
+
+static int deque_push(tp_deque *d, tp_task task) {
+    tp_lock(&d->lock);
+    if (d->size == d->capacity) {
+        size_t cap = d->capacity ? d->capacity * 2 : 64;
+        tp_task *q = (tp_task*)malloc(cap * sizeof(tp_task));
+        if (!q) {
+            tp_unlock(&d->lock);
+            return 0;
+        }
+        for (size_t i = 0; i < d->size; ++i) {
+            q[i] = d->items[(d->head + i) % d->capacity];
+        }
+        free(d->items);
+        d->items = q;
+        d->capacity = cap;
+        d->head = 0;
+    }
+    d->items[(d->head + d->size) % d->capacity] = task;
+    d->size++;
+    tp_unlock(&d->lock);
+    return 1;
+}
+
+static int deque_pop(tp_deque *d, int from_front, tp_task *out) {
+    tp_lock(&d->lock);
+    if (d->size == 0) {
+        tp_unlock(&d->lock);
+        return 0;
+    }
+    if (from_front) {
+        *out = d->items[d->head];
+        d->head = (d->head + 1) % d->capacity;
+    } else {
+        *out = d->items[(d->head + d->size - 1) % d->capacity];
+    }
+    d->size--;
+    tp_unlock(&d->lock);
+    return 1;
+}
+
+/* Worker index of the calling thread, or deque_count for threads outside this pool. */
+static uint32_t self_slot(const thread_pool *pool) {
+    return tp_self_pool == pool ? tp_self_index : pool->deque_count;
+}
+
+/* Newest task from the caller's own deque first, then the oldest task of any other worker. */
+static int take_task(thread_pool *pool, uint32_t self, tp_task *out, int *stolen) {
+    if (atomic_load_size(&pool->queued) == 0) return 0;
+    int found = 0;
+    if (self < pool->deque_count && deque_pop(&pool->deques[self], 0, out)) {
+        *stolen = 0;
+        found = 1;
+    }
+    for (uint32_t i = 0; !found && i < pool->deque_count; ++i) {
+        uint32_t victim = (self + 1 + i) % pool->deque_count;
+        if (victim == self) continue;
+        if (deque_pop(&pool->deques[victim], 1, out)) {
+            *stolen = 1;
+            found = 1;
+        }
+    }
+    if (found) thread_pool_atomic_add(&pool->queued, (size_t)-1);
+    return found;
+}
+
+/* Busy time is measured for outermost tasks only so waits nested inside a task are not counted twice. */
+static void run_task(thread_pool *pool, uint32_t slot, tp_task task, int stolen) {
+    tp_counters *c = &pool->counters[slot];
+    int outermost = tp_task_depth == 0;
+    double start_ms = outermost ? timer_now_ms() : 0.0;
+    tp_task_depth++;
+    task.fn(task.arg);
+    tp_task_depth--;
+    if (outermost) thread_pool_atomic_add(&c->busy_us, (size_t)((timer_now_ms() - start_ms) * 1000.0));
+    thread_pool_atomic_add(&c->tasks_run, 1);
+    if (stolen) thread_pool_atomic_add(&c->tasks_stolen, 1);
+
+    if (task.group && thread_pool_atomic_add(&task.group->pending, (size_t)-1) == 1) {
+        tp_lock(&pool->lock);
+        tp_cond_broadcast(&pool->done_cv);
+        tp_unlock(&pool->lock);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID param) {
+#else
+static void *worker_main(void *param) {
+#endif
+    tp_worker_arg *arg = (tp_worker_arg*)param;
+    thread_pool *pool = arg->pool;
+    tp_self_pool = pool;
+    tp_self_index = arg->index;
+    for (;;) {
+        tp_task task;
+        int stolen;
+        if (take_task(pool, arg->index, &task, &stolen)) {
+            run_task(pool, arg->index, task, stolen);
+            continue;
+        }
+        tp_lock(&pool->lock);
+        while (atomic_load_size(&pool->queued) == 0 && !pool->shutdown) {
+            tp_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        int stop = pool->shutdown && atomic_load_size(&pool->queued) == 0;
+        tp_unlock(&pool->lock);
+        if (stop) break;
+    }
+    return 0;
+}
+
+thread_pool *thread_pool_create(uint32_t worker_count) {
+    if (worker_count == 0) worker_count = thread_pool_hardware_concurrency();
+
+    thread_pool *pool = (thread_pool*)calloc(1, sizeof(thread_pool));
+    if (!pool) return NULL;
+    pool->threads = (tp_thread*)calloc(worker_count, sizeof(tp_thread));
+    pool->deques = (tp_deque*)calloc(worker_count, sizeof(tp_deque));
+    pool->counters = (tp_counters*)calloc(worker_count + 1, sizeof(tp_counters));
+    pool->worker_args = (tp_worker_arg*)calloc(worker_count, sizeof(tp_worker_arg));
+    if (!pool->threads || !pool->deques || !pool->counters || !pool->worker_args) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool->counters);
+        free(pool->worker_args);
+        free(pool);
+        return NULL;
+    }
+    tp_mutex_init(&pool->lock);
+    tp_cond_init(&pool->work_cv);
+    tp_cond_init(&pool->done_cv);
+    pool->deque_count = worker_count;
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        tp_mutex_init(&pool->deques[i].lock);
+        pool->worker_args[i] = (tp_worker_arg){pool, i};
+    }
+
+    for (uint32_t i = 0; i < worker_count; ++i) {
+#ifdef _WIN32
+        pool->threads[i] = CreateThread(NULL, 0, worker_main, &pool->worker_args[i], 0, NULL);
+        int ok = pool->threads[i] != NULL;
+#else
+        int ok = pthread_create(&pool->threads[i], NULL, worker_main, &pool->worker_args[i]) == 0;
+#endif
+        if (!ok) break;
+        pool->worker_count++;
+    }
+
+    if (pool->worker_count == 0) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool *pool) {
+    if (!pool) return;
+    tp_lock(&pool->lock);
+    pool->shutdown = 1;
+    tp_cond_broadcast(&pool->work_cv);
+    tp_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->worker_count; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+
+    for (uint32_t i = 0; i < pool->deque_count; ++i) {
+        tp_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    tp_cond_destroy(&pool->work_cv);
+    tp_cond_destroy(&pool->done_cv);
+    tp_mutex_destroy(&pool->lock);
+    free(pool->deques);
+    free(pool->counters);
+    free(pool->worker_args);
+    free(pool->threads);
+    free(pool);
+}
+
+uint32_t thread_pool_worker_count(const thread_pool *pool) {
+    return pool ? pool->worker_count : 1u;
+}
+
+int thread_pool_submit(thread_pool *pool, thread_pool_group *group, thread_pool_task_fn fn, void *arg) {
+    if (!pool) {
+        fn(arg);
+        return 1;
+    }
+
+    /* Workers push onto their own deque; other threads spread tasks round-robin. */
+    uint32_t self = self_slot(pool);
+    uint32_t target = self < pool->deque_count
+        ? self : (uint32_t)(thread_pool_atomic_add(&pool->next_deque, 1) % pool->worker_count);
+    tp_task task = {fn, arg, group};
+    if (group) thread_pool_atomic_add(&group->pending, 1);
+    thread_pool_atomic_add(&pool->queued, 1);
+    if (!deque_push(&pool->deques[target], task)) {
+        thread_pool_atomic_add(&pool->queued, (size_t)-1);
+        if (group) thread_pool_atomic_add(&group->pending, (size_t)-1);
+        fn(arg);
+        return 1;
+    }
+
+    tp_lock(&pool->lock);
+    tp_cond_signal(&pool->work_cv);
+    if (pool->waiters > 0) tp_cond_broadcast(&pool->done_cv);
+    tp_unlock(&pool->lock);
+    return 1;
+}
+
+void thread_pool_wait(thread_pool *pool, thread_pool_group *group) {
+    if (!pool || !group) return;
+    uint32_t self = self_slot(pool);
+    while (atomic_load_size(&group->pending) > 0) {
+        tp_task task;
+        int stolen;
+        if (take_task(pool, self, &task, &stolen)) {
+            run_task(pool, self, task, stolen);
+            continue;
+        }
+        tp_lock(&pool->lock);
+        if (atomic_load_size(&group->pending) > 0 && atomic_load_size(&pool->queued) == 0) {
+            pool->waiters++;
+            tp_cond_wait(&pool->done_cv, &pool->lock);
+            pool->waiters--;
+        }
+        tp_unlock(&pool->lock);
+    }
+}
+
+uint32_t thread_pool_stats_slot_count(const thread_pool *pool) {
+    return pool ? pool->deque_count + 1 : 0;
+}
+
+uint32_t thread_pool_current_slot(const thread_pool *pool) {
+    return pool ? self_slot(pool) : 0;
+}
+
+int thread_pool_get_worker_stats(const thread_pool *pool, uint32_t slot, thread_pool_worker_stats *out) {
+    if (!pool || slot > pool->deque_count) return 0;
+    tp_counters *c = &pool->counters[slot];
+    out->tasks_run = atomic_load_size(&c->tasks_run);
+    out->tasks_stolen = atomic_load_size(&c->tasks_stolen);
+    out->busy_ms = (double)atomic_load_size(&c->busy_us) / 1000.0;
+    return 1;
+}
+
+void thread_pool_reset_stats(thread_pool *pool) {
+    if (!pool) return;
+    memset(pool->counters, 0, (pool->deque_count + 1) * sizeof(tp_counters));
+}
+
+size_t thread_pool_chunk_count(const thread_pool *pool, size_t count, size_t grain) {
+    if (count == 0) return 0;
+    if (grain == 0) grain = 1;
+    size_t chunks = (count + grain - 1) / grain;
+    size_t max_chunks = (size_t)thread_pool_worker_count(pool) * THREAD_POOL_CHUNKS_PER_WORKER;
+    if (!pool) max_chunks = 1;
+    return chunks < max_chunks ? chunks : max_chunks;
+}
+
+typedef struct {
+    thread_pool_range_fn fn;
+    void *ctx;
+    size_t chunk;
+    size_t begin;
+    size_t end;
+} range_task;
+
+static void run_range_task(void *arg) {
+    range_task *t = (range_task*)arg;
+    t->fn(t->ctx, t->chunk, t->begin, t->end);
+}
+
+void thread_pool_parallel_for(thread_pool *pool, size_t count, size_t grain, thread_pool_range_fn fn, void *ctx) {
+    size_t chunks = thread_pool_chunk_count(pool, count, grain);
+    if (chunks == 0) return;
+    if (chunks == 1) {
+        fn(ctx, 0, 0, count);
+        return;
+    }
+
+    range_task *tasks = (range_task*)malloc(chunks * sizeof(range_task));
+    if (!tasks) {
+        /* Keep the chunk layout callers sized their per-chunk storage for. */
+        for (size_t c = 0; c < chunks; ++c) {
+            fn(ctx, c, count * c / chunks, count * (c + 1) / chunks);
+        }
+        return;
+    }
+
+    thread_pool_group group = {0};
+    for (size_t c = 1; c < chunks; ++c) {
+        tasks[c] = (range_task){fn, ctx, c, count * c / chunks, count * (c + 1) / chunks};
+        thread_pool_submit(pool, &group, run_range_task, &tasks[c]);
+    }
+    fn(ctx, 0, 0, count / chunks);
+    thread_pool_wait(pool, &group);
+    free(tasks);
+}
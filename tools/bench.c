@@ -0,0 +1,494 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh.h"
+#include "scene.h"
+#include "software_rt.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#define BENCH_MAX_LIST 16
+/* Triangles per instanced mesh in the grid scenes; the instance count makes up the rest. */
+#define BENCH_INSTANCE_MESH_TRIANGLES 8192
+#define BENCH_SEED 0x9e3779b9u
+
+typedef enum {
+    BENCH_SCENE_SOUP = 0,
+    BENCH_SCENE_SPHERE = 1,
+    BENCH_SCENE_INSTANCED = 2,
+    BENCH_SCENE_COUNT
+} bench_scene_kind;
+
+static const char *scene_names[BENCH_SCENE_COUNT] = {"soup", "sphere", "instanced"};
+
+typedef struct {
+    const char *label;
+    int kinds[BENCH_SCENE_COUNT];
+    size_t sizes[BENCH_MAX_LIST];
+    size_t size_count;
+    uint32_t threads[BENCH_MAX_LIST];
+    size_t thread_count;
+    uint32_t rays;
+    uint32_t repeat;
+    mesh_layout layout;
+    bvh_build_options build;
+    int csv;
+    const char *output;
+} bench_config;
+
+typedef struct {
+    double ms;
+    size_t rays;
+    size_t hits;
+} bench_rays;
+
+typedef struct {
+    const char *scene;
+    size_t triangles;
+    size_t unique_triangles;
+    size_t instances;
+    uint32_t threads;
+    double build_ms;
+    size_t bvh_nodes;
+    float sah_cost;
+    size_t geometry_bytes;
+    size_t bvh_bytes;
+    bench_rays primary, shadow, diffuse;
+} bench_result;
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--scenes soup,sphere,instanced] [--sizes 1000,10000,...] [--threads 1,4,...]\n"
+            "       [--rays count] [--repeat count] [--builder sah|lbvh] [--width 2|4|8] [--blocks 0|4|8]\n"
+            "       [--layout aos|soa|quantized] [--format json|csv] [--label text] [--output file]\n"
+            "Builds procedural scenes of about each size (1K..10M triangles) and reports BVH build time,\n"
+            "primary, shadow and diffuse rays per second and memory per scene and thread count. Timings are\n"
+            "the best of --repeat runs. Results go to stdout (or --output) as JSON or CSV.\n",
+            argv0);
+}
+
+/* xorshift32; the scenes and rays must not change between runs. */
+static float rand_unit(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+static int alloc_soa_mesh(mesh *m, size_t vertex_count, size_t triangle_count) {
+    m->layout = MESH_LAYOUT_SOA;
+    m->vertex_count = vertex_count;
+    m->triangle_count = triangle_count;
+    m->positions = (vec3*)malloc(vertex_count * sizeof(vec3));
+    m->normals = (vec3*)malloc(vertex_count * sizeof(vec3));
+    m->uvs = (float*)malloc(vertex_count * 2 * sizeof(float));
+    m->triangles = (triangle*)malloc(triangle_count * sizeof(triangle));
+    return m->positions && m->normals && m->uvs && m->triangles;
+}
+
+/* Independent triangles with uniform centers in [-1, 1]^3, sized so they overlap a little. */
+static int build_soup(mesh *m, size_t count) {
+    if (!alloc_soa_mesh(m, count * 3, count)) return 0;
+    float edge = 2.0f / cbrtf((float)count);
+    uint32_t rng = BENCH_SEED;
+    for (size_t t = 0; t < count; ++t) {
+        vec3 c = {2.0f * rand_unit(&rng) - 1.0f, 2.0f * rand_unit(&rng) - 1.0f, 2.0f * rand_unit(&rng) - 1.0f};
+        vec3 p[3];
+        for (int k = 0; k < 3; ++k) {
+            vec3 d = {rand_unit(&rng) - 0.5f, rand_unit(&rng) - 0.5f, rand_unit(&rng) - 0.5f};
+            p[k] = vec3_add(c, vec3_mul(d, edge));
+        }
+        vec3 n = vec3_cross(vec3_sub(p[1], p[0]), vec3_sub(p[2], p[0]));
+        n = vec3_dot(n, n) > 0.0f ? vec3_norm(n) : (vec3){0.0f, 0.0f, 1.0f};
+        for (int k = 0; k < 3; ++k) {
+            size_t v = 3 * t + (size_t)k;
+            m->positions[v] = p[k];
+            m->normals[v] = n;
+            m->uvs[2 * v] = (float)(k & 1);
+            m->uvs[2 * v + 1] = (float)(k >> 1);
+        }
+        m->triangles[t] = (triangle){(uint32_t)(3 * t), (uint32_t)(3 * t + 1), (uint32_t)(3 * t + 2), 0};
+    }
+    return 1;
+}
+
+/* Unit UV sphere of rings x 2 rings quads, two triangles each. */
+static int build_sphere(mesh *m, size_t count) {
+    uint32_t rings = (uint32_t)sqrt((double)count / 4.0);
+    if (rings < 2) rings = 2;
+    uint32_t segments = 2 * rings;
+    if (!alloc_soa_mesh(m, (size_t)(rings + 1) * (segments + 1), (size_t)rings * segments * 2)) return 0;
+    for (uint32_t r = 0; r <= rings; ++r) {
+        float theta = 3.14159265f * (float)r / (float)rings;
+        for (uint32_t s = 0; s <= segments; ++s) {
+            float phi = 6.28318531f * (float)s / (float)segments;
+            size_t v = (size_t)r * (segments + 1) + s;
+            vec3 n = {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+            m->positions[v] = n;
+            m->normals[v] = n;
+            m->uvs[2 * v] = (float)s / (float)segments;
+            m->uvs[2 * v + 1] = (float)r / (float)rings;
+        }
+    }
+    size_t t = 0;
+    for (uint32_t r = 0; r < rings; ++r) {
+        for (uint32_t s = 0; s < segments; ++s) {
+            uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+            m->triangles[t++] = (triangle){a, b, a + 1, 0};
+            m->triangles[t++] = (triangle){a + 1, b, b + 1, 0};
+        }
+    }
+    return 1;
+}
+
+static int build_bench_scene(scene *s, bench_scene_kind kind, size_t triangles, mesh_layout layout) {
+    memset(s, 0, sizeof(*s));
+    s->meshes = (mesh*)calloc(1, sizeof(mesh));
+    s->materials = (material*)calloc(1, sizeof(material));
+    if (!s->meshes || !s->materials) {
+        destroy_scene(s);
+        return 0;
+    }
+    s->mesh_count = 1;
+    s->material_count = 1;
+    s->materials[0] = (material){{0.8f, 0.8f, 0.8f}, 0.5f, 0.0f, -1, -1};
+
+    size_t mesh_triangles = triangles;
+    uint32_t instances = 0;
+    if (kind == BENCH_SCENE_INSTANCED && triangles > BENCH_INSTANCE_MESH_TRIANGLES) {
+        mesh_triangles = BENCH_INSTANCE_MESH_TRIANGLES;
+        instances = (uint32_t)((triangles + mesh_triangles / 2) / mesh_triangles);
+    }
+    int ok = kind == BENCH_SCENE_SOUP ? build_soup(&s->meshes[0], mesh_triangles) : build_sphere(&s->meshes[0], mesh_triangles);
+    if (ok && kind == BENCH_SCENE_INSTANCED) ok = scene_instance_grid(s, instances ? instances : 1);
+    if (ok && layout != MESH_LAYOUT_SOA) ok = scene_set_mesh_layout(s, layout);
+    if (!ok) destroy_scene(s);
+    return ok;
+}
+
+typedef struct {
+    const bvh *tree;
+    ray *rays;
+    bvh_ray_hit *hits;
+    size_t count;
+    float tmin;
+    volatile size_t hit_count;
+} trace_job;
+
+/* Primary rays go through the packet tracer, as the renderer traces them; one index is one packet. */
+static void trace_packets(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    trace_job *job = (trace_job*)ctx;
+    size_t first = begin * BVH_PACKET_MAX, last = end * BVH_PACKET_MAX < job->count ? end * BVH_PACKET_MAX : job->count;
+    size_t hits = bvh_trace_stream(job->tree, job->rays + first, last - first, job->tmin, 1e30f, job->hits + first);
+    thread_pool_atomic_add(&job->hit_count, hits);
+}
+
+static void trace_occluded(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    trace_job *job = (trace_job*)ctx;
+    size_t hits = 0;
+    for (size_t i = begin; i < end; ++i) hits += (size_t)bvh_trace_occluded(job->tree, job->rays[i], job->tmin, 1e30f);
+    thread_pool_atomic_add(&job->hit_count, hits);
+}
+
+static void trace_closest(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    trace_job *job = (trace_job*)ctx;
+    size_t hits = 0;
+    for (size_t i = begin; i < end; ++i) hits += (size_t)bvh_trace_closest_hit(job->tree, job->rays[i], job->tmin, 1e30f, &job->hits[i]);
+    thread_pool_atomic_add(&job->hit_count, hits);
+}
+
+static void run_trace(thread_pool *pool, trace_job *job, size_t count, thread_pool_range_fn fn, uint32_t repeat, bench_rays *out) {
+    out->rays = job->count;
+    out->ms = 0.0;
+    for (uint32_t i = 0; i < repeat; ++i) {
+        job->hit_count = 0;
+        double start_ms = timer_now_ms();
+        thread_pool_parallel_for(pool, count, 64, fn, job);
+        double ms = timer_now_ms() - start_ms;
+        if (i == 0 || ms < out->ms) out->ms = ms;
+    }
+    out->hits = job->hit_count;
+}
+
+/* Camera rays over the scene's bounds in 4x4 pixel blocks, so each packet is one coherent block. */
+static void primary_rays(const bvh *tree, uint32_t side, ray *rays) {
+    aabb box = tree->nodes[0].box;
+    vec3 center = vec3_mul(vec3_add(box.min, box.max), 0.5f);
+    vec3 extent = vec3_sub(box.max, box.min);
+    float radius = 0.5f * sqrtf(vec3_dot(extent, extent));
+    /* The image plane spans [-1, 1] at the default camera's focal length, as in the renderer. */
+    render_settings defaults;
+    render_settings_default(&defaults);
+    float focal_length = defaults.camera.focal_length;
+    vec3 origin = vec3_sub(center, (vec3){0.0f, 0.0f, 1.6f * radius});
+    size_t i = 0;
+    for (uint32_t by = 0; by < side; by += 4) {
+        for (uint32_t bx = 0; bx < side; bx += 4) {
+            for (uint32_t p = 0; p < 16; ++p) {
+                float x = ((float)(bx + p % 4) + 0.5f) / (float)side, y = ((float)(by + p / 4) + 0.5f) / (float)side;
+                rays[i++] = (ray){origin, vec3_norm((vec3){2.0f * x - 1.0f, 1.0f - 2.0f * y, focal_length})};
+            }
+        }
+    }
+}
+
+/* Turns primary hits into shadow rays towards a fixed light (diffuse == 0) or cosine-distributed
+ * bounce rays; returns how many were written. */
+static size_t secondary_rays(const bvh *tree, const ray *primary, const bvh_ray_hit *hits, size_t count,
+                             float offset, int diffuse, ray *out) {
+    vec3 to_light = vec3_norm((vec3){-1.0f, -1.0f, 1.0f});
+    uint32_t rng = BENCH_SEED;
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!hits[i].hit) continue;
+        vec3 normal = bvh_hit_normal(tree, &hits[i]);
+        if (vec3_dot(normal, primary[i].direction) > 0.0f) normal = vec3_mul(normal, -1.0f);
+        vec3 p = vec3_add(vec3_add(primary[i].origin, vec3_mul(primary[i].direction, hits[i].t)), vec3_mul(normal, offset));
+        vec3 dir = to_light;
+        if (diffuse) {
+            vec3 up = fabsf(normal.y) < 0.99f ? (vec3){0.0f, 1.0f, 0.0f} : (vec3){1.0f, 0.0f, 0.0f};
+            vec3 t = vec3_norm(vec3_cross(up, normal)), b = vec3_cross(normal, t);
+            float r = sqrtf(rand_unit(&rng)), phi = 6.28318531f * rand_unit(&rng);
+            float z = sqrtf(fmaxf(0.0f, 1.0f - r * r));
+            dir = vec3_norm(vec3_add(vec3_add(vec3_mul(t, r * cosf(phi)), vec3_mul(b, r * sinf(phi))), vec3_mul(normal, z)));
+        }
+        out[n++] = (ray){p, dir};
+    }
+    return n;
+}
+
+static size_t scene_geometry_bytes(const scene *s) {
+    size_t bytes = s->instance_count * sizeof(mesh_instance);
+    for (size_t i = 0; i < s->mesh_count; ++i) bytes += mesh_geometry_bytes(&s->meshes[i]);
+    return bytes;
+}
+
+static int run_case(const bench_config *cfg, bench_scene_kind kind, size_t triangles, uint32_t threads, bench_result *out) {
+    scene s;
+    if (!build_bench_scene(&s, kind, triangles, cfg->layout)) return 0;
+    thread_pool *pool = threads > 1 ? thread_pool_create(threads - 1) : NULL;
+    bvh_build_options opts = cfg->build;
+    opts.pool = pool;
+
+    memset(out, 0, sizeof(*out));
+    out->scene = scene_names[kind];
+    out->threads = threads;
+    out->unique_triangles = s.meshes[0].triangle_count;
+    out->instances = s.instance_count;
+    out->triangles = s.instance_count ? s.instance_count * out->unique_triangles : out->unique_triangles;
+    out->geometry_bytes = scene_geometry_bytes(&s);
+
+    bvh tree = {0};
+    int ok = 1;
+    for (uint32_t i = 0; ok && i < cfg->repeat; ++i) {
+        bvh_destroy(&tree);
+        ok = bvh_build_with_options(&tree, &s, &opts);
+        if (ok && (i == 0 || tree.stats.build_ms < out->build_ms)) out->build_ms = tree.stats.build_ms;
+    }
+    uint32_t side = (uint32_t)sqrt((double)cfg->rays) & ~3u;
+    if (side < 4) side = 4;
+    size_t count = (size_t)side * side;
+    ray *rays = (ray*)malloc(count * sizeof(ray));
+    ray *secondary = (ray*)malloc(count * sizeof(ray));
+    bvh_ray_hit *hits = (bvh_ray_hit*)malloc(count * sizeof(bvh_ray_hit));
+    bvh_ray_hit *scratch = (bvh_ray_hit*)malloc(count * sizeof(bvh_ray_hit));
+    ok = ok && rays && secondary && hits && scratch;
+    if (ok) {
+        out->bvh_nodes = tree.stats.node_count;
+        out->sah_cost = tree.stats.sah_cost;
+        out->bvh_bytes = bvh_memory_bytes(&tree);
+
+        aabb box = tree.nodes[0].box;
+        vec3 extent = vec3_sub(box.max, box.min);
+        float scale = sqrtf(vec3_dot(extent, extent));
+        primary_rays(&tree, side, rays);
+        trace_job job = {&tree, rays, hits, count, 0.0f, 0};
+        run_trace(pool, &job, (count + BVH_PACKET_MAX - 1) / BVH_PACKET_MAX, trace_packets, cfg->repeat, &out->primary);
+
+        job = (trace_job){&tree, secondary, scratch, 0, 0.0f, 0};
+        job.count = secondary_rays(&tree, rays, hits, count, 1e-4f * scale, 0, secondary);
+        run_trace(pool, &job, job.count, trace_occluded, cfg->repeat, &out->shadow);
+        job.count = secondary_rays(&tree, rays, hits, count, 1e-4f * scale, 1, secondary);
+        run_trace(pool, &job, job.count, trace_closest, cfg->repeat, &out->diffuse);
+    }
+
+    free(rays);
+    free(secondary);
+    free(hits);
+    free(scratch);
+    bvh_destroy(&tree);
+    thread_pool_destroy(pool);
+    destroy_scene(&s);
+    return ok;
+}
+
+static double mrays_per_s(const bench_rays *r) {
+    return r->ms > 0.0 ? (double)r->rays / (r->ms * 1000.0) : 0.0;
+}
+
+static const char *csv_header =
+    "label,scene,triangles,unique_triangles,instances,threads,builder,width,blocks,build_ms,bvh_nodes,sah_cost,"
+    "geometry_bytes,bvh_bytes,primary_rays,primary_hits,primary_ms,primary_mrays_s,shadow_rays,shadow_hits,"
+    "shadow_ms,shadow_mrays_s,diffuse_rays,diffuse_hits,diffuse_ms,diffuse_mrays_s\n";
+
+static void write_csv_row(FILE *f, const bench_config *cfg, const bench_result *r) {
+    fprintf(f, "%s,%s,%zu,%zu,%zu,%u,%s,%u,%u,%.3f,%zu,%.3f,%zu,%zu", cfg->label, r->scene, r->triangles,
+            r->unique_triangles, r->instances, r->threads, cfg->build.builder == BVH_BUILDER_LBVH ? "lbvh" : "sah",
+            cfg->build.width, cfg->build.triangle_block_width, r->build_ms, r->bvh_nodes, r->sah_cost,
+            r->geometry_bytes, r->bvh_bytes);
+    const bench_rays *kinds[3] = {&r->primary, &r->shadow, &r->diffuse};
+    for (int k = 0; k < 3; ++k) {
+        fprintf(f, ",%zu,%zu,%.3f,%.3f", kinds[k]->rays, kinds[k]->hits, kinds[k]->ms, mrays_per_s(kinds[k]));
+    }
+    fputc('\n', f);
+}
+
+static void write_json_rays(FILE *f, const char *name, const bench_rays *r, const char *tail) {
+    fprintf(f, "\"%s\": {\"rays\": %zu, \"hits\": %zu, \"ms\": %.3f, \"mrays_per_s\": %.3f}%s", name, r->rays, r->hits,
+            r->ms, mrays_per_s(r), tail);
+}
+
+static void write_json_result(FILE *f, const bench_config *cfg, const bench_result *r, int first) {
+    fprintf(f, "%s\n    {\"scene\": \"%s\", \"triangles\": %zu, \"unique_triangles\": %zu, \"instances\": %zu, \"threads\": %u,\n",
+            first ? "" : ",", r->scene, r->triangles, r->unique_triangles, r->instances, r->threads);
+    fprintf(f, "     \"build\": {\"builder\": \"%s\", \"width\": %u, \"blocks\": %u, \"ms\": %.3f, \"nodes\": %zu, \"sah_cost\": %.3f},\n",
+            cfg->build.builder == BVH_BUILDER_LBVH ? "lbvh" : "sah", cfg->build.width, cfg->build.triangle_block_width,
+            r->build_ms, r->bvh_nodes, r->sah_cost);
+    fprintf(f, "     \"memory\": {\"geometry_bytes\": %zu, \"bvh_bytes\": %zu},\n     ", r->geometry_bytes, r->bvh_bytes);
+    write_json_rays(f, "primary", &r->primary, ", ");
+    write_json_rays(f, "shadow", &r->shadow, ",\n     ");
+    write_json_rays(f, "diffuse", &r->diffuse, "}");
+}
+
+/* Comma-separated unsigned values; a k, K, m or M suffix scales by 1e3 or 1e6. */
+static size_t parse_list(const char *text, size_t *out, size_t max) {
+    size_t n = 0;
+    for (const char *p = text; *p && n < max;) {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p) return 0;
+        if (*end == 'k' || *end == 'K' || *end == 'm' || *end == 'M') {
+            v *= (*end == 'k' || *end == 'K') ? 1e3 : 1e6;
+            ++end;
+        }
+        if (v < 1.0) return 0;
+        out[n++] = (size_t)v;
+        if (*end != ',' && *end != '\0') return 0;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static int parse_args(int argc, char **argv, bench_config *cfg) {
+    static const size_t default_sizes[] = {1000, 10000, 100000, 1000000};
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->label = "";
+    for (int k = 0; k < BENCH_SCENE_COUNT; ++k) cfg->kinds[k] = 1;
+    memcpy(cfg->sizes, default_sizes, sizeof(default_sizes));
+    cfg->size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    cfg->threads[0] = thread_pool_hardware_concurrency();
+    cfg->thread_count = 1;
+    cfg->rays = 512 * 512;
+    cfg->repeat = 3;
+    cfg->layout = MESH_LAYOUT_SOA;
+    bvh_build_options_default(&cfg->build);
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) return 0;
+        ++i;
+        if (strcmp(arg, "--scenes") == 0) {
+            for (int k = 0; k < BENCH_SCENE_COUNT; ++k) {
+                size_t len = strlen(scene_names[k]);
+                const char *p = strstr(value, scene_names[k]);
+                cfg->kinds[k] = p && (p == value || p[-1] == ',') && (p[len] == ',' || p[len] == '\0');
+            }
+        } else if (strcmp(arg, "--sizes") == 0) {
+            if (!(cfg->size_count = parse_list(value, cfg->sizes, BENCH_MAX_LIST))) return 0;
+        } else if (strcmp(arg, "--threads") == 0) {
+            size_t list[BENCH_MAX_LIST];
+            if (!(cfg->thread_count = parse_list(value, list, BENCH_MAX_LIST))) return 0;
+            for (size_t t = 0; t < cfg->thread_count; ++t) cfg->threads[t] = (uint32_t)list[t];
+        } else if (strcmp(arg, "--rays") == 0) {
+            cfg->rays = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--repeat") == 0) {
+            cfg->repeat = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--builder") == 0) {
+            cfg->build.builder = strcmp(value, "lbvh") == 0 ? BVH_BUILDER_LBVH : BVH_BUILDER_SAH;
+        } else if (strcmp(arg, "--width") == 0) {
+            cfg->build.width = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--blocks") == 0) {
+            cfg->build.triangle_block_width = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--layout") == 0) {
+            if (strcmp(value, "aos") == 0) cfg->layout = MESH_LAYOUT_AOS;
+            else if (strcmp(value, "quantized") == 0) cfg->layout = MESH_LAYOUT_SOA_QUANTIZED;
+            else if (strcmp(value, "soa") != 0) return 0;
+        } else if (strcmp(arg, "--format") == 0) {
+            cfg->csv = strcmp(value, "csv") == 0;
+        } else if (strcmp(arg, "--label") == 0) {
+            cfg->label = value;
+        } else if (strcmp(arg, "--output") == 0) {
+            cfg->output = value;
+        } else {
+            return 0;
+        }
+    }
+    if (cfg->repeat == 0) cfg->repeat = 1;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg;
+    if (!parse_args(argc, argv, &cfg)) {
+        usage(argv[0]);
+        return 1;
+    }
+    FILE *f = cfg.output ? fopen(cfg.output, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", cfg.output);
+        return 1;
+    }
+
+    if (cfg.csv) {
+        fputs(csv_header, f);
+    } else {
+        fprintf(f, "{\n  \"label\": \"%s\",\n  \"hardware_threads\": %u,\n  \"rays_per_kind\": %u,\n  \"repeat\": %u,\n  \"results\": [",
+                cfg.label, thread_pool_hardware_concurrency(), cfg.rays, cfg.repeat);
+    }
+    int ok = 1, first = 1;
+    for (int k = 0; k < BENCH_SCENE_COUNT; ++k) {
+        if (!cfg.kinds[k]) continue;
+        for (size_t i = 0; i < cfg.size_count; ++i) {
+            for (size_t t = 0; t < cfg.thread_count; ++t) {
+                bench_result r;
+                if (!run_case(&cfg, (bench_scene_kind)k, cfg.sizes[i], cfg.threads[t] ? cfg.threads[t] : 1, &r)) {
+                    fprintf(stderr, "%s %zu: scene or BVH build failed\n", scene_names[k], cfg.sizes[i]);
+                    ok = 0;
+                    continue;
+                }
+                /* Progress goes to stderr so stdout stays machine-readable. */
+                fprintf(stderr, "%-9s %9zu tris %2u threads: build %9.2f ms, primary %7.2f, shadow %7.2f, diffuse %7.2f Mrays/s\n",
+                        r.scene, r.triangles, r.threads, r.build_ms, mrays_per_s(&r.primary), mrays_per_s(&r.shadow),
+                        mrays_per_s(&r.diffuse));
+                if (cfg.csv) {
+                    write_csv_row(f, &cfg, &r);
+                } else {
+                    write_json_result(f, &cfg, &r, first);
+                }
+                first = 0;
+                fflush(f);
+            }
+        }
+    }
+    if (!cfg.csv) fputs("\n  ]\n}\n", f);
+    if (f != stdout) fclose(f);
+    return ok ? 0 : 1;
+}
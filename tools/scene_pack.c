@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scene_import.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s <output> [--input file.obj|file.glb] [--no-bvh] [--width 2|4|8] [--blocks 0|4|8]\n"
+            "       [--instances count]\n"
+            "       %s --check <file>\n"
+            "Packs the imported scene (the demo scene without --input), with a prebuilt BVH unless --no-bvh,\n"
+            "and validates the result. --instances stores count copies of the scene on a grid; instanced\n"
+            "scenes are packed without a BVH, as their two-level trees are rebuilt at load. --check only\n"
+            "maps and validates an existing file.\n",
+            argv0, argv0);
+}
+
+/* Maps path the way the renderer does and runs the full validation pass on it. */
+static int check_file(const char *path, double write_ms) {
+    scene s;
+    scene_file_info info;
+    bvh loaded = {0};
+    if (!scene_file_load(path, &s, &loaded, &info)) {
+        fprintf(stderr, "Failed to map %s\n", path);
+        return 0;
+    }
+    char error[256];
+    double start_ms = timer_now_ms();
+    int ok = scene_file_validate(&s, info.has_bvh ? &loaded : NULL, error, sizeof(error));
+    double validate_ms = timer_now_ms() - start_ms;
+    if (!ok) {
+        fprintf(stderr, "Validation failed for %s: %s\n", path, error);
+    } else if (write_ms >= 0.0) {
+        printf("Wrote %s: %zu bytes, %zu sections%s; write %.3f ms, map %.3f ms, validate %.3f ms\n", path,
+               info.file_bytes, info.section_count, info.has_bvh ? ", prebuilt BVH" : "", write_ms, info.map_ms,
+               validate_ms);
+    } else {
+        printf("Valid %s: %zu bytes, %zu sections%s; map %.3f ms, validate %.3f ms\n", path, info.file_bytes,
+               info.section_count, info.has_bvh ? ", prebuilt BVH" : "", info.map_ms, validate_ms);
+    }
+    bvh_destroy(&loaded);
+    destroy_scene(&s);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    const char *input = NULL;
+    const char *check = NULL;
+    int with_bvh = 1;
+    uint32_t instances = 0;
+    bvh_build_options opts;
+    bvh_build_options_default(&opts);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            check = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input = argv[++i];
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instances = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-bvh") == 0) {
+            with_bvh = 0;
+        } else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            opts.width = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+            opts.triangle_block_width = (uint32_t)atoi(argv[++i]);
+        } else if (!output && argv[i][0] != '-') {
+            output = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (check && !output) return check_file(check, -1.0) ? 0 : 1;
+    if (!output || check) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint32_t threads = thread_pool_hardware_concurrency();
+    thread_pool *pool = threads > 1 ? thread_pool_create(threads - 1) : NULL;
+    scene s;
+    if (input) {
+        scene_import_options import_opts;
+        scene_import_options_default(&import_opts);
+        import_opts.pool = pool;
+        scene_import_stats stats;
+        if (!scene_import(input, &s, &import_opts, &stats)) {
+            fprintf(stderr, "Failed to import %s\n", input);
+            thread_pool_destroy(pool);
+            return 1;
+        }
+        printf("Imported %s: %zu meshes, %zu vertices, %zu triangles (%zu corners deduplicated) in %.1f ms, %.1f MB/s\n",
+               input, stats.mesh_count, stats.vertex_count, stats.triangle_count, stats.deduplicated_corners, stats.ms,
+               stats.mb_per_s);
+    } else if (!build_demo_scene(&s)) {
+        fprintf(stderr, "Failed to build scene\n");
+        thread_pool_destroy(pool);
+        return 1;
+    }
+    if (instances > 0) {
+        if (!scene_instance_grid(&s, instances)) {
+            fprintf(stderr, "Cannot instance this scene\n");
+            thread_pool_destroy(pool);
+            destroy_scene(&s);
+            return 1;
+        }
+        with_bvh = 0;
+    }
+    bvh tree = {0};
+    if (with_bvh) {
+        opts.pool = pool;
+        if (!bvh_build_with_options(&tree, &s, &opts)) {
+            fprintf(stderr, "BVH build failed\n");
+            thread_pool_destroy(pool);
+            destroy_scene(&s);
+            return 1;
+        }
+    }
+
+    double start_ms = timer_now_ms();
+    int ok = scene_file_write(output, &s, with_bvh ? &tree : NULL);
+    double write_ms = timer_now_ms() - start_ms;
+    bvh_destroy(&tree);
+    thread_pool_destroy(pool);
+    destroy_scene(&s);
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", output);
+        return 1;
+    }
+
+    return check_file(output, write_ms) ? 0 : 1;
+}